@@ -2,8 +2,129 @@
 #include "terms.h"
 #include "utils.h"
 #include "queryexec_ctx.h"
+#include <fcntl.h>
+
+void Trinity::Codecs::pending_file_copy::flush(int outFd) {
+        if (len) {
+                if (Utilities::copy_file_range(srcFd, srcOffset, len, outFd) == -1)
+                        throw Switch::system_error("Failed to copy file range");
+
+                len = 0;
+        }
+}
+
+Trinity::Codecs::DecodedBlocksCache::DecodedBlocksCache(const std::size_t capacityInBytes, const uint32_t minDocs)
+    : doorkeeperSize{std::max<uint32_t>(1024, capacityInBytes / sizeof(entry) / K_shards * 4)}, minDocuments{minDocs} {
+        const uint32_t perShard = std::max<std::size_t>(1, capacityInBytes / sizeof(entry) / K_shards);
+
+        for (auto &s : shards) {
+                s.capacity = perShard;
+                s.entries.reset(new entry[perShard]);
+                s.doorkeeper.reset(new uint64_t[doorkeeperSize]);
+                s.map.reserve(perShard);
+
+                for (uint32_t i{0}; i != perShard; ++i)
+                        s.entries[i].used = false;
+                memset(s.doorkeeper.get(), 0, sizeof(uint64_t) * doorkeeperSize);
+        }
+}
+
+bool Trinity::Codecs::DecodedBlocksCache::get(const block_key &key, uint32_t *const a, uint32_t *const b, const uint16_t n, uint32_t *const encodedSize) {
+        const auto                  h = key.hash();
+        auto &                      s = shards[h % K_shards];
+        std::lock_guard<std::mutex> g(s.lock);
+
+        if (const auto it = s.map.find(key); it != s.map.end()) {
+                auto &e = s.entries[it->second];
+
+                if (likely(e.n == n)) {
+                        memcpy(a, e.values[0], sizeof(uint32_t) * n);
+                        memcpy(b, e.values[1], sizeof(uint32_t) * n);
+                        *encodedSize = e.encodedSize;
+                        e.referenced = true;
+                        hits.fetch_add(1, std::memory_order_relaxed);
+                        return true;
+                }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+}
+
+void Trinity::Codecs::DecodedBlocksCache::put(const block_key &key, const uint32_t *const a, const uint32_t *const b, const uint16_t n, const uint32_t encodedSize) {
+        const auto h = key.hash();
+        auto &     s = shards[h % K_shards];
+
+        if (n > K_max_block_values)
+                return;
+
+        std::lock_guard<std::mutex> g(s.lock);
+
+        if (auto &dk = s.doorkeeper[(h / K_shards) % doorkeeperSize]; dk != h) {
+                // first time we see this block (or we have since forgotten about it)
+                dk = h;
+                return;
+        } else if (s.map.count(key)) {
+                // another thread beat us to it
+                return;
+        }
+
+        // CLOCK: find a slot that's either unused or hasn't been referenced since the last sweep
+        for (;;) {
+                auto &e = s.entries[s.hand];
+
+                if (!e.used)
+                        break;
+                else if (!e.referenced) {
+                        s.map.erase(e.key);
+                        evictions.fetch_add(1, std::memory_order_relaxed);
+                        break;
+                }
+
+                e.referenced = false;
+                s.hand       = (s.hand + 1) % s.capacity;
+        }
+
+        auto &e = s.entries[s.hand];
+
+        e.key         = key;
+        e.encodedSize = encodedSize;
+        e.n           = n;
+        e.referenced  = false;
+        e.used        = true;
+        memcpy(e.values[0], a, sizeof(uint32_t) * n);
+        memcpy(e.values[1], b, sizeof(uint32_t) * n);
+
+        s.map.insert({key, s.hand});
+        s.hand = (s.hand + 1) % s.capacity;
+}
+
+int Trinity::Codecs::IndexSession::source_file_fd(const AccessProxy *src, const char *name) {
+        if (!src->backedByFiles)
+                return -1;
+
+        const auto path = Buffer{}.append(src->basePath, "/"_s32, strwlen32_t(name));
+        auto       res  = srcFiles.insert({std::string(path.data(), path.size()), -1});
+
+        if (res.second)
+                res.first->second = open(path.c_str(), O_RDONLY | O_LARGEFILE);
+
+        return res.first->second;
+}
+
+void Trinity::Codecs::IndexSession::copy_index_chunk(int srcFd, const uint64_t offset, const uint32_t len) {
+        if (indexOut.size() || !pendingIndexCopy.try_coalesce(srcFd, offset, len)) {
+                flush_index(indexOutFd);
+                pendingIndexCopy.set(srcFd, offset, len);
+        }
+
+        indexOutFlushed += len;
+}
 
 void Trinity::Codecs::IndexSession::flush_index(int fd) {
+        // already accounted for in indexOutFlushed
+        pendingIndexCopy.flush(fd);
+
         if (indexOut.size()) {
                 if (Utilities::to_file(indexOut.data(), indexOut.size(), fd) == -1)
                         throw Switch::data_error("Failed to flush index");
@@ -4,6 +4,9 @@
 #include "docset_iterators_base.h"
 #include "docwordspace.h"
 #include "runtime.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 // Use of Codecs::Google results in a somewhat large index, while the access time is similar(maybe somewhat slower) to Lucene's codec
 namespace Trinity {
@@ -58,6 +61,32 @@ namespace Trinity {
                 struct Encoder;
                 struct AccessProxy;
 
+                // A kernel-side copy of a range of a source file, which is kept pending
+                // for as long as subsequent ranges are adjacent to it, so that they are all copied with a single
+                // Utilities::copy_file_range() call.
+                struct pending_file_copy final {
+                        int      srcFd{-1};
+                        uint64_t srcOffset{0};
+                        uint64_t len{0};
+
+                        inline bool try_coalesce(const int fd, const uint64_t offset, const uint32_t n) noexcept {
+                                if (len && fd == srcFd && offset == srcOffset + len) {
+                                        len += n;
+                                        return true;
+                                } else
+                                        return false;
+                        }
+
+                        inline void set(const int fd, const uint64_t offset, const uint32_t n) noexcept {
+                                srcFd     = fd;
+                                srcOffset = offset;
+                                len       = n;
+                        }
+
+                        // Copies the range at the current file offset of outFd
+                        void flush(int outFd);
+                };
+
                 // Represents a new indexer session
                 // All indexer sessions have an `indexOut` that holds the inverted index(posting lists for each distinct term)
                 // but other codecs may e.g open/track more files or buffers depending on their needs.
@@ -68,7 +97,9 @@ namespace Trinity {
                         enum class Capabilities : uint8_t {
                                 // append_index_chunk() is implemented
                                 AppendIndexChunk = 1,
-                                Merge            = 1 << 1
+                                Merge            = 1 << 1,
+                                // new_partition_session() and append_partition() are implemented
+                                Partitions = 1 << 2
                         };
 
                         const uint8_t caps;
@@ -90,6 +121,12 @@ namespace Trinity {
                         uint32_t indexOutFlushed;
                         char     basePath[PATH_MAX];
 
+                        // See set_index_fd()
+                        int               indexOutFd{-1};
+                        pending_file_copy pendingIndexCopy;
+                        // Source files opened by source_file_fd()
+                        std::unordered_map<std::string, int> srcFiles;
+
                         // The segment name should be the generation
                         // e.g for path Trinity/Indices/Wikipedia/Segments/100
                         // the generation is extracted as 100, but, again, this is codec specific
@@ -99,12 +136,35 @@ namespace Trinity {
                         }
 
                         virtual ~IndexSession() {
+                                for (const auto &it : srcFiles) {
+                                        if (it.second != -1)
+                                                close(it.second);
+                                }
                         }
 
                         // Utility method
                         // Demonstrates how you should update indexOutFlushed
+                        // It also performs any pending kernel-side copy (see set_index_fd())
                         void flush_index(int fd);
 
+                        // If you are going to persist the index into a file, and you set its fd here before you encode anything(i.e
+                        // before you MergeCandidatesCollection::merge()), append_index_chunk() implementations will copy
+                        // chunks from sources that are backed by files(see AccessProxy::backedByFiles) kernel-side into that file, instead of
+                        // copying them through indexOut. Adjacent chunks are coalesced into a single copy.
+                        //
+                        // You must persist the session with persist_segment() variant that accepts an fd, and pass it the same fd.
+                        void set_index_fd(int fd) {
+                                indexOutFd = fd;
+                        }
+
+                        // Queues a kernel-side copy of a range of srcFd into indexOutFd, and advances indexOutFlushed accordingly
+                        // so that (indexOut.size() + indexOutFlushed) is the offset in the index past that range.
+                        void copy_index_chunk(int srcFd, const uint64_t offset, const uint32_t len);
+
+                        // Returns a (cached) fd for the file `name` in the source's basePath, or -1 if the source
+                        // is not backed by files or that file can't be accessed
+                        int source_file_fd(const AccessProxy *src, const char *name);
+
                         // Handy utility function
                         // see SegmentIndexSession::commit()
                         void persist_terms(std::vector<std::pair<str8_t, term_index_ctx>> &);
@@ -170,6 +230,25 @@ namespace Trinity {
                         // UPDATE: now optional; if you override and implement it, make sure you set Capabilities::Merge in the constructo
                         virtual void merge(merge_participant *participants, const uint16_t participantsCnt, Encoder *const encoder) {
                         }
+
+                        // Used by MergeCandidatesCollection::merge() when merging in parallel.
+                        // The terms space is partitioned into lexicographic ranges, and each range is merged on its own thread
+                        // into a new partition session returned by this method. A partition session must be of the same codec, must never flush
+                        // to disk, and its end() will not be invoked; it is just a memory-resident buffer for the posting lists of the range.
+                        //
+                        // When a range has been merged, append_partition() is invoked with the partition session and the
+                        // (term, term_index_ctx) of all terms in the range, in the order they were encoded. You are expected to
+                        // append the partition's data to this session and to adjust the term_index_ctx of all terms accordingly (i.e
+                        // their indexChunk offsets, and whatever other codec specific offsets are stored in the index chunks).
+                        //
+                        // UPDATE: optional; if you implement them, make sure you set Capabilities::Partitions in the constructor
+                        virtual IndexSession *new_partition_session() {
+                                return nullptr;
+                        }
+
+                        virtual void append_partition(IndexSession *part, std::pair<str8_t, term_index_ctx> *terms, const size_t termsCnt) {
+                                std::abort();
+                        }
                 };
 
                 // Encoder interface for encoding a single term's posting list
@@ -260,6 +339,10 @@ namespace Trinity {
                         exec_term_id_t execCtxTermID{0};
                         queryexec_ctx *rctx{nullptr};
 
+                        // Total postings decoded by the iterators of this decoder so far. Codecs that support it
+                        // update it whenever they decode a block of postings; see exec_limits::maxPostings
+                        uint64_t decodedPostings{0};
+
                         constexpr auto exec_ctx_termid() const noexcept {
                                 return execCtxTermID;
                         }
@@ -285,6 +368,89 @@ namespace Trinity {
                         }
                 };
 
+                // An optional, size-bounded cache of decoded postings blocks, shared by all threads and index sources
+                // Hot terms(stop-word-ish tokens, popular categories, etc) are otherwise decoded again and again by every query that
+                // accesses them. Codecs that support it(currently, Lucene's) will consult the cache before they decode a block.
+                //
+                // Blocks are keyed by (IndexSource::generation(), term_index_ctx::indexChunk.offset, blockIndex), and the cache is
+                // partitioned in K_shards shards, each with its own lock and CLOCK eviction.
+                // Only blocks of terms that match at least minDocuments documents are considered, and a block is only admitted
+                // the second time it's requested(a doorkeeper tracks blocks requested once), so that we won't churn the cache with
+                // blocks accessed once.
+                //
+                // See SegmentIndexSource::use_blocks_cache()
+                class DecodedBlocksCache final {
+                      public:
+                        static constexpr std::size_t K_shards{16};
+                        static constexpr uint32_t    K_max_block_values{128};
+                        // blockIndex flag for blocks of hits, as opposed to documents blocks
+                        static constexpr uint32_t K_hits_block{uint32_t(1) << 31};
+
+                        struct block_key final {
+                                uint64_t gen;
+                                uint32_t chunkOffset;
+                                uint32_t blockIndex;
+
+                                inline bool operator==(const block_key &o) const noexcept {
+                                        return gen == o.gen && chunkOffset == o.chunkOffset && blockIndex == o.blockIndex;
+                                }
+
+                                inline uint64_t hash() const noexcept {
+                                        uint64_t h = gen * 0x9E3779B97F4A7C15ULL;
+
+                                        h ^= (uint64_t(chunkOffset) << 32 | blockIndex) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+                                        return h ^ (h >> 29);
+                                }
+                        };
+
+                      private:
+                        struct block_key_hash final {
+                                inline std::size_t operator()(const block_key &k) const noexcept {
+                                        return k.hash();
+                                }
+                        };
+
+                        // (up to) 2 arrays of K_max_block_values values each, e.g (docDeltas, docFreqs)
+                        struct entry final {
+                                block_key key;
+                                uint32_t  encodedSize;
+                                uint16_t  n;
+                                bool      referenced;
+                                bool      used;
+                                uint32_t  values[2][K_max_block_values];
+                        };
+
+                        struct alignas(64) shard final {
+                                std::mutex                                              lock;
+                                std::unordered_map<block_key, uint32_t, block_key_hash> map;
+                                std::unique_ptr<entry[]>                                entries;
+                                uint32_t                                                capacity{0}, hand{0};
+                                // direct-mapped, by hash
+                                std::unique_ptr<uint64_t[]> doorkeeper;
+                        };
+
+                        const uint32_t doorkeeperSize;
+                        shard          shards[K_shards];
+
+                      public:
+                        const uint32_t        minDocuments;
+                        // evictions: cached blocks replaced by other blocks
+                        std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+
+                      public:
+                        DecodedBlocksCache(const std::size_t capacityInBytes, const uint32_t minDocuments = 4096);
+
+                        inline bool admit_term(const term_index_ctx &tctx) const noexcept {
+                                return tctx.documents >= minDocuments;
+                        }
+
+                        // If found, copies the n values of the block into a and b, sets encodedSize to the
+                        // size of the encoded block, and returns true
+                        bool get(const block_key &, uint32_t *a, uint32_t *b, const uint16_t n, uint32_t *encodedSize);
+
+                        void put(const block_key &, const uint32_t *a, const uint32_t *b, const uint16_t n, const uint32_t encodedSize);
+                };
+
                 // Responsible for initializing segment/codec specific state and for generating(factory) decoders for terms
                 // All AccessProxy instances have a pointer to the actual index(posts lists) in common
                 struct AccessProxy {
@@ -304,6 +470,16 @@ namespace Trinity {
                         // See Codecs::Decoder for execCtxTermID
                         virtual Decoder *new_decoder(const term_index_ctx &tctx) = 0;
 
+                        // Set if indexPtr maps the whole of basePath/index, and other codec specific data are likewise
+                        // accessed from files in basePath. See IndexSession::set_index_fd()
+                        // SegmentIndexSource sets this for the AccessProxy it creates.
+                        bool backedByFiles{false};
+
+                        // If set, decoders will consult it before decoding blocks, and
+                        // blocksCacheGen is used for the cache keys. See DecodedBlocksCache
+                        DecodedBlocksCache *blocksCache{nullptr};
+                        uint64_t            blocksCacheGen{0};
+
                         AccessProxy(const char *bp, const uint8_t *index_ptr)
                             : basePath{bp}, indexPtr{index_ptr} {
                                 // Subclasses should open files, etc
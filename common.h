@@ -73,6 +73,26 @@ namespace Trinity {
 } // namespace Trinity
 
 #include "trinity_limits.h"
+
+namespace Trinity {
+        // Common-grams; see SegmentIndexSession::set_common_words()
+        // A bigram term is (first term, K_common_gram_separator, second term). The separator is reserved; a token parser must never produce it.
+        static constexpr char_t K_common_gram_separator{'\x1f'};
+
+        // Builds the bigram term of the adjacent terms (a, b) in out, which must be at least Limits::MaxTermLength in size, and returns its length.
+        // Returns 0 if the bigram would be longer than Limits::MaxTermLength, in which case it is neither indexed nor used in queries.
+        static inline uint8_t common_gram(const str8_t a, const str8_t b, char_t *const out) noexcept {
+                const std::size_t len = a.size() + 1 + b.size();
+
+                if (len > Limits::MaxTermLength)
+                        return 0;
+
+                memcpy(out, a.data(), a.size());
+                out[a.size()] = K_common_gram_separator;
+                memcpy(out + a.size() + 1, b.data(), b.size());
+                return len;
+        }
+} // namespace Trinity
 #ifdef LEAN_SWITCH
 #include <compress.h>
 #endif
@@ -264,6 +264,11 @@ static exec_node compile_node(const ast_node *const n, compilation_ctx &cctx, si
                         }
                         break;
 
+                case ast_node::Type::AppIDsSet:
+                        res.fp  = ENT::matchappids;
+                        res.ptr = const_cast<app_ids_set *>(n->app_ids);
+                        break;
+
                 case ast_node::Type::UnaryOp:
                         switch (n->unaryop.op) {
                                 case Operator::AND:
@@ -1385,6 +1390,8 @@ static auto impl_repr(const ENT fp) noexcept {
                 return "const true expr"_s8;
         else if (fp == ENT::matchsome)
                 return "[matchsome]"_s8;
+        else if (fp == ENT::matchappids)
+                return "[matchappids]"_s8;
         else if (fp == ENT::matchallnodes)
                 return "[matchallnodes]"_s8;
         else if (fp == ENT::matchanynodes)
@@ -1440,6 +1447,8 @@ void PrintImpl(Buffer &b, const exec_node &n) {
                         b.append(p->termIDs[i], ',');
                 b.shrink_by(1);
                 b.append(']');
+        } else if (n.fp == ENT::matchappids) {
+                b.append("APP IDS<", ptr_repr(n.ptr), ">");
         } else if (n.fp == ENT::constfalse)
                 b.append(false);
         else if (n.fp == ENT::dummyop)
@@ -22,6 +22,8 @@ namespace Trinity {
                 logicalnot,
                 logicalor,
                 matchsome,
+                // ptr is the ast_node's app_ids_set
+                matchappids,
                 // matchallnodes and matchanynodes are handled by the compiler/optimizer, though
                 // no exec. nodes of that type are generated during compilation.
                 matchallnodes,
@@ -4,17 +4,15 @@
 #include <boost/sort/spreadsort/spreadsort.hpp>
 
 // packs a list of updated/delete documents into a buffer that also contains
-// a skiplist for random access to the bitmaps
+// a skiplist for random access to the containers
+//
+// Layout:
+// [containers data][container descriptors][u8 log2(K_container_span)][u8 2][skiplist][u32 skiplist size][lowest][highest]
+// The older format used 0 or 1 instead of 2 (see unpack_updates())
 void Trinity::pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *const buf) {
         if (updatedDocumentIDs.size()) {
-                static constexpr size_t BANK_SIZE{32 * 1024};
-                IOBuffer                skiplist;
-                static_assert((BANK_SIZE & 63) == 0, "Not divisable by 64");
-                // we are now creating the BF only if it REALLY makes sense, because for a 256k bits long BF
-                // we need 32K, which is likely important only if we got lots of documents
-                auto bf = (updatedDocumentIDs.size() > (BANK_SIZE * 8))
-                              ? reinterpret_cast<uint64_t *>(calloc(updated_documents::K_bloom_filter_size / 64 + 1, sizeof(uint64_t)))
-                              : nullptr;
+                static constexpr size_t BITMAP_SIZE{updated_documents::K_container_span / 8};
+                IOBuffer                skiplist, containers;
 
                 boost::sort::spreadsort::spreadsort(updatedDocumentIDs.begin(), updatedDocumentIDs.end());
 
@@ -25,47 +23,65 @@ void Trinity::pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *c
 #endif
 
                 for (const auto *p = updatedDocumentIDs.data(), *const e = p + updatedDocumentIDs.size(); p != e;) {
-                        // We can create a bitmap
-                        // which will come down to about 4k that can hold 32k documents
-                        // which allows for O(1) access
-                        // For 10million IDs, this comes down to about 2MBs which is not much, considering
-                        // how we are going to be advancing one range/time
-                        const auto id = *p, base = id;
-                        const auto upto = id + BANK_SIZE;
+                        const docid_t base = *p & ~(updated_documents::K_container_span - 1);
+                        const auto    upto = uint64_t(base) + updated_documents::K_container_span;
+                        const auto    from = p;
+                        uint32_t      runs{1};
+
+                        for (++p; p != e && *p < upto; ++p) {
+                                if (p[-1] + 1 != *p) {
+                                        ++runs;
+                                }
+                        }
 
-                        buf->reserve(BANK_SIZE / 8);
+                        // pick whichever's smaller
+                        const uint32_t n         = p - from;
+                        const auto     arraySize = n <= updated_documents::K_max_array_container_size ? n * sizeof(uint16_t) : std::numeric_limits<size_t>::max();
+                        const auto     runsSize  = runs * sizeof(uint16_t) * 2;
 
-                        auto *const bm = reinterpret_cast<uint64_t *>(buf->end());
+                        if (runsSize < arraySize && runsSize < BITMAP_SIZE) {
+                                containers.pack(uint32_t(buf->size()), uint16_t(runs), uint8_t(updated_documents::ContainerType::Runs), uint8_t(0));
 
-                        memset(bm, 0, BANK_SIZE / 8);
+                                for (const auto *it = from; it != p;) {
+                                        const auto start = *it;
 
-                        skiplist.pack(id);
-                        do {
-                                const auto id  = *p;
-                                const auto rel = id - base;
-                                const auto h   = id & (updated_documents::K_bloom_filter_size - 1);
+                                        for (++it; it != p && it[-1] + 1 == *it; ++it) {
+                                                continue;
+                                        }
+                                        buf->pack(uint16_t(start - base), uint16_t(it[-1] - start));
+                                }
+                        } else if (arraySize <= BITMAP_SIZE) {
+                                containers.pack(uint32_t(buf->size()), uint16_t(n), uint8_t(updated_documents::ContainerType::Array), uint8_t(0));
 
-                                if (bf) {
-                                        bf[h / 64] |= static_cast<uint64_t>(1) << (h & 63);
+                                for (const auto *it = from; it != p; ++it) {
+                                        buf->pack(uint16_t(*it - base));
+                                }
+                        } else {
+                                // Keep bitmaps 8 bytes aligned
+                                while (buf->size() & 7) {
+                                        buf->pack(uint8_t(0));
                                 }
 
-                                SwitchBitOps::Bitmap<uint64_t>::Set(bm, rel);
-                        } while (++p != e && *p < upto);
+                                containers.pack(uint32_t(buf->size()), uint16_t(0), uint8_t(updated_documents::ContainerType::Bitmap), uint8_t(0));
 
-                        buf->advance_size(BANK_SIZE / 8);
-                }
+                                buf->reserve(BITMAP_SIZE);
 
-                if (bf) {
-                        buf->serialize(bf, updated_documents::K_bloom_filter_size / 8);
-                        std::free(bf);
-                }
+                                auto *const bm = reinterpret_cast<uint64_t *>(buf->end());
 
-                buf->pack(uint8_t(log2(BANK_SIZE))); // 1 byte will suffice
-                if (bf) {
-                        buf->pack(static_cast<uint8_t>(0)); // 0 if bloom filter is included
-                } else {
-                        buf->pack(static_cast<uint8_t>(1));
+                                memset(bm, 0, BITMAP_SIZE);
+                                for (const auto *it = from; it != p; ++it) {
+                                        SwitchBitOps::Bitmap<uint64_t>::Set(bm, *it - base);
+                                }
+
+                                buf->advance_size(BITMAP_SIZE);
+                        }
+
+                        skiplist.pack(base);
                 }
+
+                buf->serialize(containers.data(), containers.size());
+                buf->pack(uint8_t(log2(updated_documents::K_container_span)));
+                buf->pack(static_cast<uint8_t>(2)); // containers format
                 buf->serialize(skiplist.data(), skiplist.size());                 // skiplist
                 buf->pack(uint32_t(skiplist.size() / sizeof(docid_t)));           // TODO: use varint encoding here
                 buf->pack(updatedDocumentIDs.front(), updatedDocumentIDs.back()); //lowest, highest
@@ -73,7 +89,7 @@ void Trinity::pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *c
 }
 
 // see pack_updates()
-// use this function to unpack the represetnation we need to access the packed (into bitmaps)
+// use this function to unpack the represetnation we need to access the packed (into containers)
 // updated documents
 Trinity::updated_documents Trinity::unpack_updates(const range_base<const uint8_t *, uint32_t> content) {
         if (content.size() <= sizeof(uint32_t) + sizeof(uint8_t)) {
@@ -96,28 +112,152 @@ Trinity::updated_documents Trinity::unpack_updates(const range_base<const uint8_
         const uint64_t *bloom_filter;
         uint32_t        bank_size;
 
-        if (*(--p) == 0) {
-                // we have a bloom filter
-                bank_size = 1u << *(--p);
+        switch (*(--p)) {
+                case 2:
+                        // containers
+                        bank_size = 1u << *(--p);
+                        p -= skiplistSize * sizeof(updated_documents::container);
 
-                p -= updated_documents::K_bloom_filter_size / 8;
-                bloom_filter = reinterpret_cast<const uint64_t *>(p);
+                        EXPECT(p >= b);
+                        return {skiplist, skiplistSize, bank_size, b, lowest, highest, nullptr, reinterpret_cast<const updated_documents::container *>(p)};
 
-		if (p - content.start() != bank_size / 8 * skiplistSize) {
-			// Likely changed K_bloom_filter_size
-			// play it safe
-        		return {skiplist, skiplistSize, bank_size, b, lowest, highest, nullptr};
-		}
+                case 0:
+                        // older format, bitmaps banks and a bloom filter
+                        bank_size = 1u << *(--p);
 
-        } else {
-                bank_size    = 1u << *(--p);
-                bloom_filter = nullptr;
+                        p -= updated_documents::K_bloom_filter_size / 8;
+                        bloom_filter = reinterpret_cast<const uint64_t *>(p);
+
+                        if (p - content.start() != bank_size / 8 * skiplistSize) {
+                                // Likely changed K_bloom_filter_size
+                                // play it safe
+                                return {skiplist, skiplistSize, bank_size, b, lowest, highest, nullptr};
+                        }
+                        break;
+
+                default:
+                        // older format, bitmaps banks
+                        bank_size    = 1u << *(--p);
+                        bloom_filter = nullptr;
+                        break;
         }
 
         EXPECT(p - content.start() == bank_size / 8 * skiplistSize);
         return {skiplist, skiplistSize, bank_size, b, lowest, highest, bloom_filter};
 }
 
+void Trinity::materialize_updates(const updated_documents &ud, std::vector<docid_t> *const out) {
+        for (uint32_t i{0}; i != ud.skiplistSize; ++i) {
+                const auto     base = ud.skiplist[i];
+                const uint8_t *bank;
+                auto           type = updated_documents::ContainerType::Bitmap;
+                uint32_t       n{0};
+
+                if (const auto c = ud.containers) {
+                        bank = ud.banks + c[i].offset;
+                        type = updated_documents::ContainerType(c[i].type);
+                        n    = c[i].n;
+                } else {
+                        bank = ud.banks + i * (ud.bankSize / 8);
+                }
+
+                switch (type) {
+                        case updated_documents::ContainerType::Array:
+                                for (const auto *it = reinterpret_cast<const uint16_t *>(bank), *const e = it + n; it != e; ++it) {
+                                        out->push_back(base + *it);
+                                }
+                                break;
+
+                        case updated_documents::ContainerType::Runs:
+                                for (const auto *it = reinterpret_cast<const uint16_t *>(bank), *const e = it + n * 2; it != e; it += 2) {
+                                        for (uint32_t j{0}; j <= it[1]; ++j) {
+                                                out->push_back(base + it[0] + j);
+                                        }
+                                }
+                                break;
+
+                        case updated_documents::ContainerType::Bitmap: {
+                                const auto bm = reinterpret_cast<const uint64_t *>(bank);
+
+                                for (uint32_t j{0}; j != ud.bankSize / 64; ++j) {
+                                        for (auto w = bm[j]; w; w &= w - 1) {
+                                                out->push_back(base + j * 64 + __builtin_ctzll(w));
+                                        }
+                                }
+                        } break;
+                }
+        }
+}
+
+void Trinity::updated_documents_scanner::seek_bank(const docid_t *const it) {
+        skiplistBase = it;
+        curBankRange.Set(*skiplistBase, bankSize);
+
+        if (const auto c = udContainers) {
+                const auto &container = c[skiplistBase - udSkipList];
+
+                curBank     = udBanks + container.offset;
+                curBankType = updated_documents::ContainerType(container.type);
+
+                if (curBankType == updated_documents::ContainerType::Array) {
+                        curValuesBase = curValues = reinterpret_cast<const uint16_t *>(curBank);
+                        curValuesEnd              = curValues + container.n;
+                } else if (curBankType == updated_documents::ContainerType::Runs) {
+                        curValuesBase = curValues = reinterpret_cast<const uint16_t *>(curBank);
+                        curValuesEnd              = curValues + container.n * 2;
+                }
+        } else {
+                curBank = udBanks + ((skiplistBase - udSkipList) * (bankSize / 8));
+        }
+}
+
+bool Trinity::updated_documents_scanner::test_bank(const uint32_t rel) noexcept {
+        switch (curBankType) {
+                case updated_documents::ContainerType::Bitmap:
+                        return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)curBank, rel);
+
+                case updated_documents::ContainerType::Array: {
+                        // amortized O(1) for monotonically increasing IDs, but
+                        // don't scan linearly across long distances
+                        auto it = curValues;
+
+                        if (it != curValuesBase && it[-1] >= rel) {
+                                // lower than a previously tested ID
+                                it = std::lower_bound(curValuesBase, it, rel);
+                        } else if (curValuesEnd - it > 16 && it[16] < rel) {
+                                it = std::lower_bound(it + 16, curValuesEnd, rel);
+                        } else {
+                                while (it != curValuesEnd && *it < rel) {
+                                        ++it;
+                                }
+                        }
+
+                        curValues = it;
+                        return it != curValuesEnd && *it == rel;
+                }
+
+                case updated_documents::ContainerType::Runs: {
+                        // (start, length - 1) pairs
+                        auto it = curValues;
+
+                        if (it != curValuesBase && uint32_t(it[-2]) + it[-1] >= rel) {
+                                // lower than a previously tested ID
+                                it = curValuesBase;
+                        }
+
+                        while (it != curValuesEnd && uint32_t(it[0]) + it[1] < rel) {
+                                it += 2;
+                        }
+
+                        curValues = it;
+                        return it != curValuesEnd && it[0] <= rel;
+                }
+
+                default:
+                        return false;
+        }
+}
+
 bool Trinity::updated_documents_scanner::test(const docid_t id) noexcept {
         static constexpr bool trace{false}, traceAdvances{false};
 
@@ -137,13 +277,20 @@ bool Trinity::updated_documents_scanner::test(const docid_t id) noexcept {
                 }
         }
 
+        if (id < curBankRange.start() && udSkipList != end) {
+                // lower than a previously tested ID, and before the current bank(or we have been drained)
+                // search from the first bank instead
+                skiplistBase = udSkipList;
+                curBankRange.Set(*skiplistBase, 0);
+        }
+
         if (id >= curBankRange.start()) {
-                if (id < curBankRange.stop()) {
+                if (id - curBankRange.offset < curBankRange.size()) {
                         if constexpr (trace) {
                                 SLog("In bank range ", id - curBankRange.offset, "\n");
                         }
 
-                        return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)curBank, id - curBankRange.offset);
+                        return test_bank(id - curBankRange.offset);
                 } else if (id > maxDocID) {
                         reset();
                         return false;
@@ -158,7 +305,7 @@ bool Trinity::updated_documents_scanner::test(const docid_t id) noexcept {
                         // There's no need to check for success, we already checked for (id > maxDocID)
                         for (int32_t top{static_cast<int32_t>(end - skiplistBase) - 1}; btm <= top;) {
                                 const auto mid = (btm + top) / 2;
-                                const auto end = skiplistBase[mid] + bankSize;
+                                const auto end = uint64_t(skiplistBase[mid]) + bankSize;
 
                                 if (id < end) {
                                         top = mid - 1;
@@ -167,20 +314,18 @@ bool Trinity::updated_documents_scanner::test(const docid_t id) noexcept {
                                 }
                         }
 
-                        skiplistBase += btm;
-                        curBankRange.Set(*skiplistBase, bankSize);
-                        curBank = udBanks + ((skiplistBase - udSkipList) * (bankSize / 8));
+                        seek_bank(skiplistBase + btm);
 
                         if constexpr (trace || traceAdvances) {
                                 SLog("Now at ", skiplistBase - udSkipList, " => ", curBankRange, " ", curBankRange.Contains(id), "\n");
                         }
 
-                        if (curBankRange.Contains(id)) {
+                        if (id >= curBankRange.offset && id - curBankRange.offset < curBankRange.size()) {
                                 if constexpr (trace) {
                                         SLog("REL = ", id - curBankRange.offset, "\n");
                                 }
 
-                                return SwitchBitOps::Bitmap<uint64_t>::IsSet((uint64_t *)curBank, id - curBankRange.offset);
+                                return test_bank(id - curBankRange.offset);
                         } else {
                                 if constexpr (trace) {
                                         SLog("id ", id, " out of range of ", curBankRange, "\n");
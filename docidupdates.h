@@ -3,9 +3,15 @@
 #include <memory>
 #include <switch.h>
 
-// Efficient, lean, fixed-size bitmaps based document IDs tracking
-// You are expected to test for document IDs in ascending order, but if you need a different behavior, it should be easy to modify
-// the implementation to accomplish it.
+// Efficient, lean, Roaring-style document IDs tracking
+// The docID space is partitioned into containers of 64K docIDs each, and each container holding at least one
+// updated document is encoded as either a sorted array of 16bit values, a fixed-size bitmap, or a list of runs, whichever's smaller.
+// Sparse updates spread across the whole docIDs space now cost a few bytes each, instead of a 4KB bitmap bank each.
+// (we can still access files created by older Trinity releases, where all banks were 32K documents bitmaps)
+//
+// Testing document IDs in ascending order is amortized O(1). An updated_documents_scanner also supports testing a lower document ID than
+// the previous one, which rewinds it(a binary search), but masked_documents_registry drops scanners once they have been tested past their highest document ID, so
+// you are expected to test for document IDs in ascending order via a registry.
 //
 // Note that it operates on docit_t, not on isrc_docid_t. Because we store isrc_docid in ascending order in
 // postings lists, but that doesn't guarantee that the translated global document IDs will also be
@@ -13,13 +19,33 @@
 // almost as fast, takes up less memory and is great for random access
 namespace Trinity {
         struct updated_documents final {
+                // Only used by the older fixed-size bitmap banks format
                 static constexpr size_t K_bloom_filter_size{256 * 1024};
                 static_assert(0 == (K_bloom_filter_size & 1));
-                // Each bitmaps bank can be accessed by a skiplist via binary search
+
+                static constexpr uint32_t K_container_span{64 * 1024};
+                // an array container of more values than that would be larger than a bitmap container
+                static constexpr uint32_t K_max_array_container_size{4096};
+
+                enum class ContainerType : uint8_t {
+                        Array = 0,
+                        Bitmap,
+                        Runs
+                };
+
+                struct container final {
+                        uint32_t offset; // in banks
+                        uint16_t n;      // Array: values; Runs: (start, length - 1) pairs
+                        uint8_t  type;
+                        uint8_t  _unused;
+                };
+                static_assert(sizeof(container) == 8);
+
+                // Each container(bank) can be accessed by a skiplist via binary search
                 const docid_t *skiplist;
                 const uint32_t skiplistSize;
 
-                // Fixed size bitmap banks
+                // Docs. span of each container
                 const uint32_t bankSize;
                 const uint8_t *banks;
 
@@ -28,25 +54,33 @@ namespace Trinity {
 
                 const uint64_t *bf;
 
+                // nullptr for the older format, where all banks are (bankSize / 8) bytes long bitmaps
+                const container *containers{nullptr};
+
                 inline operator bool() const {
                         return banks;
                 }
         };
 
         // Facilitates fast set test operations for updated/deleted documents packed
-        // as bitmaps using pack_updates()
+        // using pack_updates()
         struct updated_documents_scanner final {
                 const docid_t *const end;
                 const uint32_t       bankSize;
 
-                range_base<docid_t, docid_t> curBankRange;
-                const docid_t *              skiplistBase;
-                const uint8_t *              curBank;
-                docid_t                      low_doc_id;
-                docid_t                      maxDocID;
-                const docid_t *const         udSkipList;
-                const uint8_t *const         udBanks;
-                const uint64_t *const        bf;
+                range_base<docid_t, docid_t>              curBankRange;
+                const docid_t *                           skiplistBase;
+                const uint8_t *                           curBank;
+                docid_t                                   low_doc_id;
+                docid_t                                   maxDocID;
+                const docid_t *const                      udSkipList;
+                const uint8_t *const                      udBanks;
+                const uint64_t *const                     bf;
+                const updated_documents::container *const udContainers;
+                updated_documents::ContainerType          curBankType{updated_documents::ContainerType::Bitmap};
+                // For Array and Runs containers, we advance this cursor instead of searching
+                // because we are usually testing monotonically increasing document IDs; it is rewound to curValuesBase otherwise
+                const uint16_t *curValuesBase{nullptr}, *curValues{nullptr}, *curValuesEnd{nullptr};
 
                 void reset() {
                         maxDocID   = std::numeric_limits<docid_t>::max();
@@ -55,37 +89,49 @@ namespace Trinity {
                 }
 
                 updated_documents_scanner(const updated_documents &ud)
-                    : end{ud.skiplist + ud.skiplistSize}, bankSize{ud.bankSize}, skiplistBase{ud.skiplist}, udSkipList{ud.skiplist}, udBanks{ud.banks}, low_doc_id{ud.lowestID}, maxDocID{ud.highestID}, bf{ud.bf} {
+                    : end{ud.skiplist + ud.skiplistSize}, bankSize{ud.bankSize}, skiplistBase{ud.skiplist}, low_doc_id{ud.lowestID}, maxDocID{ud.highestID}, udSkipList{ud.skiplist}, udBanks{ud.banks}, bf{ud.bf}, udContainers{ud.containers} {
                         if (skiplistBase != end) {
-                                curBankRange.Set(*skiplistBase, ud.bankSize);
-                                curBank = udBanks;
+                                seek_bank(skiplistBase);
                         }
                 }
 
                 updated_documents_scanner(const updated_documents_scanner &o)
-                    : end{o.end}, bankSize{o.bankSize}, skiplistBase{o.skiplistBase}, udSkipList{o.udSkipList}, udBanks{o.udBanks}, bf{o.bf} {
+                    : end{o.end}, bankSize{o.bankSize}, skiplistBase{o.skiplistBase}, udSkipList{o.udSkipList}, udBanks{o.udBanks}, bf{o.bf}, udContainers{o.udContainers} {
                         low_doc_id   = o.low_doc_id;
                         maxDocID     = o.maxDocID;
                         curBankRange = o.curBankRange;
                         curBank      = o.curBank;
+                        curBankType   = o.curBankType;
+                        curValuesBase = o.curValuesBase;
+                        curValues     = o.curValues;
+                        curValuesEnd = o.curValuesEnd;
                 }
 
                 constexpr bool drained() const noexcept {
                         return curBankRange.offset == UINT32_MAX;
                 }
 
-                // You are expected to test monotonically increasing document IDs
+                // Amortized O(1) for monotonically increasing document IDs. Testing a lower document ID than the previous one
+                // rewinds the scanner
                 bool test(const docid_t id) noexcept;
 
                 inline bool operator==(const updated_documents_scanner &o) const noexcept {
-                        return end == o.end && bankSize == o.bankSize && curBankRange == o.curBankRange && skiplistBase == o.skiplistBase && curBank == o.curBank && udSkipList == o.udSkipList && udBanks == o.udBanks;
+                        return end == o.end && bankSize == o.bankSize && curBankRange == o.curBankRange && skiplistBase == o.skiplistBase && curBank == o.curBank && udSkipList == o.udSkipList && udBanks == o.udBanks && curValues == o.curValues;
                 }
+
+              private:
+                void seek_bank(const docid_t *);
+
+                bool test_bank(const uint32_t rel) noexcept;
         };
 
         void pack_updates(std::vector<docid_t> &updatedDocumentIDs, IOBuffer *const buf);
 
         updated_documents unpack_updates(const range_base<const uint8_t *, uint32_t> content);
 
+        // Appends all document IDs in `ud` to `out`, in ascending order
+        void materialize_updates(const updated_documents &ud, std::vector<docid_t> *const out);
+
         // manages multiple scanners and tests among all of them, and if any of them is exchausted, it is removed from the collection
         struct masked_documents_registry final {
                 bool test(const docid_t id) {
@@ -189,4 +235,56 @@ namespace Trinity {
                         return std::unique_ptr<Trinity::masked_documents_registry>(ptr);
                 }
         };
+
+        // A masked_documents_registry with at most one scanner, stored inline instead of allocated by masked_documents_registry::make()
+        // Used by IndexSourcesCollection::scanner_registry_for(), where all masked documents of a source have been collapsed into a single updated_documents
+        //
+        // The scanner is a member of its own, laid out where the registry's scanners[0] is(see the static_assert), so that we never
+        // construct anything past the end of the registry's zero-length array
+        class single_masked_documents_registry final {
+              private:
+                masked_documents_registry registry;
+                // Only constructed if registry.rem == 1
+                union {
+                        updated_documents_scanner scanner;
+                };
+
+              public:
+                single_masked_documents_registry(const updated_documents &ud) {
+                        static_assert(offsetof(single_masked_documents_registry, scanner) == offsetof(single_masked_documents_registry, registry) + offsetof(masked_documents_registry, scanners),
+                                      "scanner must be masked_documents_registry::scanners[0]");
+
+                        if (ud) {
+                                new (&scanner) updated_documents_scanner(ud);
+                                registry.rem        = 1;
+                                registry.min_doc_id = ud.lowestID;
+                                registry.max_doc_id = ud.highestID;
+                        } else {
+                                registry.min_doc_id = std::numeric_limits<docid_t>::max();
+                                registry.max_doc_id = std::numeric_limits<docid_t>::min();
+                        }
+                }
+
+                single_masked_documents_registry(const single_masked_documents_registry &o) {
+                        registry.rem        = o.registry.rem;
+                        registry.min_doc_id = o.registry.min_doc_id;
+                        registry.max_doc_id = o.registry.max_doc_id;
+                        if (registry.rem)
+                                new (&scanner) updated_documents_scanner(o.scanner);
+                }
+
+                single_masked_documents_registry &operator=(const single_masked_documents_registry &) = delete;
+
+                // updated_documents_scanner is trivially destructible
+                ~single_masked_documents_registry() {
+                }
+
+                inline masked_documents_registry *get() noexcept {
+                        return &registry;
+                }
+
+                inline const masked_documents_registry *get() const noexcept {
+                        return &registry;
+                }
+        };
 } // namespace Trinity
@@ -1,6 +1,7 @@
 #include "docset_iterators.h"
 #include "codecs.h"
 #include "queryexec_ctx.h"
+#include <switch_bitops.h>
 
 // see reorder_execnode_impl()
 uint64_t Trinity::DocsSetIterators::Iterator::cost() {
@@ -10,7 +11,13 @@ uint64_t Trinity::DocsSetIterators::Iterator::cost() {
 uint64_t Trinity::DocsSetIterators::cost(const Iterator *it) {
         switch (it->type) {
                 case Type::AppIterator:
-                        std::abort();
+                        return static_cast<const AppIterator *>(it)->cost_;
+
+                case Type::AppIDs: {
+                        const auto set = static_cast<const AppIDs *>(it)->set;
+
+                        return set->repr == app_ids_set::Repr::Array ? set->array.cnt : set->bitmap.cnt;
+                }
 
                 case Type::DisjunctionSome:
                         return static_cast<const DisjunctionSome *>(it)->cost_;
@@ -21,6 +28,9 @@ uint64_t Trinity::DocsSetIterators::cost(const Iterator *it) {
                 case Type::VectorIDs:
                         return static_cast<const VectorIDs *>(it)->ids.size();
 
+                case Type::CachedDocsSet:
+                        return static_cast<const CachedDocsSet *>(it)->set->cnt;
+
                 case Type::Optional:
                         return cost(static_cast<const Optional *>(it)->main);
 
@@ -55,6 +65,17 @@ uint64_t Trinity::DocsSetIterators::cost(const Iterator *it) {
                         return cost(self->its[0]) + UINT32_MAX + UINT16_MAX * self->size;
                 } break;
 
+                case Type::PhraseSet: {
+                        const auto self = static_cast<const PhraseSet *>(it);
+                        const auto &root = self->nodes[0];
+                        uint64_t   sum{0};
+
+                        // XXX: see phrase_cost()
+                        for (auto i{root.firstChild}, end{root.firstChild + root.childrenCnt}; i != end; ++i)
+                                sum += cost(self->its[self->nodes[i].termIdx]);
+                        return sum + UINT32_MAX + UINT16_MAX * self->maxPhraseSize;
+                } break;
+
                 case Type::PostingsListIterator:
                         return static_cast<const Codecs::PostingsListIterator *>(it)->decoder()->indexTermCtx.documents;
 
@@ -202,6 +223,30 @@ Trinity::isrc_docid_t Trinity::DocsSetIterators::Phrase::advance(const isrc_doci
                 return DocIDsEND; // already reset curDocument.id to DocIDsEND
 }
 
+Trinity::isrc_docid_t Trinity::DocsSetIterators::Phrase::approximate(const isrc_docid_t target) {
+        if (size) {
+                auto id = its[0]->advance(target);
+
+                if (unlikely(id == DocIDsEND) || unlikely((id = next_impl(id)) == DocIDsEND)) {
+                        size                  = 0;
+                        return curDocument.id = DocIDsEND;
+                }
+
+                return id;
+        } else
+                return DocIDsEND; // already reset curDocument.id to DocIDsEND
+}
+
+bool Trinity::DocsSetIterators::Phrase::matches() {
+        if (confirmedDID == curDocument.id)
+                return true;
+        else if (consider_phrase_match()) {
+                confirmedDID = curDocument.id;
+                return true;
+        } else
+                return false;
+}
+
 Trinity::isrc_docid_t Trinity::DocsSetIterators::Phrase::next() {
         if (size) {
                 auto id = its[0]->next();
@@ -223,6 +268,262 @@ Trinity::isrc_docid_t Trinity::DocsSetIterators::Phrase::next() {
                 return DocIDsEND; // already reset curDocument.id to DocIDsEND
 }
 
+Trinity::DocsSetIterators::PhraseSet::PhraseSet(queryexec_ctx *r, Codecs::PostingsListIterator **iterators, const uint16_t cnt,
+                                                 const uint16_t *phrasesTerms_, const uint8_t *phrasesSizes, const uint16_t phrasesCnt,
+                                                 const bool trackCnt, const bool docsOnly_)
+    : Iterator{Type::PhraseSet}, its((Codecs::PostingsListIterator **)malloc(sizeof(Codecs::PostingsListIterator *) * cnt)), itsCnt{cnt}, maxMatchCnt{uint16_t(trackCnt ? std::numeric_limits<uint16_t>::max() : 1)}, release_docrefs{docsOnly_}, rctxRef{r} {
+        std::vector<uint16_t> order;
+
+        require(cnt);
+        require(phrasesCnt);
+        memcpy(its, iterators, sizeof(iterators[0]) * cnt);
+
+        for (uint32_t i{0}, o{0}; i != phrasesCnt; o += phrasesSizes[i++]) {
+                require(phrasesSizes[i]);
+
+                phrases.push_back({uint32_t(phrasesTerms.size()), phrasesSizes[i]});
+                phrasesTerms.insert(phrasesTerms.end(), phrasesTerms_ + o, phrasesTerms_ + o + phrasesSizes[i]);
+                maxPhraseSize = std::max(maxPhraseSize, phrasesSizes[i]);
+                order.push_back(i);
+        }
+
+        matchCnts.reset(new uint16_t[phrasesCnt]);
+        termsMarks.resize(cnt, 0);
+
+        // Sorting the phrases by their terms means that all phrases that share a prefix are adjacent, and
+        // a phrase that's a prefix of another phrase comes before it. We can then build the trie
+        // so that the children of each node are contiguous in nodes[]
+        std::sort(order.begin(), order.end(), [&](const auto a, const auto b) noexcept {
+                const auto pa = phrasesTerms.data() + phrases[a].offset, pb = phrasesTerms.data() + phrases[b].offset;
+
+                return std::lexicographical_compare(pa, pa + phrases[a].size, pb, pb + phrases[b].size);
+        });
+
+        const auto build = [&](const auto &self, const uint32_t nodeIdx, const uint16_t *from, const uint16_t *const to, const uint8_t depth) -> void {
+                uint32_t childrenCnt{0};
+
+                for (; from != to && phrases[*from].size == depth; ++from) {
+                        // if we have the same phrase more than once, we only need to consider one of them
+                        if (nodes[nodeIdx].phraseIdx == -1)
+                                nodes[nodeIdx].phraseIdx = *from;
+                }
+
+                for (auto it = from; it != to;) {
+                        const auto termIdx = phrasesTerms[phrases[*it].offset + depth];
+
+                        for (++it; it != to && phrasesTerms[phrases[*it].offset + depth] == termIdx; ++it)
+                                continue;
+                        ++childrenCnt;
+                }
+
+                const uint32_t base = nodes.size();
+
+                nodes[nodeIdx].firstChild  = base;
+                nodes[nodeIdx].childrenCnt = childrenCnt;
+                for (auto it = from; it != to;) {
+                        const auto termIdx = phrasesTerms[phrases[*it].offset + depth];
+
+                        for (++it; it != to && phrasesTerms[phrases[*it].offset + depth] == termIdx; ++it)
+                                continue;
+                        nodes.push_back({termIdx, -1, 0, 0});
+                }
+
+                for (uint32_t i{0}; i != childrenCnt; ++i) {
+                        const auto termIdx = nodes[base + i].termIdx;
+                        const auto upto    = std::find_if(from, to, [&](const auto p) noexcept { return phrasesTerms[phrases[p].offset + depth] != termIdx; });
+
+                        self(self, base + i, from, upto, depth + 1);
+                        from = upto;
+                }
+        };
+
+        nodes.push_back({0, -1, 0, 0});
+        build(build, 0, order.data(), order.data() + order.size(), 0);
+}
+
+// If the term of node `n` is in document `did`, this will advance the iterators of its sub-trie
+// to `did`, and set `found` if all terms of any phrase in the sub-trie are in the document.
+// Otherwise, returns the lowest document > did any of the phrases in the sub-trie may match
+Trinity::isrc_docid_t Trinity::DocsSetIterators::PhraseSet::lowest_candidate(const node &n, const isrc_docid_t did, bool &found) {
+        if (n.phraseIdx != -1) {
+                found = true;
+                return did;
+        }
+
+        isrc_docid_t lowest{DocIDsEND};
+
+        for (auto i{n.firstChild}, end{n.firstChild + n.childrenCnt}; i != end; ++i) {
+                const auto &c   = nodes[i];
+                auto        it  = its[c.termIdx];
+                auto        cur = it->current();
+
+                if (cur < did)
+                        cur = it->advance(did);
+
+                if (cur == did) {
+                        cur = lowest_candidate(c, did, found);
+
+                        if (found)
+                                return did;
+                }
+
+                lowest = std::min(lowest, cur);
+        }
+
+        return lowest;
+}
+
+// positions[from, to) are the positions of the first term of all phrases that match the prefix
+// that ends at node `n`, i.e the `depth` first terms of those phrases
+bool Trinity::DocsSetIterators::PhraseSet::match_children(candidate_document *const doc, const node &n, const isrc_docid_t did, const uint8_t depth, const uint32_t from, const uint32_t to) {
+        auto &rctx = *rctxRef;
+
+        if (n.phraseIdx != -1) {
+                const auto cnt = uint16_t(std::min<uint32_t>(to - from, maxMatchCnt));
+
+                matchCnts[n.phraseIdx] = cnt;
+                matchCnt += cnt;
+
+                if (release_docrefs) {
+                        // we just need to know that any of the phrases matched
+                        return true;
+                }
+
+                const auto &p = phrases[n.phraseIdx];
+
+                ++termsMark;
+                for (uint32_t i{0}; i != p.size; ++i) {
+                        const auto termIdx = phrasesTerms[p.offset + i];
+
+                        if (termsMarks[termIdx] != termsMark) {
+                                termsMarks[termIdx] = termsMark;
+                                matchedIts.push_back(its[termIdx]);
+                        }
+                }
+        }
+
+        for (auto i{n.firstChild}, end{n.firstChild + n.childrenCnt}; i != end; ++i) {
+                const auto &c   = nodes[i];
+                auto        it  = its[c.termIdx];
+                auto        cur = it->current();
+
+                // lowest_candidate() stops as soon as it finds a candidate phrase, so
+                // we may not have advanced this iterator yet
+                if (cur < did)
+                        cur = it->advance(did);
+
+                if (cur != did)
+                        continue;
+
+                const auto termID = it->decoder()->exec_ctx_termid();
+                auto *const __restrict__ th = doc->materialize_term_hits(&rctx, it, termID); // will create and initialize dws if not created
+                const uint32_t base         = positions.size();
+
+                if (depth == 0) {
+                        // See Phrase::consider_phrase_match()
+                        for (uint32_t k{0}; k != th->freq; ++k) {
+                                if (const auto pos = th->all[k].pos)
+                                        positions.push_back(pos);
+                        }
+                } else {
+                        auto *const __restrict__ dws = doc->matchedDocument.dws;
+
+                        for (auto k{from}; k != to; ++k) {
+                                if (const auto pos = positions[k]; dws->test(termID, pos + depth))
+                                        positions.push_back(pos);
+                        }
+                }
+
+                const uint32_t upto = positions.size();
+
+                if (upto != base && match_children(doc, c, did, depth + 1, base, upto)) {
+                        positions.resize(base);
+                        return true;
+                }
+
+                positions.resize(base);
+        }
+
+        return false;
+}
+
+uint32_t Trinity::DocsSetIterators::PhraseSet::consider_phrases_match(const isrc_docid_t did) {
+        auto &      rctx = *rctxRef;
+        auto *const doc  = rctx.document_by_id(did);
+
+        // See Phrase::consider_phrase_match() for why we retain or release the document
+        matchCnt = 0;
+        memset(matchCnts.get(), 0, sizeof(uint16_t) * phrases.size());
+        matchedIts.clear();
+        positions.clear();
+        match_children(doc, nodes[0], did, 0, 0, 0);
+
+        if (release_docrefs) {
+                rctx.cds_release(doc);
+        } else {
+                if (doc->rc == 1) {
+                        rctx.track_docref(doc);
+                } else {
+                        rctx.cds_release(doc);
+                }
+        }
+
+        return matchCnt;
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::PhraseSet::next_impl(isrc_docid_t target) {
+        const auto &root = nodes[0];
+
+        while (target != DocIDsEND) {
+                isrc_docid_t did{DocIDsEND};
+
+                for (auto i{root.firstChild}, end{root.firstChild + root.childrenCnt}; i != end; ++i) {
+                        auto it  = its[nodes[i].termIdx];
+                        auto cur = it->current();
+
+                        if (cur < target)
+                                cur = it->advance(target);
+
+                        did = std::min(did, cur);
+                }
+
+                if (unlikely(did == DocIDsEND))
+                        break;
+
+                isrc_docid_t lowest{DocIDsEND};
+                bool         found{false};
+
+                for (auto i{root.firstChild}, end{root.firstChild + root.childrenCnt}; i != end; ++i) {
+                        const auto &n   = nodes[i];
+                        const auto  cur = its[n.termIdx]->current();
+
+                        lowest = std::min(lowest, cur == did ? lowest_candidate(n, did, found) : cur);
+
+                        if (found)
+                                break;
+                }
+
+                if (found) {
+                        if (consider_phrases_match(did))
+                                return curDocument.id = did;
+
+                        target = did + 1;
+                } else
+                        target = lowest;
+        }
+
+        drained = true;
+        return curDocument.id = DocIDsEND;
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::PhraseSet::advance(const isrc_docid_t target) {
+        return drained ? DocIDsEND : next_impl(target);
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::PhraseSet::next() {
+        return drained ? DocIDsEND : next_impl(curDocument.id + 1);
+}
+
 Trinity::isrc_docid_t Trinity::DocsSetIterators::ConjuctionAllPLI::advance(const isrc_docid_t target) {
         if (size) {
                 const auto id = its[0]->advance(target);
@@ -249,14 +550,21 @@ Trinity::isrc_docid_t Trinity::DocsSetIterators::ConjuctionAllPLI::next() {
                 return DocIDsEND; // already reset curDocument.id to DocIDsEND
 }
 
+template <bool Sampling>
 Trinity::isrc_docid_t Trinity::DocsSetIterators::ConjuctionAllPLI::next_impl(isrc_docid_t id) {
 restart:
+        if (Sampling)
+                ++sample.candidates;
+
         for (size_t i{1}; i != size; ++i) {
                 auto it = its[i];
 
                 if (it->current() != id) {
                         const auto next = it->advance(id);
 
+                        if (Sampling)
+                                sample.probe(i, size, next > id);
+
                         if (next > id) {
                                 if (unlikely(next == DocIDsEND)) {
                                         // draining either of the iterators means we always need to return DocIDsEND from now on
@@ -271,17 +579,51 @@ restart:
                                         return curDocument.id = DocIDsEND;
                                 }
 
+                                if (Sampling)
+                                        sample.probe_lead(size, id != next);
+
                                 goto restart;
                         }
-                }
+                } else if (Sampling)
+                        sample.probe(i, size, false);
         }
 
+        if (Sampling && sample.candidates >= conjunction_sample::K_candidates)
+                sample.replan(its, size);
+
         return curDocument.id = id;
 }
 
+Trinity::DocsSetIterators::Conjuction::Conjuction(Iterator **iterators, const uint16_t cnt)
+    : Iterator{Type::Conjuction}, size{cnt}, its((Iterator **)malloc(sizeof(Iterator *) * cnt)), sample{cnt} {
+        require(cnt);
+        memcpy(its, iterators, cnt * sizeof(Iterator *));
+
+        for (uint16_t i{0}; i != cnt; ++i) {
+                if (its[i]->type == Type::Phrase) {
+                        if (!twoPhase)
+                                twoPhase = (Phrase **)malloc(sizeof(Phrase *) * cnt);
+                        twoPhase[twoPhaseCnt++] = static_cast<Phrase *>(its[i]);
+                }
+        }
+
+        leadApproximation = its[0]->type == Type::Phrase;
+        std::sort(twoPhase, twoPhase + twoPhaseCnt, [](const auto a, const auto b) noexcept {
+                return a->size < b->size;
+        });
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::Conjuction::lead_advance(const isrc_docid_t target) {
+        return leadApproximation ? static_cast<Phrase *>(its[0])->approximate(target) : its[0]->advance(target);
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::Conjuction::lead_next() {
+        return leadApproximation ? static_cast<Phrase *>(its[0])->approximate(its[0]->current() + 1) : its[0]->next();
+}
+
 Trinity::isrc_docid_t Trinity::DocsSetIterators::Conjuction::advance(const isrc_docid_t target) {
         if (size) {
-                const auto id = its[0]->advance(target);
+                const auto id = lead_advance(target);
 
                 if (unlikely(id == DocIDsEND)) {
                         size                  = 0;
@@ -294,7 +636,7 @@ Trinity::isrc_docid_t Trinity::DocsSetIterators::Conjuction::advance(const isrc_
 
 Trinity::isrc_docid_t Trinity::DocsSetIterators::Conjuction::next() {
         if (size) {
-                const auto id = its[0]->next();
+                const auto id = lead_next();
 
                 if (unlikely(id == DocIDsEND)) {
                         size                  = 0;
@@ -305,11 +647,15 @@ Trinity::isrc_docid_t Trinity::DocsSetIterators::Conjuction::next() {
                 return DocIDsEND; // already reset curDocument.id to DocIDsEND
 }
 
+template <bool Sampling>
 Trinity::isrc_docid_t Trinity::DocsSetIterators::Conjuction::next_impl(isrc_docid_t id) {
         static constexpr bool trace{false};
         const auto            localSize{size}; // alias just in case the compiler can't do it itself
 
 restart:
+        if (Sampling)
+                ++sample.candidates;
+
         for (size_t i{1}; i != localSize; ++i) {
                 auto it = its[i];
 
@@ -317,11 +663,14 @@ restart:
                         SLog(i, "/", size, " id = ", id, ", it->current = ", it->current(), "\n");
 
                 if (it->current() != id) {
-                        const auto next = it->advance(id);
+                        const auto next = twoPhaseCnt && it->type == Type::Phrase ? static_cast<Phrase *>(it)->approximate(id) : it->advance(id);
 
                         if (trace)
                                 SLog("Advanced it to ", next, "\n");
 
+                        if (Sampling)
+                                sample.probe(i, localSize, next > id);
+
                         if (next > id) {
                                 if (unlikely(next == DocIDsEND)) {
                                         // draining either of the iterators means we always need to return DocIDsEND from now on
@@ -329,7 +678,7 @@ restart:
                                         return curDocument.id = DocIDsEND;
                                 }
 
-                                id = its[0]->advance(next);
+                                id = lead_advance(next);
 
                                 if (trace)
                                         SLog("After advancing lead to ", next, " ", id, "\n");
@@ -339,11 +688,35 @@ restart:
                                         size                  = 0;
                                         return curDocument.id = DocIDsEND;
                                 }
+
+                                if (Sampling)
+                                        sample.probe_lead(localSize, id != next);
+
                                 goto restart;
                         }
+                } else if (Sampling)
+                        sample.probe(i, localSize, false);
+        }
+
+        // All iterators(or their approximations) agree on id; confirm the phrases
+        for (uint16_t i{0}; i != twoPhaseCnt; ++i) {
+                if (!twoPhase[i]->matches()) {
+                        id = lead_next();
+
+                        if (unlikely(id == DocIDsEND)) {
+                                size                  = 0;
+                                return curDocument.id = DocIDsEND;
+                        }
+                        goto restart;
                 }
         }
 
+        if (Sampling && sample.candidates >= conjunction_sample::K_candidates) {
+                sample.replan(its, localSize);
+                // the lead may have been replaced
+                leadApproximation = its[0]->type == Type::Phrase;
+        }
+
         return curDocument.id = id;
 }
 
@@ -809,3 +1182,89 @@ void Trinity::DocsSetIterators::DisjunctionSome::update_matched_cnt() {
 
         tail.clear();
 }
+
+uint32_t Trinity::DocsSetIterators::gallop(const isrc_docid_t *const ids, uint32_t from, const uint32_t cnt, const isrc_docid_t target) noexcept {
+        uint32_t step{1};
+
+        // find [from, to) so that ids[to] >= target, doubling the step every time
+        while (from != cnt && ids[from] < target) {
+                const auto to = std::min(from + step, cnt);
+
+                if (to == cnt || ids[to] >= target)
+                        return std::lower_bound(ids + from + 1, ids + to, target) - ids;
+
+                from = to;
+                step <<= 1;
+        }
+
+        return from;
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::bitmap_from(const uint64_t *const bm, const std::size_t size, const isrc_docid_t id) noexcept {
+        auto i = std::size_t(id) / 64;
+
+        if (i >= size)
+                return DocIDsEND;
+
+        for (auto w = bm[i] & (std::numeric_limits<uint64_t>::max() << (id & 63));;) {
+                if (w)
+                        return i * 64 + SwitchBitOps::TrailingZeros(w);
+                else if (++i == size)
+                        return DocIDsEND;
+
+                w = bm[i];
+        }
+}
+
+// idx is past the current document, so we can't gallop from there to a target at or before it; see Iterator::advance()
+Trinity::isrc_docid_t Trinity::DocsSetIterators::VectorIDs::advance(const isrc_docid_t target) {
+        const auto cnt = ids.size();
+
+        if (target <= curDocument.id)
+                return curDocument.id;
+
+        if ((idx = gallop(ids.data(), idx, cnt, target)) == cnt)
+                return curDocument.id = DocIDsEND;
+
+        return curDocument.id = ids[idx++];
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::CachedDocsSet::next() {
+        if (set->repr == docids_set::Repr::Array)
+                return curDocument.id = idx == set->cnt ? DocIDsEND : set->ids[idx++];
+        else
+                return curDocument.id = bitmap_from(set->bm.get(), set->maxDocID / 64 + 1, curDocument.id + 1);
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::CachedDocsSet::advance(const isrc_docid_t target) {
+        if (target <= curDocument.id) {
+                // see VectorIDs::advance()
+                return curDocument.id;
+        } else if (set->repr == docids_set::Repr::Array) {
+                if ((idx = gallop(set->ids.get(), idx, set->cnt, target)) == set->cnt)
+                        return curDocument.id = DocIDsEND;
+
+                return curDocument.id = set->ids[idx++];
+        } else
+                return curDocument.id = bitmap_from(set->bm.get(), set->maxDocID / 64 + 1, target);
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::AppIDs::next() {
+        if (set->repr == app_ids_set::Repr::Array)
+                return curDocument.id = idx == set->array.cnt ? DocIDsEND : set->array.ids[idx++];
+        else
+                return curDocument.id = bitmap_from(set->bitmap.words, set->bitmap.size, curDocument.id + 1);
+}
+
+Trinity::isrc_docid_t Trinity::DocsSetIterators::AppIDs::advance(const isrc_docid_t target) {
+        if (target <= curDocument.id) {
+                // see VectorIDs::advance()
+                return curDocument.id;
+        } else if (set->repr == app_ids_set::Repr::Array) {
+                if ((idx = gallop(set->array.ids, idx, set->array.cnt, target)) == set->array.cnt)
+                        return curDocument.id = DocIDsEND;
+
+                return curDocument.id = set->array.ids[idx++];
+        } else
+                return curDocument.id = bitmap_from(set->bitmap.words, set->bitmap.size, target);
+}
@@ -3,6 +3,7 @@
 // in their constructors. Doing so would cause all kinds of issues with Docsets Spans.
 #pragma once
 #include "docset_iterators_base.h"
+#include "filter_cache.h"
 #include <prioqueue.h>
 
 #ifdef __clang__
@@ -302,6 +303,95 @@ namespace Trinity {
 #endif
                 };
 
+                struct Phrase;
+
+                // reorder_execnode() orders the operands of a conjunction once, by cost(), but cost() is just an estimate; for PLIs it's the
+                // number of documents of the term, for phrases and other iterators it's a rough guess, and it knows nothing about correlated terms.
+                // For [apple iphone], almost all documents that match iphone will also match apple, so checking apple first is mostly a waste.
+                //
+                // Conjunctions sample how many of the candidates(documents of the lead) each other iterator was asked about, and how many of them it rejected,
+                // for the first K_rounds rounds of K_candidates candidates each. At the end of every round, the iterators other than the lead are re-ordered
+                // by their observed rejection rate DESC, so that most candidates are rejected by the first iterator we check.
+                //
+                // The lead is sampled as well: whenever a follower rejects a candidate, the lead is advanced to where the follower landed, and it
+                // either has that document too or rejects it. Of two iterators, the sparser is the one that rejects the other's documents more often, so if the
+                // first follower(after re-ordering) rejected the lead's candidates more often than the lead rejected the followers' documents, they swap
+                // places; the lead decides how many candidates we consider, and it should be the sparsest iterator.
+                //
+                // Once sampling is over, next_impl<false>() is used, which doesn't track anything.
+                struct conjunction_sample final {
+                        static constexpr uint32_t K_candidates{2048};
+                        static constexpr uint8_t  K_rounds{4};
+
+                        // probes[size], rejections[size]
+                        uint32_t *const counters;
+                        uint32_t        candidates{0};
+                        uint8_t         rounds;
+
+                        // we won't replace the lead unless it has been probed at least that many times in a round
+                        static constexpr uint32_t K_min_lead_probes{16};
+
+                        conjunction_sample(const uint16_t cnt)
+                            : counters((uint32_t *)calloc(cnt * 2, sizeof(uint32_t))), rounds(cnt > 1 ? 0 : K_rounds) {
+                                // nothing to re-order unless we have at least one iterator other than the lead
+                        }
+
+                        ~conjunction_sample() noexcept {
+                                std::free(counters);
+                        }
+
+                        inline bool active() const noexcept {
+                                return rounds != K_rounds;
+                        }
+
+                        inline void probe(const uint16_t i, const uint16_t size, const bool rejected) noexcept {
+                                ++counters[i];
+                                counters[size + i] += rejected;
+                        }
+
+                        // probe() for the lead(i = 0), when advanced to a document a follower landed on
+                        inline void probe_lead(const uint16_t size, const bool rejected) noexcept {
+                                probe(0, size, rejected);
+                        }
+
+                        // Must be invoked when all iterators are on the same document, because it may replace the lead
+                        //
+                        // Only the operands of a conjunction are re-planned. The rest of what was planned from the estimates is not revisited:
+                        // we don't switch between GenericDocsSetSpan and FilteredDocsSetSpan(exec.cpp) mid-query, we don't replace a Disjunction with
+                        // a DocsSetSpanForDisjunctions or the other way around, and the operands of disjunctions are not re-ordered. They'd all need
+                        // the span or iterator to be replaced while the query is executing, and that is not supported yet.
+                        template <typename T>
+                        void replan(T **const its, const uint16_t size) noexcept {
+                                auto       probes = counters, rejections = counters + size;
+                                const auto rate   = [&](const uint16_t i) noexcept {
+                                        return probes[i] ? double(rejections[i]) / probes[i] : 0;
+                                };
+                                const auto swap = [&](const uint16_t a, const uint16_t b) noexcept {
+                                        std::swap(its[a], its[b]);
+                                        std::swap(probes[a], probes[b]);
+                                        std::swap(rejections[a], rejections[b]);
+                                };
+                                const auto reorder = [&]() noexcept {
+                                        // insertion sort; there are only a handful of them
+                                        for (uint16_t i{2}; i < size; ++i) {
+                                                for (auto j = i; j > 1 && rate(j - 1) < rate(j); --j)
+                                                        swap(j - 1, j);
+                                        }
+                                };
+
+                                reorder();
+                                if (probes[0] >= K_min_lead_probes && rate(1) > rate(0)) {
+                                        // the first follower is sparser than the lead; the former lead becomes a follower
+                                        swap(0, 1);
+                                        reorder();
+                                }
+
+                                memset(counters, 0, sizeof(uint32_t) * size * 2);
+                                candidates = 0;
+                                ++rounds;
+                        }
+                };
+
                 struct ConjuctionAllPLI final
                     : public Iterator {
 
@@ -310,11 +400,19 @@ namespace Trinity {
                         uint16_t                             size;
 
                       private:
+                        conjunction_sample sample;
+
+                      private:
+                        template <bool Sampling>
                         isrc_docid_t next_impl(isrc_docid_t id);
 
+                        inline isrc_docid_t next_impl(const isrc_docid_t id) {
+                                return unlikely(sample.active()) ? next_impl<true>(id) : next_impl<false>(id);
+                        }
+
                       public:
                         ConjuctionAllPLI(Iterator **iterators, const uint16_t cnt)
-                            : Iterator{Type::ConjuctionAllPLI}, size{cnt}, its((Codecs::PostingsListIterator **)malloc(sizeof(Codecs::PostingsListIterator *) * cnt)) {
+                            : Iterator{Type::ConjuctionAllPLI}, size{cnt}, its((Codecs::PostingsListIterator **)malloc(sizeof(Codecs::PostingsListIterator *) * cnt)), sample{cnt} {
                                 require(cnt);
                                 memcpy(its, iterators, cnt * sizeof(Codecs::PostingsListIterator *));
                         }
@@ -345,17 +443,37 @@ namespace Trinity {
                         uint16_t         size;
 
                       private:
+                        conjunction_sample sample;
+
+                        // Two-phase iteration for phrases, similar to Lucene's TwoPhaseIterator.
+                        //
+                        // Confirming that a document matches a phrase(see Phrase::consider_phrase_match()) requires materializing the hits
+                        // of all its terms, which is expensive, and is a waste if another iterator of the conjunction rejects that document anyway.
+                        // So we only approximate(see Phrase::approximate()) the phrases while we look for a document all iterators agree on, and
+                        // then confirm the phrases there, those with the fewer terms first.
+                        // If the lead is a phrase, it is approximated too.
+                        Phrase **twoPhase{nullptr};
+                        uint16_t twoPhaseCnt{0};
+                        bool     leadApproximation{false};
+
+                      private:
+                        template <bool Sampling>
                         isrc_docid_t next_impl(isrc_docid_t id);
 
-                      public:
-                        Conjuction(Iterator **iterators, const uint16_t cnt)
-                            : Iterator{Type::Conjuction}, size{cnt}, its((Iterator **)malloc(sizeof(Iterator *) * cnt)) {
-                                require(cnt);
-                                memcpy(its, iterators, cnt * sizeof(Iterator *));
+                        inline isrc_docid_t next_impl(const isrc_docid_t id) {
+                                return unlikely(sample.active()) ? next_impl<true>(id) : next_impl<false>(id);
                         }
 
-                        ~Conjuction() noexcept  {
+                        isrc_docid_t lead_advance(const isrc_docid_t target);
+
+                        isrc_docid_t lead_next();
+
+                      public:
+                        Conjuction(Iterator **iterators, const uint16_t cnt);
+
+                        ~Conjuction() noexcept {
                                 std::free(its);
+                                std::free(twoPhase);
                         }
 
                         isrc_docid_t advance(const isrc_docid_t target) override final;
@@ -387,8 +505,8 @@ namespace Trinity {
                         queryexec_ctx *const rctxRef;
                         isrc_docid_t         next_impl(isrc_docid_t id);
 
-                      public:
-                        isrc_docid_t lastUncofirmedDID{DocIDsEND};
+                        // the last document matches() confirmed
+                        isrc_docid_t confirmedDID{0};
 
                       public:
                         Phrase(queryexec_ctx *r, Codecs::PostingsListIterator **iterators, const uint16_t cnt, const bool trackCnt, const bool docsOnly_)
@@ -405,6 +523,94 @@ namespace Trinity {
 
                         isrc_docid_t next() override final;
 
+                        // Two-phase iteration(see Conjuction::twoPhase)
+                        // approximate() advances to the first document >= target that contains all terms of the phrase, without checking their positions.
+                        // matches() then confirms that they form the phrase in the current document.
+                        isrc_docid_t approximate(const isrc_docid_t target);
+
+                        bool matches();
+
+#ifdef RDP_NEED_TOTAL_MATCHES
+                        inline uint32_t total_matches() override final {
+                                return matchCnt;
+                        }
+#endif
+                };
+
+                // A disjunction of phrases(see ENT::matchanyphrases), e.g
+                // "apple iphone" OR "apple iphone x" OR "apple ipad" OR "samsung galaxy"
+                //
+                // Instead of a Disjunction of Phrase iterators, where each Phrase owns a PostingsListIterator for
+                // each of its terms, here all phrases share a single PostingsListIterator per distinct term, and the phrases
+                // are arranged in a trie over their terms, so that phrases with common leading terms share the same trie nodes.
+                //
+                // For a candidate document, we advance the iterators of the trie nodes top-down, so that a prefix that's missing from
+                // the document disqualifies all phrases that share it, and if it's not, we materialize the hits of each distinct term once and
+                // verify positions by walking the trie, filtering the surviving positions of the first term at each level.
+                // If no phrase can match the candidate document, we can skip ahead to the lowest document any of the phrases may match, based
+                // on the current documents of the iterators we have considered.
+                struct PhraseSet final
+                    : public Iterator {
+                      public:
+                        struct node final {
+                                uint16_t termIdx;     // in its[]
+                                int32_t  phraseIdx;   // >= 0 if a phrase ends at this node
+                                uint32_t firstChild;  // in nodes[]; children are contiguous
+                                uint16_t childrenCnt;
+                        };
+
+                        struct phrase_ref final {
+                                uint32_t offset; // in phrasesTerms[]
+                                uint8_t  size;
+                        };
+
+                      public:
+                        Codecs::PostingsListIterator **const its;
+                        const uint16_t                       itsCnt;
+                        // nodes[0] is the root; its children are the first terms of all phrases
+                        std::vector<node>       nodes;
+                        std::vector<phrase_ref> phrases;
+                        std::vector<uint16_t>   phrasesTerms;
+                        uint8_t                 maxPhraseSize{0};
+                        const uint16_t          maxMatchCnt;
+                        const bool              release_docrefs;
+                        // Matches for each phrase in the current document, and in total
+                        std::unique_ptr<uint16_t[]> matchCnts;
+                        uint32_t                    matchCnt{0};
+                        // distinct terms of all phrases matched in the current document, for prepare_match()
+                        // not tracked if release_docrefs is set
+                        std::vector<Codecs::PostingsListIterator *> matchedIts;
+
+                      private:
+                        queryexec_ctx *const    rctxRef;
+                        bool                    drained{false};
+                        std::vector<tokenpos_t> positions;
+                        std::vector<uint32_t>   termsMarks;
+                        uint32_t                termsMark{0};
+
+                      private:
+                        isrc_docid_t lowest_candidate(const node &, const isrc_docid_t, bool &);
+
+                        bool match_children(candidate_document *, const node &, const isrc_docid_t, const uint8_t, const uint32_t, const uint32_t);
+
+                        uint32_t consider_phrases_match(const isrc_docid_t);
+
+                        isrc_docid_t next_impl(isrc_docid_t target);
+
+                      public:
+                        // phrasesTerms holds the indices(in iterators[]) of all terms of all phrases, and phrasesSizes the size of each phrase
+                        PhraseSet(queryexec_ctx *r, Codecs::PostingsListIterator **iterators, const uint16_t cnt,
+                                  const uint16_t *phrasesTerms, const uint8_t *phrasesSizes, const uint16_t phrasesCnt,
+                                  const bool trackCnt, const bool docsOnly_);
+
+                        ~PhraseSet() noexcept {
+                                std::free(its);
+                        }
+
+                        isrc_docid_t advance(const isrc_docid_t target) override final;
+
+                        isrc_docid_t next() override final;
+
 #ifdef RDP_NEED_TOTAL_MATCHES
                         inline uint32_t total_matches() override final {
                                 return matchCnt;
@@ -412,6 +618,13 @@ namespace Trinity {
 #endif
                 };
 
+                // Returns the index of the first of ids[from, cnt) that's >= target, or cnt if there is none
+                // It gallops from ids[from] first, so that it's cheap for targets close to it, which is by far the most common case for advance()
+                uint32_t gallop(const isrc_docid_t *ids, uint32_t from, const uint32_t cnt, const isrc_docid_t target) noexcept;
+
+                // Returns the first document >= id in the bitmap(size words), or DocIDsEND
+                isrc_docid_t bitmap_from(const uint64_t *bm, const std::size_t size, const isrc_docid_t id) noexcept;
+
                 struct VectorIDs final
                     : public Iterator {
                         friend uint64_t cost(const Iterator *);
@@ -424,26 +637,73 @@ namespace Trinity {
 
                       public:
                         VectorIDs(const std::initializer_list<isrc_docid_t> list)
-                            : Iterator{Type::VectorIDs} {
-                                for (const auto id : list)
-                                        ids.push_back(id);
+                            : VectorIDs(std::vector<isrc_docid_t>(list)) {
+                        }
 
-                                std::sort(ids.begin(), ids.end());	 // TODO: use boost::spreadsort
+                        VectorIDs(std::vector<isrc_docid_t> &&v)
+                            : Iterator{Type::VectorIDs}, ids(std::move(v)) {
+                                if (!std::is_sorted(ids.begin(), ids.end()))
+                                        std::sort(ids.begin(), ids.end()); // TODO: use boost::spreadsort
                         }
 
                         inline isrc_docid_t next() override {
                                 return idx == ids.size() ? curDocument.id = DocIDsEND : curDocument.id = ids[idx++];
                         }
 
-                        isrc_docid_t advance(isrc_docid_t target) override {
-                                isrc_docid_t id;
+                        isrc_docid_t advance(isrc_docid_t target) override;
+
+#ifdef RDP_NEED_TOTAL_MATCHES
+                        inline uint32_t total_matches() override final {
+                                return 1;
+                        }
+#endif
+                };
+
+                // Iterates an app_ids_set Array or Bitmap in place. See docset_iterators_base.h
+                struct AppIDs final
+                    : public Iterator {
+                        friend uint64_t cost(const Iterator *);
+
+                      private:
+                        const app_ids_set *const set;
+                        uint32_t                 idx{0}; // Repr::Array: index of the next ID
+
+                      public:
+                        AppIDs(const app_ids_set *const s)
+                            : Iterator{Type::AppIDs}, set{s} {
+                        }
+
+                        isrc_docid_t next() override final;
+
+                        isrc_docid_t advance(const isrc_docid_t target) override final;
+
+#ifdef RDP_NEED_TOTAL_MATCHES
+                        inline uint32_t total_matches() override final {
+                                return 1;
+                        }
+#endif
+                };
+
+                // Iterates a docids_set materialized and cached by a FilterCache(see filter_cache.h), or drained from
+                // the postings of a large ENT::matchanyterms run(see queryexec_ctx::termset_iterator())
+                // It holds a reference to the set, so that it won't be released if evicted from the cache while we are using it
+                struct CachedDocsSet final
+                    : public Iterator {
+                        friend uint64_t cost(const Iterator *);
 
-                                while ((id = next()) < target)
-                                        continue;
+                      private:
+                        const std::shared_ptr<const docids_set> set;
+                        uint32_t                                idx{0}; // Repr::Array: index of the next ID
 
-                                return id;
+                      public:
+                        CachedDocsSet(std::shared_ptr<const docids_set> s)
+                            : Iterator{Type::CachedDocsSet}, set{std::move(s)} {
                         }
 
+                        isrc_docid_t next() override final;
+
+                        isrc_docid_t advance(const isrc_docid_t target) override final;
+
 #ifdef RDP_NEED_TOTAL_MATCHES
                         inline uint32_t total_matches() override final {
                                 return 1;
@@ -6,6 +6,8 @@
 #include <switch.h>
 
 namespace Trinity {
+        class IndexSource;
+
         namespace DocsSetIterators {
                 enum class Type : uint8_t {
                         PostingsListIterator = 0,
@@ -15,10 +17,13 @@ namespace Trinity {
                         Disjunction,
                         DisjunctionAllPLI,
                         Phrase,
+                        PhraseSet,
                         Conjuction,
                         ConjuctionAllPLI,
                         AppIterator,
                         VectorIDs,
+                        CachedDocsSet,
+                        AppIDs,
                         Dummy,
                 };
 
@@ -95,26 +100,98 @@ namespace Trinity {
                         }
                 };
 
-                class IndexSource;
-
                 // If you are going to provide your own application iterator, you will need
                 // to subclass AppIterator. It's main purpose is to provide a virtual destructor, which
                 // is required for docsetsIterators destruction, and some other facilities specific to those iterators
                 //
-                // They are produced by factory functions and are trackedby the execution engine.
-                // That is, ast_node nodes of Type::app_ids_set (or whaever) will embed a pointer to a factory class
-                // which will be asked to provide an AppIterator instance (which would be passed the context embedded in
-                // the ast_node).
+                // They are produced by factory functions and are tracked by the execution engine.
+                // That is, ast_node nodes of Type::AppIDsSet embed a pointer to an app_ids_set, and if that's an app_ids_set::factory, it
+                // will be asked to provide an AppIterator instance for each index source the query is executed against.
+                //
+                // cost is the (estimated) number of documents the iterator will produce; the execution engine
+                // relies on it for reordering conjunctions and picking the lead iterator.
                 struct AppIterator
                     : public Iterator {
                         IndexSource *const isrc;
+                        const uint64_t     cost_;
 
-                        AppIterator(IndexSource *const src)
-                            : Iterator(Type::AppIterator), isrc{src} {
+                        AppIterator(IndexSource *const src, const uint64_t cost = std::numeric_limits<uint32_t>::max())
+                            : Iterator(Type::AppIterator), isrc{src}, cost_{cost} {
                         }
 
                         virtual ~AppIterator() {
                         }
                 };
         } // namespace DocsSetIterators
+
+        // An application-provided set of documents, referenced by ast_node(Type::AppIDsSet) nodes. See ast_node::make_app_ids_set()
+        // This is useful for restrictions like ACLs, or "in the user's wishlist", which you would otherwise need to apply
+        // in MatchedIndexDocumentsFilter::consider() after the documents have been matched(and scored).
+        //
+        // Nothing is copied; the set, and whatever it references, must outlive the execution of all queries that reference it.
+        // Array and Bitmap IDs are in the index source documents space, i.e they are used for every index source as is.
+        // If you need a different set per index source(e.g because of IndexSource::translate_docid()), use a factory.
+        struct app_ids_set final {
+                struct factory {
+                        // Returns a new AppIterator for src. The execution engine owns it.
+                        virtual DocsSetIterators::AppIterator *new_iterator(IndexSource *src) = 0;
+
+                        // The (estimated) number of documents new_iterator(src) will produce
+                        virtual uint64_t cost(IndexSource *src) = 0;
+
+                        virtual ~factory() {
+                        }
+                };
+
+                enum class Repr : uint8_t {
+                        Array = 0,
+                        Bitmap,
+                        Factory
+                } repr;
+
+                union {
+                        // ascending IDs
+                        struct {
+                                const isrc_docid_t *ids;
+                                uint32_t            cnt;
+                        } array;
+
+                        // bit (id & 63) of words[id / 64] is set for every document id
+                        // cnt is the number of bits set, which is used as the set's cost
+                        struct {
+                                const uint64_t *words;
+                                uint32_t        size;
+                                uint32_t        cnt;
+                        } bitmap;
+
+                        factory *f;
+                };
+
+                static app_ids_set of_array(const isrc_docid_t *const ids, const uint32_t cnt) noexcept {
+                        app_ids_set res;
+
+                        res.repr      = Repr::Array;
+                        res.array.ids = ids;
+                        res.array.cnt = cnt;
+                        return res;
+                }
+
+                static app_ids_set of_bitmap(const uint64_t *const words, const uint32_t size, const uint32_t cnt) noexcept {
+                        app_ids_set res;
+
+                        res.repr         = Repr::Bitmap;
+                        res.bitmap.words = words;
+                        res.bitmap.size  = size;
+                        res.bitmap.cnt   = cnt;
+                        return res;
+                }
+
+                static app_ids_set of_factory(factory *const f) noexcept {
+                        app_ids_set res;
+
+                        res.repr = Repr::Factory;
+                        res.f    = f;
+                        return res;
+                }
+        };
 } // namespace Trinity
@@ -227,9 +227,72 @@ static IteratorScorer *default_wrapper(queryexec_ctx *const rctx, DocsSetIterato
                         return new Wrapper(it, rctx);
                 }
 
+                case DocsSetIterators::Type::PhraseSet: {
+                        // Same as a Disjunction of Phrase iterators; one weight per phrase
+                        struct Wrapper final
+                            : public IteratorScorer {
+                                Similarity::IndexSourceTermsScorer *const scorer;
+                                std::vector<Similarity::ScorerWeight *>   weights;
+
+                                Wrapper(Iterator *it, queryexec_ctx *const rctx)
+                                    : IteratorScorer{it}, scorer{rctx->scorer} {
+                                        auto p = static_cast<DocsSetIterators::PhraseSet *>(it);
+
+                                        for (const auto &phrase : p->phrases) {
+                                                str8_t terms[phrase.size];
+
+                                                for (uint32_t i{0}; i != phrase.size; ++i) {
+                                                        const auto termID = static_cast<const Codecs::PostingsListIterator *>(p->its[p->phrasesTerms[phrase.offset + i]])->decoder()->execCtxTermID;
+
+                                                        terms[i] = rctx->tctxMap[termID].second;
+                                                }
+
+                                                weights.push_back(scorer->new_scorer_weight(terms, phrase.size));
+                                        }
+                                }
+
+                                ~Wrapper() {
+                                        for (auto w : weights)
+                                                delete w;
+                                }
+
+                                double iterator_score() override final {
+                                        const auto it  = static_cast<const PhraseSet *>(this->it);
+                                        const auto did = it->current();
+                                        double     res{0};
+
+                                        for (uint32_t i{0}; i != weights.size(); ++i) {
+                                                if (const auto cnt = it->matchCnts[i])
+                                                        res += scorer->score(did, cnt, weights[i]);
+                                        }
+                                        return res;
+                                }
+                        };
+
+                        return new Wrapper(it, rctx);
+                }
+
+                case DocsSetIterators::Type::AppIDs:
+                case DocsSetIterators::Type::AppIterator: {
+                        // Application sets of documents restrict the matched documents, they don't contribute to their scores
+                        // They may still be operands of conjunctions and disjunctions we do score, so we need a wrapper
+                        struct Wrapper final
+                            : public IteratorScorer {
+                                Wrapper(Iterator *it)
+                                    : IteratorScorer{it} {
+                                }
+
+                                double iterator_score() override final {
+                                        return 0;
+                                }
+                        };
+
+                        return new Wrapper(it);
+                }
+
                 case DocsSetIterators::Type::VectorIDs:
+                case DocsSetIterators::Type::CachedDocsSet:
                 case DocsSetIterators::Type::Dummy:
-                case DocsSetIterators::Type::AppIterator:
                         return nullptr;
         }
 
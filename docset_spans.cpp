@@ -3,7 +3,6 @@
 #include <switch_bitops.h>
 
 using namespace Trinity;
-extern thread_local Trinity::queryexec_ctx *curRCTX;
 
 #pragma mark          DocsSetSpanForPartialMatch
 Trinity::isrc_docid_t Trinity::DocsSetSpanForPartialMatch::process(MatchesProxy *const mp, const isrc_docid_t min, const isrc_docid_t max) {
@@ -16,6 +15,12 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForPartialMatch::process(MatchesProxy
                 id = it->current();
                 if (id >= max)
                         break;
+                else if (unlikely(id < min)) {
+                        // e.g if the execution starts past the first document(see exec_limits::firstDocumentID)
+                        it->advance(min);
+                        pq.update_top();
+                        continue;
+                }
 
                 const isrc_docid_t windowBase = id & ~MASK;
                 //[[maybe_unused]] const auto windowMin = std::max<isrc_docid_t>(min, windowBase);
@@ -84,8 +89,8 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForPartialMatch::process(MatchesProxy
 }
 
 #pragma mark DocsSetSpanForDisjunctionsWithSpans
-Trinity::DocsSetSpanForDisjunctionsWithSpans::DocsSetSpanForDisjunctionsWithSpans(std::vector<DocsSetSpan *> &its)
-    : matching((uint64_t *)calloc(SET_SIZE, sizeof(uint64_t))), pq(its.size() + 16), collected((span_ctx *)malloc(sizeof(span_ctx) * (its.size() + 1))), tracker(matching, curRCTX) {
+Trinity::DocsSetSpanForDisjunctionsWithSpans::DocsSetSpanForDisjunctionsWithSpans(std::vector<DocsSetSpan *> &its, queryexec_ctx *const rctx)
+    : matching((uint64_t *)calloc(SET_SIZE, sizeof(uint64_t))), pq(its.size() + 16), collected((span_ctx *)malloc(sizeof(span_ctx) * (its.size() + 1))), tracker(matching, rctx) {
         for (auto it : its) {
                 // XXX: do we need to it->process(nullptr, 1,1) here for the eqivalent of it->next() we
                 // do in other pq population loops in other Spans?
@@ -105,6 +110,12 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctions::process(MatchesProxy
                 id = it->current();
                 if (unlikely(id >= max)) 
                         break;
+                else if (unlikely(id < min)) {
+                        // e.g if the execution starts past the first document(see exec_limits::firstDocumentID)
+                        it->advance(min);
+                        pq.update_top();
+                        continue;
+                }
 
                 // fast round down to SIZE(works because SIZE is a power of two int.). Identifies the window the next match belongs to.
                 const isrc_docid_t windowBase = id & ~MASK;
@@ -301,8 +312,8 @@ void         Trinity::DocsSetSpanForDisjunctionsWithSpans::Tracker::process(rele
         matching[mi] |= uint64_t(1) << (i & 63);
 }
 
-Trinity::DocsSetSpanForDisjunctionsWithSpansAndCost::DocsSetSpanForDisjunctionsWithSpansAndCost(const uint16_t min, std::vector<DocsSetSpan *> &its)
-    : matchesTracker((std::pair<double, uint32_t> *)calloc(SIZE, sizeof(std::pair<double, uint32_t>))), leads((span_ctx **)malloc(sizeof(span_ctx *) * (its.size() + 1))), head(its.size() - min + 1), tail(min - 1), matching((uint64_t *)calloc(SET_SIZE, sizeof(uint64_t))), matchThreshold{min}, storage((span_ctx *)malloc(sizeof(span_ctx) * (its.size() + 1))), tracker(matching, matchesTracker, curRCTX) {
+Trinity::DocsSetSpanForDisjunctionsWithSpansAndCost::DocsSetSpanForDisjunctionsWithSpansAndCost(const uint16_t min, std::vector<DocsSetSpan *> &its, queryexec_ctx *const rctx)
+    : matchesTracker((std::pair<double, uint32_t> *)calloc(SIZE, sizeof(std::pair<double, uint32_t>))), leads((span_ctx **)malloc(sizeof(span_ctx *) * (its.size() + 1))), head(its.size() - min + 1), tail(min - 1), matching((uint64_t *)calloc(SET_SIZE, sizeof(uint64_t))), matchThreshold{min}, storage((span_ctx *)malloc(sizeof(span_ctx) * (its.size() + 1))), tracker(matching, matchesTracker, rctx) {
         EXPECT(min && min <= its.size());
         EXPECT(its.size() > 1);
 
@@ -688,6 +699,12 @@ Trinity::isrc_docid_t Trinity::DocsSetSpanForDisjunctionsWithThreshold::process(
                 id = it->current();
                 if (id >= max)
                         break;
+                else if (unlikely(id < min)) {
+                        // e.g if the execution starts past the first document(see exec_limits::firstDocumentID)
+                        it->advance(min);
+                        pq.update_top();
+                        continue;
+                }
 
                 const isrc_docid_t          windowBase = id & ~MASK;
                 [[maybe_unused]] const auto windowMin  = std::max<isrc_docid_t>(min, windowBase);
@@ -333,7 +333,7 @@ namespace Trinity {
                 span_ctx advance(const isrc_docid_t);
 
               public:
-                DocsSetSpanForDisjunctionsWithSpans(std::vector<DocsSetSpan *> &its);
+                DocsSetSpanForDisjunctionsWithSpans(std::vector<DocsSetSpan *> &its, queryexec_ctx *const rctx);
 
                 ~DocsSetSpanForDisjunctionsWithSpans() noexcept {
                         std::free(matching);
@@ -424,7 +424,7 @@ namespace Trinity {
                 void score_window_many(MatchesProxy *const mp, const isrc_docid_t windowBase, const isrc_docid_t windowMin, const isrc_docid_t windowMax, uint16_t leadsCnt);
 
               public:
-                DocsSetSpanForDisjunctionsWithSpansAndCost(const uint16_t min, std::vector<DocsSetSpan *> &its);
+                DocsSetSpanForDisjunctionsWithSpansAndCost(const uint16_t min, std::vector<DocsSetSpan *> &its, queryexec_ctx *const rctx);
 
                 ~DocsSetSpanForDisjunctionsWithSpansAndCost() noexcept {
                         std::free(matching);
@@ -0,0 +1,616 @@
+#include "docvalues.h"
+#include "index_source.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <switch_bitops.h>
+#include <sys/mman.h>
+
+namespace {
+        // TDV1 files had a 2 words header(magic, fields count); we don't read them, they are rejected as unexpected content
+        static constexpr uint32_t K_docvalues_magic{0x32564454}; // TDV2
+
+        // Serialized for each field after the file header(magic, fields count, index sort field(index + 1, or 0 if not sorted), index sort order)
+        // All offsets are from the beginning of the file
+        struct field_header final {
+                uint8_t  kind;
+                uint8_t  nameLen;
+                uint16_t unused;
+                uint32_t valuesCnt;
+                uint32_t blocksCnt;
+                uint32_t dictCnt;
+                uint64_t nameOffset;
+                uint64_t blocksOffset;
+                uint64_t dataOffset;
+                uint64_t dictOffset;
+        };
+        static_assert(sizeof(field_header) == 48);
+
+        static inline uint8_t required_bits(const uint64_t v) noexcept {
+                return v ? 64 - SwitchBitOps::LeadingZeros(v) : 0;
+        }
+
+        static inline void set_bits(uint64_t *const words, const uint64_t bitOffset, const uint64_t v, const uint8_t bits) noexcept {
+                if (!bits)
+                        return;
+
+                const auto idx = bitOffset >> 6;
+                const auto s   = bitOffset & 63;
+
+                words[idx] |= v << s;
+                if (s + bits > 64)
+                        words[idx + 1] |= v >> (64 - s);
+        }
+
+        // Same semantics as std::string::compare()
+        static inline int strings_cmp(const Trinity::str32_t a, const Trinity::str32_t b) noexcept {
+                if (const auto r = memcmp(a.data(), b.data(), std::min(a.size(), b.size())))
+                        return r;
+                else
+                        return int(a.size()) - int(b.size());
+        }
+
+        static void pad(IOBuffer *const b) {
+                while (b->size() & 7)
+                        b->pack(uint8_t(0));
+        }
+
+        // Iterates the documents of a column where the value(or ordinal) is within [lo, hi]
+        // Blocks that don't overlap the range are skipped, and for blocks where [min, max] is within the range
+        // all documents are matched without decoding their values.
+        struct docvalues_range_iterator final
+            : public Trinity::DocsSetIterators::AppIterator {
+                const Trinity::docvalues_field *const f;
+                const int64_t                         lo, hi;
+                uint32_t                              bi{0}; // current block
+                uint32_t                              i{0};  // next pair in the current block
+                bool                                  all{false};
+
+                docvalues_range_iterator(Trinity::IndexSource *const src, const uint64_t cost, const Trinity::docvalues_field *const field, const int64_t l, const int64_t h)
+                    : AppIterator(src, cost), f{field}, lo{l}, hi{h} {
+                        if (f)
+                                seek(0);
+                }
+
+                inline bool overlaps(const Trinity::docvalues_block &b) const noexcept {
+                        return b.max >= lo && b.min <= hi;
+                }
+
+                // Positions at the first block, starting from `from`, that overlaps [lo, hi]
+                void seek(uint32_t from) noexcept {
+                        const auto n = f->blocksCnt;
+
+                        while (from < n && !overlaps(f->blocks[from]))
+                                ++from;
+
+                        bi = from;
+                        i  = 0;
+                        if (from != n)
+                                all = f->blocks[from].min >= lo && f->blocks[from].max <= hi;
+                }
+
+                Trinity::isrc_docid_t next() override final {
+                        if (unlikely(!f))
+                                return curDocument.id = Trinity::DocIDsEND;
+
+                        while (bi != f->blocksCnt) {
+                                const auto &b = f->blocks[bi];
+
+                                while (i < b.cnt) {
+                                        const auto idx = i++;
+
+                                        if (all)
+                                                return curDocument.id = f->document(b, idx);
+                                        else if (const auto v = f->value(b, idx); v >= lo && v <= hi)
+                                                return curDocument.id = f->document(b, idx);
+                                }
+
+                                seek(bi + 1);
+                        }
+
+                        return curDocument.id = Trinity::DocIDsEND;
+                }
+
+                Trinity::isrc_docid_t advance(const Trinity::isrc_docid_t target) override final {
+                        if (unlikely(!f) || bi == f->blocksCnt)
+                                return curDocument.id = Trinity::DocIDsEND;
+
+                        if (target > f->blocks[bi].lastDocID) {
+                                // Blocks don't overlap, so all documents in blocks past the first where lastDocID >= target are > target
+                                const auto nb = f->block_for(bi + 1, target);
+
+                                seek(nb);
+                                if (bi == nb && bi != f->blocksCnt)
+                                        i = f->lower_bound(f->blocks[bi], 0, target);
+                        } else
+                                i = f->lower_bound(f->blocks[bi], i, target);
+
+                        return next();
+                }
+
+#ifdef RDP_NEED_TOTAL_MATCHES
+                inline uint32_t total_matches() override final {
+                        return 1;
+                }
+#endif
+        };
+} // namespace
+
+uint32_t Trinity::docvalues_field::lower_bound(const docvalues_block &b, const uint32_t from, const isrc_docid_t target) const noexcept {
+        if (!b.docBits) {
+                const uint32_t idx = target > b.firstDocID ? std::min<isrc_docid_t>(target - b.firstDocID, b.cnt) : 0;
+
+                return std::max(from, idx);
+        }
+
+        uint32_t l{from}, h{b.cnt};
+
+        while (l < h) {
+                const auto m = (l + h) >> 1;
+
+                if (document(b, m) < target)
+                        l = m + 1;
+                else
+                        h = m;
+        }
+        return l;
+}
+
+uint32_t Trinity::docvalues_field::block_for(const uint32_t from, const isrc_docid_t target) const noexcept {
+        // gallop first; advance() targets are usually close to the current block
+        uint32_t l{from}, h{from}, step{1};
+
+        while (h < blocksCnt && blocks[h].lastDocID < target) {
+                l = h + 1;
+                h += step;
+                step <<= 1;
+        }
+
+        h = std::min(h, blocksCnt);
+        while (l < h) {
+                const auto m = (l + h) >> 1;
+
+                if (blocks[m].lastDocID < target)
+                        l = m + 1;
+                else
+                        h = m;
+        }
+        return l;
+}
+
+bool Trinity::docvalues_field::get(const isrc_docid_t documentID, int64_t *const out) const noexcept {
+        const auto bi = block_for(0, documentID);
+
+        if (bi == blocksCnt || blocks[bi].firstDocID > documentID)
+                return false;
+
+        const auto &b = blocks[bi];
+        const auto  i = lower_bound(b, 0, documentID);
+
+        if (i == b.cnt || document(b, i) != documentID)
+                return false;
+
+        *out = value(b, i);
+        return true;
+}
+
+uint32_t Trinity::docvalues_field::lower_bound(const str32_t s) const noexcept {
+        uint32_t l{0}, h{dictCnt};
+
+        while (l < h) {
+                const auto m = (l + h) >> 1;
+
+                if (strings_cmp(string(m), s) < 0)
+                        l = m + 1;
+                else
+                        h = m;
+        }
+        return l;
+}
+
+uint32_t Trinity::docvalues_field::upper_bound(const str32_t s) const noexcept {
+        uint32_t l{0}, h{dictCnt};
+
+        while (l < h) {
+                const auto m = (l + h) >> 1;
+
+                if (strings_cmp(string(m), s) <= 0)
+                        l = m + 1;
+                else
+                        h = m;
+        }
+        return l;
+}
+
+Trinity::DocValuesWriter::field *Trinity::DocValuesWriter::field_for(const str8_t name, const docvalues_kind kind) {
+        // fields are few, so a linear scan is fine
+        for (auto &it : fields) {
+                if (name.Eq(it.first.data(), it.first.size())) {
+                        if (it.second->kind != kind)
+                                throw Switch::data_error("Unexpected value kind for field ", name);
+
+                        return it.second.get();
+                }
+        }
+
+        if (name.empty())
+                throw Switch::data_error("Expected field name");
+
+        auto f = std::make_unique<field>();
+
+        f->kind = kind;
+        fields.emplace_back(std::string(name.data(), name.size()), std::move(f));
+        return fields.back().second.get();
+}
+
+void Trinity::DocValuesWriter::set(const isrc_docid_t documentID, const str8_t fieldName, const int64_t value) {
+        field_for(fieldName, docvalues_kind::Numeric)->values.emplace_back(documentID, value);
+}
+
+void Trinity::DocValuesWriter::set(const isrc_docid_t documentID, const str8_t fieldName, const str32_t value) {
+        auto       f   = field_for(fieldName, docvalues_kind::String);
+        const auto res = f->strings.emplace(std::string(value.data(), value.size()), f->strings.size());
+
+        f->values.emplace_back(documentID, res.first->second);
+}
+
+void Trinity::DocValuesWriter::sort_values(field *const f) {
+        auto &values = f->values;
+
+        if (std::is_sorted(values.begin(), values.end(), [](const auto &a, const auto &b) noexcept { return a.first < b.first; })) {
+                // fast-path
+        } else
+                std::stable_sort(values.begin(), values.end(), [](const auto &a, const auto &b) noexcept { return a.first < b.first; });
+
+        values.erase(std::unique(values.begin(), values.end(), [](const auto &a, const auto &b) noexcept { return a.first == b.first; }), values.end());
+}
+
+bool Trinity::DocValuesWriter::in_order(const str8_t fieldName, const index_sort::Order order, const std::size_t documentsCnt) {
+        const auto it = std::find_if(fields.begin(), fields.end(), [fieldName](const auto &p) noexcept { return fieldName.Eq(p.first.data(), p.first.size()); });
+
+        if (it == fields.end() || it->second->kind != docvalues_kind::Numeric)
+                return false;
+
+        auto *const f = it->second.get();
+
+        sort_values(f);
+        if (documentsCnt && f->values.size() != documentsCnt)
+                return false;
+        else if (order == index_sort::Order::Ascending)
+                return std::is_sorted(f->values.begin(), f->values.end(), [](const auto &a, const auto &b) noexcept { return a.second < b.second; });
+        else
+                return std::is_sorted(f->values.begin(), f->values.end(), [](const auto &a, const auto &b) noexcept { return a.second > b.second; });
+}
+
+void Trinity::DocValuesWriter::serialize(IOBuffer *const out) {
+        std::vector<field_header> headers;
+        IOBuffer                  body;
+        std::vector<uint64_t>     data;
+        std::vector<uint32_t>     ordinals;
+        const std::size_t         base = out->size() + sizeof(uint32_t) * 4 + sizeof(field_header) * fields.size();
+        uint32_t                  sortFieldRef{0};
+
+        require((out->size() & 7) == 0);
+        for (auto &it : fields) {
+                auto &     f      = *it.second;
+                auto &     values = f.values;
+                field_header fh;
+
+                memset(&fh, 0, sizeof(fh));
+
+                sort_values(&f);
+                if (!sortField.empty() && sortField == it.first)
+                        sortFieldRef = headers.size() + 1;
+
+                fh.kind       = uint8_t(f.kind);
+                fh.nameLen    = it.first.size();
+                fh.valuesCnt  = values.size();
+                fh.nameOffset = base + body.size();
+                body.Serialize(it.first.data(), it.first.size());
+                pad(&body);
+
+                if (f.kind == docvalues_kind::String) {
+                        // sort the dictionary and replace indices with ordinals
+                        std::vector<const std::pair<const std::string, uint32_t> *> all;
+                        uint32_t                                                    offset{0};
+
+                        all.reserve(f.strings.size());
+                        for (const auto &s : f.strings)
+                                all.push_back(&s);
+                        std::sort(all.begin(), all.end(), [](const auto a, const auto b) noexcept { return a->first < b->first; });
+
+                        ordinals.resize(all.size());
+                        for (uint32_t i{0}; i != all.size(); ++i)
+                                ordinals[all[i]->second] = i;
+                        for (auto &v : values)
+                                v.second = ordinals[v.second];
+
+                        fh.dictCnt    = all.size();
+                        fh.dictOffset = base + body.size();
+                        for (const auto p : all) {
+                                body.pack(offset);
+                                offset += p->first.size();
+                        }
+                        body.pack(offset);
+                        for (const auto p : all)
+                                body.Serialize(p->first.data(), p->first.size());
+                        pad(&body);
+                }
+
+                // blocks
+                data.clear();
+                fh.blocksOffset = base + body.size();
+                for (uint32_t i{0}; i < values.size(); i += K_block_size) {
+                        const auto      n    = std::min<uint32_t>(K_block_size, values.size() - i);
+                        const auto      it   = values.data() + i;
+                        docvalues_block b;
+
+                        b.firstDocID = it[0].first;
+                        b.lastDocID  = it[n - 1].first;
+                        b.min = b.max = it[0].second;
+                        for (uint32_t j{1}; j != n; ++j) {
+                                b.min = std::min(b.min, it[j].second);
+                                b.max = std::max(b.max, it[j].second);
+                        }
+
+                        b.cnt        = n;
+                        b.docBits    = b.lastDocID - b.firstDocID + 1 == n ? 0 : required_bits(b.lastDocID - b.firstDocID);
+                        b.valueBits  = required_bits(uint64_t(b.max) - uint64_t(b.min));
+                        b.dataOffset = data.size();
+
+                        const auto docsWords   = (n * b.docBits + 63) >> 6;
+                        const auto valuesWords = (uint64_t(n) * b.valueBits + 63) >> 6;
+
+                        data.resize(data.size() + docsWords + valuesWords, 0);
+                        require(data.size() < std::numeric_limits<uint32_t>::max());
+                        for (uint32_t j{0}; j != n; ++j) {
+                                set_bits(data.data() + b.dataOffset, uint64_t(j) * b.docBits, it[j].first - b.firstDocID, b.docBits);
+                                set_bits(data.data() + b.dataOffset + docsWords, uint64_t(j) * b.valueBits, uint64_t(it[j].second) - uint64_t(b.min), b.valueBits);
+                        }
+
+                        body.Serialize(&b, sizeof(b));
+                        ++fh.blocksCnt;
+                }
+
+                // so that data is never empty
+                data.push_back(0);
+                fh.dataOffset = base + body.size();
+                body.Serialize(data.data(), data.size() * sizeof(uint64_t));
+                headers.push_back(fh);
+        }
+
+        if (!sortField.empty() && !sortFieldRef)
+                throw Switch::data_error("Index sort field not found");
+
+        out->pack(K_docvalues_magic, uint32_t(fields.size()), sortFieldRef, uint32_t(sortOrder));
+        out->Serialize(headers.data(), headers.size() * sizeof(field_header));
+        out->Serialize(body.data(), body.size());
+}
+
+void Trinity::DocValuesWriter::persist(const char *path) {
+        IOBuffer b;
+
+        serialize(&b);
+        if (Utilities::to_file(b.data(), b.size(), path) == -1)
+                throw Switch::system_error("Failed to persist ", path);
+}
+
+Trinity::DocValues::DocValues(const uint8_t *const content, const std::size_t size, const bool ownsMapping)
+    : fileData{content, size}, owned{ownsMapping} {
+        try {
+                const auto in_file = [&](const uint64_t offset, const uint64_t len) {
+                        if (offset > size || len > size - offset)
+                                throw Switch::data_error("Unexpected docvalues file content");
+                };
+                uint32_t magic, fieldsCnt, sortFieldRef, sortOrder;
+
+                in_file(0, sizeof(uint32_t) * 4);
+                magic        = reinterpret_cast<const uint32_t *>(content)[0];
+                fieldsCnt    = reinterpret_cast<const uint32_t *>(content)[1];
+                sortFieldRef = reinterpret_cast<const uint32_t *>(content)[2];
+                sortOrder    = reinterpret_cast<const uint32_t *>(content)[3];
+                if (magic != K_docvalues_magic || sortFieldRef > fieldsCnt || sortOrder > uint32_t(index_sort::Order::Descending))
+                        throw Switch::data_error("Unexpected docvalues file content");
+
+                in_file(sizeof(uint32_t) * 4, uint64_t(fieldsCnt) * sizeof(field_header));
+                fields_.reserve(fieldsCnt);
+                for (uint32_t i{0}; i != fieldsCnt; ++i) {
+                        const auto &    fh = reinterpret_cast<const field_header *>(content + sizeof(uint32_t) * 4)[i];
+                        docvalues_field f;
+
+                        in_file(fh.nameOffset, fh.nameLen);
+                        in_file(fh.blocksOffset, uint64_t(fh.blocksCnt) * sizeof(docvalues_block));
+                        if (fh.kind > uint8_t(docvalues_kind::String) || (fh.blocksOffset & 7) || (fh.dataOffset & 7))
+                                throw Switch::data_error("Unexpected docvalues file content");
+
+                        // The packed data of a block are at [dataOffset, dataOffset + docsWords + valuesWords) words, so the blocks headers are
+                        // all we need to know how far into the file we will access when unpacking(see docvalues_field::document() and value()).
+                        // We also check what the iterators and binary searches depend on: that blocks are not empty and don't overlap.
+                        const auto blocks = reinterpret_cast<const docvalues_block *>(content + fh.blocksOffset);
+                        uint64_t   dataWords{1}, valuesCnt{0};
+
+                        for (uint32_t bi{0}; bi != fh.blocksCnt; ++bi) {
+                                const auto &b = blocks[bi];
+
+                                if (!b.cnt || b.cnt > DocValuesWriter::K_block_size || b.docBits > 32 || b.valueBits > 64 || b.min > b.max || b.firstDocID > b.lastDocID ||
+                                    (!b.docBits && b.lastDocID - b.firstDocID + 1 != b.cnt) || (bi && b.firstDocID <= blocks[bi - 1].lastDocID))
+                                        throw Switch::data_error("Unexpected docvalues file content");
+
+                                const auto docsWords   = (uint64_t(b.cnt) * b.docBits + 63) >> 6;
+                                const auto valuesWords = (uint64_t(b.cnt) * b.valueBits + 63) >> 6;
+
+                                dataWords = std::max(dataWords, uint64_t(b.dataOffset) + docsWords + valuesWords);
+                                valuesCnt += b.cnt;
+                        }
+
+                        if (valuesCnt != fh.valuesCnt)
+                                throw Switch::data_error("Unexpected docvalues file content");
+
+                        in_file(fh.dataOffset, dataWords * sizeof(uint64_t));
+
+                        f.name        = str8_t(reinterpret_cast<const char *>(content + fh.nameOffset), fh.nameLen);
+                        f.kind        = docvalues_kind(fh.kind);
+                        f.valuesCnt   = fh.valuesCnt;
+                        f.blocksCnt   = fh.blocksCnt;
+                        f.blocks      = reinterpret_cast<const docvalues_block *>(content + fh.blocksOffset);
+                        f.data        = reinterpret_cast<const uint64_t *>(content + fh.dataOffset);
+                        f.dictCnt     = 0;
+                        f.dictOffsets = nullptr;
+                        f.dictData    = nullptr;
+
+                        if (f.kind == docvalues_kind::String) {
+                                in_file(fh.dictOffset, (uint64_t(fh.dictCnt) + 1) * sizeof(uint32_t));
+
+                                f.dictCnt     = fh.dictCnt;
+                                f.dictOffsets = reinterpret_cast<const uint32_t *>(content + fh.dictOffset);
+                                f.dictData    = reinterpret_cast<const char *>(f.dictOffsets + f.dictCnt + 1);
+                                in_file(fh.dictOffset + (uint64_t(fh.dictCnt) + 1) * sizeof(uint32_t), f.dictOffsets[f.dictCnt]);
+
+                                // string() trusts them
+                                for (uint32_t i{0}; i != f.dictCnt; ++i) {
+                                        if (f.dictOffsets[i] > f.dictOffsets[i + 1])
+                                                throw Switch::data_error("Unexpected docvalues file content");
+                                }
+                                // blocks ranges are ranges of ordinals; see docvalues_range
+                                for (uint32_t bi{0}; bi != f.blocksCnt; ++bi) {
+                                        if (f.blocks[bi].min < 0 || uint64_t(f.blocks[bi].max) >= f.dictCnt)
+                                                throw Switch::data_error("Unexpected docvalues file content");
+                                }
+                        }
+
+                        fields_.push_back(f);
+                }
+
+                if (sortFieldRef) {
+                        sorted     = true;
+                        sort.field = fields_[sortFieldRef - 1].name;
+                        sort.order = index_sort::Order(sortOrder);
+                }
+        } catch (...) {
+                if (owned)
+                        munmap(const_cast<uint8_t *>(content), size);
+                throw;
+        }
+}
+
+Trinity::DocValues::~DocValues() {
+        if (owned)
+                munmap(const_cast<uint8_t *>(fileData.offset), fileData.size());
+}
+
+std::unique_ptr<Trinity::DocValues> Trinity::DocValues::open(const char *path) {
+        int fd = ::open(path, O_RDONLY | O_LARGEFILE);
+
+        if (fd == -1) {
+                if (errno == ENOENT)
+                        return nullptr;
+
+                throw Switch::system_error("open() failed for ", path);
+        }
+
+        const auto fileSize = lseek64(fd, 0, SEEK_END);
+
+        if (fileSize <= 0) {
+                close(fd);
+                return nullptr;
+        }
+
+        auto fileData = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+
+        close(fd);
+        if (unlikely(fileData == MAP_FAILED))
+                throw Switch::data_error("Failed to access ", path, ":", strerror(errno));
+
+        madvise(fileData, fileSize, MADV_DONTDUMP);
+        return std::make_unique<DocValues>(static_cast<const uint8_t *>(fileData), fileSize, true);
+}
+
+Trinity::isrc_docid_t Trinity::DocValues::first_after(const sorted_document &cursor) const noexcept {
+        if (!sorted)
+                return 1;
+
+        // all documents have a value, and (value, document) pairs are in sort order, so that's a binary search for the
+        // first block where the last pair is after the cursor, and then for the first such pair in the block
+        const auto f         = field(sort.field);
+        const auto pair_at   = [f](const docvalues_block &b, const uint32_t i) noexcept { return sorted_document{f->document(b, i), true, f->value(b, i)}; };
+        uint32_t   l{0}, h{f->blocksCnt};
+
+        while (l < h) {
+                const auto  m = (l + h) >> 1;
+                const auto &b = f->blocks[m];
+
+                if (sort.before(cursor, pair_at(b, b.cnt - 1)))
+                        h = m;
+                else
+                        l = m + 1;
+        }
+
+        if (l == f->blocksCnt)
+                return DocIDsEND;
+
+        const auto &b = f->blocks[l];
+        uint32_t    i{0}, e{b.cnt - 1u};
+
+        while (i < e) {
+                const auto m = (i + e) >> 1;
+
+                if (sort.before(cursor, pair_at(b, m)))
+                        e = m;
+                else
+                        i = m + 1;
+        }
+
+        return f->document(b, i);
+}
+
+const Trinity::docvalues_field *Trinity::DocValues::field(const str8_t name) const noexcept {
+        for (const auto &f : fields_) {
+                if (f.name == name)
+                        return &f;
+        }
+        return nullptr;
+}
+
+const Trinity::docvalues_field *Trinity::docvalues_range::resolve(IndexSource *const src, int64_t *const l, int64_t *const h) const {
+        const auto dv = src->doc_values();
+
+        if (!dv)
+                return nullptr;
+
+        const auto f = dv->field(str8_t(fieldName.data(), fieldName.size()));
+
+        if (!f || f->kind != kind)
+                return nullptr;
+
+        if (kind == docvalues_kind::Numeric) {
+                *l = lo;
+                *h = hi;
+        } else {
+                // the range of ordinals of the strings within [loString, hiString]
+                *l = f->lower_bound(str32_t(loString.data(), loString.size()));
+                *h = int64_t(f->upper_bound(str32_t(hiString.data(), hiString.size()))) - 1;
+        }
+
+        return *l <= *h ? f : nullptr;
+}
+
+uint64_t Trinity::docvalues_range::cost(IndexSource *const src) {
+        int64_t    l, h;
+        const auto f = resolve(src, &l, &h);
+        uint64_t   res{0};
+
+        if (f) {
+                // an upper bound; all documents in the blocks that overlap the range
+                for (uint32_t i{0}; i != f->blocksCnt; ++i) {
+                        if (const auto &b = f->blocks[i]; b.max >= l && b.min <= h)
+                                res += b.cnt;
+                }
+        }
+        return res;
+}
+
+Trinity::DocsSetIterators::AppIterator *Trinity::docvalues_range::new_iterator(IndexSource *const src) {
+        int64_t    l{0}, h{0};
+        const auto f = resolve(src, &l, &h);
+
+        return new docvalues_range_iterator(src, cost(src), f, l, h);
+}
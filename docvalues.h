@@ -0,0 +1,278 @@
+#pragma once
+#include "docset_iterators_base.h"
+#include <buffer.h>
+#include <unordered_map>
+
+namespace Trinity {
+        // Per-document values, like Lucene's DocValues; a forward index, stored column-wise, one column per field.
+        //
+        // Trinity only indexes terms, so predicates like "price between 100 and 250", or "published after <timestamp>" would otherwise need to be
+        // expressed as (potentially very long) OR-lists of terms, or be evaluated in MatchedIndexDocumentsFilter::consider() after every document has been matched and scored,
+        // which is expensive and can't help the execution engine skip anything.
+        //
+        // You can set values with SegmentIndexSession::document_proxy::set_value(). SegmentIndexSession::commit() persists them in the segment's docvalues file,
+        // MergeCandidatesCollection::merge() carries them over to the merged segment, and SegmentIndexSource mmaps it and provides access to it
+        // via IndexSource::doc_values().
+        //
+        // A column is a sequence of blocks of up to K_block_size (document, value) pairs, ordered by document ID. For each block we track
+        // the first and last document and the minimum and maximum value, and we bit-pack the documents(as deltas from the first document, unless
+        // the block's documents are consecutive, in which case we don't need to store them at all) and the values (as deltas from the minimum value).
+        // The blocks metadata are all we need to skip entire blocks when filtering by range(see docvalues_range), and, for blocks where all values
+        // are within the range, to match all their documents without looking at the values.
+        //
+        // Strings are dictionary-encoded; the column holds the ordinal of each string in the field's sorted dictionary, so that
+        // a range of strings is also a range of ordinals.
+        //
+        // A document has at most one value per field. Documents without a value for a field are not in its column.
+        enum class docvalues_kind : uint8_t {
+                Numeric = 0,
+                String
+        };
+
+        struct docvalues_block final {
+                isrc_docid_t firstDocID;
+                isrc_docid_t lastDocID;
+                int64_t      min;
+                int64_t      max;
+                // offset in docvalues_field::data of the packed documents, followed(word-aligned) by the packed values
+                uint32_t dataOffset;
+                uint16_t cnt;
+                // 0 if the documents are consecutive, i.e lastDocID - firstDocID + 1 == cnt
+                uint8_t docBits;
+                uint8_t valueBits;
+        };
+        static_assert(sizeof(docvalues_block) == 32);
+
+        // A view of a field's column in a DocValues
+        struct docvalues_field final {
+                str8_t                 name;
+                docvalues_kind         kind;
+                uint32_t               valuesCnt;
+                uint32_t               blocksCnt;
+                const docvalues_block *blocks;
+                const uint64_t *       data;
+
+                // kind == docvalues_kind::String
+                uint32_t        dictCnt;
+                const uint32_t *dictOffsets; // dictCnt + 1 offsets in dictData
+                const char *    dictData;
+
+                static inline uint64_t unpack(const uint64_t *const words, const uint64_t bitOffset, const uint8_t bits) noexcept {
+                        if (!bits)
+                                return 0;
+
+                        const auto idx = bitOffset >> 6;
+                        const auto s   = bitOffset & 63;
+                        auto       v   = words[idx] >> s;
+
+                        if (s + bits > 64)
+                                v |= words[idx + 1] << (64 - s);
+
+                        return bits == 64 ? v : v & ((uint64_t(1) << bits) - 1);
+                }
+
+                // The document of the i-th pair in block b
+                inline isrc_docid_t document(const docvalues_block &b, const uint32_t i) const noexcept {
+                        return b.firstDocID + (b.docBits ? isrc_docid_t(unpack(data + b.dataOffset, uint64_t(i) * b.docBits, b.docBits)) : i);
+                }
+
+                // The value of the i-th pair in block b; the ordinal of the string for docvalues_kind::String
+                inline int64_t value(const docvalues_block &b, const uint32_t i) const noexcept {
+                        const auto docsWords = (uint32_t(b.cnt) * b.docBits + 63) >> 6;
+
+                        return int64_t(uint64_t(b.min) + unpack(data + b.dataOffset + docsWords, uint64_t(i) * b.valueBits, b.valueBits));
+                }
+
+                // Index of the first pair in block b, starting from `from`, where the document is >= target, or b.cnt
+                uint32_t lower_bound(const docvalues_block &b, const uint32_t from, const isrc_docid_t target) const noexcept;
+
+                // Index of the first block, starting from `from`, where lastDocID >= target, or blocksCnt
+                uint32_t block_for(const uint32_t from, const isrc_docid_t target) const noexcept;
+
+                // Returns false if the document has no value for this field
+                bool get(const isrc_docid_t documentID, int64_t *const out) const noexcept;
+
+                inline str32_t string(const uint32_t ordinal) const noexcept {
+                        return {dictData + dictOffsets[ordinal], dictOffsets[ordinal + 1] - dictOffsets[ordinal]};
+                }
+
+                // First ordinal where string(ordinal) >= s, or dictCnt
+                uint32_t lower_bound(const str32_t s) const noexcept;
+
+                // First ordinal where string(ordinal) > s, or dictCnt
+                uint32_t upper_bound(const str32_t s) const noexcept;
+
+                // Invokes l(documentID, value) for all pairs, in document ID order
+                template <typename L>
+                void for_each(L &&l) const {
+                        for (uint32_t bi{0}; bi != blocksCnt; ++bi) {
+                                const auto &b = blocks[bi];
+
+                                for (uint32_t i{0}; i != b.cnt; ++i)
+                                        l(document(b, i), value(b, i));
+                        }
+                }
+        };
+
+        // A document and its value for the sort field; e.g the last document of a page of results, which is the cursor
+        // for the next page(see exec_query_sorted())
+        struct sorted_document final {
+                docid_t id;
+                bool    hasValue;
+                int64_t value;
+        };
+
+        // Trinity document IDs are assigned by the application, so, unlike e.g Lucene, we can't re-number documents in sort order when
+        // we commit or merge segments. Instead, if the application assigns IDs in the order of a numeric field(e.g IDs assigned in publication time order, or
+        // in reverse publication time order for "newest first"), a segment may declare that its documents are sorted by that field.
+        // Then, the first k documents of the segment that match a query are also its top-k by that field(ties broken by document ID),
+        // which is what exec_query_sorted() relies on.
+        //
+        // See SegmentIndexSession::set_index_sort() and DocValues::documents_sort()
+        struct index_sort final {
+                enum class Order : uint8_t {
+                        Ascending = 0,
+                        Descending
+                };
+
+                str8_t field;
+                Order  order;
+
+                inline bool operator==(const index_sort &o) const noexcept {
+                        return field == o.field && order == o.order;
+                }
+
+                // true if a is ordered before b. Documents without a value are ordered last, and ties are broken by document ID
+                inline bool before(const sorted_document &a, const sorted_document &b) const noexcept {
+                        if (a.hasValue != b.hasValue)
+                                return a.hasValue;
+                        else if (a.hasValue && a.value != b.value)
+                                return order == Order::Ascending ? a.value < b.value : a.value > b.value;
+                        else
+                                return a.id < b.id;
+                }
+        };
+
+        // Accumulates (document, field, value) and serializes them in the docvalues file format
+        class DocValuesWriter final {
+              public:
+                static constexpr uint32_t K_block_size{256};
+
+              private:
+                struct field final {
+                        docvalues_kind                                kind;
+                        std::vector<std::pair<isrc_docid_t, int64_t>> values;
+                        // kind == docvalues_kind::String: values hold the string's index in the order it was first set()
+                        // which is replaced with the string's ordinal in serialize()
+                        std::unordered_map<std::string, uint32_t> strings;
+                };
+
+                std::vector<std::pair<std::string, std::unique_ptr<field>>> fields;
+                std::string                                                 sortField;
+                index_sort::Order                                           sortOrder{index_sort::Order::Ascending};
+
+              private:
+                field *field_for(const str8_t name, const docvalues_kind kind);
+
+                // Orders values by document, retaining the first value set() for each document
+                static void sort_values(field *);
+
+              public:
+                // If you set() more than one value for the same (document, field), only the first one is retained
+                void set(const isrc_docid_t documentID, const str8_t fieldName, const int64_t value);
+
+                void set(const isrc_docid_t documentID, const str8_t fieldName, const str32_t value);
+
+                inline bool empty() const noexcept {
+                        return fields.empty();
+                }
+
+                void clear() {
+                        fields.clear();
+                        sortField.clear();
+                }
+
+                // Returns true if the values of the numeric field, in document ID order, are in order, and if documentsCnt != 0, if
+                // there are exactly documentsCnt values.
+                bool in_order(const str8_t fieldName, const index_sort::Order order, const std::size_t documentsCnt = 0);
+
+                // The sort is persisted by serialize(); you should check in_order() first.
+                void set_index_sort(const str8_t fieldName, const index_sort::Order order) {
+                        sortField.assign(fieldName.data(), fieldName.size());
+                        sortOrder = order;
+                }
+
+                void serialize(IOBuffer *const out);
+
+                // Serializes and persists in path
+                void persist(const char *path);
+        };
+
+        // Provides access to a serialized docvalues file(see DocValuesWriter), which is usually a segment's docvalues file
+        class DocValues final {
+              private:
+                range_base<const uint8_t *, std::size_t> fileData;
+                bool                                     owned;
+                std::vector<docvalues_field>             fields_;
+                index_sort                               sort;
+                bool                                     sorted{false};
+
+              public:
+                // The content is not copied; it must outlive this DocValues
+                DocValues(const uint8_t *content, const std::size_t size, const bool ownsMapping = false);
+
+                ~DocValues();
+
+                // Returns nullptr if path doesn't exist
+                static std::unique_ptr<DocValues> open(const char *path);
+
+                const docvalues_field *field(const str8_t name) const noexcept;
+
+                inline const auto &fields() const noexcept {
+                        return fields_;
+                }
+
+                // The sort the documents are in, if any. See index_sort
+                inline const Trinity::index_sort *documents_sort() const noexcept {
+                        return sorted ? &sort : nullptr;
+                }
+
+                // If documents_sort() is set, the first document ordered after cursor, or DocIDsEND if there are none.
+                // All documents before it are ordered at or before the cursor. The cursor's ID is compared as an index source document ID.
+                // Returns 1 if documents are not sorted.
+                isrc_docid_t first_after(const sorted_document &cursor) const noexcept;
+        };
+
+        // Matches all documents where field's value is within [lo, hi], inclusive, by iterating the blocks of the field's column in every index source
+        // and skipping those that don't overlap the range.
+        //
+        // It is an app_ids_set::factory, so you can use it in queries via ast_node::make_app_ids_set(), e.g
+        // docvalues_range price("price"_s8, 100, 250);
+        // app_ids_set set = app_ids_set::of_factory(&price);
+        // q.root = ast_node::make_binop(q.allocator); q.root->binop.op = Operator::AND; q.root->binop.lhs = ...; q.root->binop.rhs = ast_node::make_app_ids_set(q.allocator, &set);
+        //
+        // Index sources without doc-values, or without values for the field, match no documents.
+        struct docvalues_range final
+            : public app_ids_set::factory {
+                const std::string    fieldName;
+                const docvalues_kind kind;
+                const int64_t        lo, hi;
+                const std::string    loString, hiString;
+
+                docvalues_range(const str8_t f, const int64_t l, const int64_t h)
+                    : fieldName(f.data(), f.size()), kind{docvalues_kind::Numeric}, lo{l}, hi{h} {
+                }
+
+                docvalues_range(const str8_t f, const str32_t l, const str32_t h)
+                    : fieldName(f.data(), f.size()), kind{docvalues_kind::String}, lo{0}, hi{0}, loString(l.data(), l.size()), hiString(h.data(), h.size()) {
+                }
+
+                DocsSetIterators::AppIterator *new_iterator(IndexSource *src) override final;
+
+                uint64_t cost(IndexSource *src) override final;
+
+              private:
+                // The column for src, and the range of values(ordinals for strings) in it, or nullptr if none can match
+                const docvalues_field *resolve(IndexSource *src, int64_t *l, int64_t *h) const;
+        };
+} // namespace Trinity
@@ -1,15 +1,17 @@
 #include "exec.h"
 #include "docset_spans.h"
 #include "docwordspace.h"
+#include "filter_cache.h"
 #include "matches.h"
 #include "queryexec_ctx.h"
 #include "similarity.h"
 #include <prioqueue.h>
+#include <switch_bitops.h>
 
 #include <memory>
+#include <unordered_set>
 
 using namespace Trinity;
-thread_local Trinity::queryexec_ctx *curRCTX;
 
 namespace // static/local this module
 {
@@ -87,6 +89,20 @@ static uint64_t reorder_execnode_impl(exec_node &n, bool &updates, queryexec_ctx
                 for (size_t i{0}; i != g->size; ++i)
                         reorder_execnode(g->nodes[i], updates, rctx);
                 return UINT64_MAX - 1;
+        } else if (n.fp == ENT::matchappids) {
+                const auto set = static_cast<app_ids_set *>(n.ptr);
+
+                switch (set->repr) {
+                        case app_ids_set::Repr::Array:
+                                return set->array.cnt;
+
+                        case app_ids_set::Repr::Bitmap:
+                                return set->bitmap.cnt;
+
+                        case app_ids_set::Repr::Factory:
+                                return set->f->cost(rctx.idxsrc);
+                }
+                std::abort();
         } else if (n.fp == ENT::matchallterms) {
                 const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
 
@@ -227,10 +243,9 @@ static exec_node prepare_tree(exec_node root, queryexec_ctx &rctx) {
         // No need to have done so if we could have determined that the query would have failed anyway
         // This could take some time - for 52 distinct terms it takes 0.002s (>1ms)
         before = Timings::Microseconds::Tick();
-        for (const auto &kv : rctx.tctxMap) {
-                const auto termID = kv.first;
-
-                rctx.prepare_decoder(termID);
+        for (exec_term_id_t termID{1}; termID < rctx.tctxMap.size(); ++termID) {
+                if (rctx.tctxMap[termID].first.documents)
+                        rctx.prepare_decoder(termID);
         }
 
         if (traceMetrics)
@@ -250,7 +265,205 @@ static bool  all_pli(const std::vector<DocsSetIterators::Iterator *> &its) noexc
 
 void PrintImpl(Buffer &b, const exec_node &n); // compilation_ctx.cpp
 
+// Appends a canonical representation of the sub-tree to out, for FilterCache keys.
+// It's based on the terms, not on the term IDs which are only meaningful in the context of this execution, and the operands
+// of commutative operators are sorted, so that e.g [a AND b] and [b AND a] are represented the same way.
+//
+// Returns false if the sub-tree can't be cached. Phrases require materialization of hits and tracking of candidate documents,
+// which we can't use while we are still building the iterators, so sub-trees that include phrases are not supported.
+static bool canonical_execnode(const exec_node n, queryexec_ctx &rctx, std::string *const out) {
+        std::vector<std::string> operands;
+        bool                     commutative{true};
+
+        if (n.fp == ENT::unaryand)
+                return canonical_execnode(static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr, rctx, out);
+
+        out->push_back(char(n.fp));
+        if (n.fp == ENT::matchterm) {
+                const auto token = rctx.tctxMap[n.u16].second;
+
+                out->push_back(char(token.size()));
+                out->append(token.data(), token.size());
+                return true;
+        } else if (n.fp == ENT::matchallterms || n.fp == ENT::matchanyterms) {
+                const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                for (size_t i{0}; i != run->size; ++i) {
+                        const auto token = rctx.tctxMap[run->terms[i]].second;
+
+                        operands.emplace_back(token.data(), token.size());
+                }
+        } else if (n.fp == ENT::logicaland || n.fp == ENT::logicalor) {
+                const auto ctx = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+
+                operands.resize(2);
+                if (!canonical_execnode(ctx->lhs, rctx, &operands[0]) || !canonical_execnode(ctx->rhs, rctx, &operands[1]))
+                        return false;
+        } else if (n.fp == ENT::logicalnot) {
+                // Length-prefixed like all other operands(terms runs are not self-delimiting), but not commutative
+                const auto ctx = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+
+                operands.resize(2);
+                if (!canonical_execnode(ctx->lhs, rctx, &operands[0]) || !canonical_execnode(ctx->rhs, rctx, &operands[1]))
+                        return false;
+                commutative = false;
+        } else if (n.fp == ENT::matchsome) {
+                const auto pm = static_cast<const compilation_ctx::partial_match_ctx *>(n.ptr);
+
+                out->append(reinterpret_cast<const char *>(&pm->min), sizeof(pm->min));
+                operands.resize(pm->size);
+                for (size_t i{0}; i != pm->size; ++i) {
+                        if (!canonical_execnode(pm->nodes[i], rctx, &operands[i]))
+                                return false;
+                }
+        } else
+                return false;
+
+        if (commutative)
+                std::sort(operands.begin(), operands.end());
+        for (const auto &it : operands) {
+                const uint32_t len = it.size();
+
+                out->append(reinterpret_cast<const char *>(&len), sizeof(len));
+                out->append(it);
+        }
+
+        return true;
+}
+
+DocsSetIterators::Iterator *queryexec_ctx::cached_filter_iterator(const exec_node n, const uint32_t execFlags) {
+        const auto  gen = idxsrc->generation();
+        std::string key;
+
+        // we won't bother with single terms; they are cheap to iterate as it is
+        if (n.fp == ENT::matchterm || n.cost < filterCache->minCost)
+                return nullptr;
+
+        key.append(reinterpret_cast<const char *>(&gen), sizeof(gen));
+        if (!canonical_execnode(n, *this, &key))
+                return nullptr;
+
+        auto set = filterCache->get(key);
+
+        if (!set) {
+                if (!filterCache->consider(key))
+                        return nullptr;
+
+                // Materialize the sub-tree now
+                // We won't consider the cache for the sub-trees of this sub-tree while building its iterator
+                std::vector<isrc_docid_t> ids;
+
+                const auto savedBudget = advancesBudget;
+
+                // it will be drained
+                materializingFilter = true;
+                advancesBudget      = std::numeric_limits<uint64_t>::max();
+                auto *const it      = build_iterator(n, execFlags);
+                materializingFilter = false;
+                advancesBudget      = savedBudget;
+
+                for (auto id = it->next(); id != DocIDsEND; id = it->next())
+                        ids.push_back(id);
+
+                set = docids_set::make(ids.data(), ids.size());
+                filterCache->put(key, set);
+
+                if constexpr (traceCompile)
+                        SLog("Materialized ", dotnotation_repr(ids.size()), " documents for FilterCache\n");
+        }
+
+        // we are not going to reg_docset_it() it; it's never scored so there's no need to wrap it
+        // in AccumulatedScoreScheme mode
+        auto *const it = new DocsSetIterators::CachedDocsSet(std::move(set));
+
+        docsetsIterators.emplace_back(it);
+        return it;
+}
+
+// Applications that personalize results often OR together hundreds or thousands of ID terms(e.g [cid:1 OR cid:2 OR ... cid:900]). Those
+// compile to a single ENT::matchanyterms run, and merging that many PLIs with a heap costs O(log(terms)) for every posting, and
+// a heap sift for every advance() as well.
+// If we don't need to know which of those terms matched a document, and we don't score it, we can instead drain all postings
+// into a bitmap first, which is O(1) per posting, and then iterate the resulting docids_set(either a bitmap or a sorted IDs array, whichever's smaller)
+// with a single cheap iterator, much like we do for FilterCache sets.
+//
+// We need to drain them all though, even if the consumer only advance()s a few times(e.g if it's a follower in a conjunction with a very selective lead), whereas
+// the heap only goes through the postings it's advanced to, skipping the rest. So the heap's cost depends on the consumer: for the root, a conjunction lead or a
+// materialized filter, it's all postings, but for a follower it's bounded by advancesBudget(the cost of the other operands), times the PLIs the heap may need to advance each time.
+// We only drain runs of at least K_termset_min_terms terms, and if draining is cheaper than the heap for that consumer.
+DocsSetIterators::Iterator *queryexec_ctx::termset_iterator(const compilation_ctx::termsrun *const run) {
+        static constexpr uint16_t K_termset_min_terms{16};
+        // set a bit now, and find it later when iterating the set
+        static constexpr uint64_t K_drain_posting_cost{2};
+        uint64_t                  total{0};
+
+        if (run->size < K_termset_min_terms)
+                return nullptr;
+
+        for (size_t i{0}; i != run->size; ++i)
+                total += tctxMap[run->terms[i]].first.documents;
+
+        // postings the heap will go through; at most run->size PLIs are advanced for every advance() of the disjunction
+        const uint64_t heapPostings = advancesBudget >= total / run->size ? total : advancesBudget * run->size;
+        const uint64_t heapCost     = heapPostings * (64 - SwitchBitOps::LeadingZeros(uint64_t(run->size)));
+        const uint64_t drainCost    = total * K_drain_posting_cost;
+
+        if (drainCost >= heapCost)
+                return nullptr;
+
+        std::unique_ptr<uint64_t[]> bm;
+        std::size_t                 words{0};
+
+        for (size_t i{0}; i != run->size; ++i) {
+                // we don't reg_pli() it; it won't outlive this loop
+                std::unique_ptr<Codecs::PostingsListIterator> it(decode_ctx.decoders[run->terms[i]]->new_iterator());
+
+                for (auto id = it->next(); id != DocIDsEND; id = it->next()) {
+                        if (const std::size_t w = id / 64; unlikely(w >= words)) {
+                                // grow it; IDs are in ascending order per PLI so this happens at most a few times
+                                const auto n = std::max<std::size_t>(w + 1, words * 2);
+                                auto       b = new uint64_t[n];
+
+                                if (words)
+                                        memcpy(b, bm.get(), words * sizeof(uint64_t));
+                                memset(b + words, 0, (n - words) * sizeof(uint64_t));
+                                bm.reset(b);
+                                words = n;
+                        }
+
+                        bm[id / 64] |= uint64_t(1) << (id & 63);
+                }
+        }
+
+        auto set = docids_set::from_bitmap(std::move(bm), words);
+
+        if constexpr (traceCompile)
+                SLog("Drained ", dotnotation_repr(total), " postings of ", run->size, " terms into a set of ", dotnotation_repr(set->cnt), " documents\n");
+
+        auto *const it = new DocsSetIterators::CachedDocsSet(std::move(set));
+
+        docsetsIterators.emplace_back(it);
+        return it;
+}
+
+DocsSetIterators::Iterator *queryexec_ctx::build_follower_iterator(const exec_node n, const uint64_t leadCost, const uint32_t execFlags) {
+        const auto saved = advancesBudget;
+
+        advancesBudget = std::min(saved, leadCost);
+
+        auto *const it = build_iterator(n, execFlags);
+
+        advancesBudget = saved;
+        return it;
+}
+
 DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, const uint32_t execFlags) {
+        if (filterCache && documentsOnly && !materializingFilter) {
+                // we neither score documents nor collect matched terms in this mode, so we can replace any sub-tree
+                if (auto it = cached_filter_iterator(n, execFlags))
+                        return it;
+        }
+
         if (n.fp == ENT::matchallterms) {
                 const auto                  run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
                 DocsSetIterators::Iterator *decoders[run->size];
@@ -266,6 +479,11 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                 const auto                  run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
                 DocsSetIterators::Iterator *decoders[run->size];
 
+                if (documentsOnly || materializingFilter || buildingFilter) {
+                        if (auto it = termset_iterator(run))
+                                return it;
+                }
+
                 for (size_t i{0}; i != run->size; ++i) {
                         auto pli = reg_pli(decode_ctx.decoders[run->terms[i]]->new_iterator());
 
@@ -299,6 +517,34 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                 const auto                  run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
                 DocsSetIterators::Iterator *its[run->size];
 
+                if (run->size > 1) {
+                        // All phrases will share a single PLI for each distinct term
+                        // See DocsSetIterators::PhraseSet
+                        std::vector<Codecs::PostingsListIterator *> tits;
+                        std::vector<exec_term_id_t>                 termIDs;
+                        std::vector<uint16_t>                       phrasesTerms;
+                        uint8_t                                     sizes[run->size];
+
+                        for (uint32_t pit{0}; pit != run->size; ++pit) {
+                                const auto p = run->phrases[pit];
+
+                                for (size_t i{0}; i != p->size; ++i) {
+                                        const auto termID = p->termIDs[i];
+                                        const auto idx    = std::find(termIDs.begin(), termIDs.end(), termID) - termIDs.begin();
+
+                                        if (idx == termIDs.size()) {
+                                                termIDs.push_back(termID);
+                                                tits.push_back(reg_pli(decode_ctx.decoders[termID]->new_iterator()));
+                                        }
+                                        phrasesTerms.push_back(idx);
+                                }
+                                sizes[pit] = p->size;
+                        }
+
+                        return reg_docset_it(new DocsSetIterators::PhraseSet(this, tits.data(), tits.size(), phrasesTerms.data(), sizes, run->size,
+                                                                             execFlags & unsigned(ExecFlags::AccumulatedScoreScheme), execFlags & unsigned(ExecFlags::DocumentsOnly)));
+                }
+
                 for (uint32_t pit{0}; pit != run->size; ++pit) {
                         const auto                    p = run->phrases[pit];
                         Codecs::PostingsListIterator *tits[p->size];
@@ -370,14 +616,15 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                 if (e->lhs.fp == ENT::consttrueexpr) {
                         const auto op = static_cast<const compilation_ctx::unaryop_ctx *>(e->lhs.ptr);
 
-                        return reg_docset_it(new DocsSetIterators::Optional(build_iterator(e->rhs, execFlags), build_iterator(op->expr, execFlags)));
+                        return reg_docset_it(new DocsSetIterators::Optional(build_iterator(e->rhs, execFlags), build_follower_iterator(op->expr, e->rhs.cost, execFlags)));
                 } else if (e->rhs.fp == ENT::consttrueexpr) {
                         const auto op = static_cast<const compilation_ctx::unaryop_ctx *>(e->rhs.ptr);
 
-                        return reg_docset_it(new DocsSetIterators::Optional(build_iterator(e->lhs, execFlags), build_iterator(op->expr, execFlags)));
+                        return reg_docset_it(new DocsSetIterators::Optional(build_iterator(e->lhs, execFlags), build_follower_iterator(op->expr, e->lhs.cost, execFlags)));
                 } else {
                         std::vector<DocsSetIterators::Iterator *> its;
-                        Trinity::DocsSetIterators::Iterator *     v[2] = {build_iterator(e->lhs, execFlags), build_iterator(e->rhs, execFlags)};
+                        // each is advanced at most as many times as the other has documents; see termset_iterator()
+                        Trinity::DocsSetIterators::Iterator *v[2] = {build_follower_iterator(e->lhs, e->rhs.cost, execFlags), build_follower_iterator(e->rhs, e->lhs.cost, execFlags)};
 
                         for (size_t i{0}; i != 2; ++i) {
                                 auto it = v[i];
@@ -402,10 +649,20 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
         } else if (n.fp == ENT::matchallnodes) {
                 std::vector<DocsSetIterators::Iterator *> its;
                 const auto                                g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+                uint64_t                                  lowest[2]{std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max()};
+
+                // the lowest two costs, so that we know the cost of the cheapest other node for each node
+                for (size_t i{0}; i != g->size; ++i) {
+                        if (const auto c = g->nodes[i].cost; c < lowest[0]) {
+                                lowest[1] = lowest[0];
+                                lowest[0] = c;
+                        } else if (c < lowest[1])
+                                lowest[1] = c;
+                }
 
                 its.reserve(g->size);
                 for (size_t i{0}; i != g->size; ++i)
-                        its.emplace_back(build_iterator(g->nodes[i], execFlags));
+                        its.emplace_back(build_follower_iterator(g->nodes[i], g->nodes[i].cost == lowest[0] ? lowest[1] : lowest[0], execFlags));
 
                 return reg_docset_it(all_pli(its)
                                          ? static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::ConjuctionAllPLI(its.data(), its.size()))
@@ -422,11 +679,35 @@ DocsSetIterators::Iterator *queryexec_ctx::build_iterator(const exec_node n, con
                                          ? static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::DisjunctionAllPLI(its.data(), its.size()))
                                          : static_cast<DocsSetIterators::Iterator *>(new DocsSetIterators::Disjunction(its.data(), its.size())));
         } else if (n.fp == ENT::logicalnot) {
-                const auto e = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                const auto                  e = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                DocsSetIterators::Iterator *filter{nullptr};
 
-                return reg_docset_it(new DocsSetIterators::Filter(build_iterator(e->lhs, execFlags), build_iterator(e->rhs, execFlags)));
+                // The filter is never scored, and we don't collect matched terms from it, so
+                // we can use the FilterCache in all execution modes
+                if (filterCache && !documentsOnly && !materializingFilter)
+                        filter = cached_filter_iterator(e->rhs, execFlags);
+
+                auto *const req = build_iterator(e->lhs, execFlags);
+
+                if (!filter) {
+                        const auto saved = buildingFilter;
+
+                        // the filter is advanced at most once for every document of the lhs
+                        buildingFilter = true;
+                        filter         = build_follower_iterator(e->rhs, e->lhs.cost, execFlags);
+                        buildingFilter = saved;
+                }
+
+                return reg_docset_it(new DocsSetIterators::Filter(req, filter));
         } else if (n.fp == ENT::matchterm) {
                 return reg_pli(decode_ctx.decoders[n.u16]->new_iterator());
+        } else if (n.fp == ENT::matchappids) {
+                const auto set = static_cast<const app_ids_set *>(n.ptr);
+
+                if (set->repr == app_ids_set::Repr::Factory)
+                        return reg_docset_it(set->f->new_iterator(idxsrc));
+                else
+                        return reg_docset_it(new DocsSetIterators::AppIDs(set));
         } else if (n.fp == ENT::unaryand) {
                 auto *const ctx = static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr);
 
@@ -505,43 +786,201 @@ static std::unique_ptr<DocsSetSpan> build_span(DocsSetIterators::Iterator *root,
 }
 
 #pragma mark Trinity Queries Execution Engine
+namespace {
+        // All MatchesProxy`s we use to execute queries count the matched documents
+        struct counting_matches_proxy
+            : public MatchesProxy {
+                std::size_t n{0};
+
+                // MatchesProxy::~MatchesProxy() is not virtual
+                virtual ~counting_matches_proxy() {
+                }
+        };
 
-void Trinity::exec_query(const query &in,
-                         IndexSource *const __restrict__ idxsrc,
-                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
-                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
-                         IndexDocumentsFilter *__restrict__ const documentsFilter,
-                         const uint32_t                      execFlags,
-                         Similarity::IndexSourceTermsScorer *scorer) {
+        // Tracks the documents evaluated and enforces exec_limits::maxMatches
+        struct limits_matches_proxy final
+            : public MatchesProxy {
+                counting_matches_proxy *handler;
+                exec_limits *           limits;
+                std::size_t             maxMatches;
+                uint64_t                evaluated{0};
+
+                void process(relevant_document_provider *const rdp) override final {
+                        ++evaluated;
+                        handler->process(rdp);
+
+                        if (unlikely(handler->n >= maxMatches)) {
+                                limits->truncated = true;
+                                throw aborted_search_exception();
+                        }
+                }
+        };
+
+        // The state of a query execution, once prepared. It owns everything the spans and the iterators depend on, so that
+        // it can be resumed at any time, and on any thread; see exec_query_resumable()
+        struct query_execution final
+            : public QueryExecution {
+                query                                   q;
+                queryexec_ctx                           rctx;
+                std::unique_ptr<DocsSetSpan>            span;
+                std::unique_ptr<counting_matches_proxy> handler;
+                isrc_docid_t                            next{1};
+                uint64_t                                start;
+                exec_limits *const                      limits;
+                limits_matches_proxy                    limitsProxy;
+                MatchedIndexDocumentsFilter *const      matchesFilter;
+
+                query_execution(const query &in, IndexSource *const src, const uint32_t execFlags, exec_limits *const l, MatchedIndexDocumentsFilter *const mf)
+                    : q(in, true), rctx(src, execFlags & uint32_t(ExecFlags::DocumentsOnly), execFlags & uint32_t(ExecFlags::AccumulatedScoreScheme)), limits{l}, matchesFilter{mf} {
+                }
+
+                // Whether it ran to completion, was abandoned, or was executed directly by prepare_query_execution(), we are done
+                // with this index source; see MatchedIndexDocumentsFilter::finalize_index_source()
+                ~query_execution() {
+                        matchesFilter->finalize_index_source(rctx.idxsrc);
+                }
+
+                bool limits_reached() const noexcept;
+
+                bool resume(const isrc_docid_t maxDocIDs) override final;
+
+                // Processes the matches in [next, max); see exec_queries()
+                bool resume_until(const isrc_docid_t max);
+
+                std::size_t matched() const noexcept override final {
+                        return handler->n;
+                }
+        };
+} // namespace
+
+
+// See SegmentIndexSession::set_common_words()
+//
+// For each position of phrase p, we use the bigram of the terms at (position, position + 1) if either is one of the index source's common
+// words and the bigram exists in the index source, otherwise the term at that position, so that the terms of the new phrase are still in consecutive positions;
+// the last term is dropped if the bigram before it covers it. e.g for "world of warcraft" that's ["world<sep>of" "of<sep>warcraft"].
+// Bigrams of other pairs may exist, but they are not necessarily indexed for all their occurrences; see common_words_set.
+// Returns nullptr if no bigrams exist for any of its pairs.
+static phrase *common_grams_phrase(const phrase *const p, IndexSource *const src, const common_words_set &cw, simple_allocator &a) {
+        str8_t  tokens[Limits::MaxPhraseSize];
+        char_t  gram[Limits::MaxTermLength];
+        uint8_t n{0};
+        bool    any{false}, lastCovered{false};
+
+        for (uint8_t i{0}; i != p->size; ++i) {
+                if (i + 1 != p->size && (cw.contains(p->terms[i].token) || cw.contains(p->terms[i + 1].token))) {
+                        if (const auto len = common_gram(p->terms[i].token, p->terms[i + 1].token, gram); len && src->term_ctx({gram, len}).documents) {
+                                tokens[n++].Set(a.CopyOf(gram, len), len);
+                                any         = true;
+                                lastCovered = i + 2 == p->size;
+                                continue;
+                        }
+                } else if (i + 1 == p->size && lastCovered)
+                        break;
+
+                tokens[n++] = p->terms[i].token;
+        }
+
+        if (!any)
+                return nullptr;
+
+        auto res = phrase::make(tokens, n, &a);
+
+        res->rep           = p->rep;
+        res->index         = p->index;
+        res->toNextSpan    = p->toNextSpan;
+        res->flags         = p->flags;
+        res->app_phrase_id = p->app_phrase_id;
+        res->inputRange    = p->inputRange;
+        res->rewrite_ctx   = p->rewrite_ctx;
+        return res;
+}
+
+// Replaces phrases with their common-grams equivalents, but only where their terms are neither scored nor collected, i.e
+// anywhere in DocumentsOnly mode, and on the RHS of NOT otherwise.
+static void rewrite_common_grams(ast_node *const n, IndexSource *const src, const common_words_set &cw, simple_allocator &a, const bool scored) {
+        switch (n->type) {
+                case ast_node::Type::Phrase:
+                        if (!scored && n->p->size > 1) {
+                                if (auto p = common_grams_phrase(n->p, src, cw, a)) {
+                                        n->p = p;
+                                        if (p->size == 1)
+                                                n->type = ast_node::Type::Token;
+                                }
+                        }
+                        break;
+
+                case ast_node::Type::BinOp:
+                        rewrite_common_grams(n->binop.lhs, src, cw, a, scored);
+                        rewrite_common_grams(n->binop.rhs, src, cw, a, scored && n->binop.op != Operator::NOT);
+                        break;
+
+                case ast_node::Type::UnaryOp:
+                        rewrite_common_grams(n->unaryop.expr, src, cw, a, scored && n->unaryop.op != Operator::NOT);
+                        break;
+
+                case ast_node::Type::ConstTrueExpr:
+                        rewrite_common_grams(n->expr, src, cw, a, scored);
+                        break;
+
+                case ast_node::Type::MatchSome:
+                        for (uint16_t i{0}; i != n->match_some.size; ++i)
+                                rewrite_common_grams(n->match_some.nodes[i], src, cw, a, scored);
+                        break;
+
+                default:
+                        break;
+        }
+}
+
+// Compiles the query and prepares its execution; returns nullptr if there's nothing(else) to do.
+// Unless resumable is set, this may also execute the query directly(see single term specializations), in which case it also returns nullptr.
+static std::unique_ptr<query_execution> prepare_query_execution(const query &in,
+                                                                IndexSource *const __restrict__ idxsrc,
+                                                                masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
+                                                                MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
+                                                                IndexDocumentsFilter *__restrict__ const documentsFilter,
+                                                                const uint32_t                      execFlags,
+                                                                Similarity::IndexSourceTermsScorer *scorer,
+                                                                exec_limits *const                  limits,
+                                                                const bool                          resumable) {
         struct query_term_instance final
             : public query_term_ctx::instance_struct {
                 str8_t token;
         };
 
+        matchesFilter->prepare_index_source(idxsrc);
+
         if (!in) {
                 if constexpr (traceCompile)
                         SLog("No root node\n");
 
-                return;
+                matchesFilter->finalize_index_source(idxsrc);
+                return nullptr;
         }
 
         // We need a copy of that query here
         // for we we will need to modify it
         const auto _start = Timings::Microseconds::Tick();
-        query      q(in, true); // shallow copy, no need for a deep copy here
+        auto       res    = std::make_unique<query_execution>(in, idxsrc, execFlags, limits, matchesFilter); // shallow copy, no need for a deep copy here
+        auto &     q      = res->q;
 
         // Normalize just in case
         if (!q.normalize()) {
                 if constexpr (traceCompile)
                         SLog("No root node after normalization\n");
 
-                return;
+                return nullptr;
         }
 
         const bool documentsOnly  = execFlags & uint32_t(ExecFlags::DocumentsOnly);
         const bool accumScoreMode = execFlags & uint32_t(ExecFlags::AccumulatedScoreScheme);
         const bool defaultMode    = !documentsOnly && !accumScoreMode;
 
+        // q is a shallow copy; rewrite_common_grams() only replaces the phrases of its own nodes
+        if (const auto cw = idxsrc->common_words())
+                rewrite_common_grams(q.root, idxsrc, *cw, q.allocator, !documentsOnly);
+
         // We need to collect all term instances in the query
         // so that we the score function will be able to take that into account (See matched_document::queryTermInstances)
         // We only need to do this for specific AST branches and node types(i.e we ignore all RHS expressions of logical NOT nodes)
@@ -558,7 +997,7 @@ void Trinity::exec_query(const query &in,
         }
 
 
-        queryexec_ctx rctx(idxsrc, documentsOnly, accumScoreMode);
+        auto &rctx = res->rctx;
 
         struct comp_ctx final
             : public compilation_ctx {
@@ -669,7 +1108,7 @@ void Trinity::exec_query(const query &in,
                 if constexpr (traceCompile)
                         SLog("Nothing to do\n");
 
-                return;
+                return nullptr;
         }
 
         // Prepare and further optimize tree for execution
@@ -688,8 +1127,7 @@ void Trinity::exec_query(const query &in,
         query_index_terms **queryIndicesTerms;
         const auto          maxQueryTermIDPlus1 = rctx.termsDict.size() + 1;
 
-        curRCTX         = &rctx;
-        curRCTX->scorer = scorer;
+        rctx.scorer = scorer;
 
         if (defaultMode) {
                 std::vector<const query_term_instance *>           collected;
@@ -719,7 +1157,7 @@ void Trinity::exec_query(const query &in,
                                 SLog("Collecting token [", token, "]\n");
 
 			// only if this token has actually been used in the compiled query
-                        if (const auto termID = rctx.termsDict[token]) {
+                        if (const auto termID = rctx.termsDict.find(token)) {
                                 collected.clear();
                                 do {
                                         collected.emplace_back(p);
@@ -888,7 +1326,7 @@ void Trinity::exec_query(const query &in,
 
 #pragma mark Execution
         try {
-                if (rootExecNode.fp == ENT::matchterm && !accumScoreMode) {
+                if (rootExecNode.fp == ENT::matchterm && !accumScoreMode && !resumable) {
                         isrc_docid_t docID;
 
                         // SPECIALIZATION: single term
@@ -1080,12 +1518,14 @@ void Trinity::exec_query(const query &in,
                         auto *const sit = rctx.build_iterator(rootExecNode, execFlags);
                         // Over-estimate capacity, make sure we won't overrun any buffers
                         const std::size_t capacity = rctx.tctxMap.size() + rctx.allIterators.size() + rctx.docsetsIterators.size() + 64;
-                        auto              span     = build_span(sit, &rctx);
 
                         rctx.collectedIts.init(capacity);
-                        rctx.reusableCDS.capacity = std::max<uint32_t>(4096, capacity);
-                        rctx.reusableCDS.data     = static_cast<candidate_document **>(malloc(sizeof(candidate_document *) * rctx.reusableCDS.capacity));
-                        rctx.rootIterator         = sit;
+                        rctx.reusableCDS.reserve(std::max<uint32_t>(4096, capacity));
+                        rctx.rootIterator = sit;
+
+                        // build_span() may advance phrase iterators, which will materialize and then release
+                        // candidate documents, so reusableCDS needs to be initialized first
+                        res->span = build_span(sit, &rctx);
 
                         // We will create different Handlers depending on the mode and other execution options so
                         // because process() is a hot method and we 'd like to reduce checks in there if we can
@@ -1093,14 +1533,13 @@ void Trinity::exec_query(const query &in,
                                 if (documentsFilter) {
                                         if (maskedDocumentsRegistry && !maskedDocumentsRegistry->empty()) {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         const bool           requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *__restrict__ const rdp) final {
                                                                 const auto id          = rdp->document();
@@ -1116,19 +1555,17 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
                                         } else {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         const bool           requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *const rdp) final {
                                                                 const auto id          = rdp->document();
@@ -1144,20 +1581,18 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, documentsFilter);
                                         }
                                 } else if (maskedDocumentsRegistry && !maskedDocumentsRegistry->empty()) {
                                         struct Handler final
-                                            : public MatchesProxy {
+                                            : public counting_matches_proxy {
                                                 queryexec_ctx *const ctx;
                                                 IndexSource *const   idxsrc;
                                                 const bool           requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                 masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
-                                                std::size_t n{0};
 
                                                 void process(relevant_document_provider *const rdp) final {
                                                         const auto id          = rdp->document();
@@ -1173,18 +1608,16 @@ void Trinity::exec_query(const query &in,
                                                     : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr} {
                                                 }
 
-                                        } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
+                                        };
 
-                                        span->process(&handler, 1, DocIDsEND);
-                                        matchedDocuments = handler.n;
+                                        res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
                                 } else {
                                         if (idxsrc->require_docid_translation()) {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *const rdp) final {
                                                                 const auto id = rdp->document();
@@ -1197,17 +1630,15 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, matchesFilter{mf} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter);
                                         } else {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *const rdp) final {
                                                                 const auto id = rdp->document();
@@ -1220,24 +1651,22 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, matchesFilter{mf} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter);
                                         }
                                 }
                         } else if (accumScoreMode) {
                                 if (documentsFilter) {
                                         if (maskedDocumentsRegistry && !maskedDocumentsRegistry->empty()) {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         const bool           requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) final {
                                                                 const auto id          = relDoc->document();
@@ -1253,19 +1682,17 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
                                         } else {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         const bool           requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) final {
                                                                 const auto id          = relDoc->document();
@@ -1281,20 +1708,18 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, documentsFilter);
                                         }
                                 } else if (maskedDocumentsRegistry && !maskedDocumentsRegistry->empty()) {
                                         struct Handler final
-                                            : public MatchesProxy {
+                                            : public counting_matches_proxy {
                                                 queryexec_ctx *const ctx;
                                                 IndexSource *const   idxsrc;
                                                 const bool           requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                 masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
-                                                std::size_t n{0};
 
                                                 void process(relevant_document_provider *relDoc) final {
                                                         const auto id          = relDoc->document();
@@ -1310,18 +1735,16 @@ void Trinity::exec_query(const query &in,
                                                     : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr} {
                                                 }
 
-                                        } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
+                                        };
 
-                                        span->process(&handler, 1, DocIDsEND);
-                                        matchedDocuments = handler.n;
+                                        res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
                                 } else {
                                         struct Handler final
-                                            : public MatchesProxy {
+                                            : public counting_matches_proxy {
                                                 queryexec_ctx *const ctx;
                                                 IndexSource *const   idxsrc;
                                                 const bool           requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
-                                                std::size_t n{0};
 
                                                 void process(relevant_document_provider *relDoc) final {
                                                         const auto                  id          = relDoc->document();
@@ -1335,10 +1758,9 @@ void Trinity::exec_query(const query &in,
                                                     : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf} {
                                                 }
 
-                                        } handler(&rctx, idxsrc, matchesFilter);
+                                        };
 
-                                        span->process(&handler, 1, DocIDsEND);
-                                        matchedDocuments = handler.n;
+                                        res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter);
                                 }
                         } else {
 
@@ -1348,14 +1770,13 @@ void Trinity::exec_query(const query &in,
                                 if (documentsFilter) {
                                         if (maskedDocumentsRegistry && !maskedDocumentsRegistry->empty()) {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         const bool           requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) final {
                                                                 const auto id          = relDoc->document();
@@ -1381,19 +1802,17 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr}, documentsFilter{df} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry, documentsFilter);
                                         } else {
                                                 struct Handler final
-                                                    : public MatchesProxy {
+                                                    : public counting_matches_proxy {
                                                         queryexec_ctx *const ctx;
                                                         IndexSource *const   idxsrc;
                                                         const bool           requireDocIDTranslation;
                                                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                         IndexDocumentsFilter *__restrict__ const documentsFilter;
-                                                        std::size_t n{0};
 
                                                         void process(relevant_document_provider *relDoc) final {
                                                                 const auto id          = relDoc->document();
@@ -1419,20 +1838,18 @@ void Trinity::exec_query(const query &in,
                                                             : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, documentsFilter{df} {
                                                         }
 
-                                                } handler(&rctx, idxsrc, matchesFilter, documentsFilter);
+                                                };
 
-                                                span->process(&handler, 1, DocIDsEND);
-                                                matchedDocuments = handler.n;
+                                                res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, documentsFilter);
                                         }
                                 } else if (maskedDocumentsRegistry && !maskedDocumentsRegistry->empty()) {
                                         struct Handler final
-                                            : public MatchesProxy {
+                                            : public counting_matches_proxy {
                                                 queryexec_ctx *const ctx;
                                                 IndexSource *const   idxsrc;
                                                 const bool           requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
                                                 masked_documents_registry *const __restrict__ maskedDocumentsRegistry;
-                                                std::size_t n{0};
 
                                                 void process(relevant_document_provider *relDoc) final {
                                                         const auto id          = relDoc->document();
@@ -1458,18 +1875,16 @@ void Trinity::exec_query(const query &in,
                                                     : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf}, maskedDocumentsRegistry{mr} {
                                                 }
 
-                                        } handler(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
+                                        };
 
-                                        span->process(&handler, 1, DocIDsEND);
-                                        matchedDocuments = handler.n;
+                                        res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter, maskedDocumentsRegistry);
                                 } else {
                                         struct Handler final
-                                            : public MatchesProxy {
+                                            : public counting_matches_proxy {
                                                 queryexec_ctx *const ctx;
                                                 IndexSource *const   idxsrc;
                                                 const bool           requireDocIDTranslation;
                                                 MatchedIndexDocumentsFilter *__restrict__ const matchesFilter;
-                                                std::size_t n{0};
 
                                                 void process(relevant_document_provider *relDoc) final {
                                                         const auto                  id          = relDoc->document();
@@ -1492,23 +1907,460 @@ void Trinity::exec_query(const query &in,
                                                     : idxsrc{src}, ctx{c}, requireDocIDTranslation{src->require_docid_translation()}, matchesFilter{mf} {
                                                 }
 
-                                        } handler(&rctx, idxsrc, matchesFilter);
+                                        };
 
-                                        span->process(&handler, 1, DocIDsEND);
-                                        matchedDocuments = handler.n;
+                                        res->handler = std::make_unique<Handler>(&rctx, idxsrc, matchesFilter);
                                 }
                         }
                 }
         } catch (const aborted_search_exception &e) {
                 // search was aborted
+                return nullptr;
         } catch (...) {
                 // something else, throw it and let someone else handle it
                 throw;
         }
 
+        if (res->span) {
+                // ready to be executed
+                res->start = start;
+
+                if (limits) {
+                        res->limitsProxy.handler    = res->handler.get();
+                        res->limitsProxy.limits     = limits;
+                        res->limitsProxy.maxMatches = limits->maxMatches ?: std::numeric_limits<std::size_t>::max();
+                        res->next                   = std::max<isrc_docid_t>(res->next, limits->firstDocumentID);
+                }
+                return res;
+        }
+
         const auto duration    = Timings::Microseconds::Since(start);
         const auto durationAll = Timings::Microseconds::Since(_start);
 
         if (traceCompile || traceExec)
                 SLog(ansifmt::bold, ansifmt::color_red, dotnotation_repr(matchedDocuments), " matched in ", duration_repr(duration), ansifmt::reset, " (", Timings::Microseconds::ToMillis(duration), " ms) ", duration_repr(durationAll), " all\n");
+
+        return nullptr;
+}
+
+bool query_execution::limits_reached() const noexcept {
+        if (limits->maxDocuments && limitsProxy.evaluated >= limits->maxDocuments)
+                return true;
+
+        if (limits->maxPostings) {
+                uint64_t decoded{0};
+
+                for (uint32_t i{0}; i != rctx.decode_ctx.capacity; ++i) {
+                        if (const auto dec = rctx.decode_ctx.decoders[i])
+                                decoded += dec->decodedPostings;
+                }
+
+                if (decoded >= limits->maxPostings)
+                        return true;
+        }
+
+        return limits->deadline && Timings::Microseconds::Tick() >= limits->deadline;
+}
+
+bool query_execution::resume(const isrc_docid_t maxDocIDs) {
+        if (next == DocIDsEND)
+                return false;
+
+        // the window of document IDs to process: [next, max)
+        return resume_until(maxDocIDs >= DocIDsEND - next ? DocIDsEND : next + maxDocIDs);
+}
+
+bool query_execution::resume_until(const isrc_docid_t max) {
+        if (next == DocIDsEND)
+                return false;
+        else if (next >= max)
+                return true;
+
+        try {
+                if (!limits)
+                        next = span->process(handler.get(), next, max);
+                else {
+                        // in windows of (up to) exec_limits::K_window document IDs, so that we can check the limits in between
+                        while (next < max) {
+                                const auto windowMax = max - next > exec_limits::K_window ? next + exec_limits::K_window : max;
+
+                                next = span->process(&limitsProxy, next, windowMax);
+                                if (next != DocIDsEND && limits_reached()) {
+                                        limits->truncated = true;
+                                        next              = DocIDsEND;
+                                }
+                        }
+                }
+        } catch (const aborted_search_exception &e) {
+                // search was aborted
+                next = DocIDsEND;
+        } catch (...) {
+                // something else, throw it and let someone else handle it
+                throw;
+        }
+
+        if (next != DocIDsEND)
+                return true;
+
+        if (traceCompile || traceExec) {
+                const auto duration = Timings::Microseconds::Since(start);
+
+                SLog(ansifmt::bold, ansifmt::color_red, dotnotation_repr(handler->n), " matched in ", duration_repr(duration), ansifmt::reset, " (", Timings::Microseconds::ToMillis(duration), " ms)\n");
+        }
+
+        return false;
+}
+
+void Trinity::exec_query(const query &in,
+                         IndexSource *const __restrict__ idxsrc,
+                         masked_documents_registry *const __restrict__ maskedDocumentsRegistry,
+                         MatchedIndexDocumentsFilter *__restrict__ const matchesFilter,
+                         IndexDocumentsFilter *__restrict__ const documentsFilter,
+                         const uint32_t                      execFlags,
+                         Similarity::IndexSourceTermsScorer *scorer,
+                         exec_limits *const                  limits) {
+        if (limits)
+                limits->truncated = false;
+
+        // the single term specializations don't support limits
+        if (auto e = prepare_query_execution(in, idxsrc, maskedDocumentsRegistry, matchesFilter, documentsFilter, execFlags, scorer, limits, limits != nullptr)) {
+                // all at once
+                e->resume(DocIDsEND);
+        }
+}
+
+std::unique_ptr<Trinity::QueryExecution> Trinity::exec_query_resumable(const query &in,
+                                                                       IndexSource *const                  idxsrc,
+                                                                       masked_documents_registry *const    maskedDocumentsRegistry,
+                                                                       MatchedIndexDocumentsFilter *const  matchesFilter,
+                                                                       IndexDocumentsFilter *const         documentsFilter,
+                                                                       const uint32_t                      execFlags,
+                                                                       Similarity::IndexSourceTermsScorer *scorer,
+                                                                       exec_limits *const                  limits) {
+        if (limits)
+                limits->truncated = false;
+
+        return prepare_query_execution(in, idxsrc, maskedDocumentsRegistry, matchesFilter, documentsFilter, execFlags, scorer, limits, true);
+}
+
+
+#pragma mark batch execution
+namespace {
+        // A term's postings list, decoded once and shared by all queries of an exec_queries() batch
+        //
+        // Because all queries of the batch process the same window of document IDs before any of them moves on to the next(see exec_queries()),
+        // only the postings from the lowest position of any query's iterator onwards are needed. Postings are decoded on demand
+        // into a sliding buffer, and trim() drops those all iterators are past, in between windows.
+        struct shared_postings final {
+                static constexpr uint32_t K_decode_batch{128};
+
+                term_index_ctx                                tctx;
+                bool                                          withHits;
+                std::unique_ptr<Codecs::Decoder>              dec;
+                std::unique_ptr<Codecs::PostingsListIterator> it;
+                std::unique_ptr<DocWordsSpace>                dws; // materialize_hits() needs one, though we don't care for it
+                bool                                          drained{false};
+
+                // the postings [base, base + docs.size()) of the postings list
+                uint32_t                  base{0};
+                std::vector<isrc_docid_t> docs;
+                std::vector<tokenpos_t>   freqs;
+                // hits of docs[i] are hits[hitsOffsets[i], hitsOffsets[i] + freqs[i])
+                // empty if we didn't need to decode hits
+                std::vector<uint32_t> hitsOffsets;
+                std::vector<term_hit> hits;
+
+                // positions(in the postings list) of the iterators of all queries on this term
+                std::vector<const uint32_t *> consumers;
+
+                shared_postings(IndexSource *const src, const str8_t term, const term_index_ctx ctx, const bool needHits)
+                    : tctx{ctx}, withHits{needHits}, dec(src->new_postings_decoder(term, ctx)), it(dec->new_iterator()) {
+                        if (withHits)
+                                dws.reset(new DocWordsSpace(src->max_indexed_position()));
+                }
+
+                // Decodes the next K_decode_batch postings; returns false if there are no more
+                bool decode_more() {
+                        if (drained)
+                                return false;
+
+                        for (uint32_t i{0}; i != K_decode_batch; ++i) {
+                                const auto id = it->next();
+
+                                if (id == DocIDsEND) {
+                                        drained = true;
+                                        return i;
+                                }
+
+                                const auto freq = it->freq;
+
+                                docs.push_back(id);
+                                freqs.push_back(freq);
+
+                                if (withHits) {
+                                        const auto o = hits.size();
+
+                                        hitsOffsets.push_back(o);
+                                        hits.resize(o + freq);
+                                        it->materialize_hits(dws.get(), hits.data() + o);
+                                }
+                        }
+
+                        return true;
+                }
+
+                // Drops the postings before the lowest position of all iterators, except for the posting before it
+                // which is the current document of that iterator, and may still need its hits materialized
+                void trim() {
+                        auto lowest{base + uint32_t(docs.size())};
+
+                        for (const auto p : consumers)
+                                lowest = std::min(lowest, *p);
+
+                        const auto keepFrom = lowest ? lowest - 1 : 0;
+
+                        if (keepFrom <= base)
+                                return;
+
+                        const auto n = keepFrom - base;
+
+                        docs.erase(docs.begin(), docs.begin() + n);
+                        freqs.erase(freqs.begin(), freqs.begin() + n);
+                        if (withHits) {
+                                const auto h = n == hitsOffsets.size() ? hits.size() : hitsOffsets[n];
+
+                                hits.erase(hits.begin(), hits.begin() + h);
+                                hitsOffsets.erase(hitsOffsets.begin(), hitsOffsets.begin() + n);
+                                for (auto &o : hitsOffsets)
+                                        o -= h;
+                        }
+                        base += n;
+                }
+        };
+
+        struct SharedPostingsDecoder final
+            : public Codecs::Decoder {
+                shared_postings *const sp;
+
+                struct Iterator final
+                    : public Codecs::PostingsListIterator {
+                        shared_postings *const sp;
+                        // position in the postings list(not in sp->docs)
+                        uint32_t idx{0};
+
+                        Iterator(SharedPostingsDecoder *const d)
+                            : Codecs::PostingsListIterator{d}, sp{d->sp} {
+                                sp->consumers.push_back(&idx);
+                        }
+
+                        ~Iterator() {
+                                auto &c = sp->consumers;
+
+                                c.erase(std::find(c.begin(), c.end(), &idx));
+                        }
+
+                        isrc_docid_t next() override final {
+                                if (unlikely(idx - sp->base == sp->docs.size()) && !sp->decode_more())
+                                        return curDocument.id = DocIDsEND;
+
+                                const auto i = idx++ - sp->base;
+
+                                freq = sp->freqs[i];
+                                return curDocument.id = sp->docs[i];
+                        }
+
+                        isrc_docid_t advance(const isrc_docid_t target) override final {
+                                // we can't skip blocks in the underlying postings list, because other queries may need them
+                                while (sp->docs.empty() || sp->docs.back() < target) {
+                                        if (!sp->decode_more())
+                                                break;
+                                }
+
+                                const auto &docs = sp->docs;
+                                const auto  it   = std::lower_bound(docs.begin() + (idx - sp->base), docs.end(), target);
+
+                                idx = sp->base + (it - docs.begin());
+                                return next();
+                        }
+
+                        void materialize_hits(DocWordsSpace *const dws, term_hit *const out) override final {
+                                const auto termID = dec->exec_ctx_termid();
+                                const auto i      = idx - 1 - sp->base;
+                                const auto n      = sp->freqs[i];
+                                const auto hits   = sp->hits.data() + sp->hitsOffsets[i];
+
+                                for (uint32_t i{0}; i != n; ++i) {
+                                        out[i] = hits[i];
+                                        if (const auto pos = hits[i].pos)
+                                                dws->set(termID, pos);
+                                }
+                        }
+                };
+
+                SharedPostingsDecoder(shared_postings *const p)
+                    : sp{p} {
+                        indexTermCtx = p->tctx;
+                }
+
+                void init(const term_index_ctx &, Codecs::AccessProxy *) override final {
+                }
+
+                Codecs::PostingsListIterator *new_iterator() override final {
+                        return new Iterator(this);
+                }
+        };
+
+        // Provides SharedPostingsDecoderS for the shared terms, and delegates everything else to the wrapped source
+        class BatchIndexSource final
+            : public IndexSource {
+              public:
+                IndexSource *const                                            src;
+                std::unordered_map<str8_t, std::unique_ptr<shared_postings>> shared;
+
+                BatchIndexSource(IndexSource *const s)
+                    : src{s} {
+                        gen         = s->generation();
+                        filterCache = s->filter_cache();
+                }
+
+                ~BatchIndexSource() {
+                        ResetRefs();
+                }
+
+                term_index_ctx resolve_term_ctx(const str8_t term) override final {
+                        return src->term_ctx(term);
+                }
+
+                bool require_docid_translation() const override final {
+                        return src->require_docid_translation();
+                }
+
+                docid_t translate_docid(const isrc_docid_t localId) override final {
+                        return src->translate_docid(localId);
+                }
+
+                Codecs::Decoder *new_postings_decoder(const str8_t term, const term_index_ctx ctx) override final {
+                        if (const auto it = shared.find(term); it != shared.end())
+                                return new SharedPostingsDecoder(it->second.get());
+                        else
+                                return src->new_postings_decoder(term, ctx);
+                }
+
+                updated_documents masked_documents() override final {
+                        return src->masked_documents();
+                }
+
+                tokenpos_t max_indexed_position() const override final {
+                        return src->max_indexed_position();
+                }
+
+                field_statistics default_field_stats() override final {
+                        return src->default_field_stats();
+                }
+
+                bool index_empty() const override final {
+                        return src->index_empty();
+                }
+
+                bool immutable() const override final {
+                        return src->immutable();
+                }
+
+                const DocValues *doc_values() const override final {
+                        return src->doc_values();
+                }
+
+                const common_words_set *common_words() const override final {
+                        return src->common_words();
+                }
+        };
+} // namespace
+
+void Trinity::exec_queries(const query *const queries, const std::size_t cnt,
+                           IndexSource *const __restrict__ idxsrc,
+                           masked_documents_registry **const maskedDocumentsRegistries,
+                           MatchedIndexDocumentsFilter **const matchesFilters,
+                           IndexDocumentsFilter *__restrict__ const documentsFilter,
+                           const uint32_t                      execFlags,
+                           Similarity::IndexSourceTermsScorer *scorer) {
+        static constexpr bool                                    trace{false};
+        // the width of the window of document IDs all queries process before any of them moves past it
+        static constexpr isrc_docid_t                            K_window{64 * 1024};
+        const bool                                               documentsOnly = execFlags & uint32_t(ExecFlags::DocumentsOnly);
+        BatchIndexSource                                         batchSrc(idxsrc);
+        std::unordered_map<str8_t, std::pair<uint32_t, bool>>    termsQueries; // term => (queries, required hits)
+        std::unordered_set<str8_t>                               queryTerms;
+        // declared after batchSrc so that they are destroyed before the shared postings their iterators reference
+        std::vector<std::unique_ptr<query_execution>> executions;
+
+        // Determine which terms are used by more than one query; we will only decode those once
+        // and the rest will be decoded by each query as usual
+        for (size_t i{0}; i != cnt; ++i) {
+                queryTerms.clear();
+
+                if (!queries[i])
+                        continue;
+
+                for (const auto n : queries[i].nodes()) {
+                        if (n->type != ast_node::Type::Token && n->type != ast_node::Type::Phrase)
+                                continue;
+
+                        const auto p = n->p;
+
+                        for (size_t k{0}; k != p->size; ++k) {
+                                const auto token = p->terms[k].token;
+                                auto &     info  = termsQueries[token];
+
+                                if (queryTerms.insert(token).second)
+                                        ++info.first;
+
+                                // we only need hits for phrases if we are only interested in documents
+                                info.second |= !documentsOnly || p->size > 1;
+                        }
+                }
+        }
+
+        for (const auto &it : termsQueries) {
+                if (it.second.first < 2)
+                        continue;
+
+                const auto term = it.first;
+
+                if (const auto tctx = idxsrc->term_ctx(term); tctx.documents) {
+                        if (trace)
+                                SLog("Shared [", term, "] ", it.second.first, " queries, ", dotnotation_repr(tctx.documents), " documents\n");
+
+                        batchSrc.shared.insert({term, std::make_unique<shared_postings>(idxsrc, term, tctx, it.second.second)});
+                }
+        }
+
+        // Resumable executions, so that we won't use the single term specializations, which would drain the shared postings
+        // on their own before any other query gets to use them
+        executions.reserve(cnt);
+        for (size_t i{0}; i != cnt; ++i) {
+                if (auto e = prepare_query_execution(queries[i], &batchSrc, maskedDocumentsRegistries[i], matchesFilters[i], documentsFilter, execFlags, scorer, nullptr, true))
+                        executions.emplace_back(std::move(e));
+        }
+
+        // A single pass over the documents space: all queries process [windowStart, windowEnd) before any of them moves past it.
+        // This is what bounds the shared postings buffers; once all queries are done with a window, we can drop the postings they
+        // are all past. A query that's already past the window(because none of its iterators match in it) just sits it out.
+        while (!executions.empty()) {
+                auto windowStart{DocIDsEND};
+
+                for (const auto &e : executions)
+                        windowStart = std::min(windowStart, e->next);
+
+                const auto windowEnd = DocIDsEND - windowStart > K_window ? windowStart + K_window : DocIDsEND;
+
+                for (auto &e : executions) {
+                        if (!e->resume_until(windowEnd))
+                                e.reset(); // done; release its iterators so that they won't hold back trim()
+                }
+
+                executions.erase(std::remove(executions.begin(), executions.end(), nullptr), executions.end());
+
+                for (auto &it : batchSrc.shared)
+                        it.second->trim();
+        }
 }
@@ -1,6 +1,7 @@
 // Please refer to https://github.com/phaistos-networks/Trinity/wiki/Query-Execution-Engine-Internals
 #pragma once
 #include "docidupdates.h"
+#include "docvalues.h"
 #include "index_source.h"
 #include "matches.h"
 #include "queries.h"
@@ -47,9 +48,90 @@ namespace Trinity {
                         throw Switch::invalid_argument("DocumentsOnly and AccumulatedScoreScheme are mutually exclusive modes");
         }
 
+        // Optional limits for a query execution; 0 means no limit.
+        //
+        // Throwing aborted_search_exception from a MatchedIndexDocumentsFilter is only possible when a document matches, so
+        // a pathological query that matches nothing can't be stopped that way. Limits are instead checked by the execution engine at span windows
+        // boundaries, i.e every K_window document IDs, except for maxMatches which is checked for every match.
+        // Once a limit has been reached, execution stops and truncated is set; the documents matched until then have
+        // already been provided to the MatchedIndexDocumentsFilter.
+        struct exec_limits final {
+                static constexpr isrc_docid_t K_window{64 * 1024};
+
+                // in Timings::Microseconds::Tick() units, e.g Timings::Microseconds::Tick() + Timings::Milliseconds::ToMicros(50)
+                uint64_t deadline{0};
+
+                // documents evaluated; that is, matched by the query, before the masked documents registry and the IndexDocumentsFilter are considered
+                uint64_t maxDocuments{0};
+
+                // postings decoded, for codecs that track them(see Codecs::Decoder::decodedPostings)
+                uint64_t maxPostings{0};
+
+                // stop once that many documents have been provided to the MatchedIndexDocumentsFilter
+                std::size_t maxMatches{0};
+
+                // if set, the execution starts from that index source document ID; documents before it are skipped(iterators advance() past them)
+                // without being evaluated. DocIDsEND skips the index source altogether.
+                // e.g for the next page of results of an index source sorted by a field, see exec_query_sorted()
+                isrc_docid_t firstDocumentID{0};
+
+                // set by the execution engine
+                bool truncated{false};
+        };
+
         void exec_query(const query &in, IndexSource *, masked_documents_registry *const maskedDocumentsRegistry, MatchedIndexDocumentsFilter *, IndexDocumentsFilter *const f = nullptr,
                         const uint32_t                      flags  = 0,
-                        Similarity::IndexSourceTermsScorer *scorer = nullptr);
+                        Similarity::IndexSourceTermsScorer *scorer = nullptr,
+                        exec_limits *const                  limits = nullptr);
+
+        // A query execution that can be suspended and resumed; see exec_query_resumable()
+        class QueryExecution {
+              public:
+                virtual ~QueryExecution() {
+                }
+
+                // Processes the matches among the next maxDocIDs index source document IDs, i.e within
+                // [next document ID to consider, next document ID to consider + maxDocIDs), and then suspends execution.
+                // Returns true if there may be more matches, false if the execution is complete(or a limit has been reached)
+                virtual bool resume(const isrc_docid_t maxDocIDs) = 0;
+
+                // Total matched documents so far
+                virtual std::size_t matched() const noexcept = 0;
+        };
+
+        // Like exec_query(), except that it only compiles the query and prepares for its execution, and returns a QueryExecution
+        // which you can resume() whenever you want to process the next window of document IDs, or nullptr if there is nothing to execute
+        // (e.g no documents can match the query).
+        //
+        // The execution context is owned by the QueryExecution and is passed explicitly to whatever needs it, so
+        // there is no thread affinity; e.g you can interleave the execution of many queries on the same thread, with time-slicing, and you can
+        // stop resuming(i.e preempt) long running queries. maskedDocumentsRegistry, matchesFilter and documentsFilter must outlive the QueryExecution;
+        // matchesFilter->finalize_index_source() is invoked when it is destroyed.
+        //
+        // Because single term queries are no longer special-cased, exec_query() is faster for those.
+        std::unique_ptr<QueryExecution> exec_query_resumable(const query &in, IndexSource *, masked_documents_registry *const maskedDocumentsRegistry, MatchedIndexDocumentsFilter *, IndexDocumentsFilter *const f = nullptr,
+                                                             const uint32_t                      flags  = 0,
+                                                             Similarity::IndexSourceTermsScorer *scorer = nullptr,
+                                                             exec_limits *const                  limits = nullptr);
+
+        // Executes a batch of queries against the same index source, e.g for alerting or percolation-like bulk jobs where
+        // thousands of queries are executed against each new segment, and many of them share the same (hot) terms.
+        //
+        // All queries are executed in a single pass over the documents space, in windows of 64k document IDs; every query processes
+        // a window before any of them moves on to the next one. The postings list of each distinct term used by 2+ queries is decoded once,
+        // into a buffer that all queries that use that term access(docs, frequencies, and hits if required) instead of decoding the same blocks again,
+        // and which only holds the postings from the lowest position of those queries onwards. Terms used by a single query are decoded as usual.
+        //
+        // Matches are dispatched per window, not per document; within a window, queries[0] reports its matches before queries[1] and so on.
+        // The results of queries[i] are provided to matchesFilters[i].
+        // maskedDocumentsRegistries[i] is used for queries[i]; you can't share the same registry among queries, because
+        // masked_documents_registry expects to test monotonically increasing document IDs (see scanner_registry_for())
+        void exec_queries(const query *queries, const std::size_t cnt, IndexSource *,
+                          masked_documents_registry **const maskedDocumentsRegistries,
+                          MatchedIndexDocumentsFilter **const matchesFilters,
+                          IndexDocumentsFilter *const         f      = nullptr,
+                          const uint32_t                      flags  = 0,
+                          Similarity::IndexSourceTermsScorer *scorer = nullptr);
 
         // Handy utility function; executes query on all index sources in the provided collection in sequence and returns
         // a vector with the match filters/results of each execution.
@@ -80,6 +162,87 @@ namespace Trinity {
                 return out;
         }
 
+        // exec_queries() for all index sources in the provided collection, in sequence
+        // Returns, for each query, the match filters/results of each index source, which you are expected to merge/reduce/blend
+        template <typename T, typename... Arg>
+        std::vector<std::vector<std::unique_ptr<T>>> exec_queries(const query *queries, const std::size_t cnt, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, Arg &&... args) {
+                static_assert(std::is_base_of<MatchedIndexDocumentsFilter, T>::value, "Expected a MatchedIndexDocumentsFilter subclass");
+                const auto                                   n = collection->sources.size();
+                std::vector<std::vector<std::unique_ptr<T>>> out(cnt);
+                std::vector<MatchedIndexDocumentsFilter *>   filters(cnt);
+                std::vector<masked_documents_registry *>     registries(cnt);
+
+                validate_flags(flags);
+
+                for (size_t i{0}; i != n; ++i) {
+                        auto                                          source = collection->sources[i];
+                        std::vector<single_masked_documents_registry> scanners;
+
+                        if (source->index_empty())
+                                continue;
+
+                        // registries[] point into scanners[]
+                        scanners.reserve(cnt);
+
+                        for (size_t qi{0}; qi != cnt; ++qi) {
+                                out[qi].emplace_back(std::make_unique<T>(std::forward<Arg>(args)...));
+                                filters[qi] = out[qi].back().get();
+
+                                scanners.emplace_back(collection->scanner_registry_for(i));
+                                registries[qi] = scanners.back().get();
+                        }
+
+                        exec_queries(queries, cnt, source, registries.data(), filters.data(), f, flags);
+                }
+
+                return out;
+        }
+
+        // Executes query on all index sources in the provided collection in sequence, for the top-k documents by sort(see SortedDocumentsCollector), and
+        // returns a vector with the match filters/results of each execution, which you are expected to merge.
+        //
+        // For index sources that are sorted the same way(see index_sort), the first k matched documents that are not masked or filtered are the top-k documents
+        // of the source, so the execution stops once they have been provided to the MatchedIndexDocumentsFilter(see exec_limits::maxMatches) instead of
+        // matching all documents of the source, which is what makes e.g "newest first" queries for large categories cheap.
+        // Other index sources are executed as usual.
+        //
+        // If after is set(search-after; usually the last document of the previous page of results), the execution of sorted index sources starts from the
+        // first document ordered after it(see DocValues::first_after()), so that the cost of the next page doesn't grow with the number of pages before it.
+        // You should also provide it to the MatchedIndexDocumentsFilter, which is expected to reject documents ordered at or before it in other index sources.
+        template <typename T, typename... Arg>
+        std::vector<std::unique_ptr<T>> exec_query_sorted(const query &in, IndexSourcesCollection *collection, IndexDocumentsFilter *f, const uint32_t flags, const index_sort &sort,
+                                                          const sorted_document *const after, const std::size_t k, Arg &&... args) {
+                static_assert(std::is_base_of<MatchedIndexDocumentsFilter, T>::value, "Expected a MatchedIndexDocumentsFilter subclass");
+                const auto                      n = collection->sources.size();
+                std::vector<std::unique_ptr<T>> out;
+
+                validate_flags(flags);
+                if (flags & unsigned(ExecFlags::AccumulatedScoreScheme))
+                        throw Switch::invalid_argument("AccumulatedScoreScheme is not supported");
+
+                for (size_t i{0}; i != n; ++i) {
+                        auto       source  = collection->sources[i];
+                        auto       scanner = collection->scanner_registry_for(i);
+                        auto       filter  = std::make_unique<T>(std::forward<Arg>(args)...);
+                        const auto dv      = source->doc_values();
+
+                        if (const auto s = dv ? dv->documents_sort() : nullptr; s && *s == sort && k && !source->require_docid_translation()) {
+                                exec_limits limits;
+
+                                limits.maxMatches = k;
+                                if (after)
+                                        limits.firstDocumentID = dv->first_after(*after);
+                                if (limits.firstDocumentID != DocIDsEND)
+                                        exec_query(in, source, scanner.get(), filter.get(), f, flags, nullptr, &limits);
+                        } else
+                                exec_query(in, source, scanner.get(), filter.get(), f, flags);
+
+                        out.push_back(std::move(filter));
+                }
+
+                return out;
+        }
+
         // Parallel queries execution, using std::async()
         // This variant also supports ExecFlags::AccumulatedScoreScheme
         // You will need to provide a cs for this to work
@@ -0,0 +1,249 @@
+#include "facets.h"
+#include "index_source.h"
+
+Trinity::FacetsCollector::FacetsCollector(const str8_t *const fieldNames, const uint8_t cnt) {
+        fields.resize(cnt);
+        for (uint8_t i{0}; i != cnt; ++i)
+                fields[i].name = fieldNames[i];
+}
+
+void Trinity::FacetsCollector::prepare_index_source(IndexSource *const src) {
+        const auto dv = src->doc_values();
+
+        if (dv && src->require_docid_translation())
+                throw Switch::invalid_argument("FacetsCollector doesn't support index sources that require document IDs translation");
+
+        // whatever's pending belongs to the previous index source, if any
+        flush();
+        lastID = 0;
+
+        for (auto &fc : fields) {
+                fold(fc);
+
+                fc.dense.clear();
+                fc.f  = dv ? dv->field(fc.name) : nullptr;
+                fc.bi = 0;
+                if (!fc.f)
+                        continue;
+                else if (fc.seen && fc.kind != fc.f->kind)
+                        throw Switch::data_error("Unexpected value kind for field ", fc.name);
+
+                const auto f = fc.f;
+
+                fc.seen = true;
+                fc.kind = f->kind;
+                fc.base = 0;
+                if (f->kind == docvalues_kind::String)
+                        fc.dense.resize(f->dictCnt);
+                else if (f->blocksCnt) {
+                        auto min = f->blocks[0].min, max = f->blocks[0].max;
+
+                        for (uint32_t i{1}; i < f->blocksCnt; ++i) {
+                                min = std::min(min, f->blocks[i].min);
+                                max = std::max(max, f->blocks[i].max);
+                        }
+
+                        if (uint64_t(max) - uint64_t(min) < K_max_dense_range) {
+                                fc.base = min;
+                                fc.dense.resize(uint64_t(max) - uint64_t(min) + 1);
+                        }
+                }
+        }
+}
+
+void Trinity::FacetsCollector::finalize_index_source(IndexSource *) {
+        flush();
+        lastID = 0;
+
+        for (auto &fc : fields) {
+                fold(fc);
+
+                fc.dense.clear();
+                fc.f  = nullptr;
+                fc.bi = 0;
+        }
+}
+
+void Trinity::FacetsCollector::consider(const docid_t *const ids, const size_t cnt) {
+        for (size_t i{0}; i != cnt;) {
+                const auto n = std::min<size_t>(cnt - i, K_batch_size - batchSize);
+
+                memcpy(batch + batchSize, ids + i, n * sizeof(docid_t));
+                batchSize += n;
+                i += n;
+                if (batchSize == K_batch_size)
+                        flush();
+        }
+}
+
+void Trinity::FacetsCollector::flush() {
+        if (!batchSize)
+                return;
+
+        if (!std::is_sorted(batch, batch + batchSize))
+                std::sort(batch, batch + batchSize);
+
+        if (batch[0] < lastID) {
+                // not in ascending order across batches; restart from the first block
+                for (auto &fc : fields)
+                        fc.bi = 0;
+        }
+
+        for (auto &fc : fields) {
+                if (fc.f)
+                        count(fc, batch, batchSize);
+        }
+
+        lastID = batch[batchSize - 1];
+        matched_ += batchSize;
+        batchSize = 0;
+}
+
+void Trinity::FacetsCollector::count(field_counts &fc, const docid_t *const ids, const uint32_t n) {
+        const auto  f      = fc.f;
+        const auto  blocks = f->blocks;
+        auto *const dense  = fc.dense.data();
+        const auto  base   = fc.base;
+        const bool  isDense{!fc.dense.empty()};
+        uint32_t    bi{fc.bi};
+
+        const auto add = [&](const int64_t v, const uint32_t c) {
+                if (isDense)
+                        dense[uint64_t(v) - uint64_t(base)] += c;
+                else
+                        fc.sparse[v] += c;
+        };
+
+        for (uint32_t i{0}; i != n;) {
+                if ((bi = f->block_for(bi, ids[i])) == f->blocksCnt)
+                        break;
+
+                const auto &b = blocks[bi];
+
+                // documents before the block have no value
+                while (i != n && ids[i] < b.firstDocID)
+                        ++i;
+
+                // [i, e) are within the block
+                auto e = i;
+
+                while (e != n && ids[e] <= b.lastDocID)
+                        ++e;
+
+                if (i == e)
+                        continue;
+
+                if (!b.docBits) {
+                        // consecutive documents
+                        if (!b.valueBits)
+                                add(b.min, e - i);
+                        else {
+                                for (; i != e; ++i)
+                                        add(f->value(b, ids[i] - b.firstDocID), 1);
+                        }
+                } else if ((e - i) * 8 > b.cnt) {
+                        // many matched documents in this block; merge-scan instead of searching for each of them
+                        uint32_t     j{0};
+                        isrc_docid_t d{f->document(b, 0)};
+
+                        for (; i != e; ++i) {
+                                while (d < ids[i] && ++j != b.cnt)
+                                        d = f->document(b, j);
+
+                                if (j == b.cnt)
+                                        break;
+                                else if (d == ids[i])
+                                        add(f->value(b, j), 1);
+                        }
+                        i = e;
+                } else {
+                        uint32_t j{0};
+
+                        for (; i != e; ++i) {
+                                if ((j = f->lower_bound(b, j, ids[i])) == b.cnt)
+                                        break;
+                                else if (f->document(b, j) == ids[i])
+                                        add(f->value(b, j), 1);
+                        }
+                        i = e;
+                }
+        }
+
+        fc.bi = bi;
+}
+
+void Trinity::FacetsCollector::fold(field_counts &fc) {
+        if (const auto f = fc.f) {
+                for (uint32_t i{0}; i != fc.dense.size(); ++i) {
+                        if (const auto c = fc.dense[i]) {
+                                if (f->kind == docvalues_kind::String)
+                                        fc.strings[std::string(f->string(i).data(), f->string(i).size())] += c;
+                                else
+                                        fc.values[int64_t(uint64_t(fc.base) + i)] += c;
+                        }
+                }
+
+                for (const auto &it : fc.sparse)
+                        fc.values[it.first] += it.second;
+        }
+
+        std::fill(fc.dense.begin(), fc.dense.end(), 0);
+        fc.sparse.clear();
+}
+
+void Trinity::FacetsCollector::collect(std::vector<merged_counts> *const all, const field_counts &fc) {
+        if (!fc.seen)
+                return;
+
+        auto it = std::find_if(all->begin(), all->end(), [&fc](const auto &m) noexcept { return m.name == fc.name; });
+
+        if (it == all->end()) {
+                all->emplace_back();
+                it       = all->end() - 1;
+                it->name = fc.name;
+                it->kind = fc.kind;
+        } else if (it->kind != fc.kind)
+                throw Switch::data_error("Unexpected value kind for field ", fc.name);
+
+        for (const auto &v : fc.strings)
+                it->strings[v.first] += v.second;
+        for (const auto &v : fc.values)
+                it->values[v.first] += v.second;
+}
+
+std::vector<Trinity::FacetsCollector::facet> Trinity::FacetsCollector::finalize(const std::vector<merged_counts> &all, const std::size_t topN) {
+        std::vector<facet> res;
+
+        for (const auto &m : all) {
+                facet f;
+
+                f.field.assign(m.name.data(), m.name.size());
+                f.kind = m.kind;
+                for (const auto &it : m.strings)
+                        f.values.push_back({it.first, 0, it.second});
+                for (const auto &it : m.values)
+                        f.values.push_back({{}, it.first, it.second});
+
+                const auto n = topN ? std::min(topN, f.values.size()) : f.values.size();
+
+                std::partial_sort(f.values.begin(), f.values.begin() + n, f.values.end(), [](const auto &a, const auto &b) noexcept {
+                        return a.count > b.count || (a.count == b.count && (a.str < b.str || (a.str == b.str && a.value < b.value)));
+                });
+                f.values.resize(n);
+                res.push_back(std::move(f));
+        }
+
+        return res;
+}
+
+std::vector<Trinity::FacetsCollector::facet> Trinity::FacetsCollector::facets(const std::size_t topN) {
+        std::vector<merged_counts> all;
+
+        flush();
+        for (auto &fc : fields) {
+                fold(fc);
+                collect(&all, fc);
+        }
+
+        return finalize(all, topN);
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "docvalues.h"
+#include "matches.h"
+
+namespace Trinity {
+        // Counts the values of matched documents in doc-values columns(see docvalues.h), e.g how many of the matched products are
+        // of each brand, for the facets of a search results page, without having to look up every matched document in an external store.
+        //
+        // Matched document IDs are buffered and resolved in batches of up to K_batch_size against each column. Because the execution engine
+        // provides matches in ascending document ID order, resolving a batch is a merge-scan of the batch and the column's blocks, galloping
+        // past blocks that contain no matched documents. For blocks of consecutive documents, the value of a document is located by its offset in the block, and
+        // for blocks where all documents have the same value, all matched documents in the block are counted at once.
+        //
+        // Counts are tracked in an array indexed by ordinal for strings, or by (value - column minimum) for numeric columns if the
+        // range of the column's values is narrow(see K_max_dense_range), and in a hashtable otherwise.
+        //
+        // You may use it with exec_query_par() to count the facets of all index sources in parallel, and merge() the counts of all collectors, e.g
+        // 	const str8_t fields[] = {"brand"_s8, "category"_s8};
+        // 	auto res = exec_query_par<FacetsCollector>(q, &collection, nullptr, unsigned(ExecFlags::DocumentsOnly), nullptr, fields, 2);
+        // 	auto facets = FacetsCollector::merge(res, 10);
+        //
+        // Subclass and override consider() if you also need to collect the matched documents, and invoke FacetsCollector::consider() from your overrides.
+        // Index sources that require document IDs translation are not supported, because doc-values are keyed by index source document IDs.
+        class FacetsCollector
+            : public MatchedIndexDocumentsFilter {
+              public:
+                static constexpr uint32_t K_batch_size{512};
+                static constexpr uint64_t K_max_dense_range{64 * 1024};
+
+                struct facet_value final {
+                        std::string str;   // docvalues_kind::String
+                        int64_t     value; // docvalues_kind::Numeric
+                        uint64_t    count;
+                };
+
+                struct facet final {
+                        std::string              field;
+                        docvalues_kind           kind;
+                        std::vector<facet_value> values; // by count DESC, value ASC
+                };
+
+              private:
+                struct field_counts final {
+                        str8_t                 name;
+                        docvalues_kind         kind{docvalues_kind::Numeric};
+                        bool                   seen{false}; // set if any index source had a column for that field
+                        const docvalues_field *f{nullptr};   // in the current index source
+                        uint32_t               bi{0};        // current block of f
+                        int64_t                base{0};
+                        std::vector<uint32_t>  dense; // by ordinal, or value - base
+                        std::unordered_map<int64_t, uint32_t> sparse;
+
+                        // counts of previous index sources
+                        std::unordered_map<std::string, uint64_t> strings;
+                        std::unordered_map<int64_t, uint64_t>     values;
+                };
+
+                struct merged_counts final {
+                        str8_t                                    name;
+                        docvalues_kind                            kind;
+                        std::unordered_map<std::string, uint64_t> strings;
+                        std::unordered_map<int64_t, uint64_t>     values;
+                };
+
+                std::vector<field_counts> fields;
+                docid_t                   batch[K_batch_size];
+                uint32_t                  batchSize{0};
+                docid_t                   lastID{0};
+                uint64_t                  matched_{0};
+
+              private:
+                void flush();
+
+                void count(field_counts &, const docid_t *ids, const uint32_t n);
+
+                // moves the counts of the current index source to strings or values; strings are copied from the
+                // index source's dictionary, so that they outlive it
+                void fold(field_counts &);
+
+                static void collect(std::vector<merged_counts> *, const field_counts &);
+
+                static std::vector<facet> finalize(const std::vector<merged_counts> &, const std::size_t topN);
+
+              public:
+                // fields must outlive the collector
+                FacetsCollector(const str8_t *const fieldNames, const uint8_t cnt);
+
+                void prepare_index_source(IndexSource *src) override;
+
+                // Folds the counts of src and forgets its columns, so that the index source(and its doc-values) can be released
+                // before facets() or merge() are invoked
+                void finalize_index_source(IndexSource *src) override;
+
+                void consider(const docid_t id) override {
+                        batch[batchSize++] = id;
+                        if (batchSize == K_batch_size)
+                                flush();
+                }
+
+                void consider(const docid_t *const ids, const size_t cnt) override;
+
+                void consider(const docid_t id, const double) override {
+                        FacetsCollector::consider(id);
+                }
+
+                void consider(const matched_document &match) override {
+                        FacetsCollector::consider(match.id);
+                }
+
+                // total documents considered
+                inline uint64_t matched() const noexcept {
+                        return matched_ + batchSize;
+                }
+
+                // The counts of this collector, for each field that exists in any of the index sources it was used for.
+                // If topN != 0, only the topN values(by count) of each field are returned
+                std::vector<facet> facets(const std::size_t topN = 0);
+
+                // Merges the counts of all collectors
+                template <typename T>
+                static std::vector<facet> merge(const std::vector<std::unique_ptr<T>> &collectors, const std::size_t topN = 0) {
+                        static_assert(std::is_base_of<FacetsCollector, T>::value);
+                        std::vector<merged_counts> all;
+
+                        for (const auto &c : collectors) {
+                                c->flush();
+                                for (auto &fc : c->fields) {
+                                        c->fold(fc);
+                                        collect(&all, fc);
+                                }
+                        }
+
+                        return finalize(all, topN);
+                }
+        };
+} // namespace Trinity
@@ -0,0 +1,133 @@
+#include "filter_cache.h"
+#include <switch_bitops.h>
+
+std::shared_ptr<const Trinity::docids_set> Trinity::docids_set::make(const isrc_docid_t *const ids, const uint32_t cnt) {
+        auto              res      = std::make_shared<docids_set>();
+        const auto        maxDocID = cnt ? ids[cnt - 1] : 0;
+        const std::size_t bmWords  = maxDocID / 64 + 1;
+
+        res->cnt      = cnt;
+        res->maxDocID = maxDocID;
+
+        // pick whichever's smaller
+        if (cnt * sizeof(isrc_docid_t) <= bmWords * sizeof(uint64_t)) {
+                res->repr = Repr::Array;
+                res->ids.reset(new isrc_docid_t[cnt]);
+                memcpy(res->ids.get(), ids, cnt * sizeof(isrc_docid_t));
+        } else {
+                auto bm = new uint64_t[bmWords];
+
+                memset(bm, 0, bmWords * sizeof(uint64_t));
+                for (uint32_t i{0}; i != cnt; ++i)
+                        bm[ids[i] / 64] |= uint64_t(1) << (ids[i] & 63);
+
+                res->repr = Repr::Bitmap;
+                res->bm.reset(bm);
+        }
+
+        return res;
+}
+
+std::shared_ptr<const Trinity::docids_set> Trinity::docids_set::from_bitmap(std::unique_ptr<uint64_t[]> bm, std::size_t words) {
+        auto     res = std::make_shared<docids_set>();
+        uint32_t cnt{0};
+
+        while (words && !bm[words - 1])
+                --words;
+        for (std::size_t i{0}; i != words; ++i)
+                cnt += SwitchBitOps::PopCnt(bm[i]);
+
+        res->cnt      = cnt;
+        res->maxDocID = words ? (words - 1) * 64 + 63 - SwitchBitOps::LeadingZeros(bm[words - 1]) : 0;
+
+        if (cnt * sizeof(isrc_docid_t) <= words * sizeof(uint64_t)) {
+                auto ids = new isrc_docid_t[cnt];
+                auto out = ids;
+
+                for (std::size_t i{0}; i != words; ++i) {
+                        for (auto w = bm[i]; w; w &= w - 1)
+                                *out++ = i * 64 + SwitchBitOps::TrailingZeros(w);
+                }
+
+                res->repr = Repr::Array;
+                res->ids.reset(ids);
+        } else {
+                res->repr = Repr::Bitmap;
+                res->bm   = std::move(bm);
+        }
+
+        return res;
+}
+
+Trinity::FilterCache::FilterCache(const std::size_t capacityInBytes, const uint64_t minCost_, const uint16_t minFrequency_)
+    : capacity{capacityInBytes}, minCost{minCost_}, minFrequency{minFrequency_} {
+        memset(tracked, 0, sizeof(tracked));
+}
+
+std::shared_ptr<const Trinity::docids_set> Trinity::FilterCache::get(const std::string &key) {
+        std::lock_guard<std::mutex> g(lock);
+
+        if (const auto it = map.find(key); it != map.end()) {
+                lru.splice(lru.begin(), lru, it->second);
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return it->second->set;
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+}
+
+bool Trinity::FilterCache::consider(const std::string &key) {
+        const uint64_t              h = std::hash<std::string>{}(key);
+        std::lock_guard<std::mutex> g(lock);
+        auto &                      slot = tracked[trackedNext];
+
+        if (slot) {
+                // forget about the oldest tracked key
+                if (auto it = trackedFreqs.find(slot); it != trackedFreqs.end() && 0 == --(it->second))
+                        trackedFreqs.erase(it);
+        }
+
+        slot        = h;
+        trackedNext = (trackedNext + 1) % K_tracked_keys;
+        return ++trackedFreqs[h] >= minFrequency;
+}
+
+void Trinity::FilterCache::put(const std::string &key, std::shared_ptr<const docids_set> set) {
+        const auto                  required = set->size_in_bytes() + key.size();
+        std::lock_guard<std::mutex> g(lock);
+
+        if (required > capacity / 4) {
+                // won't let a single set claim most of the cache
+                return;
+        } else if (map.count(key)) {
+                // another thread beat us to it
+                return;
+        }
+
+        while (size + required > capacity && !lru.empty()) {
+                auto &e = lru.back();
+
+                size -= e.set->size_in_bytes() + e.key.size();
+                map.erase(e.key);
+                lru.pop_back();
+                evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        lru.push_front({key, std::move(set)});
+        map.insert({key, lru.begin()});
+        size += required;
+}
+
+void Trinity::FilterCache::evict_generation(const uint64_t gen) {
+        std::lock_guard<std::mutex> g(lock);
+
+        for (auto it = lru.begin(); it != lru.end();) {
+                if (it->key.size() >= sizeof(uint64_t) && !memcmp(it->key.data(), &gen, sizeof(uint64_t))) {
+                        size -= it->set->size_in_bytes() + it->key.size();
+                        map.erase(it->key);
+                        it = lru.erase(it);
+                } else
+                        ++it;
+        }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "common.h"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Trinity {
+        // An immutable set of index source document IDs, materialized from an execution nodes sub-tree
+        // Depending on its density, it's either a sorted array of IDs or a bitmap, whichever's smaller.
+        struct docids_set final {
+                enum class Repr : uint8_t {
+                        Array = 0,
+                        Bitmap
+                } repr;
+
+                uint32_t                        cnt;
+                isrc_docid_t                    maxDocID;
+                std::unique_ptr<isrc_docid_t[]> ids; // Array
+                std::unique_ptr<uint64_t[]>     bm;  // Bitmap: (maxDocID / 64 + 1) words
+
+                // ids must be in ascending order
+                static std::shared_ptr<const docids_set> make(const isrc_docid_t *ids, const uint32_t cnt);
+
+                // Takes ownership of bm(words in size), which is used as is if that's the smaller representation
+                static std::shared_ptr<const docids_set> from_bitmap(std::unique_ptr<uint64_t[]> bm, const std::size_t words);
+
+                inline std::size_t size_in_bytes() const noexcept {
+                        return sizeof(docids_set) + (repr == Repr::Array ? cnt * sizeof(isrc_docid_t) : (maxDocID / 64 + 1) * sizeof(uint64_t));
+                }
+        };
+
+        // A Lucene-style filter cache, shared by all threads and index sources.
+        //
+        // Applications almost always AND or NOT the same handful of filter sub-expressions (e.g [cid:806 AND instock:1])
+        // with the query, and the execution engine would otherwise evaluate them again for every query. With a FilterCache
+        // attached to an IndexSource(see IndexSource::use_filter_cache()), exec_query() will consider exec_node sub-trees
+        // whose cost(as computed by reorder_execnode()) is at least minCost, and once a sub-tree has been seen minFrequency
+        // times among the last K_tracked_keys considered, it is materialized into a docids_set, and this and all later queries will
+        // replace the sub-tree with an iterator over that set.
+        //
+        // Sub-trees are keyed by (IndexSource::generation(), canonical representation of the sub-tree), where the canonical
+        // representation is based on the terms, not on the query-specific term IDs, and the order of the operands of commutative
+        // operators doesn't matter. Sets are bounded by capacityInBytes in total, and the least recently used are evicted first.
+        // Because the generation is all that identifies the source, the cache is only used for sources that are IndexSource::immutable().
+        //
+        // Only sub-trees that are never scored, and for which we don't need to collect the matched terms, can be
+        // replaced: the RHS of logical NOT(i.e the filter) in all execution modes, and any sub-tree if ExecFlags::DocumentsOnly is set.
+        class FilterCache final {
+              public:
+                static constexpr std::size_t K_tracked_keys{256};
+
+              private:
+                struct entry final {
+                        std::string                       key;
+                        std::shared_ptr<const docids_set> set;
+                };
+
+                std::mutex                                                   lock;
+                std::list<entry>                                             lru; // most recently used first
+                std::unordered_map<std::string, std::list<entry>::iterator> map;
+                std::size_t                                                  size{0};
+                const std::size_t                                            capacity;
+
+                // ring of the hashes of the last K_tracked_keys keys considered and their frequencies
+                uint64_t                               tracked[K_tracked_keys];
+                uint32_t                               trackedNext{0};
+                std::unordered_map<uint64_t, uint16_t> trackedFreqs;
+
+              public:
+                const uint64_t        minCost;
+                const uint16_t        minFrequency;
+                std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+
+              public:
+                FilterCache(const std::size_t capacityInBytes, const uint64_t minCost = 4096, const uint16_t minFrequency = 2);
+
+                // Keys begin with the (u64) IndexSource generation, followed by the canonical representation of the sub-tree
+                // Returns the set for key if cached, nullptr otherwise
+                std::shared_ptr<const docids_set> get(const std::string &key);
+
+                // Tracks another use of key, and returns true if it should now be materialized and put() in the cache
+                bool consider(const std::string &key);
+
+                void put(const std::string &key, std::shared_ptr<const docids_set> set);
+
+                // Drops all sets of the index source with that generation; e.g when a segment has been merged away
+                void evict_generation(const uint64_t gen);
+        };
+} // namespace Trinity
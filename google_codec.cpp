@@ -150,7 +150,7 @@ void Trinity::Codecs::Google::Encoder::commit_block() {
                 if (likely(skipListData.size() / (sizeof(isrc_docid_t) + sizeof(uint32_t)) < UINT16_MAX)) {
                         // we can only support upto 65k skiplist entries so that
                         // we will only need a u16 to store that number in the index chunk header for the term
-                        skipListData.pack(prevBlockLastDocumentID, uint32_t(out->size() - curTermOffset));
+                        skipListData.pack(prevBlockLastDocumentID, uint32_t((out->size() + sess->indexOutFlushed) - curTermOffset));
 
                         if (trace)
                                 SLog("NOW skipListData.size = ", skipListData.size(), "\n");
@@ -179,10 +179,29 @@ range32_t Trinity::Codecs::Google::IndexSession::append_index_chunk(const Trinit
         auto       src = static_cast<const Trinity::Codecs::Google::AccessProxy *>(src_);
         const auto o   = indexOut.size() + indexOutFlushed;
 
+        if (indexOutFd != -1) {
+                if (const auto fd = source_file_fd(src, "index"); fd != -1) {
+                        copy_index_chunk(fd, srcTCTX.indexChunk.offset, srcTCTX.indexChunk.size());
+                        return {uint32_t(o), srcTCTX.indexChunk.size()};
+                }
+        }
+
         indexOut.serialize(src->indexPtr + srcTCTX.indexChunk.offset, srcTCTX.indexChunk.size());
         return {uint32_t(o), srcTCTX.indexChunk.size()};
 }
 
+// Google index chunks are position independent (skiplist entries are relative to the chunk), so
+// we only need to copy the partition's index and adjust the chunk offsets
+void Trinity::Codecs::Google::IndexSession::append_partition(Trinity::Codecs::IndexSession *part, std::pair<str8_t, term_index_ctx> *terms, const size_t termsCnt) {
+        const auto base = indexOut.size() + indexOutFlushed;
+
+        require(part->indexOutFlushed == 0);
+        indexOut.serialize(part->indexOut.data(), part->indexOut.size());
+
+        for (size_t i{0}; i != termsCnt; ++i)
+                terms[i].second.indexChunk.offset += base;
+}
+
 void Trinity::Codecs::Google::IndexSession::merge(IndexSession::merge_participant *participants, const uint16_t participantsCnt, Trinity::Codecs::Encoder *encoder_) {
         static constexpr bool trace{false};
 
@@ -636,6 +655,7 @@ void Trinity::Codecs::Google::Decoder::unpack_block(PostingsListIterator *const
         // We don't need to track current block documents cnt, because
         // we can just check if (documents[blockDocIdx] == blockLastDocID)
         it->blockDocIdx = 0;
+        decodedPostings += n;
 }
 
 void Trinity::Codecs::Google::Decoder::seek_block(PostingsListIterator *const it, const isrc_docid_t target) {
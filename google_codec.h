@@ -29,7 +29,7 @@ namespace Trinity
                                 Trinity::Codecs::Encoder *new_encoder() override final;
 
                                 IndexSession(const char *bp)
-                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge)}
+                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge) | unsigned(Capabilities::Partitions)}
                                 {
                                 }
 
@@ -41,6 +41,13 @@ namespace Trinity
                                 range32_t append_index_chunk(const Trinity::Codecs::AccessProxy *, const term_index_ctx srcTCTX) override final;
 
                                 void merge(merge_participant *, const uint16_t, Trinity::Codecs::Encoder *) override final;
+
+                                Trinity::Codecs::IndexSession *new_partition_session() override final
+                                {
+                                        return new IndexSession(basePath);
+                                }
+
+                                void append_partition(Trinity::Codecs::IndexSession *, std::pair<str8_t, term_index_ctx> *, const size_t) override final;
                         };
 
                         class Encoder final
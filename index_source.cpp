@@ -7,9 +7,40 @@ void Trinity::IndexSourcesCollection::commit() {
 
         map.clear();
         all.clear();
+        collapsedMaskedDocuments.clear();
+        collapsedMaskedDocumentsStorage.clear();
+
+        std::vector<docid_t> ids, fresh, merged;
+        std::size_t          collapsed{0}; // how many of all[] are accounted for in ids
+
         for (auto s : sources) {
                 auto ud = s->masked_documents();
 
+                if (collapsed != all.size()) {
+                        // more updated_documents since the last source; collapse them into a new set
+                        auto b = std::make_unique<IOBuffer>();
+
+                        // ids is already sorted and unique; only sort the newly materialized IDs, and merge
+                        fresh.clear();
+                        while (collapsed != all.size()) {
+                                materialize_updates(all[collapsed++], &fresh);
+                        }
+
+                        std::sort(fresh.begin(), fresh.end());
+                        fresh.erase(std::unique(fresh.begin(), fresh.end()), fresh.end());
+                        merged.clear();
+                        std::set_union(ids.begin(), ids.end(), fresh.begin(), fresh.end(), std::back_inserter(merged));
+                        std::swap(ids, merged);
+
+                        pack_updates(ids, b.get());
+                        collapsedMaskedDocuments.push_back(unpack_updates({reinterpret_cast<const uint8_t *>(b->data()), uint32_t(b->size())}));
+                        collapsedMaskedDocumentsStorage.push_back(std::move(b));
+                } else if (collapsedMaskedDocuments.empty()) {
+                        collapsedMaskedDocuments.push_back({});
+                } else {
+                        collapsedMaskedDocuments.push_back(collapsedMaskedDocuments.back());
+                }
+
                 map.push_back({s, all.size()});
                 if (ud)
                         all.push_back(ud);
@@ -23,8 +54,89 @@ Trinity::IndexSourcesCollection::~IndexSourcesCollection() {
         }
 }
 
-std::unique_ptr<Trinity::masked_documents_registry> Trinity::IndexSourcesCollection::scanner_registry_for(const uint16_t idx) {
-        const auto n = map[idx].second;
+Trinity::IndexSourcesCollectionSnapshots::reader_slot *Trinity::IndexSourcesCollectionSnapshots::enter() {
+        static std::atomic<uint32_t> nextThreadIndex{0};
+        static thread_local uint32_t threadIndex{nextThreadIndex.fetch_add(1, std::memory_order_relaxed)};
+
+        for (auto i{threadIndex};; ++i) {
+                auto       slot     = slots + (i % K_max_readers);
+                uint64_t   expected = 0;
+                const auto e        = epoch.load();
+
+                // Nested acquire()s from the same thread, or other threads mapped to the same slot, will
+                // try the next slot(s)
+                if (slot->epoch.compare_exchange_strong(expected, e)) {
+                        return slot;
+                }
+        }
+}
+
+void Trinity::IndexSourcesCollectionSnapshots::leave(reader_slot *const slot) {
+        slot->epoch.store(0, std::memory_order_release);
+
+        if (retiredCnt.load(std::memory_order_relaxed)) {
+                reclaim();
+        }
+}
+
+Trinity::IndexSourcesCollectionSnapshots::pinned Trinity::IndexSourcesCollectionSnapshots::acquire() {
+        auto slot = enter();
+
+        // we must load current _after_ we have announced our epoch (seq_cst)
+        // see reclaim_impl()
+        return {this, slot, current.load()};
+}
+
+void Trinity::IndexSourcesCollectionSnapshots::publish(IndexSourcesCollection *const c) {
+        auto prev = current.exchange(c);
+
+        if (prev) {
+                std::lock_guard<std::mutex> g(retiredLock);
+
+                // Readers that announced an epoch > than the one we retire prev with
+                // have done so after we exchanged current, so they can't be accessing prev
+                retired.push_back({prev, epoch.fetch_add(1)});
+                retiredCnt.store(retired.size(), std::memory_order_relaxed);
+        }
+
+        reclaim();
+}
+
+void Trinity::IndexSourcesCollectionSnapshots::reclaim() {
+        std::unique_lock<std::mutex> g(retiredLock, std::try_to_lock);
+
+        // if someone else is reclaiming, they will take care of it
+        if (g.owns_lock()) {
+                reclaim_impl();
+        }
+}
+
+void Trinity::IndexSourcesCollectionSnapshots::reclaim_impl() {
+        auto oldest = std::numeric_limits<uint64_t>::max();
+
+        for (const auto &it : slots) {
+                if (const auto e = it.epoch.load(); e && e < oldest) {
+                        oldest = e;
+                }
+        }
+
+        retired.erase(std::remove_if(retired.begin(), retired.end(), [oldest](const auto &it) {
+                              if (it.epoch < oldest) {
+                                      delete it.collection;
+                                      return true;
+                              } else {
+                                      return false;
+                              }
+                      }),
+                      retired.end());
+        retiredCnt.store(retired.size(), std::memory_order_relaxed);
+}
+
+Trinity::IndexSourcesCollectionSnapshots::~IndexSourcesCollectionSnapshots() {
+        // No readers are expected to be around
+        for (const auto &it : retired) {
+                delete it.collection;
+        }
 
-        return masked_documents_registry::make(all.data(), n);
+        delete current.load();
 }
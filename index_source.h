@@ -1,5 +1,6 @@
 #pragma once
 #include "codecs.h"
+#include <atomic>
 #include <mutex>
 #include <switch.h>
 #include <switch_dictionary.h>
@@ -7,6 +8,41 @@
 #include <switch_refcnt.h>
 
 namespace Trinity {
+        class FilterCache;
+        class DocValues;
+
+        // The common words an index source was indexed with; see SegmentIndexSession::set_common_words()
+        //
+        // All occurrences of a pair of adjacent terms are indexed as a bigram only if either of the two terms is a common word, so a bigram
+        // that exists in an index source is not necessarily complete unless that is the case; e.g if a segment indexed with common words [of] is merged
+        // with another indexed with [the], then [the<sep>world] exists in the merged segment, but not for the documents of the first segment.
+        // exec_query() only uses the bigrams of pairs with a word of the index source's set, and merge() refuses to merge candidates indexed with different sets.
+        //
+        // Segments persist them in basePath/common_words
+        struct common_words_set final {
+                std::vector<std::string> words; // distinct, sorted by terms_cmp()
+
+                bool contains(const str8_t w) const noexcept {
+                        const auto it = std::lower_bound(words.begin(), words.end(), w, [](const std::string &a, const str8_t b) noexcept {
+                                return terms_cmp(a.data(), a.size(), b.data(), b.size()) < 0;
+                        });
+
+                        return it != words.end() && !terms_cmp(it->data(), it->size(), w.data(), w.size());
+                }
+
+                // Sorts and dedups words
+                void normalize();
+
+                bool operator==(const common_words_set &o) const noexcept {
+                        return words == o.words;
+                }
+
+                void persist(const char *path) const;
+
+                // Returns nullptr if there is no such file, i.e the index source was indexed without common words
+                static std::unique_ptr<common_words_set> open(const char *path);
+        };
+
         // An index source provides term_index_ctx and decoders to the query execution runtime
         // It can be a RO wrapper to an index segment, a wrapper to a simple hashtable/list, anything
         // Lucene implements near real-time search by providing a segment wrapper(i.e index source) which accesses the indexer state directly
@@ -22,6 +58,7 @@ namespace Trinity {
                 simple_allocator                           keysAllocator{512};
                 std::unordered_map<str8_t, term_index_ctx> cache;
                 uint64_t                                   gen{0}; // See IndexSourcesCollection
+                FilterCache *                              filterCache{nullptr};
 
               public:
                 // We currently don't support multiple fields
@@ -57,6 +94,18 @@ namespace Trinity {
                         return gen;
                 }
 
+                // If set, the execution engine will use it to cache materialized sub-expressions
+                // of queries executed against this source. A FilterCache can be shared by many index sources. See filter_cache.h
+                //
+                // Cached sets are keyed by the source's generation, so the FilterCache is only used if the source is immutable(); see immutable()
+                void use_filter_cache(FilterCache *const c) noexcept {
+                        filterCache = c;
+                }
+
+                inline auto filter_cache() const noexcept {
+                        return filterCache;
+                }
+
                 term_index_ctx term_ctx(const str8_t term) {
                         [[maybe_unused]] static constexpr bool trace{false};
                         std::lock_guard<std::mutex>            g(cacheLock);
@@ -140,6 +189,17 @@ namespace Trinity {
                         return {};
                 }
 
+                // Per-document values of this index source, if any. See docvalues.h
+                // Those are used by docvalues_range filters, and you may use them in MatchedIndexDocumentsFilter::consider() as well
+                virtual const DocValues *doc_values() const {
+                        return nullptr;
+                }
+
+                // The common words this index source was indexed with, if any; see common_words_set
+                virtual const common_words_set *common_words() const {
+                        return nullptr;
+                }
+
                 // After we merge, we may, depending on which indices we decided to merge, be left with
                 // 1+ indices that may have masked documents, but no index data(i.e they exist simply
                 // to hold the masked documents.
@@ -150,6 +210,13 @@ namespace Trinity {
                         return true;
                 }
 
+                // Return true if the documents and terms of this source never change for as long as it's around with the
+                // same generation(e.g segments). Cached state the execution engine keys by generation, i.e FilterCache sets, is only
+                // used for immutable sources, so that a source that is updated in place(e.g for real time search) won't be served stale sets.
+                virtual bool immutable() const {
+                        return false;
+                }
+
                 virtual ~IndexSource() {
                 }
         };
@@ -205,6 +272,10 @@ namespace Trinity {
         // IndexSourcesCollection facilitates that arrangement.
         // It represents a `search session` collection of index sources, and for each such source, it creates a masked_documents_registry that contains scanners
         // for all more recent sources.
+        // UPDATE: commit() now collapses the updated_documents of all more recent sources into a single updated_documents per source, so
+        // that the registry returned by scanner_registry_for() has a single scanner, and testing a document is a single probe no matter how many sources
+        // are in the collection. Those are packed once in commit(), and are immutable and shared by all queries until the next commit();
+        // scanner_registry_for() only initializes a scanner for them, inline(no allocations).
         //
         // It also retains all sources.
         // See Trinity::exec_query(const query&, IndexSourcesCollection *) for how to do this in sequence, but you can and should do
@@ -220,6 +291,10 @@ namespace Trinity {
                 // for each source, we track how many of the first update_documents in all[]
                 // we should consider for masking documents
                 std::vector<std::pair<IndexSource *, uint16_t>> map;
+                // for each source, the union of the first map[].second updated_documents in all[]
+                // sources with the same map[].second share the same collapsed updated_documents
+                std::vector<updated_documents>         collapsedMaskedDocuments;
+                std::vector<std::unique_ptr<IOBuffer>> collapsedMaskedDocumentsStorage;
 
               public:
                 std::vector<IndexSource *> sources;
@@ -234,6 +309,113 @@ namespace Trinity {
 
                 void commit();
 
-                std::unique_ptr<Trinity::masked_documents_registry> scanner_registry_for(const uint16_t idx);
+                // Use get() for the masked_documents_registry to pass to exec_query(); it must outlive the execution
+                single_masked_documents_registry scanner_registry_for(const uint16_t idx) const {
+                        // see commit()
+                        return {collapsedMaskedDocuments[idx]};
+                }
+        };
+
+        // Publishes IndexSourcesCollection snapshots, so that you don't need to track who's using which collection
+        // when you reload segments/sources.
+        //
+        // Writers publish() a new (commit()ed) collection, and the previously published collection is retired.
+        // Readers acquire() the current collection and use it for as long as they hold on to the returned `pinned` handle.
+        // A retired collection is deleted (and so its sources are Release()d, and e.g segments are munmap()ed) once no reader
+        // that may have acquired it is still around.
+        //
+        // This is epoch based; a reader announces the global epoch in a slot(its own cache line) before it loads the current collection, and clears it when done, so
+        // acquiring and releasing a snapshot comes down to a CAS and a store on a thread-private cache line, instead of
+        // Retain()/Release()ing the collection or its sources, which bounces the same cache lines across all threads at high QPS.
+        //
+        // Example:
+        // IndexSourcesCollectionSnapshots snapshots;
+        // ...
+        // auto c = new IndexSourcesCollection(); c->insert(..); c->commit(); snapshots.publish(c);
+        // ...
+        // auto snapshot = snapshots.acquire();
+        // auto res = exec_query<T>(q, snapshot.get(), nullptr, 0);
+        class IndexSourcesCollectionSnapshots final {
+              public:
+                // If more than that many threads hold a snapshot at the same time, acquire() will spin until a slot is released
+                static constexpr std::size_t K_max_readers{256};
+
+              private:
+                struct alignas(64) reader_slot final {
+                        // 0 if not in use
+                        std::atomic<uint64_t> epoch{0};
+                };
+
+                struct retired_collection final {
+                        IndexSourcesCollection *collection;
+                        uint64_t                epoch;
+                };
+
+                std::atomic<IndexSourcesCollection *> current{nullptr};
+                std::atomic<uint64_t>                 epoch{1};
+                reader_slot                           slots[K_max_readers];
+                std::mutex                            retiredLock;
+                std::vector<retired_collection>       retired;
+                std::atomic<uint32_t>                 retiredCnt{0};
+
+              private:
+                reader_slot *enter();
+
+                void leave(reader_slot *);
+
+                void reclaim_impl();
+
+              public:
+                class pinned final {
+                        friend class IndexSourcesCollectionSnapshots;
+
+                      private:
+                        IndexSourcesCollectionSnapshots *snapshots;
+                        reader_slot *                    slot;
+                        IndexSourcesCollection *         collection;
+
+                        pinned(IndexSourcesCollectionSnapshots *const s, reader_slot *const rs, IndexSourcesCollection *const c)
+                            : snapshots{s}, slot{rs}, collection{c} {
+                        }
+
+                      public:
+                        pinned(pinned &&o)
+                            : snapshots{o.snapshots}, slot{o.slot}, collection{o.collection} {
+                                o.slot = nullptr;
+                        }
+
+                        pinned(const pinned &) = delete;
+
+                        pinned &operator=(const pinned &) = delete;
+
+                        ~pinned() {
+                                if (slot) {
+                                        snapshots->leave(slot);
+                                }
+                        }
+
+                        // nullptr if nothing's been published yet
+                        inline IndexSourcesCollection *get() const noexcept {
+                                return collection;
+                        }
+
+                        inline IndexSourcesCollection *operator->() const noexcept {
+                                return collection;
+                        }
+                };
+
+                ~IndexSourcesCollectionSnapshots();
+
+                // You should hold on to the returned handle for as short as possible, because
+                // no collection published after it can be reclaimed while you do.
+                pinned acquire();
+
+                // Assumes ownership of `c`; the previously published collection, if any, is retired
+                // and deleted when no reader may be accessing it.
+                void publish(IndexSourcesCollection *c);
+
+                // publish() and leaving readers reclaim retired collections for you, but you may want
+                // to invoke this periodically
+                void reclaim();
         };
 } // namespace Trinity
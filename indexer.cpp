@@ -30,13 +30,83 @@ void SegmentIndexSession::document_proxy::insert(const uint32_t termID, const to
                 hits[termID & 15].push_back({termID, {position, {0, 0}}});
 }
 
+void SegmentIndexSession::set_common_words(const std::vector<str8_t> &words) {
+        for (const auto w : words) {
+                const auto id = term_id(w);
+
+                commonWords.words.emplace_back(w.data(), w.size());
+
+                if (id >= commonGramsTerms.size())
+                        commonGramsTerms.resize(id + 1, 0);
+                commonGramsTerms[id] = K_common_word;
+        }
+
+        commonWords.normalize();
+}
+
+// See set_common_words()
+void SegmentIndexSession::index_common_grams() {
+        const auto is_common = [this](const uint32_t id) noexcept {
+                return id < commonGramsTerms.size() && commonGramsTerms[id] == K_common_word;
+        };
+        auto &all = positionsScratch;
+        char_t gram[Limits::MaxTermLength];
+
+        all.clear();
+        for (const auto &v : hits) {
+                for (const auto &it : v) {
+                        if (const auto pos = it.second.first)
+                                all.emplace_back(pos, it.first);
+                }
+        }
+
+        std::sort(all.begin(), all.end());
+        all.erase(std::unique(all.begin(), all.end()), all.end());
+
+        for (const auto *p = all.data(), *const e = p + all.size(); p != e;) {
+                const auto pos  = p->first;
+                const auto from = p;
+
+                while (p != e && p->first == pos)
+                        ++p;
+
+                // terms at (pos + 1)
+                const auto *next = p, *nextEnd = p;
+
+                if (next == e || next->first != pos + 1)
+                        continue;
+                while (nextEnd != e && nextEnd->first == pos + 1)
+                        ++nextEnd;
+
+                for (auto a = from; a != p; ++a) {
+                        for (auto b = next; b != nextEnd; ++b) {
+                                if (!is_common(a->second) && !is_common(b->second))
+                                        continue;
+
+                                if (const auto len = common_gram(term(a->second), term(b->second), gram)) {
+                                        const auto id = term_id({gram, len});
+
+                                        if (id >= commonGramsTerms.size())
+                                                commonGramsTerms.resize(id + 1, 0);
+                                        commonGramsTerms[id] = K_common_gram;
+                                        hits[id & 15].push_back({id, {pos, {0, 0}}});
+                                }
+                        }
+                }
+        }
+}
+
 void SegmentIndexSession::commit_document_impl(const document_proxy &proxy, const bool replace) {
         uint32_t        terms{0};
         const auto      all_hits = reinterpret_cast<const uint8_t *>(hitsBuf.data());
         field_doc_stats fs;
 
+        if (!commonGramsTerms.empty())
+                index_common_grams();
+
         // we can't update the same document more than once in the same session
 	consider_update(proxy.did);
+        ++documentsCnt;
 
         b.pack(proxy.did);
 
@@ -235,7 +305,68 @@ Trinity::SegmentIndexSession::document_proxy SegmentIndexSession::begin(const is
 // Callee is responsible for clos()ing indexFd
 //
 // Please note that it will invoke sess->end() for you
+void Trinity::common_words_set::normalize() {
+        std::sort(words.begin(), words.end(), [](const auto &a, const auto &b) noexcept {
+                return terms_cmp(a.data(), a.size(), b.data(), b.size()) < 0;
+        });
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+}
+
+// (length:u8, word) for each word
+void Trinity::common_words_set::persist(const char *path) const {
+        IOBuffer b;
+
+        for (const auto &w : words) {
+                b.pack(uint8_t(w.size()));
+                b.serialize(w.data(), w.size());
+        }
+
+        if (Trinity::Utilities::to_file(b.data(), b.size(), path) == -1)
+                throw Switch::system_error("Failed to persist common words");
+}
+
+std::unique_ptr<Trinity::common_words_set> Trinity::common_words_set::open(const char *path) {
+        int fd = ::open(path, O_RDONLY | O_LARGEFILE);
+
+        if (fd == -1) {
+                if (errno == ENOENT)
+                        return nullptr;
+
+                throw Switch::system_error("Failed to access ", path);
+        }
+
+        DEFER({
+                close(fd);
+        });
+
+        const auto                        fileSize = lseek64(fd, 0, SEEK_END);
+        std::unique_ptr<uint8_t[]>        data(new uint8_t[fileSize]);
+        std::unique_ptr<common_words_set> res(new common_words_set());
+
+        if (fileSize == -1 || pread64(fd, data.get(), fileSize, 0) != fileSize)
+                throw Switch::system_error("Failed to read ", path);
+
+        for (const auto *p = data.get(), *const e = p + fileSize; p != e;) {
+                const auto len = *p++;
+
+                if (unlikely(!len || len > e - p))
+                        throw Switch::data_error("Unexpected common words contents");
+
+                res->words.emplace_back(reinterpret_cast<const char *>(p), len);
+                p += len;
+        }
+
+        res->normalize();
+        return res;
+}
+
 void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs, Trinity::Codecs::IndexSession *const sess, std::vector<isrc_docid_t> &updatedDocumentIDs, int indexFd) {
+        if (sess->indexOutFd != -1) {
+                // see IndexSession::set_index_fd()
+                EXPECT(sess->indexOutFd == indexFd);
+                sess->flush_index(indexFd);
+        }
+
         if (sess->indexOut.size()) {
                 if (Trinity::Utilities::to_file(sess->indexOut.data(), sess->indexOut.size(), indexFd) == -1)
                         throw Switch::system_error("Failed to persist index");
@@ -276,6 +407,8 @@ void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs,
 }
 
 void Trinity::persist_segment(const Trinity::IndexSource::field_statistics &fs, Trinity::Codecs::IndexSession *const sess, std::vector<isrc_docid_t> &updatedDocumentIDs) {
+        EXPECT(sess->indexOutFd == -1);
+
         auto path = Buffer{}.append(sess->basePath, "/index.t");
         int  fd   = open(path.c_str(), O_WRONLY | O_CREAT | O_LARGEFILE | O_TRUNC, 0775);
 
@@ -310,6 +443,16 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess) {
                 uint8_t      rangeIdx;
         };
 
+        if (!indexSortField.empty() && documentsCnt) {
+                // before we persist anything
+                const str8_t field(indexSortField.data(), indexSortField.size());
+
+                if (!docValues.in_order(field, indexSortOrder, documentsCnt))
+                        throw Switch::data_error("Documents are not in index sort order");
+
+                docValues.set_index_sort(field, indexSortOrder);
+        }
+
         static constexpr bool                        trace{false};
         std::vector<uint32_t>                        allOffsets;
         std::unordered_map<uint32_t, term_index_ctx> map;
@@ -327,7 +470,7 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess) {
 
 	// TODO: We could track all terms (document, terms)
 	// in order to propertly reserve() enough storage for all[] so that we 'll avoid reallocations
-        const auto scan = [&defaultFieldStats = this->defaultFieldStats, flushFreq = this->flushFreq, indexFd, enc = enc_.get(), &map, sess ](const auto &ranges) {
+        const auto scan = [&defaultFieldStats = this->defaultFieldStats, flushFreq = this->flushFreq, indexFd, enc = enc_.get(), &map, sess, &commonGramsTerms = this->commonGramsTerms](const auto &ranges) {
                 uint8_t                   payloadSize;
                 std::vector<segment_data> all[32];
                 term_index_ctx            tctx;
@@ -418,6 +561,8 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess) {
                                 const auto   term = it->termID;
                                 isrc_docid_t prevDID{0};
                                 uint32_t     _t;
+                                // bigrams don't count towards the field statistics; see set_common_words()
+                                const bool gram = term < commonGramsTerms.size() && commonGramsTerms[term] == K_common_gram;
 
                                 // TODO:
                                 // Maybe we need a new API which would allow us to encode terms individually, i.e use begin_term() to get
@@ -436,7 +581,8 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess) {
 
                                         require(documentID > prevDID);
 
-                                        defaultFieldStats.sumTermHits += hitsCnt;
+                                        if (!gram)
+                                                defaultFieldStats.sumTermHits += hitsCnt;
 
                                         enc->begin_document(documentID);
                                         for (uint32_t i{0}; i != hitsCnt; ++i) {
@@ -455,7 +601,8 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess) {
                                         }
                                         enc->end_document();
 
-                                        ++defaultFieldStats.sumTermsDocs;
+                                        if (!gram)
+                                                ++defaultFieldStats.sumTermsDocs;
 
                                         prevDID = documentID;
                                 } while (likely(++it != e) && it->termID == term);
@@ -463,7 +610,8 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess) {
                                 enc->end_term(&tctx);
                                 map.emplace(term, tctx);
 
-                                ++defaultFieldStats.totalTerms;
+                                if (!gram)
+                                        ++defaultFieldStats.totalTerms;
 
                                 if (flushFreq && unlikely(sess->indexOut.size() > flushFreq))
                                         sess->flush_index(indexFd);
@@ -530,6 +678,10 @@ void SegmentIndexSession::commit(Trinity::Codecs::IndexSession *const sess) {
         before = Timings::Microseconds::Tick();
 
         sess->persist_terms(v);
+        if (!docValues.empty())
+                docValues.persist(Buffer{}.append(sess->basePath, "/docvalues"_s32).c_str());
+        if (!commonWords.words.empty())
+                commonWords.persist(Buffer{}.append(sess->basePath, "/common_words"_s32).c_str());
         persist_segment(defaultFieldStats, sess, updatedDocumentIDs, indexFd);
 
         if (trace)
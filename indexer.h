@@ -1,5 +1,6 @@
 #pragma once
 #include "codecs.h"
+#include "docvalues.h"
 #include "index_source.h"
 #include <buffer.h>
 #include <sparsefixedbitset.h>
@@ -11,6 +12,8 @@ namespace Trinity {
         // Persists an index sesion as a segment
         // The application is responsible for persisting the terms (see SegmentIndexSession::commit()
         // for example, and IndexSession::persist_terms())
+        //
+        // If you used IndexSession::set_index_fd(), you must pass the same fd here
         void persist_segment(const IndexSource::field_statistics &, Trinity::Codecs::IndexSession *const sess, std::vector<uint32_t> &updatedDocumentIDs, int fd);
 
         // Wrapper for persist_segment(); opens the index file and passes it to persist_segment()
@@ -88,6 +91,21 @@ namespace Trinity {
                 //See IndexSession::indexOutFlushed comments
                 uint32_t flushFreq{0}, intermediateStateFlushFreq{0};
 
+                // See set_common_words()
+                // By term ID; K_common_word or K_common_gram
+                static constexpr uint8_t                  K_common_word{1}, K_common_gram{2};
+                std::vector<uint8_t>                      commonGramsTerms;
+                std::vector<std::pair<tokenpos_t, uint32_t>> positionsScratch;
+                common_words_set                          commonWords; // persisted with the segment
+
+                // See document_proxy::set_value()
+                DocValuesWriter docValues;
+
+                // See set_index_sort()
+                std::string       indexSortField;
+                index_sort::Order indexSortOrder{index_sort::Order::Ascending};
+                uint32_t          documentsCnt{0};
+
               public:
                 // Check https://www.ebayinc.com/stories/blogs/tech/making-e-commerce-search-faster/
                 // for an alternative ordering scheme, based on grouping and other semantics
@@ -141,11 +159,24 @@ namespace Trinity {
 
                                 insert(termID, pos, {reinterpret_cast<const uint8_t *>(&payload), requiredBytes});
                         }
+
+                        // Sets the document's value for `field`; see docvalues.h
+                        // Values are persisted by commit() in the segment's docvalues file, whether you insert() or replace() the document.
+                        // A field's values must all be either numeric or strings.
+                        void set_value(const str8_t field, const int64_t value) {
+                                sess.docValues.set(did, field, value);
+                        }
+
+                        void set_value(const str8_t field, const str32_t value) {
+                                sess.docValues.set(did, field, value);
+                        }
                 };
 
               private:
                 void commit_document_impl(const document_proxy &proxy, const bool replace);
 
+                void index_common_grams();
+
                 bool track(const isrc_docid_t);
 
 		void consider_update(const isrc_docid_t);
@@ -157,6 +188,8 @@ namespace Trinity {
 
                 void clear() {
                         b.clear();
+                        docValues.clear();
+                        documentsCnt = 0;
                         while (banks.size()) {
                                 delete banks.back();
                                 banks.pop_back();
@@ -173,6 +206,28 @@ namespace Trinity {
                         intermediateStateFlushFreq = n;
                 }
 
+                // Common-grams, like Lucene's CommonGramsFilter.
+                //
+                // Phrases with frequent terms, e.g "world of warcraft" or "of the", require intersecting the huge postings lists of those terms
+                // and checking positions in every document where they co-occur. If you set_common_words(), then for every pair of adjacent terms in a document
+                // where either of the two is a common word, a bigram term(see Trinity::common_gram()) is also indexed at the position of the first term.
+                // exec_query() will then match phrases using the bigrams instead, if they exist in the index source, which are far less frequent.
+                //
+                // Bigrams don't count towards the field statistics(see IndexSource::field_statistics).
+                // The common words are persisted with the segment(see common_words_set). You must use the same common words for all segments you intend to
+                // merge together(merge() refuses otherwise), and set them before you index any documents.
+                void set_common_words(const std::vector<str8_t> &words);
+
+                // Declares that the documents are sorted by the numeric doc-values field, in order; see index_sort
+                // That is, in document ID order, the values of the field are ascending(or descending), and every
+                // document you insert() or replace() has a value for the field.
+                //
+                // commit() verifies that and will throw if that's not the case, and persists the sort in the segment's docvalues file.
+                void set_index_sort(const str8_t field, const index_sort::Order order) {
+                        indexSortField.assign(field.data(), field.size());
+                        indexSortOrder = order;
+                }
+
                 void erase(const isrc_docid_t documentID);
 
                 // After you have obtained a document_proxy, you can use its insert methods to register term hits
@@ -199,7 +254,7 @@ namespace Trinity {
                         commit_document_impl(proxy, true);
                 }
 
-                // Persist index and masked products into the directory s->basePath
+                // Persist index, masked products and doc-values(see document_proxy::set_value()) into the directory s->basePath
                 // See also SegmentIndexSource::SegmentIndexSource()
                 void commit(Trinity::Codecs::IndexSession *const s);
 
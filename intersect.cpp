@@ -1,4 +1,6 @@
 #include "intersect.h"
+#include <future>
+#include <prioqueue.h>
 
 using namespace Trinity;
 
@@ -50,136 +52,156 @@ void Trinity::intersect_impl(const uint64_t                                 stop
         if (anyUnknown)
                 origMask = 0;
 
-        struct ctx final {
-                uint64_t mapPrev{0};
-                uint8_t  indexPrev{0};
-
-                struct match final {
-                        uint64_t v;
-                        uint32_t cnt;
-                };
-
-                std::vector<match> matches;
-
-                void consider(const uint64_t map) {
-                        if (map == mapPrev)
-                                ++matches[indexPrev].cnt;
-                        else {
-                                auto matchesCnt = matches.size();
-                                auto all        = matches.data();
-
-                                mapPrev = map;
-                                for (size_t i{0}; i < matchesCnt;) {
-                                        if (const auto v = all[i].v; (v & map) == map) {
-                                                // [wars jedi] [star wars jedi]
-                                                if (map == v)
-                                                        ++all[i].cnt;
-                                                indexPrev = i;
-                                                return;
-                                        } else if ((map & v) == v) {
-                                                // [star wars return jedi] [wars jedi]
-                                                matches[i] = matches.back();
-                                                matches.pop_back();
-                                                --matchesCnt;
-                                        }
-                                        else
-                                                ++i;
-                                }
-
-                                indexPrev = matchesCnt;
-                                matches.push_back({map, 1});
-                        }
+        // We used to merge-scan all remaining[] for the lowest document on every step, and then
+        // consider() the matched tokens mask against all matches collected so far.
+        //
+        // We now use the same scheme as DocsSetSpanForDisjunctions (see docset_spans.h)
+        // A prio.queue tracks all iterators by their current document; we consider a window of SIZE documents
+        // based on the top iterator's document, and drain all iterators with a document in that window, OR-ing
+        // their token bit into masks[document - windowBase]. We then aggregate the (non-zero) masks of the window
+        // by mask in a hashtable. Once done, we only keep the masks that are not subsets of other masks.
+        //
+        // This is equivalent to the consider() semantics, where only documents that match exactly a mask
+        // that is not masked by another mask are counted.
+        static constexpr std::size_t SHIFT{13};
+        static constexpr std::size_t SIZE{1 << SHIFT};
+        static constexpr std::size_t MASK{SIZE - 1};
+        static constexpr std::size_t SET_SIZE{SIZE / 64};
+
+        struct tracked_cmp final {
+                inline bool operator()(const tracked &a, const tracked &b) const noexcept {
+                        return a.it->curDocument.id < b.it->curDocument.id;
                 }
+        };
 
-                void finalize() {
-                        std::sort(matches.begin(), matches.end(), [](const auto &a, const auto &b) noexcept {
-                                const auto r = int8_t(SwitchBitOps::PopCnt(b.v)) - int8_t(SwitchBitOps::PopCnt(a.v));
+        Switch::priority_queue<tracked, tracked_cmp> pq(rem);
+        std::unique_ptr<uint64_t[]>                  masks(new uint64_t[SIZE]);
+        uint64_t                                     touched[SET_SIZE];
+        std::unordered_map<uint64_t, uint32_t>       counts;
+        const auto                                   before = Timings::Microseconds::Tick();
 
-                                return r < 0 || (!r && b.cnt < a.cnt);
-                        });
-                }
-        };
+        memset(masks.get(), 0, sizeof(uint64_t) * SIZE);
+        memset(touched, 0, sizeof(touched));
+
+        for (size_t i{0}; i != rem; ++i) {
+                pq.push(remaining[i]);
+        }
+
+        do {
+                const auto windowBase = pq.top().it->curDocument.id & ~MASK;
+                const auto windowEnd  = uint64_t(windowBase) + SIZE;
+
+                do {
+                        auto       t   = pq.top();
+                        auto       it  = t.it;
+                        const auto bit = uint64_t(1u) << t.tokenIdx;
+                        auto       id  = it->curDocument.id;
+
+                        do {
+                                const auto rel = id & MASK;
+
+                                masks[rel] |= bit;
+                                touched[rel / 64] |= uint64_t(1) << (rel & 63);
+                        } while ((id = it->next()) < windowEnd);
 
-        uint16_t   selected[sizeof_array(remaining)];
-        ctx        c;
-        const auto before = Timings::Microseconds::Tick();
-
-        // TODO: use Switch::priority_queue<>
-        for (;;) {
-                uint16_t     cnt{1};
-                isrc_docid_t lowest;
-                const auto & it   = remaining[0];
-                uint64_t     mask = uint64_t(1u) << it.tokenIdx;
-                uint8_t      first{0}, last{0};
-
-                selected[0] = 0;
-                lowest      = it.it->curDocument.id;
-                for (size_t i{1}; i != rem; ++i) {
-                        const auto &it = remaining[i];
-
-                        if (const auto docID = it.it->curDocument.id; docID == lowest) {
-                                const auto m = uint64_t(1u) << it.tokenIdx;
-
-                                mask |= m;
-                                selected[cnt++] = i;
-                                last            = i;
-                        } else if (docID < lowest) {
-                                mask        = uint64_t(1u) << it.tokenIdx;
-                                selected[0] = i;
-                                cnt         = 1;
-                                lowest      = docID;
-                                first = last = i;
+                        if (id == DocIDsEND) {
+                                delete t.dec;
+                                delete t.it;
+                                pq.pop();
+                        } else {
+                                pq.update_top();
                         }
+                } while (pq.size() && pq.top().it->curDocument.id < windowEnd);
+
+                for (uint32_t i{0}; i != SET_SIZE; ++i) {
+                        for (auto w = touched[i]; w; w &= w - 1) {
+                                const auto rel  = i * 64 + SwitchBitOps::TrailingZeros(w);
+                                const auto mask = masks[rel];
 
-                l100:;
+                                masks[rel] = 0;
+                                if (!maskedDocumentsRegistry->test(windowBase + rel)) {
+                                        ++counts[mask];
+                                }
+                        }
+                        touched[i] = 0;
                 }
+        } while (pq.size());
 
-                [[maybe_unused]] static constexpr bool trace{false};
+        std::vector<std::pair<uint64_t, uint32_t>> matches;
 
-                if (mask != origMask) {
-                        if (0 == (stopwordsMask & ((uint64_t(1) << first) | (uint64_t(1) << last)))) {
-                                if (!maskedDocumentsRegistry->test(lowest))
-                                        c.consider(mask);
-                        }
+        for (const auto &it : counts) {
+                const auto mask = it.first;
+
+                if (mask == origMask) {
+                        // we don't want to match the original query
+                        continue;
+                } else if (stopwordsMask & ((uint64_t(1) << SwitchBitOps::TrailingZeros(mask)) | (uint64_t(1) << (63 - SwitchBitOps::LeadingZeros(mask))))) {
+                        // first or last token is a stop word
+                        continue;
                 }
 
-                while (cnt) {
-                        const auto idx = selected[--cnt];
+                matches.push_back({mask, it.second});
+        }
+
+        // by popcnt DESC, so that we only need to check for supersets among the ones we have already accepted
+        std::sort(matches.begin(), matches.end(), [](const auto &a, const auto &b) noexcept {
+                const auto r = int8_t(SwitchBitOps::PopCnt(b.first)) - int8_t(SwitchBitOps::PopCnt(a.first));
+
+                return r < 0 || (!r && b.second < a.second);
+        });
+
+        const auto base = out->size();
 
-                        if (unlikely(DocIDsEND == remaining[idx].it->next())) {
-                                delete remaining[idx].dec;
-                                delete remaining[idx].it;
+        for (const auto &it : matches) {
+                const auto mask = it.first;
+                bool       masked{false};
 
-                                if (--rem == 0)
-                                        goto l10;
-                                else
-                                        remaining[idx] = remaining[rem];
+                for (auto i{base}; i != out->size(); ++i) {
+                        if (((*out)[i].first & mask) == mask) {
+                                // [wars jedi] [star wars jedi]
+                                masked = true;
+                                break;
                         }
                 }
-        }
 
-l10:
-        c.finalize();
-        if (trace)
-                SLog(duration_repr(Timings::Microseconds::Since(before)), " to intersect, c.matches.size = ", c.matches.size(), "\n");
+                if (!masked) {
+                        if (trace)
+                                SLog("output:", mask, ", cnt = ", it.second, ", popcnt = ", SwitchBitOps::PopCnt(mask), "\n");
 
-        for (const auto &it : c.matches) {
-                if (trace)
-                        SLog("output:", it.v, ", cnt = ", it.cnt, ", popcnt = ", SwitchBitOps::PopCnt(uint64_t(it.v)), "\n");
-                out->push_back({it.v, it.cnt});
+                        out->push_back(it);
+                }
         }
+
+        if (trace)
+                SLog(duration_repr(Timings::Microseconds::Since(before)), " to intersect, ", out->size() - base, " intersections\n");
 }
 
 std::vector<std::pair<uint64_t, uint32_t>> Trinity::intersect(const uint64_t stopwordsMask, const std::vector<std::unordered_set<str8_t>> &tokens, IndexSourcesCollection *collection) {
-        std::vector<std::pair<uint64_t, uint32_t>> out;
-        const auto                                 n = collection->sources.size();
+        std::vector<std::pair<uint64_t, uint32_t>>                              out;
+        const auto                                                              n = collection->sources.size();
+        std::vector<std::future<std::vector<std::pair<uint64_t, uint32_t>>>> futures;
+
+        // Sources are independent of each other; schedule all but the first via std::async()
+        // and we 'll handle the first here. See exec_query_par()
+        for (size_t i{1}; i < n; ++i) {
+                futures.emplace_back(std::async(std::launch::async, [&](const size_t i) {
+                        auto scanner = collection->scanner_registry_for(i);
+
+                        return intersect(stopwordsMask, tokens, collection->sources[i], scanner.get());
+                },
+                                                i));
+        }
+
+        if (n) {
+                auto scanner = collection->scanner_registry_for(0);
+
+                intersect_impl(stopwordsMask, tokens, collection->sources[0], scanner.get(), &out);
+        }
 
-        // TODO: use std::async()?
-        for (size_t i{0}; i != n; ++i) {
-                auto source  = collection->sources[i];
-                auto scanner = collection->scanner_registry_for(i);
+        for (auto &f : futures) {
+                const auto v = f.get();
 
-                intersect_impl(stopwordsMask, tokens, source, scanner.get(), &out);
+                out.insert(out.end(), v.begin(), v.end());
         }
 
         std::sort(out.begin(), out.end(), [](const auto &a, const auto &b) noexcept { return a.first < b.first; });
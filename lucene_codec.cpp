@@ -111,6 +111,9 @@ void Trinity::Codecs::Lucene::IndexSession::flush_positions_data() {
                         throw Switch::data_error("Failed to persist hits.data");
         }
 
+        // already accounted for in positionsOutFlushed
+        pendingPositionsCopy.flush(positionsOutFd);
+
         if (Utilities::to_file(positionsOut.data(), positionsOut.size(), positionsOutFd) == -1)
                 throw Switch::data_error("Failed to persist hits.data");
 
@@ -118,8 +121,17 @@ void Trinity::Codecs::Lucene::IndexSession::flush_positions_data() {
         positionsOut.clear();
 }
 
+void Trinity::Codecs::Lucene::IndexSession::copy_positions_chunk(int srcFd, const uint64_t offset, const uint32_t len) {
+        if (positionsOut.size() || !pendingPositionsCopy.try_coalesce(srcFd, offset, len)) {
+                flush_positions_data();
+                pendingPositionsCopy.set(srcFd, offset, len);
+        }
+
+        positionsOutFlushed += len;
+}
+
 void Trinity::Codecs::Lucene::IndexSession::end() {
-        if (positionsOut.size())
+        if (positionsOut.size() || pendingPositionsCopy.len)
                 flush_positions_data();
 
         if (positionsOutFd != -1) {
@@ -152,13 +164,44 @@ range32_t Trinity::Codecs::Lucene::IndexSession::append_index_chunk(const Trinit
         p += sizeof(uint16_t);
         const auto newHitsDataOffset = positionsOut.size() + positionsOutFlushed;
 
-        positionsOut.serialize(src->hitsDataPtr + hitsDataOffset, positionsChunkSize);
+        // The index chunk header needs to be rewritten, so only the positions chunk(which is
+        // likely far larger anyway) is copied kernel-side, and only if we are persisting into a file(see IndexSession::set_index_fd())
+        if (const auto fd = indexOutFd != -1 ? source_file_fd(src, "hits.data") : -1; fd != -1)
+                copy_positions_chunk(fd, hitsDataOffset, positionsChunkSize);
+        else
+                positionsOut.serialize(src->hitsDataPtr + hitsDataOffset, positionsChunkSize);
+
         indexOut.pack(uint32_t(newHitsDataOffset), sumHits, positionsChunkSize, skiplistSize);
         indexOut.serialize(p, end - p);
 
         return {uint32_t(o), srcTCTX.indexChunk.size()};
 }
 
+// Each index chunk begins with the absolute offset of the term's hits in hits.data
+// (skiplist offsets are relative to the chunk), so in addition to adjusting the chunk offsets we also need to
+// patch that header field by the base of the partition's positions data.
+void Trinity::Codecs::Lucene::IndexSession::append_partition(Trinity::Codecs::IndexSession *part_, std::pair<str8_t, term_index_ctx> *terms, const size_t termsCnt) {
+        auto       part   = static_cast<Trinity::Codecs::Lucene::IndexSession *>(part_);
+        const auto base   = indexOut.size() + indexOutFlushed;
+        const auto offset = indexOut.size();
+        const auto hdBase = positionsOut.size() + positionsOutFlushed;
+
+        require(part->indexOutFlushed == 0 && part->positionsOutFlushed == 0);
+
+        indexOut.serialize(part->indexOut.data(), part->indexOut.size());
+        positionsOut.serialize(part->positionsOut.data(), part->positionsOut.size());
+
+        for (size_t i{0}; i != termsCnt; ++i) {
+                auto &tctx = terms[i].second;
+
+                *reinterpret_cast<uint32_t *>(indexOut.data() + offset + tctx.indexChunk.offset) += hdBase;
+                tctx.indexChunk.offset += base;
+        }
+
+        if (flushFreq && unlikely(positionsOut.size() > flushFreq))
+                flush_positions_data();
+}
+
 void Trinity::Codecs::Lucene::Encoder::begin_term() {
         const auto s = static_cast<Trinity::Codecs::Lucene::IndexSession *>(sess);
 
@@ -399,14 +442,27 @@ void Trinity::Codecs::Lucene::Decoder::refill_hits(PostingsListIterator *it) {
         uint32_t payloadsChunkLength;
 
         if (it->hitsLeft >= BLOCK_SIZE) {
+                const auto                          c = blocksCache;
+                const DecodedBlocksCache::block_key key{blocksCacheGen, chunkOffset, uint32_t((totalHits - it->hitsLeft) / BLOCK_SIZE) | DecodedBlocksCache::K_hits_block};
+                uint32_t                            encodedSize;
+
+                if (c && c->get(key, it->hitsPositionDeltas, it->hitsPayloadLengths, BLOCK_SIZE, &encodedSize)) {
+                        it->hdp += encodedSize;
+                } else {
+                        [[maybe_unused]] const auto base = it->hdp;
+
 #ifdef LUCENE_USE_FASTPFOR
-                it->hdp = ints_decode(forUtil, it->hdp, it->hitsPositionDeltas);
-                it->hdp = ints_decode(forUtil, it->hdp, it->hitsPayloadLengths);
+                        it->hdp = ints_decode(forUtil, it->hdp, it->hitsPositionDeltas);
+                        it->hdp = ints_decode(forUtil, it->hdp, it->hitsPayloadLengths);
 #else
-                it->hdp = ints_decode(it->hdp, it->hitsPositionDeltas);
-                it->hdp = ints_decode(it->hdp, it->hitsPayloadLengths);
+                        it->hdp = ints_decode(it->hdp, it->hitsPositionDeltas);
+                        it->hdp = ints_decode(it->hdp, it->hitsPayloadLengths);
 #endif
 
+                        if (c)
+                                c->put(key, it->hitsPositionDeltas, it->hitsPayloadLengths, BLOCK_SIZE, it->hdp - base);
+                }
+
                 varbyte_get32(it->hdp, payloadsChunkLength);
 
                 it->payloadsIt = it->hdp;
@@ -511,16 +567,32 @@ void Trinity::Codecs::Lucene::Decoder::refill_hits(PostingsListIterator *it) {
 
 void Trinity::Codecs::Lucene::Decoder::refill_documents(Trinity::Codecs::Lucene::PostingsListIterator *it) {
         if (it->docsLeft >= BLOCK_SIZE) {
+                // documents are encoded in blocks of BLOCK_SIZE documents, so this is the block's index
+                // (skiplist entries also point to the beginning of blocks)
+                const auto                          c = blocksCache;
+                const DecodedBlocksCache::block_key key{blocksCacheGen, chunkOffset, uint32_t((totalDocuments - it->docsLeft) / BLOCK_SIZE)};
+                uint32_t                            encodedSize;
+
+                if (c && c->get(key, it->docDeltas, it->docFreqs, BLOCK_SIZE, &encodedSize)) {
+                        it->p += encodedSize;
+                } else {
+                        [[maybe_unused]] const auto base = it->p;
+
 #ifdef LUCENE_USE_FASTPFOR
-                it->p = ints_decode(forUtil, it->p, it->docDeltas);
-                it->p = ints_decode(forUtil, it->p, it->docFreqs);
+                        it->p = ints_decode(forUtil, it->p, it->docDeltas);
+                        it->p = ints_decode(forUtil, it->p, it->docFreqs);
 #else
-                it->p = ints_decode(it->p, it->docDeltas);
-                it->p = ints_decode(it->p, it->docFreqs);
+                        it->p = ints_decode(it->p, it->docDeltas);
+                        it->p = ints_decode(it->p, it->docFreqs);
 #endif
 
+                        if (c)
+                                c->put(key, it->docDeltas, it->docFreqs, BLOCK_SIZE, it->p - base);
+                }
+
                 it->bufferedDocs = BLOCK_SIZE;
                 it->docsLeft -= BLOCK_SIZE;
+                decodedPostings += BLOCK_SIZE;
         } else {
                 uint32_t   v;
                 auto       p{it->p};
@@ -548,6 +620,7 @@ void Trinity::Codecs::Lucene::Decoder::refill_documents(Trinity::Codecs::Lucene:
                 it->p            = p; // restore
                 it->bufferedDocs = docsLeft;
                 it->docsLeft     = 0;
+                decodedPostings += docsLeft;
         }
 
         it->docsIndex = 0;
@@ -928,6 +1001,12 @@ void Trinity::Codecs::Lucene::Decoder::init(const term_index_ctx &tctx, Trinity:
         }
 
         hitsBase = ap->hitsDataPtr + hitsDataOffset;
+
+        if (const auto c = ap->blocksCache; c && c->admit_term(tctx)) {
+                blocksCache    = c;
+                blocksCacheGen = ap->blocksCacheGen;
+                chunkOffset    = tctx.indexChunk.offset;
+        }
 }
 
 Trinity::Codecs::Lucene::AccessProxy::~AccessProxy() {
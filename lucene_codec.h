@@ -55,16 +55,20 @@ namespace Trinity {
 
                                 // TODO: support for periodic flushing
                                 // i.e in either Encoder::end_term() or Encoder::end_document()
-                                IOBuffer positionsOut;
-                                uint32_t positionsOutFlushed;
-                                int      positionsOutFd;
-                                uint32_t flushFreq;
+                                IOBuffer          positionsOut;
+                                uint32_t          positionsOutFlushed;
+                                int               positionsOutFd;
+                                uint32_t          flushFreq;
+                                pending_file_copy pendingPositionsCopy;
 
                                 // private
                                 void flush_positions_data();
 
+                                // see IndexSession::copy_index_chunk()
+                                void copy_positions_chunk(int srcFd, const uint64_t offset, const uint32_t len);
+
                                 IndexSession(const char *bp)
-                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge)}, positionsOutFlushed{0}, positionsOutFd{-1}, flushFreq{0} {
+                                    : Trinity::Codecs::IndexSession{bp, unsigned(Capabilities::AppendIndexChunk) | unsigned(Capabilities::Merge) | unsigned(Capabilities::Partitions)}, positionsOutFlushed{0}, positionsOutFd{-1}, flushFreq{0} {
                                 }
 
                                 ~IndexSession() {
@@ -90,6 +94,13 @@ namespace Trinity {
                                 range32_t append_index_chunk(const Trinity::Codecs::AccessProxy *, const term_index_ctx srcTCTX) override final;
 
                                 void merge(merge_participant *, const uint16_t, Trinity::Codecs::Encoder *) override final;
+
+                                // flushFreq is not inherited; partitions are never flushed
+                                Trinity::Codecs::IndexSession *new_partition_session() override final {
+                                        return new IndexSession(basePath);
+                                }
+
+                                void append_partition(Trinity::Codecs::IndexSession *, std::pair<str8_t, term_index_ctx> *, const size_t) override final;
                         };
 
                         class Encoder final
@@ -239,6 +250,10 @@ namespace Trinity {
                                 } skiplist;
                                 const uint8_t *postingListBase, *hitsBase;
                                 uint32_t       totalDocuments, totalHits;
+                                // set if the term is eligible for caching; see DecodedBlocksCache
+                                DecodedBlocksCache *blocksCache{nullptr};
+                                uint64_t            blocksCacheGen;
+                                uint32_t            chunkOffset;
 
                               private:
                                 void init_skiplist(const uint16_t);
@@ -3,6 +3,8 @@
 #include "runtime.h"
 
 namespace Trinity {
+        class IndexSource;
+
         // We assign an index (base 0) to each token in the query, which is monotonically increasing, except
         // when we are assigning to tokens in OR expressions, where we need to do more work and it gets more complicated (see assign_query_indices() for how that works).
         //
@@ -174,6 +176,18 @@ namespace Trinity {
                         query_final_term_index = fi;
                 }
 
+                // Invoked by the exec.engine before the query is executed against the index source src, in all execution modes, even
+                // if it turns out that nothing can match the query.
+                // You may want to override this if you need access to the index source, e.g to its doc-values(see FacetsCollector)
+                virtual void prepare_index_source(IndexSource *src) {
+                }
+
+                // Invoked by the exec.engine once it is done with the index source src for the query; i.e once exec_query() returns, when
+                // the QueryExecution is destroyed(see exec_query_resumable()), or right after prepare_index_source() if there is nothing to execute.
+                // Applications may release the index source afterwards, so you must not retain anything that points into it(e.g doc-values).
+                virtual void finalize_index_source(IndexSource *src) {
+                }
+
                 virtual ~MatchedIndexDocumentsFilter() {
                 }
         };
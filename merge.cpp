@@ -1,5 +1,7 @@
 #include "merge.h"
 #include "docwordspace.h"
+#include <future>
+#include <prioqueue.h>
 #include <unordered_set>
 #include <text.h>
 
@@ -33,118 +35,251 @@ std::unique_ptr<Trinity::masked_documents_registry> Trinity::MergeCandidatesColl
         return masked_documents_registry::make(all.data(), n, false);
 }
 
-// Make sure you have commited first
-// Unlike with e.g SegmentIndexSession where the order of postlists in the index is based on our translation(term=>integer id) and the ascending order of that id
-// here the order will match the order the terms are found in `tersm`, because we perform a merge-sort and so we process terms in lexicograpphic order
-void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is, simple_allocator *allocator, std::vector<std::pair<str8_t, Trinity::term_index_ctx>> *const terms, IndexSource::field_statistics *const defaultFieldStats, const uint32_t flushFreq, const bool disableOptimizations) {
-        static constexpr bool trace{false};
+const Trinity::index_sort *Trinity::MergeCandidatesCollection::merged_sort() const {
+        const index_sort *sort{nullptr};
 
-        struct tracked_candidate {
-                uint16_t        idx;
-                merge_candidate candidate;
-        };
+        // The merged segment may be sorted only if all candidates are sorted the same way
+        for (const auto &c : candidates) {
+                if (!c.docValues) {
+                        if (c.ap)
+                                return nullptr;
+                        continue;
+                }
 
-        std::vector<tracked_candidate> all_;
+                if (const auto s = c.docValues->documents_sort(); !s || (sort && !(*sort == *s)))
+                        return nullptr;
+                else
+                        sort = s;
+        }
 
-        if (trace)
-                SLog("Merging ", candidates.size(), " candidates\n");
+        return sort;
+}
 
-        require(candidates.size() < std::numeric_limits<uint16_t>::max());
+const Trinity::common_words_set *Trinity::MergeCandidatesCollection::merged_common_words() const {
+        const common_words_set *res{nullptr};
+        bool                    first{true};
+
+        // The bigrams of the merged segment are only complete if all candidates indexed the same pairs; see common_words_set
+        for (const auto &c : candidates) {
+                if (!c.ap) {
+                        // no index, only masked documents
+                        continue;
+                }
 
+                if (first) {
+                        res   = c.commonWords;
+                        first = false;
+                } else if (!res != !c.commonWords || (res && !(*res == *c.commonWords)))
+                        throw Switch::invalid_argument("Merge candidates were indexed with different common words");
+        }
+
+        return res;
+}
+
+void Trinity::MergeCandidatesCollection::merge_doc_values(const char *basePath) {
+        const auto      sort = merged_sort();
+        DocValuesWriter w;
+        bool            any{false};
+        std::size_t     sortValuesCnt{0};
+
+        // candidates are ordered by gen DESC, and DocValuesWriter retains the first value
+        // set() for each (document, field), which is what we want here
         for (uint16_t i{0}; i != candidates.size(); ++i) {
-                if (trace)
-                        SLog("Candidate ", i, " gen=", candidates[i].gen, " ", candidates[i].ap->codec_identifier(), "\n");
+                const auto dv = candidates[i].docValues;
 
-                if (i)
-                        require(candidates[i].gen < candidates[i - 1].gen);
+                if (!dv)
+                        continue;
 
-                if (candidates[i].terms && false == candidates[i].terms->done() && candidates[i].ap) {
-                        // ap may be nullptr if we only wanted to e.g mask documents
-                        all_.push_back({i, candidates[i]});
+                any = true;
+                for (const auto &f : dv->fields()) {
+                        // the registry expects documents in ascending order, so we need a new one for each field
+                        auto reg = scanner_registry_for(i);
+
+                        if (f.kind == docvalues_kind::Numeric) {
+                                const bool sortField = sort && f.name == sort->field;
+
+                                f.for_each([&](const isrc_docid_t documentID, const int64_t v) {
+                                        if (!reg->test(documentID)) {
+                                                w.set(documentID, f.name, v);
+                                                sortValuesCnt += sortField;
+                                        }
+                                });
+                        } else {
+                                f.for_each([&](const isrc_docid_t documentID, const int64_t ordinal) {
+                                        if (!reg->test(documentID))
+                                                w.set(documentID, f.name, f.string(ordinal));
+                                });
+                        }
                 }
         }
 
-        if (all_.empty())
-                return;
+        // and only if the documents of the candidates don't overlap, which we need to check.
+        // Every document of a sorted candidate has a value for the sort field(SegmentIndexSession::commit() and this method make sure of that), so
+        // every merged document does too, unless a document that's not masked is in more than one candidates, in which case only one
+        // of its values was retained, and the values count won't match sortValuesCnt. That's cheaper than tracking the distinct documents we merged.
+        if (sort && sortValuesCnt && w.in_order(sort->field, sort->order, sortValuesCnt))
+                w.set_index_sort(sort->field, sort->order);
+
+        // We persist it even if it's empty(i.e all values masked), so that it's obvious
+        // that the source had doc-values
+        if (any)
+                w.persist(Buffer{}.append(basePath, "/docvalues"_s32).c_str());
+}
 
-        auto                                                          all = all_.data();
-        uint16_t                                                      rem = all_.size();
-        uint16_t                                                      toAdvance[rem];
-        const auto                                                    isCODEC = is->codec_identifier();
-        DocWordsSpace                                                 dws{Limits::MaxPosition}; // dummy, for materialize_hits()
-        size_t                                                        termHitsCapacity{0};
-        term_hit *                                                    termHitsStorage{nullptr};
-        std::vector<Trinity::Codecs::IndexSession::merge_participant> mergeParticipants;
-        std::vector<std::pair<
-            std::pair<Trinity::Codecs::Decoder *, Trinity::Codecs::PostingsListIterator *>,
-            masked_documents_registry *>>
-            decodersV;
-        term_index_ctx                            tctx;
-        std::unique_ptr<Trinity::Codecs::Encoder> enc(is->new_encoder());
-        // Only if it's implemented by the codec's IndexSession
-        const bool haveAppendIndexChunk = (false == disableOptimizations) && (is->caps & unsigned(Codecs::IndexSession::Capabilities::AppendIndexChunk));
-        const bool haveMerge            = (false == disableOptimizations) && (is->caps & unsigned(Codecs::IndexSession::Capabilities::Merge));
-
-        Defer(
-            {
-                    if (termHitsStorage)
-                            std::free(termHitsStorage);
-            });
-
-        for (;;) {
-                uint8_t    toAdvanceCnt{1};
-                const auto pair = all[0].candidate.terms->cur();
-                auto       selected{pair};
-                auto       codec = all[0].candidate.ap->codec_identifier();
-                bool       sameCODEC{true};
+namespace {
+        // A candidate that has a posting list for the term being merged
+        struct merge_term_participant final {
+                uint16_t                idx; // in candidates[]
+                Trinity::term_index_ctx tctx;
+        };
 
-                toAdvance[0] = 0;
-                for (uint16_t i{1}; i != rem; ++i) {
-                        const auto pair = all[i].candidate.terms->cur();
-                        const auto r    = terms_cmp(pair.first.data(), pair.first.size(), selected.first.data(), selected.first.size());
-
-                        if (r < 0) {
-                                toAdvanceCnt = 1;
-                                toAdvance[0] = i;
-                                selected     = pair;
-                                sameCODEC    = true;
-                                codec        = all[i].candidate.ap->codec_identifier();
-                        } else if (r == 0) {
-                                if (sameCODEC) {
-                                        auto c = all[i].candidate.ap->codec_identifier();
-
-                                        if (c != codec)
-                                                sameCODEC = false;
+        struct tracked_terms final {
+                uint16_t                                            idx;
+                Trinity::IndexSourceTermsView *                     terms;
+                std::pair<Trinity::str8_t, Trinity::term_index_ctx> cur;
+        };
+
+        // order by (term ASC, idx ASC), so that for the same term
+        // candidates are popped in generation DESC order
+        struct tracked_terms_cmp final {
+                inline bool operator()(const tracked_terms *const a, const tracked_terms *const b) const noexcept {
+                        const auto r = Trinity::terms_cmp(a->cur.first.data(), a->cur.first.size(), b->cur.first.data(), b->cur.first.size());
+
+                        return r < 0 || (r == 0 && a->idx < b->idx);
+                }
+        };
+
+        // Merge-sorts the terms of all tracked candidates, and for each distinct term
+        // invokes l(term, participants, participantsCnt), where participants are ordered by generation DESC.
+        //
+        // We used to select the lowest term by scanning all remaining candidates for every term, which
+        // is fine for a few candidates but not for many-way merges.
+        template <typename L>
+        void merge_terms(tracked_terms *const all, const uint16_t cnt, L &&l) {
+                Switch::priority_queue<tracked_terms *, tracked_terms_cmp> pq(cnt);
+                tracked_terms *                                            popped[cnt];
+                merge_term_participant                                     participants[cnt];
+
+                for (uint16_t i{0}; i != cnt; ++i) {
+                        auto t = all + i;
+
+                        t->cur = t->terms->cur();
+                        pq.push(t);
+                }
+
+                while (false == pq.empty()) {
+                        uint16_t   n{0};
+                        const auto t    = pq.pop();
+                        const auto term = t->cur.first;
+
+                        popped[n]         = t;
+                        participants[n++] = {t->idx, t->cur.second};
+
+                        while (false == pq.empty() && 0 == Trinity::terms_cmp(pq.top()->cur.first.data(), pq.top()->cur.first.size(), term.data(), term.size())) {
+                                const auto it = pq.pop();
+
+                                popped[n]         = it;
+                                participants[n++] = {it->idx, it->cur.second};
+                        }
+
+                        l(term, participants, n);
+
+                        do {
+                                auto it = popped[--n];
+
+                                it->terms->next();
+                                if (false == it->terms->done()) {
+                                        it->cur = it->terms->cur();
+                                        pq.push(it);
                                 }
+                        } while (n);
+                }
+        }
+
+        // Encodes merged terms into an index session
+        // We need one for every partition when merging in parallel
+        struct term_merger final {
+                Trinity::MergeCandidatesCollection *const                          coll;
+                Trinity::Codecs::IndexSession *const                               is;
+                std::vector<std::pair<Trinity::str8_t, Trinity::term_index_ctx>> *const terms;
+                Trinity::IndexSource::field_statistics *const                      defaultFieldStats;
+                const strwlen8_t                                                   isCODEC;
+                const bool                                                         haveAppendIndexChunk;
+                const bool                                                         haveMerge;
+                std::unique_ptr<Trinity::Codecs::Encoder>                          enc;
+                Trinity::DocWordsSpace                                             dws{Trinity::Limits::MaxPosition}; // dummy, for materialize_hits()
+                size_t                                                             termHitsCapacity{0};
+                Trinity::term_hit *                                                termHitsStorage{nullptr};
+                std::vector<Trinity::Codecs::IndexSession::merge_participant>      mergeParticipants;
+                std::vector<std::pair<
+                    std::pair<Trinity::Codecs::Decoder *, Trinity::Codecs::PostingsListIterator *>,
+                    Trinity::masked_documents_registry *>>
+                                        decodersV;
+                Trinity::term_index_ctx tctx;
+
+                term_merger(Trinity::MergeCandidatesCollection *c, Trinity::Codecs::IndexSession *s, std::vector<std::pair<Trinity::str8_t, Trinity::term_index_ctx>> *const t, Trinity::IndexSource::field_statistics *const fs, const bool disableOptimizations)
+                    : coll{c}, is{s}, terms{t}, defaultFieldStats{fs}, isCODEC{s->codec_identifier()},
+                      // Only if it's implemented by the codec's IndexSession
+                      haveAppendIndexChunk{(false == disableOptimizations) && (s->caps & unsigned(Trinity::Codecs::IndexSession::Capabilities::AppendIndexChunk))},
+                      haveMerge{(false == disableOptimizations) && (s->caps & unsigned(Trinity::Codecs::IndexSession::Capabilities::Merge))},
+                      enc(s->new_encoder()) {
+                }
+
+                ~term_merger() {
+                        if (termHitsStorage)
+                                std::free(termHitsStorage);
+                }
+
+                void ensure_term_hits_capacity(const size_t freq) {
+                        if (freq > termHitsCapacity) {
+                                if (termHitsStorage)
+                                        std::free(termHitsStorage);
 
-                                toAdvance[toAdvanceCnt++] = i;
+                                termHitsCapacity = freq + 128;
+                                termHitsStorage  = (Trinity::term_hit *)malloc(sizeof(Trinity::term_hit) * termHitsCapacity);
+                        }
+                }
+
+                void merge_term(const Trinity::str8_t outTerm, const merge_term_participant *participants, const uint16_t participantsCnt);
+        };
+
+        void term_merger::merge_term(const Trinity::str8_t outTerm, const merge_term_participant *const participants, const uint16_t participantsCnt) {
+                using namespace Trinity;
+                auto &     candidates = coll->candidates;
+                const auto codec      = candidates[participants[0].idx].ap->codec_identifier();
+                bool       sameCODEC{true};
+
+                for (uint16_t i{1}; i != participantsCnt; ++i) {
+                        if (candidates[participants[i].idx].ap->codec_identifier() != codec) {
+                                sameCODEC = false;
+                                break;
                         }
                 }
 
-                const str8_t                outTerm(allocator->CopyOf(selected.first.data(), selected.first.size()), selected.first.size());
                 [[maybe_unused]] const bool fastPath = sameCODEC && codec == isCODEC;
                 static constexpr bool       trace{false};
-                //const bool trace = selected.first.Eq(_S("ANNEX"));
+                //const bool trace = outTerm.Eq(_S("ANNEX"));
 
                 if (trace)
-                        SLog("TERM [", selected.first, "], toAdvanceCnt = ", toAdvanceCnt, ", sameCODEC = ", sameCODEC, ", first = ", toAdvance[0], ", fastPath = ", fastPath, "\n");
+                        SLog("TERM [", outTerm, "], participantsCnt = ", participantsCnt, ", sameCODEC = ", sameCODEC, ", first = ", participants[0].idx, ", fastPath = ", fastPath, "\n");
 
-                if (toAdvanceCnt == 1) {
-                        auto c             = all[toAdvance[0]].candidate;
-                        auto maskedDocsReg = scanner_registry_for(all[toAdvance[0]].idx);
+                if (participantsCnt == 1) {
+                        const auto &selected      = participants[0];
+                        auto        c             = candidates[selected.idx];
+                        auto        maskedDocsReg = coll->scanner_registry_for(selected.idx);
 
                         if (fastPath && maskedDocsReg->empty() && haveAppendIndexChunk) {
-                                if (likely(selected.second.documents)) {
+                                if (likely(selected.tctx.documents)) {
                                         // See comments below for why this is possible
-                                        const auto chunk = is->append_index_chunk(c.ap, selected.second);
+                                        const auto chunk = is->append_index_chunk(c.ap, selected.tctx);
 
-                                        terms->push_back({outTerm, {selected.second.documents, chunk}});
+                                        terms->push_back({outTerm, {selected.tctx.documents, chunk}});
 
                                         ++(defaultFieldStats->totalTerms);
                                 } else if (trace)
                                         SLog("No documents\n");
                         } else {
-                                if (unlikely(0 == selected.second.documents)) {
+                                if (unlikely(0 == selected.tctx.documents)) {
                                         // It's possible, however unlikely (check your implementation)
                                         // that you have e.g indexed a term, but indexed no documents for that term
                                         // in which case, it will be 0 documents.
@@ -154,9 +289,9 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                                         // Note that SegmentIndexSession and this merge() method explicitly drop terms with no documents associated with them, so
                                         // the only real way to get a term with no document is to use the various Trinity segment constructs directly.
                                         if (trace)
-                                                Print("0 documents for TERM [", selected.first, "]\n");
+                                                Print("0 documents for TERM [", outTerm, "]\n");
                                 } else {
-                                        std::unique_ptr<Trinity::Codecs::Decoder>              dec(c.ap->new_decoder(selected.second));
+                                        std::unique_ptr<Trinity::Codecs::Decoder>              dec(c.ap->new_decoder(selected.tctx));
                                         std::unique_ptr<Trinity::Codecs::PostingsListIterator> it(dec->new_iterator());
 
                                         it->next();
@@ -172,13 +307,7 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                                                         SLog("docID = ", docID, ", masked = ", maskedDocsReg->test(docID), "\n");
 
                                                 if (!maskedDocsReg->test(docID)) {
-                                                        if (freq > termHitsCapacity) {
-                                                                if (termHitsStorage)
-                                                                        std::free(termHitsStorage);
-
-                                                                termHitsCapacity = freq + 128;
-                                                                termHitsStorage  = (term_hit *)malloc(sizeof(term_hit) * termHitsCapacity);
-                                                        }
+                                                        ensure_term_hits_capacity(freq);
 
                                                         enc->begin_document(docID);
                                                         it->materialize_hits(&dws /* dummy */, termHitsStorage);
@@ -217,16 +346,16 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                         if (fastPath && haveMerge) {
                                 mergeParticipants.clear();
 
-                                for (uint16_t i{0}; i != toAdvanceCnt; ++i) {
-                                        const auto idx = toAdvance[i];
+                                for (uint16_t i{0}; i != participantsCnt; ++i) {
+                                        const auto &p = participants[i];
 
-                                        if (likely(all[idx].candidate.terms->cur().second.documents)) {
+                                        if (likely(p.tctx.documents)) {
                                                 // See comments earliert for why this is possible
 
                                                 mergeParticipants.push_back(
-                                                    {all[idx].candidate.ap,
-                                                     all[idx].candidate.terms->cur().second,
-                                                     scanner_registry_for(all[idx].idx).release()});
+                                                    {candidates[p.idx].ap,
+                                                     p.tctx,
+                                                     coll->scanner_registry_for(p.idx).release()});
                                         } else if (trace)
                                                 SLog("No documents for candidate ", i, "\n");
                                 }
@@ -246,15 +375,15 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                                 }
                         } else {
                                 // we got to merge-sort across different codecs and output to an encoder of a different, potentially, codec
-                                for (uint16_t i{0}; i != toAdvanceCnt; ++i) {
-                                        const auto idx = toAdvance[i];
+                                for (uint16_t i{0}; i != participantsCnt; ++i) {
+                                        const auto &p = participants[i];
 
-                                        if (likely(all[idx].candidate.terms->cur().second.documents)) {
+                                        if (likely(p.tctx.documents)) {
                                                 // see earlier comments for why this is possible
-                                                auto ap  = all[idx].candidate.ap;
-                                                auto dec = ap->new_decoder(all[idx].candidate.terms->cur().second);
+                                                auto ap  = candidates[p.idx].ap;
+                                                auto dec = ap->new_decoder(p.tctx);
                                                 auto it  = dec->new_iterator();
-                                                auto reg = scanner_registry_for(all[idx].idx).release();
+                                                auto reg = coll->scanner_registry_for(p.idx).release();
 
                                                 require(reg);
                                                 it->next();
@@ -296,13 +425,7 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                                                         auto       it   = decoders[toAdvance[0]].first.second;
                                                         const auto freq = it->freq;
 
-                                                        if (freq > termHitsCapacity) {
-                                                                if (termHitsStorage)
-                                                                        std::free(termHitsStorage);
-
-                                                                termHitsCapacity = freq + 128;
-                                                                termHitsStorage  = (term_hit *)malloc(sizeof(term_hit) * termHitsCapacity);
-                                                        }
+                                                        ensure_term_hits_capacity(freq);
 
                                                         enc->begin_document(lowestDID);
                                                         it->materialize_hits(&dws /* dummy */, termHitsStorage);
@@ -347,25 +470,156 @@ void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is
                                 }
                         }
                 }
+        }
+} // namespace
 
-                if (flushFreq && is->indexOut.size() > flushFreq) {
-                        // TODO: support pending
+// Make sure you have commited first
+// Unlike with e.g SegmentIndexSession where the order of postlists in the index is based on our translation(term=>integer id) and the ascending order of that id
+// here the order will match the order the terms are found in `tersm`, because we perform a merge-sort and so we process terms in lexicograpphic order
+void Trinity::MergeCandidatesCollection::merge(Trinity::Codecs::IndexSession *is, simple_allocator *allocator, std::vector<std::pair<str8_t, Trinity::term_index_ctx>> *const terms, IndexSource::field_statistics *const defaultFieldStats, const uint32_t flushFreq, const bool disableOptimizations, const uint32_t threadsCnt) {
+        static constexpr bool      trace{false};
+        std::vector<tracked_terms> all;
+
+        if (trace)
+                SLog("Merging ", candidates.size(), " candidates\n");
+
+        require(candidates.size() < std::numeric_limits<uint16_t>::max());
+
+        if (const auto cw = merged_common_words())
+                cw->persist(Buffer{}.append(is->basePath, "/common_words"_s32).c_str());
+
+        for (uint16_t i{0}; i != candidates.size(); ++i) {
+                if (trace)
+                        SLog("Candidate ", i, " gen=", candidates[i].gen, " ", candidates[i].ap->codec_identifier(), "\n");
+
+                if (i)
+                        require(candidates[i].gen < candidates[i - 1].gen);
+
+                if (candidates[i].terms && false == candidates[i].terms->done() && candidates[i].ap) {
+                        // ap may be nullptr if we only wanted to e.g mask documents
+                        all.push_back({i, candidates[i].terms, {}});
                 }
+        }
+
+        if (all.empty()) {
+                merge_doc_values(is->basePath);
+                return;
+        }
 
-                do {
-                        const auto idx   = toAdvance[--toAdvanceCnt];
-                        auto       terms = all[idx].candidate.terms;
+        if (threadsCnt < 2 || 0 == (is->caps & unsigned(Codecs::IndexSession::Capabilities::Partitions))) {
+                term_merger m(this, is, terms, defaultFieldStats, disableOptimizations);
 
-                        terms->next();
-                        if (terms->done()) {
-                                if (!--rem)
-                                        goto l1;
+                merge_terms(all.data(), all.size(), [&](const str8_t term, const merge_term_participant *participants, const uint16_t participantsCnt) {
+                        const str8_t outTerm(allocator->CopyOf(term.data(), term.size()), term.size());
 
-                                memmove(all + idx, all + idx + 1, (rem - idx) * sizeof(all[0]));
+                        m.merge_term(outTerm, participants, participantsCnt);
+
+                        if (flushFreq && is->indexOut.size() > flushFreq) {
+                                // TODO: support pending
                         }
-                } while (toAdvanceCnt);
+                });
+
+                merge_doc_values(is->basePath);
+                return;
         }
-l1:;
+
+        // Parallel merge
+        // We first merge-sort all terms, which is cheap compared to merging the postings lists, and
+        // partition the terms space into ranges of roughly equal cost, based on the number of documents of all participants.
+        // Each range is merged on its own thread into its own partition session, and then
+        // all partitions are appended, in order, to `is`, which fixes up the term_index_ctx of their terms.
+        struct term_ref final {
+                str8_t   term;
+                uint32_t participantsOffset;
+                uint16_t participantsCnt;
+        };
+
+        struct partition final {
+                std::unique_ptr<Codecs::IndexSession>          sess;
+                std::vector<std::pair<str8_t, term_index_ctx>> terms;
+                IndexSource::field_statistics                  fs;
+        };
+
+        std::vector<term_ref>                          allTerms;
+        std::vector<merge_term_participant>            allParticipants;
+        std::vector<std::pair<uint32_t, uint32_t>>     ranges;
+        std::vector<std::future<std::unique_ptr<partition>>> futures;
+        uint64_t                                       totalCost{0};
+
+        merge_terms(all.data(), all.size(), [&](const str8_t term, const merge_term_participant *participants, const uint16_t participantsCnt) {
+                allTerms.push_back({{allocator->CopyOf(term.data(), term.size()), term.size()}, uint32_t(allParticipants.size()), participantsCnt});
+
+                for (uint16_t i{0}; i != participantsCnt; ++i) {
+                        allParticipants.push_back(participants[i]);
+                        totalCost += participants[i].tctx.documents;
+                }
+                ++totalCost;
+        });
+
+        if (trace)
+                SLog(allTerms.size(), " distinct terms, totalCost = ", totalCost, "\n");
+
+        {
+                const auto target = totalCost / threadsCnt + 1;
+                uint64_t   cost{0};
+                uint32_t   base{0};
+
+                for (uint32_t i{0}; i != allTerms.size(); ++i) {
+                        const auto &t = allTerms[i];
+
+                        for (uint16_t j{0}; j != t.participantsCnt; ++j)
+                                cost += allParticipants[t.participantsOffset + j].tctx.documents;
+                        ++cost;
+
+                        if (cost >= target) {
+                                ranges.push_back({base, i + 1});
+                                base = i + 1;
+                                cost = 0;
+                        }
+                }
+
+                if (base != allTerms.size())
+                        ranges.push_back({base, allTerms.size()});
+        }
+
+        for (const auto range : ranges) {
+                futures.emplace_back(
+                    std::async(std::launch::async, [&, range, disableOptimizations]() {
+                            auto p = std::make_unique<partition>();
+
+                            p->sess.reset(is->new_partition_session());
+                            require(p->sess);
+                            p->sess->begin();
+
+                            {
+                                    term_merger m(this, p->sess.get(), &p->terms, &p->fs, disableOptimizations);
+
+                                    for (auto i{range.first}; i != range.second; ++i) {
+                                            const auto &t = allTerms[i];
+
+                                            m.merge_term(t.term, allParticipants.data() + t.participantsOffset, t.participantsCnt);
+                                    }
+                            }
+
+                            return p;
+                    }));
+        }
+
+        for (auto &f : futures) {
+                auto p = f.get();
+
+                is->append_partition(p->sess.get(), p->terms.data(), p->terms.size());
+                terms->insert(terms->end(), p->terms.begin(), p->terms.end());
+
+                defaultFieldStats->sumTermHits += p->fs.sumTermHits;
+                defaultFieldStats->totalTerms += p->fs.totalTerms;
+                defaultFieldStats->sumTermsDocs += p->fs.sumTermsDocs;
+
+                if (trace)
+                        SLog("Appended partition of ", p->terms.size(), " terms\n");
+        }
+
+        merge_doc_values(is->basePath);
 }
 
 std::vector<std::pair<uint64_t, Trinity::MergeCandidatesCollection::IndexSourceRetention>>
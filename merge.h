@@ -1,5 +1,6 @@
 #pragma once
 #include "docidupdates.h"
+#include "docvalues.h"
 #include "terms.h"
 #include "index_source.h"
 
@@ -20,10 +21,18 @@ namespace Trinity {
                 // see MergeCandidatesCollection::merge() impl.
                 updated_documents maskedDocuments;
 
+                // The index source's doc-values, if any(see IndexSource::doc_values())
+                const DocValues *docValues{nullptr};
+
+                // The common words the index source was indexed with, if any(see IndexSource::common_words())
+                const common_words_set *commonWords{nullptr};
+
                 merge_candidate &operator=(const merge_candidate &o) {
-                        gen   = o.gen;
-                        terms = o.terms;
-                        ap    = o.ap;
+                        gen         = o.gen;
+                        terms       = o.terms;
+                        ap          = o.ap;
+                        docValues   = o.docValues;
+                        commonWords = o.commonWords;
                         new (&maskedDocuments) updated_documents(o.maskedDocuments);
                         return *this;
                 }
@@ -47,6 +56,15 @@ namespace Trinity {
 
                 std::unique_ptr<Trinity::masked_documents_registry> scanner_registry_for(const uint16_t idx);
 
+              private:
+                const index_sort *merged_sort() const;
+
+                const common_words_set *merged_common_words() const;
+
+                void merge_doc_values(const char *basePath);
+
+              public:
+
                 // This method will merge all registered merge candidates into a new index session and will also output all
                 // distinct terms and their term_index_ctx.
                 // It will properly and optimally handle different input codecs and mismatches between output codec(i.e is->codec_identifier() )
@@ -66,7 +84,20 @@ namespace Trinity {
                 // If you are going to use ExecFlags::AccumulatedScoreScheme, and your scorer depends on IndexSource::field_statistics, those are
                 // only computed, during merge, for terms that are not handled by append_index_chunk(), so you may want to disable it, so that
                 // statistics for those terms as well will be collected.
-                void merge(Codecs::IndexSession *outIndexSess, simple_allocator *, std::vector<std::pair<str8_t, term_index_ctx>> *const outTerms, IndexSource::field_statistics *fs, const uint32_t flushFreq = 0, const bool disableOptimizations = false);
+                //
+                // If threadsCnt > 1 and outIndexSess's codec supports Codecs::IndexSession::Capabilities::Partitions, the terms space
+                // is partitioned into up to threadsCnt lexicographic ranges which are merged in parallel, each into its own partition session, and
+                // then appended to outIndexSess in order (see Codecs::IndexSession::new_partition_session()).
+                // All partitions are memory-resident until they are appended, so you may want to account for that with very large merges.
+                //
+                // If any of the candidates has docValues, the values of all documents that are not masked are persisted in outIndexSess->basePath/docvalues.
+                // If the same document has a value in more than one candidates, the value from the most recent one(highest gen) is retained.
+                // If all candidates are sorted the same way(see index_sort), and the merged documents are still in order, so is the merged segment.
+                // That also requires that no document that's not masked is in more than one of the candidates.
+                //
+                // All candidates with an index must have been indexed with the same common words(see common_words_set), or none, otherwise
+                // merge() throws Switch::invalid_argument before it merges anything. The common words, if any, are persisted in outIndexSess->basePath/common_words.
+                void merge(Codecs::IndexSession *outIndexSess, simple_allocator *, std::vector<std::pair<str8_t, term_index_ctx>> *const outTerms, IndexSource::field_statistics *fs, const uint32_t flushFreq = 0, const bool disableOptimizations = false, const uint32_t threadsCnt = 1);
 
                 enum class IndexSourceRetention : uint8_t {
                         RetainAll = 0,
@@ -1,4 +1,6 @@
 #include "percolator.h"
+#include <functional>
+#include <unordered_set>
 
 using namespace Trinity;
 
@@ -130,8 +132,755 @@ bool percolator_query::exec(const exec_node n, percolator_document_proxy &src) c
                         return true;
 
                 case ENT::dummyop:
+                case ENT::matchappids:
                 case ENT::SPECIALIMPL_COLLECTION_LOGICALOR:
                 case ENT::SPECIALIMPL_COLLECTION_LOGICALAND:
                         std::abort();
         }
 }
+
+bool percolator_query::leaders(const exec_node n, std::vector<exec_term_id_t> *const out) const {
+        // When any one of a few alternatives will do(e.g for a logical AND), we prefer the one with fewer terms, and
+        // then the one with the longest shortest term; longer terms tend to be rarer, so fewer documents will need to consider the query
+        const auto shortest = [this](const exec_term_id_t *const terms, const std::size_t cnt) {
+                std::size_t res{std::numeric_limits<std::size_t>::max()};
+
+                for (std::size_t i{0}; i != cnt; ++i)
+                        res = std::min<std::size_t>(res, term_by_index(terms[i]).size());
+                return res;
+        };
+        const auto longest = [this](const exec_term_id_t *const terms, const std::size_t cnt) {
+                auto res = terms[0];
+
+                for (std::size_t i{1}; i != cnt; ++i) {
+                        if (term_by_index(terms[i]).size() > term_by_index(res).size())
+                                res = terms[i];
+                }
+                return res;
+        };
+        const auto any_of = [&](const exec_node *const nodes, const std::size_t cnt) {
+                std::vector<exec_term_id_t> best, cur;
+                bool                        found{false};
+
+                for (std::size_t i{0}; i != cnt; ++i) {
+                        cur.clear();
+                        if (!leaders(nodes[i], &cur))
+                                continue;
+
+                        if (!found || cur.size() < best.size() || (cur.size() == best.size() && shortest(cur.data(), cur.size()) > shortest(best.data(), best.size()))) {
+                                best.swap(cur);
+                                found = true;
+                        }
+                }
+
+                if (found)
+                        out->insert(out->end(), best.begin(), best.end());
+                return found;
+        };
+        const auto all_of = [&](const exec_node *const nodes, const std::size_t cnt) {
+                for (std::size_t i{0}; i != cnt; ++i) {
+                        if (!leaders(nodes[i], out))
+                                return false;
+                }
+                return true;
+        };
+
+        switch (n.fp) {
+                case ENT::matchterm:
+                        out->push_back(n.u16);
+                        return true;
+
+                case ENT::constfalse:
+                        // never matches, so no terms are needed
+                        return true;
+
+                case ENT::consttrue:
+                case ENT::consttrueexpr:
+                case ENT::unarynot:
+                        return false;
+
+                case ENT::matchallterms: {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                        out->push_back(longest(run->terms, run->size));
+                        return true;
+                }
+
+                case ENT::matchanyterms: {
+                        const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                        out->insert(out->end(), run->terms, run->terms + run->size);
+                        return true;
+                }
+
+                case ENT::unaryand:
+                        return leaders(static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr, out);
+
+                case ENT::matchphrase: {
+                        const auto p = static_cast<const compilation_ctx::phrase *>(n.ptr);
+
+                        out->push_back(longest(p->termIDs, p->size));
+                        return true;
+                }
+
+                case ENT::matchallphrases: {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+                        const auto p   = run->phrases[0];
+
+                        out->push_back(longest(p->termIDs, p->size));
+                        return true;
+                }
+
+                case ENT::matchanyphrases: {
+                        const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+
+                        for (decltype(run->size) i{0}; i != run->size; ++i) {
+                                const auto p = run->phrases[i];
+
+                                out->push_back(longest(p->termIDs, p->size));
+                        }
+                        return true;
+                }
+
+                case ENT::logicaland: {
+                        const auto b = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+                        const exec_node nodes[] = {b->lhs, b->rhs};
+
+                        return any_of(nodes, 2);
+                }
+
+                case ENT::logicalnot:
+                        return leaders(static_cast<const compilation_ctx::binop_ctx *>(n.ptr)->lhs, out);
+
+                case ENT::logicalor: {
+                        const auto b = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+
+                        return leaders(b->lhs, out) && leaders(b->rhs, out);
+                }
+
+                case ENT::matchsome: {
+                        // it's enough for any min of them to match, so we need them all
+                        const auto pm = static_cast<const compilation_ctx::partial_match_ctx *>(n.ptr);
+
+                        return all_of(pm->nodes, pm->size);
+                }
+
+                case ENT::matchallnodes: {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+
+                        return any_of(g->nodes, g->size);
+                }
+
+                case ENT::matchanynodes: {
+                        const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+
+                        return all_of(g->nodes, g->size);
+                }
+
+                case ENT::dummyop:
+                case ENT::matchappids:
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALOR:
+                case ENT::SPECIALIMPL_COLLECTION_LOGICALAND:
+                        std::abort();
+        }
+
+        return false;
+}
+
+bool percolator_query::leader_terms(std::vector<exec_term_id_t> *const out) const {
+        out->clear();
+        if (!leaders(root, out))
+                return false;
+
+        std::sort(out->begin(), out->end());
+        out->erase(std::unique(out->begin(), out->end()), out->end());
+        return true;
+}
+
+percolator_program::percolator_program(const uint8_t *p) {
+        const auto hdr = reinterpret_cast<const uint32_t *>(p);
+
+        size       = hdr[2];
+        codeSize   = hdr[3];
+        termsCnt   = reinterpret_cast<const uint16_t *>(p)[8];
+        phrasesCnt = reinterpret_cast<const uint16_t *>(p)[9];
+        maxDepth   = reinterpret_cast<const uint16_t *>(p)[10];
+        leadersCnt = reinterpret_cast<const uint16_t *>(p)[11];
+        code       = hdr + K_header_size / sizeof(uint32_t);
+        leaders    = reinterpret_cast<const uint16_t *>(code + codeSize);
+        phrases    = leaders + (has_leaders() ? leadersCnt : 0);
+
+        auto it = phrases;
+
+        for (decltype(phrasesCnt) i{0}; i != phrasesCnt; ++i)
+                it += *it + 1;
+        terms = reinterpret_cast<const uint8_t *>(it);
+}
+
+percolator_program::percolator_program(const uint8_t *p, const std::size_t available)
+    : percolator_program(validated(p, available)) {
+}
+
+const uint8_t *percolator_program::validated(const uint8_t *const p, const std::size_t available) {
+        if (available < K_header_size || (reinterpret_cast<uintptr_t>(p) & 3))
+                throw Switch::data_error("Unexpected percolator program");
+
+        const auto hdr = reinterpret_cast<const uint32_t *>(p);
+
+        if (hdr[0] != K_magic)
+                throw Switch::data_error("Not a percolator program");
+        else if (hdr[1] != K_version)
+                throw Switch::data_error("Unsupported percolator program version ", hdr[1]);
+
+        const auto size       = hdr[2];
+        const auto codeSize   = hdr[3];
+        const auto termsCnt   = reinterpret_cast<const uint16_t *>(p)[8];
+        const auto phrasesCnt = reinterpret_cast<const uint16_t *>(p)[9];
+        const auto maxDepth   = reinterpret_cast<const uint16_t *>(p)[10];
+        const auto leadersCnt = reinterpret_cast<const uint16_t *>(p)[11];
+        const auto end        = p + size;
+        const auto bitsCnt    = uint32_t(termsCnt) + phrasesCnt;
+
+        if (size < K_header_size || size > available || (size & 3) || !codeSize || codeSize > (size - K_header_size) / sizeof(uint32_t))
+                throw Switch::data_error("Unexpected percolator program size");
+
+        const auto code = hdr + K_header_size / sizeof(uint32_t);
+        auto       it   = reinterpret_cast<const uint16_t *>(code + codeSize);
+
+        if (leadersCnt != K_no_leaders) {
+                if (reinterpret_cast<const uint8_t *>(it + leadersCnt) > end)
+                        throw Switch::data_error("Unexpected percolator program leaders");
+
+                for (uint16_t i{0}; i != leadersCnt; ++i) {
+                        if (it[i] >= termsCnt)
+                                throw Switch::data_error("Unexpected percolator program leader");
+                }
+                it += leadersCnt;
+        }
+
+        for (uint16_t i{0}; i != phrasesCnt; ++i) {
+                if (reinterpret_cast<const uint8_t *>(it + 1) > end || !*it || reinterpret_cast<const uint8_t *>(it + 1 + *it) > end)
+                        throw Switch::data_error("Unexpected percolator program phrase");
+
+                for (uint16_t k{1}; k <= *it; ++k) {
+                        if (it[k] >= termsCnt)
+                                throw Switch::data_error("Unexpected percolator program phrase term");
+                }
+                it += *it + 1;
+        }
+
+        auto t = reinterpret_cast<const uint8_t *>(it);
+
+        for (uint16_t i{0}; i != termsCnt; ++i) {
+                if (t >= end || t + 1 + *t > end)
+                        throw Switch::data_error("Unexpected percolator program term");
+                t += 1 + *t;
+        }
+
+        // Simulate the stack; see match()
+        uint32_t depth{0};
+
+        for (auto ip = code, codeEnd = code + codeSize; ip != codeEnd;) {
+                const auto in      = *ip++;
+                const auto operand = in >> 8;
+
+                switch (in & 0xff) {
+                        case uint8_t(Op::Bit):
+                                if (operand >= bitsCnt)
+                                        throw Switch::data_error("Unexpected percolator program bit");
+                                ++depth;
+                                break;
+
+                        case uint8_t(Op::Const):
+                                if (operand > 1)
+                                        throw Switch::data_error("Unexpected percolator program constant");
+                                ++depth;
+                                break;
+
+                        case uint8_t(Op::AllBits):
+                        case uint8_t(Op::AnyBits):
+                                if (operand > uint32_t(codeEnd - ip))
+                                        throw Switch::data_error("Unexpected percolator program bits");
+                                for (uint32_t i{0}; i != operand; ++i) {
+                                        if (ip[i] >= bitsCnt)
+                                                throw Switch::data_error("Unexpected percolator program bit");
+                                }
+                                ip += operand;
+                                ++depth;
+                                break;
+
+                        case uint8_t(Op::Not):
+                                if (!depth)
+                                        throw Switch::data_error("Unexpected percolator program stack");
+                                break;
+
+                        case uint8_t(Op::AndNot):
+                                if (depth < 2)
+                                        throw Switch::data_error("Unexpected percolator program stack");
+                                --depth;
+                                break;
+
+                        case uint8_t(Op::AtLeast):
+                                if (ip == codeEnd)
+                                        throw Switch::data_error("Unexpected percolator program code");
+                                ++ip; // min
+                                [[fallthrough]];
+
+                        case uint8_t(Op::AllOf):
+                        case uint8_t(Op::AnyOf):
+                                if (!operand || operand > depth)
+                                        throw Switch::data_error("Unexpected percolator program stack");
+                                depth -= operand - 1;
+                                break;
+
+                        default:
+                                throw Switch::data_error("Unexpected percolator program instruction");
+                }
+
+                if (depth > maxDepth)
+                        throw Switch::data_error("Unexpected percolator program stack");
+        }
+
+        if (depth != 1)
+                throw Switch::data_error("Unexpected percolator program stack");
+
+        return p;
+}
+
+void percolator_program::all_terms(str8_t *const out) const noexcept {
+        auto p = terms;
+
+        for (decltype(termsCnt) i{0}; i != termsCnt; ++i) {
+                const auto len = *p++;
+
+                out[i].Set(reinterpret_cast<const char *>(p), len);
+                p += len;
+        }
+}
+
+bool percolator_program::match(const uint64_t *const bits) const noexcept {
+        uint8_t    stack[maxDepth + 1];
+        uint32_t   sp{0};
+        const auto bit = [bits](const uint32_t i) noexcept {
+                return uint8_t((bits[i >> 6] >> (i & 63)) & 1);
+        };
+
+        for (auto ip = code, end = code + codeSize; ip != end;) {
+                const auto in      = *ip++;
+                const auto operand = in >> 8;
+
+                switch (Op(in & 0xff)) {
+                        case Op::Bit:
+                                stack[sp++] = bit(operand);
+                                break;
+
+                        case Op::Const:
+                                stack[sp++] = operand;
+                                break;
+
+                        case Op::AllBits: {
+                                uint8_t r{1};
+
+                                for (uint32_t i{0}; i != operand; ++i)
+                                        r &= bit(ip[i]);
+                                ip += operand;
+                                stack[sp++] = r;
+                        } break;
+
+                        case Op::AnyBits: {
+                                uint8_t r{0};
+
+                                for (uint32_t i{0}; i != operand; ++i)
+                                        r |= bit(ip[i]);
+                                ip += operand;
+                                stack[sp++] = r;
+                        } break;
+
+                        case Op::Not:
+                                stack[sp - 1] ^= 1;
+                                break;
+
+                        case Op::AndNot:
+                                --sp;
+                                stack[sp - 1] &= stack[sp] ^ 1;
+                                break;
+
+                        case Op::AllOf: {
+                                uint8_t r{1};
+
+                                sp -= operand;
+                                for (uint32_t i{0}; i != operand; ++i)
+                                        r &= stack[sp + i];
+                                stack[sp++] = r;
+                        } break;
+
+                        case Op::AnyOf: {
+                                uint8_t r{0};
+
+                                sp -= operand;
+                                for (uint32_t i{0}; i != operand; ++i)
+                                        r |= stack[sp + i];
+                                stack[sp++] = r;
+                        } break;
+
+                        case Op::AtLeast: {
+                                const auto min = *ip++;
+                                uint32_t   n{0};
+
+                                sp -= operand;
+                                for (uint32_t i{0}; i != operand; ++i)
+                                        n += stack[sp + i];
+                                stack[sp++] = n >= min;
+                        } break;
+                }
+        }
+
+        return stack[0];
+}
+
+void percolator_query::compile(IOBuffer *const out) const {
+        using Op = percolator_program::Op;
+        std::vector<uint32_t>                            code;
+        std::vector<const compilation_ctx::phrase *>     phrases;
+        std::vector<exec_term_id_t>                      leaders;
+        const uint32_t                                   termsCnt = comp_ctx.allTerms.size();
+        uint32_t                                         depth{0}, maxDepth{0};
+        const auto                                       push     = [&](const uint32_t in) {
+                code.push_back(in);
+                maxDepth = std::max(maxDepth, ++depth);
+        };
+        const auto phrase_bit = [&](const compilation_ctx::phrase *const p) -> uint32_t {
+                // phrases are not interned; we 'll identify them by their terms
+                for (uint32_t i{0}; i != phrases.size(); ++i) {
+                        if (phrases[i]->size == p->size && !memcmp(phrases[i]->termIDs, p->termIDs, p->size * sizeof(exec_term_id_t)))
+                                return termsCnt + i;
+                }
+
+                phrases.push_back(p);
+                return termsCnt + phrases.size() - 1;
+        };
+        std::function<void(const exec_node)> emit = [&](const exec_node n) {
+                switch (n.fp) {
+                        case ENT::matchterm:
+                                push(percolator_program::instruction(Op::Bit, n.u16 - 1));
+                                break;
+
+                        case ENT::constfalse:
+                                push(percolator_program::instruction(Op::Const, 0));
+                                break;
+
+                        case ENT::consttrue:
+                        case ENT::consttrueexpr:
+                                push(percolator_program::instruction(Op::Const, 1));
+                                break;
+
+                        case ENT::matchallterms:
+                        case ENT::matchanyterms: {
+                                const auto run = static_cast<const compilation_ctx::termsrun *>(n.ptr);
+
+                                push(percolator_program::instruction(n.fp == ENT::matchallterms ? Op::AllBits : Op::AnyBits, run->size));
+                                for (decltype(run->size) i{0}; i != run->size; ++i)
+                                        code.push_back(run->terms[i] - 1);
+                        } break;
+
+                        case ENT::unaryand:
+                                emit(static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr);
+                                break;
+
+                        case ENT::unarynot:
+                                emit(static_cast<const compilation_ctx::unaryop_ctx *>(n.ptr)->expr);
+                                code.push_back(percolator_program::instruction(Op::Not, 0));
+                                break;
+
+                        case ENT::matchphrase:
+                                push(percolator_program::instruction(Op::Bit, phrase_bit(static_cast<const compilation_ctx::phrase *>(n.ptr))));
+                                break;
+
+                        case ENT::matchallphrases:
+                        case ENT::matchanyphrases: {
+                                const auto run = static_cast<const compilation_ctx::phrasesrun *>(n.ptr);
+
+                                push(percolator_program::instruction(n.fp == ENT::matchallphrases ? Op::AllBits : Op::AnyBits, run->size));
+                                for (decltype(run->size) i{0}; i != run->size; ++i)
+                                        code.push_back(phrase_bit(run->phrases[i]));
+                        } break;
+
+                        case ENT::logicaland:
+                        case ENT::logicalor:
+                        case ENT::logicalnot: {
+                                const auto b = static_cast<const compilation_ctx::binop_ctx *>(n.ptr);
+
+                                emit(b->lhs);
+                                emit(b->rhs);
+                                depth -= 2;
+                                push(n.fp == ENT::logicalnot
+                                         ? percolator_program::instruction(Op::AndNot, 0)
+                                         : percolator_program::instruction(n.fp == ENT::logicaland ? Op::AllOf : Op::AnyOf, 2));
+                        } break;
+
+                        case ENT::matchsome: {
+                                const auto pm = static_cast<const compilation_ctx::partial_match_ctx *>(n.ptr);
+
+                                for (decltype(pm->size) i{0}; i != pm->size; ++i)
+                                        emit(pm->nodes[i]);
+                                depth -= pm->size;
+                                push(percolator_program::instruction(Op::AtLeast, pm->size));
+                                code.push_back(pm->min);
+                        } break;
+
+                        case ENT::matchallnodes:
+                        case ENT::matchanynodes: {
+                                const auto g = static_cast<const compilation_ctx::nodes_group *>(n.ptr);
+
+                                for (decltype(g->size) i{0}; i != g->size; ++i)
+                                        emit(g->nodes[i]);
+                                depth -= g->size;
+                                push(percolator_program::instruction(n.fp == ENT::matchallnodes ? Op::AllOf : Op::AnyOf, g->size));
+                        } break;
+
+                        case ENT::dummyop:
+                        case ENT::matchappids:
+                        case ENT::SPECIALIMPL_COLLECTION_LOGICALOR:
+                        case ENT::SPECIALIMPL_COLLECTION_LOGICALAND:
+                                std::abort();
+                }
+        };
+
+        emit(root);
+
+        const bool hasLeaders = leader_terms(&leaders);
+        const auto base       = out->size();
+
+        require(termsCnt + phrases.size() < (1u << 24));
+        out->pack(percolator_program::K_magic, percolator_program::K_version, uint32_t(0), uint32_t(code.size()),
+                  uint16_t(termsCnt), uint16_t(phrases.size()), uint16_t(maxDepth), hasLeaders ? uint16_t(leaders.size()) : percolator_program::K_no_leaders);
+        out->serialize(code.data(), code.size() * sizeof(uint32_t));
+        if (hasLeaders) {
+                for (const auto id : leaders)
+                        out->pack(uint16_t(id - 1));
+        }
+        for (const auto p : phrases) {
+                out->pack(uint16_t(p->size));
+                for (uint16_t i{0}; i != p->size; ++i)
+                        out->pack(uint16_t(p->termIDs[i] - 1));
+        }
+        for (const auto term : comp_ctx.allTerms) {
+                out->pack(uint8_t(term.size()));
+                out->serialize(term.data(), term.size());
+        }
+        while ((out->size() - base) & 3)
+                out->pack(uint8_t(0));
+
+        *reinterpret_cast<uint32_t *>(out->data() + base + 2 * sizeof(uint32_t)) = out->size() - base;
+}
+
+percolator_index::~percolator_index() {
+        for (auto &it : byTerm)
+                std::free(const_cast<char *>(it.first.data()));
+}
+
+void percolator_index::index(const uint32_t slot) {
+        const percolator_program p(queries[slot].program);
+
+        if (!p.has_leaders()) {
+                unindexed.push_back(slot);
+                return;
+        }
+
+        str8_t terms[p.termsCnt];
+
+        p.all_terms(terms);
+        for (uint16_t i{0}; i != p.leadersCnt; ++i) {
+                const auto term = terms[p.leaders[i]];
+                auto       it   = byTerm.find(term);
+
+                if (it == byTerm.end()) {
+                        // the key must outlive the program, because other programs may be indexed by the same term
+                        auto data = static_cast<char *>(malloc(term.size()));
+
+                        memcpy(data, term.data(), term.size());
+                        it = byTerm.emplace(str8_t(data, term.size()), std::vector<uint32_t>{}).first;
+                }
+
+                it->second.push_back(slot);
+        }
+}
+
+uint32_t percolator_index::store(const query_id_t id, const uint8_t *const program) {
+        uint32_t slot;
+
+        erase(id);
+        if (!freeSlots.empty()) {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+        } else {
+                slot = queries.size();
+                queries.emplace_back();
+        }
+
+        queries[slot].id      = id;
+        queries[slot].program = program;
+        slots.emplace(id, slot);
+        return slot;
+}
+
+bool percolator_index::insert(const query_id_t id, const Trinity::query &in) {
+        const percolator_query q(in);
+
+        if (!q) {
+                erase(id);
+                return false;
+        }
+
+        IOBuffer b;
+
+        q.compile(&b);
+
+        auto owned = std::make_unique<uint32_t[]>(b.size() / sizeof(uint32_t));
+
+        memcpy(owned.get(), b.data(), b.size());
+
+        const auto slot = store(id, reinterpret_cast<const uint8_t *>(owned.get()));
+
+        queries[slot].owned = std::move(owned);
+        index(slot);
+        return true;
+}
+
+void percolator_index::insert(const std::vector<std::pair<query_id_t, const Trinity::query *>> &all) {
+        slots.reserve(slots.size() + all.size());
+        queries.reserve(queries.size() + all.size());
+
+        for (const auto &it : all)
+                insert(it.first, *it.second);
+}
+
+void percolator_index::insert(const query_id_t id, const uint8_t *const program, const std::size_t available) {
+        const percolator_program p(program, available); // validate it before we touch the index
+
+        index(store(id, program));
+}
+
+void percolator_index::insert(const std::vector<std::pair<query_id_t, range_base<const uint8_t *, std::size_t>>> &all) {
+        slots.reserve(slots.size() + all.size());
+        queries.reserve(queries.size() + all.size());
+
+        for (const auto &it : all)
+                insert(it.first, it.second.offset, it.second.size());
+}
+
+bool percolator_index::erase(const query_id_t id) {
+        return erase(&id, 1) != 0;
+}
+
+std::size_t percolator_index::erase(const query_id_t *const ids, const std::size_t cnt) {
+        std::vector<uint32_t> erased;
+        std::vector<str8_t>   affected;
+        bool                  anyUnindexed{false};
+
+        for (std::size_t i{0}; i != cnt; ++i) {
+                const auto it = slots.find(ids[i]);
+
+                if (it == slots.end())
+                        continue;
+
+                const auto               slot = it->second;
+                const percolator_program p(queries[slot].program);
+
+                if (p.has_leaders()) {
+                        str8_t terms[p.termsCnt];
+
+                        p.all_terms(terms);
+                        for (uint16_t i{0}; i != p.leadersCnt; ++i)
+                                affected.push_back(terms[p.leaders[i]]);
+                } else
+                        anyUnindexed = true;
+
+                erased.push_back(slot);
+                slots.erase(it);
+        }
+
+        if (erased.empty())
+                return 0;
+
+        std::sort(erased.begin(), erased.end());
+
+        const auto is_erased = [&erased](const uint32_t slot) noexcept {
+                return std::binary_search(erased.begin(), erased.end(), slot);
+        };
+
+        // affected terms may point into erased programs, so we need to compact the lists before we release them
+        std::sort(affected.begin(), affected.end());
+        affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+        for (const auto term : affected) {
+                const auto it = byTerm.find(term);
+
+                if (it == byTerm.end())
+                        continue;
+
+                auto &v = it->second;
+
+                v.erase(std::remove_if(v.begin(), v.end(), is_erased), v.end());
+                if (v.empty()) {
+                        auto data = const_cast<char *>(it->first.data());
+
+                        byTerm.erase(it);
+                        std::free(data);
+                }
+        }
+
+        if (anyUnindexed)
+                unindexed.erase(std::remove_if(unindexed.begin(), unindexed.end(), is_erased), unindexed.end());
+
+        for (const auto slot : erased) {
+                queries[slot].program = nullptr;
+                queries[slot].owned.reset();
+                freeSlots.push_back(slot);
+        }
+
+        return erased.size();
+}
+
+void percolator_index::match(percolator_document &doc, const str8_t *const docTerms, const std::size_t docTermsCnt, std::vector<query_id_t> *const out) const {
+        std::vector<uint32_t>            candidates;
+        const std::unordered_set<str8_t> present(docTerms, docTerms + docTermsCnt);
+
+        for (std::size_t i{0}; i != docTermsCnt; ++i) {
+                if (const auto it = byTerm.find(docTerms[i]); it != byTerm.end())
+                        candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+        }
+        candidates.insert(candidates.end(), unindexed.begin(), unindexed.end());
+
+        // a query may be indexed by more than one of the document's terms
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        for (const auto slot : candidates) {
+                const percolator_program p(queries[slot].program);
+                uint64_t                 bits[(p.bits_cnt() + 63) / 64 + 1];
+                str8_t                   terms[p.termsCnt];
+                uint32_t                 bit{p.termsCnt};
+
+                memset(bits, 0, sizeof(bits));
+                p.all_terms(terms);
+                for (uint32_t i{0}; i != p.termsCnt; ++i) {
+                        if (present.count(terms[i]))
+                                bits[i >> 6] |= uint64_t(1) << (i & 63);
+                }
+
+                p.for_each_phrase([&](const uint16_t *const phraseTerms, const uint16_t size) {
+                        str8_t phrase[size];
+
+                        for (uint16_t i{0}; i != size; ++i)
+                                phrase[i] = terms[phraseTerms[i]];
+
+                        // all of its terms must be present, otherwise don't bother
+                        if (std::all_of(phrase, phrase + size, [&present](const auto t) { return present.count(t); }) && doc.match_phrase(phrase, size))
+                                bits[bit >> 6] |= uint64_t(1) << (bit & 63);
+                        ++bit;
+                });
+
+                if (p.match(bits))
+                        out->push_back(queries[slot].id);
+        }
+}
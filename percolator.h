@@ -1,9 +1,11 @@
 // See https://www.youtube.com/watch?v=f4lqBb1d7no&list=PLcGKfGEEONaDzd0Hkn2f1talsTu1HLDYu&index=21
 //  Describes the Predicate Index Twitter employs to reduce number of distinct rules to
 // attempt to match against a new tweet.
+#pragma once
 #include "common.h"
 #include "compilation_ctx.h"
 #include "queries.h"
+#include <memory>
 
 namespace Trinity {
         struct percolator_document_proxy {
@@ -16,6 +18,94 @@ namespace Trinity {
                 virtual bool match_phrase(const uint16_t *, const uint16_t cnt) = 0;
         };
 
+        // A percolator_query compiled(see percolator_query::compile()) into a flat, post-order program for a tiny stack machine.
+        // The document is represented as a bitset: bit i is set if the document contains the query's term i + 1(i.e term_by_index(i + 1)), and
+        // bit terms_cnt + j is set if it contains the query's phrase j. There are no pointers to chase, no virtual calls and no recursion.
+        //
+        // Programs contain no pointers, so you can write them to a file and then use them directly from the mmap()ed file. percolator_program
+        // is just a view over a program; it doesn't own the memory, which must be 4 bytes aligned.
+        // Programs you didn't compile yourself in this process(e.g read from a file) should be accessed with the constructor that validates them.
+        //
+        // Layout:
+        // 	u32 magic(K_magic), u32 version(K_version), u32 size(in bytes, a multiple of 4), u32 codeSize, u16 termsCnt, u16 phrasesCnt, u16 maxDepth, u16 leadersCnt
+        // 	u32 code[codeSize]: instructions; u8 op | operand << 8
+        // 	u16 leaders[leadersCnt]: see percolator_query::leader_terms(); leadersCnt is K_no_leaders if there is no such set of terms
+        // 	phrases[phrasesCnt]: u16 size, u16 terms[size]
+        // 	terms[termsCnt]: u8 len, len bytes
+        // 	padding
+        struct percolator_program final {
+                enum class Op : uint8_t {
+                        Bit = 0, // push bit(operand)
+                        Const,   // push operand
+                        AllBits, // followed by operand bit indices; push 1 if all of those are set
+                        AnyBits, // followed by operand bit indices; push 1 if any of those is set
+                        Not,     // negate the top
+                        AndNot,  // pop rhs and lhs, push lhs && !rhs
+                        AllOf,   // pop operand values, push 1 if all are 1
+                        AnyOf,   // pop operand values, push 1 if any is 1
+                        AtLeast, // followed by min; pop operand values, push 1 if at least min of them are 1
+                };
+
+                static constexpr uint16_t K_no_leaders{std::numeric_limits<uint16_t>::max()};
+                static constexpr uint32_t K_magic{0x47525054}; // TPRG
+                static constexpr uint32_t K_version{1};
+                static constexpr uint32_t K_header_size{6 * sizeof(uint32_t)};
+
+                uint32_t        size;
+                uint32_t        codeSize;
+                uint16_t        termsCnt;
+                uint16_t        phrasesCnt;
+                uint16_t        maxDepth;
+                uint16_t        leadersCnt;
+                const uint32_t *code;
+                const uint16_t *leaders;
+                const uint16_t *phrases;
+                const uint8_t * terms;
+
+                // p must point to a program compiled by percolator_query::compile(), or one already validated; nothing is checked
+                percolator_program(const uint8_t *p);
+
+                // Validates the program in p[0, available) first: the header, that the program fits in available bytes, that leaders, phrases and terms
+                // are within the program, and that the code is well formed; every instruction is known, every bit index and term index is in range, and the stack
+                // never underflows nor exceeds maxDepth, so that match() can trust it.
+                // Throws Switch::data_error if it's not a valid program. This is what you want for programs read from a file.
+                percolator_program(const uint8_t *p, const std::size_t available);
+
+                static inline uint32_t instruction(const Op op, const uint32_t operand) noexcept {
+                        return uint32_t(op) | (operand << 8);
+                }
+
+                inline std::size_t bits_cnt() const noexcept {
+                        return termsCnt + phrasesCnt;
+                }
+
+                inline bool has_leaders() const noexcept {
+                        return leadersCnt != K_no_leaders;
+                }
+
+                // Fills out[0, termsCnt)
+                void all_terms(str8_t *out) const noexcept;
+
+                // l(const uint16_t *terms, const uint16_t size) for each phrase, in order
+                // Terms are 0-based indices, same as the bits
+                template <typename L>
+                void for_each_phrase(L &&l) const {
+                        auto p = phrases;
+
+                        for (decltype(phrasesCnt) i{0}; i != phrasesCnt; ++i) {
+                                const auto n = *p++;
+
+                                l(p, n);
+                                p += n;
+                        }
+                }
+
+                bool match(const uint64_t *bits) const noexcept;
+
+              private:
+                static const uint8_t *validated(const uint8_t *p, const std::size_t available);
+        };
+
         class percolator_query final {
               protected:
                 struct CCTX final
@@ -44,6 +134,8 @@ namespace Trinity {
               protected:
                 bool exec(const exec_node, percolator_document_proxy &) const;
 
+                bool leaders(const exec_node, std::vector<exec_term_id_t> *) const;
+
               public:
                 auto term_by_index(const uint16_t idx) const {
                         return comp_ctx.allTerms[idx - 1];
@@ -60,6 +152,8 @@ namespace Trinity {
               public:
                 // After compilation, you can access all distinct terms, i.e all distinct terms you may be
                 // interested in, in a document, via distinct_terms()
+                //
+                // q must not contain ast_node::Type::AppIDsSet nodes; those are sets of indexed documents, which are meaningless here
                 percolator_query(const Trinity::query &q) {
                         if (!q) {
                                 root.fp = ENT::constfalse;
@@ -82,5 +176,84 @@ namespace Trinity {
                 }
 
                 bool match(percolator_document_proxy &) const; // percolator_document_proxy is not const, because you may want to do whatever there
+
+                // Compiles the query into a percolator_program, and appends it to out
+                // Make sure out->size() is a multiple of 4 if you intend to append multiple programs to the same buffer
+                void compile(IOBuffer *out) const;
+
+                // Collects into out(as indices for term_by_index()) a set of terms so that any document that matches this query
+                // contains at least one of them; e.g for [apple iphone] that's either {apple} or {iphone}, and for [apple OR (macbook pro)] it's {apple, macbook}
+                //
+                // Returns false if there is no such set, e.g for [-apple]. This is similar in spirit to query::leader_nodes(), except that
+                // it considers the compiled and optimised query, and it is guaranteed to never miss a match, which is what the percolator_index needs.
+                bool leader_terms(std::vector<exec_term_id_t> *out) const;
+        };
+
+        // A document you want to match against all queries of a percolator_index
+        struct percolator_document {
+                // Only invoked for queries that contain phrases
+                virtual bool match_phrase(const str8_t *terms, const uint16_t cnt) = 0;
+        };
+
+        // A predicate index for percolator_programs, as described in the talk referenced on the top of this file.
+        //
+        // If you have millions of stored queries(e.g alerts) and you need to match each new document against them, testing every
+        // query against every document doesn't scale. Instead, each query is indexed by its leader terms(see percolator_query::leader_terms()), and
+        // match() only considers the queries with leader terms that are among the document's terms, and those few(e.g [-apple]) that have no leader terms.
+        //
+        // Queries are stored as percolator_programs; you can either insert() a query, which is compiled and owned by the index, or
+        // insert() a program, e.g from an mmap()ed file of programs, which must outlive the index. Programs are validated when inserted(see percolator_program).
+        //
+        // match() may be invoked concurrently from multiple threads, but not concurrently with insert() or erase().
+        class percolator_index final {
+              public:
+                using query_id_t = uint64_t;
+
+              private:
+                struct stored_query final {
+                        query_id_t                 id;
+                        const uint8_t *            program; // nullptr for free slots
+                        std::unique_ptr<uint32_t[]> owned;
+                };
+
+                // The key of each entry is owned by it; see index()
+                std::unordered_map<str8_t, std::vector<uint32_t>> byTerm;
+                std::vector<uint32_t>                             unindexed; // queries with no leader terms
+                std::vector<stored_query>                         queries;   // by slot
+                std::vector<uint32_t>                             freeSlots;
+                std::unordered_map<query_id_t, uint32_t>          slots;
+
+              private:
+                void index(const uint32_t slot);
+
+                uint32_t store(const query_id_t id, const uint8_t *program);
+
+              public:
+                ~percolator_index();
+
+                // Returns false if the query can never match a document, in which case it's not stored
+                // If a query with the same id is already indexed, it is replaced
+                bool insert(const query_id_t id, const Trinity::query &q);
+
+                void insert(const std::vector<std::pair<query_id_t, const Trinity::query *>> &all);
+
+                // program(in program[0, available)) must outlive the index, or be erase()d first
+                // Throws Switch::data_error if it's not a valid program, in which case the index is not modified
+                void insert(const query_id_t id, const uint8_t *program, const std::size_t available);
+
+                void insert(const std::vector<std::pair<query_id_t, range_base<const uint8_t *, std::size_t>>> &all);
+
+                bool erase(const query_id_t id);
+
+                // Bulk erase; cheaper than erasing one by one, because each affected leader term list is only compacted once
+                // Returns how many of those were erased
+                std::size_t erase(const query_id_t *ids, const std::size_t cnt);
+
+                inline std::size_t size() const noexcept {
+                        return slots.size();
+                }
+
+                // Appends to out the IDs of all queries that match the document, whose distinct terms are docTerms[0, docTermsCnt)
+                void match(percolator_document &doc, const str8_t *docTerms, const std::size_t docTermsCnt, std::vector<query_id_t> *out) const;
         };
 } // namespace Trinity
@@ -294,6 +294,10 @@ void PrintImpl(Buffer &b, const Trinity::ast_node &n) {
                         b.append("<dummy>"_s8);
                         break;
 
+                case ast_node::Type::AppIDsSet:
+                        b.append("<app ids "_s32, ptr_repr(n.app_ids), '>');
+                        break;
+
                 case ast_node::Type::MatchSome:
                         b.append("MatchSome("_s32, n.match_some.min, '/', n.match_some.size, ")["_s32);
                         for (size_t i{0}; i != n.match_some.size; ++i) {
@@ -1153,6 +1157,7 @@ static void assign_query_indices(ast_node *const n, query_assign_ctx &ctx) {
 
                                                 case ast_node::Type::Dummy:
                                                 case ast_node::Type::ConstFalse:
+                                                case ast_node::Type::AppIDsSet:
                                                         break;
                                         }
                                 } while (!stack.empty());
@@ -1342,6 +1347,10 @@ ast_node *   ast_node::copy(simple_allocator *const a, std::vector<void *> *cons
                         res->expr = n->expr->copy(a, large_allocs);
                         break;
 
+                case ast_node::Type::AppIDsSet:
+                        res->app_ids = n->app_ids;
+                        break;
+
                 case ast_node::Type::UnaryOp:
                         res->unaryop.op   = n->unaryop.op;
                         res->unaryop.expr = n->unaryop.expr->copy(a, large_allocs);
@@ -1388,6 +1397,10 @@ ast_node *ast_node::shallow_copy(simple_allocator *const a, std::vector<void *>
                         res->expr = n->expr->shallow_copy(a, large_allocs);
                         break;
 
+                case ast_node::Type::AppIDsSet:
+                        res->app_ids = n->app_ids;
+                        break;
+
                 case ast_node::Type::UnaryOp:
                         res->unaryop.op   = n->unaryop.op;
                         res->unaryop.expr = n->unaryop.expr->shallow_copy(a, large_allocs);
@@ -1696,6 +1709,7 @@ bool ast_node::any_leader_tokens() const {
 
                         case ast_node::Type::Token:
                         case ast_node::Type::Phrase:
+                        case ast_node::Type::AppIDsSet:
                                 return true;
 
                         case ast_node::Type::BinOp:
@@ -1836,6 +1850,7 @@ void query::bind_tokens_to_allocator(ast_node *n, simple_allocator *a) {
 
                         case ast_node::Type::Dummy:
                         case ast_node::Type::ConstFalse:
+                        case ast_node::Type::AppIDsSet:
                                 break;
                 }
         } while (!stack.empty());
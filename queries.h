@@ -16,6 +16,7 @@ namespace Trinity {
         };
 
         struct phrase;
+        struct app_ids_set;
 
         // A query is an ASTree
         //
@@ -61,6 +62,9 @@ namespace Trinity {
                         // for both type::Token and type::Phrase
                         phrase *  p;
                         ast_node *expr;
+
+                        // for Type::AppIDsSet
+                        const app_ids_set *app_ids;
                 };
 
                 enum class Type : uint8_t {
@@ -94,6 +98,13 @@ namespace Trinity {
                         // its own features, and use MatchSome ast_node with all the features extracted from the input image, and a threshold set to say 50% of the total features in that input image, and then execute
                         // the query; it will match all images that have at least 50% common features with the input image. This is going to be very fast and very handy.
                         MatchSome,
+
+                        // Matches the documents of an application-provided set(see app_ids_set in docset_iterators_base.h), e.g
+                        // [apple AND <documents the user can access>]. The set is referenced, not copied.
+                        //
+                        // This is never scored, and it doesn't contribute to matched terms. You can't parse those; use make_app_ids_set()
+                        // and e.g replace or AND the root of a parsed query with it.
+                        AppIDsSet,
                 } type;
 
                 // this is handy if you want to delete a node
@@ -155,6 +166,13 @@ namespace Trinity {
                         return res;
                 }
 
+                static ast_node *make_app_ids_set(simple_allocator &a, const app_ids_set *const set) {
+                        auto res = make(a, Type::AppIDsSet);
+
+                        res->app_ids = set;
+                        return res;
+                }
+
                 static ast_node *make_binop(simple_allocator &a) {
                         auto res = make(a, Type::BinOp);
 
@@ -722,6 +740,7 @@ namespace Trinity {
                                         case ast_node::Type::Dummy:
                                         case ast_node::Type::ConstFalse:
                                         case ast_node::Type::ConstTrueExpr:
+                                        case ast_node::Type::AppIDsSet:
                                                 break;
                                 }
                         }
@@ -1,6 +1,7 @@
 #include "queryexec_ctx.h"
 #include "docset_iterators.h"
 #include <unordered_set>
+#include <utility>
 
 
 using namespace Trinity;
@@ -152,13 +153,32 @@ DocsSetIterators::Iterator *Trinity::queryexec_ctx::reg_docset_it(DocsSetIterato
         return res;
 }
 
+queryexec_ctx::queryexec_ctx(IndexSource *src, const bool documentsOnly_, const bool accumScoreMode_)
+    : documentsOnly{documentsOnly_}, accumScoreMode{accumScoreMode_}, idxsrc{src}, arena{queryexec_arena::acquire()}, filterCache{src->immutable() ? src->filter_cache() : nullptr},
+#ifdef _HAVE_CANDIDATE_DOCUMENTS_ALLOCATOR
+      candidate_documents_allocator{arena->candidate_documents_allocator},
+#endif
+      termsDict{arena->termsDict}, allocator{arena->allocator}, large_allocs{arena->large_allocs}, tctxMap{arena->tctxMap}, docsetsIterators{arena->docsetsIterators}, allIterators{arena->allIterators} {
+        // take over the arena's arrays
+        tracked_docrefs.data     = std::exchange(arena->trackedDocrefs, nullptr);
+        tracked_docrefs.capacity = std::exchange(arena->trackedDocrefsCapacity, 0);
+        reusableCDS.data         = std::exchange(arena->reusableCDS, nullptr);
+        reusableCDS.capacity     = std::exchange(arena->reusableCDSCapacity, 0);
+        decode_ctx.decoders      = std::exchange(arena->decoders, nullptr);
+        decode_ctx.capacity      = std::exchange(arena->decodersCapacity, 0);
+        collectedIts.data        = std::exchange(arena->collectedIts, nullptr);
+        collectedIts.capacity    = std::exchange(arena->collectedItsCapacity, 0);
+
+#ifdef USE_BANKS
+        banks.swap(arena->banks);
+        reusableBanks.swap(arena->reusableBanks);
+#endif
+}
+
 queryexec_ctx::~queryexec_ctx() {
         if constexpr (trace_docrefs)
                 SLog("Flushing ", tracked_docrefs.size, "\n");
 
-        for (auto p : large_allocs)
-                std::free(p);
-
         while (tracked_docrefs.size) {
                 auto d = tracked_docrefs.data[--tracked_docrefs.size];
 
@@ -171,17 +191,19 @@ queryexec_ctx::~queryexec_ctx() {
                 cds_release(d);
         }
 
-        if (auto ptr = tracked_docrefs.data)
-                std::free(ptr);
-
 #ifdef USE_BANKS
+        // all banks are idle now
         for (auto it : banks)
-                delete it;
-        for (auto it : reusableBanks)
-                delete it;
-
-        reusableBanks.clear();
+                reusableBanks.emplace_back(it);
         banks.clear();
+
+        while (reusableBanks.size() > queryexec_arena::K_max_idle_docstracker_banks) {
+                delete reusableBanks.back();
+                reusableBanks.pop_back();
+        }
+
+        banks.swap(arena->banks);
+        reusableBanks.swap(arena->reusableBanks);
 #endif
 
         while (!allIterators.empty()) {
@@ -228,6 +250,14 @@ queryexec_ctx::~queryexec_ctx() {
                                 delete static_cast<DocsSetIterators::VectorIDs *>(ptr);
                                 break;
 
+                        case DocsSetIterators::Type::CachedDocsSet:
+                                delete static_cast<DocsSetIterators::CachedDocsSet *>(ptr);
+                                break;
+
+                        case DocsSetIterators::Type::AppIDs:
+                                delete static_cast<DocsSetIterators::AppIDs *>(ptr);
+                                break;
+
                         case DocsSetIterators::Type::Conjuction:
                                 delete static_cast<DocsSetIterators::Conjuction *>(ptr);
                                 break;
@@ -240,11 +270,16 @@ queryexec_ctx::~queryexec_ctx() {
                                 delete static_cast<DocsSetIterators::Phrase *>(ptr);
                                 break;
 
+                        case DocsSetIterators::Type::PhraseSet:
+                                delete static_cast<DocsSetIterators::PhraseSet *>(ptr);
+                                break;
+
                         case DocsSetIterators::Type::Dummy:
                         case DocsSetIterators::Type::PostingsListIterator:
                                 break;
                 }
         }
+        docsetsIterators.clear();
 
 #ifndef _HAVE_CANDIDATE_DOCUMENTS_ALLOCATOR
         while (auto p = reusableCDS.pop_one()) {
@@ -256,9 +291,26 @@ queryexec_ctx::~queryexec_ctx() {
 	}
 #endif
 
-        if (reusableCDS.data) {
-                std::free(reusableCDS.data);
-	}
+        // candidate_documents may have been using those
+        for (auto p : large_allocs)
+                std::free(p);
+        large_allocs.clear();
+
+        for (uint32_t i{0}; i != decode_ctx.capacity; ++i) {
+                delete decode_ctx.decoders[i];
+                decode_ctx.decoders[i] = nullptr;
+        }
+
+        arena->trackedDocrefs         = std::exchange(tracked_docrefs.data, nullptr);
+        arena->trackedDocrefsCapacity = tracked_docrefs.capacity;
+        arena->reusableCDS            = std::exchange(reusableCDS.data, nullptr);
+        arena->reusableCDSCapacity    = reusableCDS.capacity;
+        arena->decoders               = std::exchange(decode_ctx.decoders, nullptr);
+        arena->decodersCapacity       = std::exchange(decode_ctx.capacity, 0);
+        arena->collectedIts           = std::exchange(collectedIts.data, nullptr);
+        arena->collectedItsCapacity   = collectedIts.capacity;
+
+        queryexec_arena::release(arena);
 }
 
 void queryexec_ctx::prepare_decoder(exec_term_id_t termID) {
@@ -275,10 +327,10 @@ void queryexec_ctx::prepare_decoder(exec_term_id_t termID) {
 }
 
 exec_term_id_t queryexec_ctx::resolve_term(const str8_t term) {
-        const auto res = termsDict.insert({term, 0});
+        const auto res = termsDict.insert(term);
 
         if (res.second) {
-                auto       ptr  = &res.first->second;
+                auto       ptr  = res.first;
                 const auto tctx = idxsrc->term_ctx(term);
 
                 if (tctx.documents == 0) {
@@ -286,11 +338,116 @@ exec_term_id_t queryexec_ctx::resolve_term(const str8_t term) {
                         *ptr = 0;
                 } else {
                         *ptr = termsDict.size();
-                        tctxMap.insert({*ptr, {tctx, term}});
+                        if (tctxMap.size() <= *ptr)
+                                tctxMap.resize(*ptr + 1);
+                        tctxMap[*ptr] = {tctx, term};
+                }
+        }
+
+        return *res.first;
+}
+
+std::pair<exec_term_id_t *, bool> terms_dict::insert(const str8_t term) {
+        if ((cnt + 1) * 2 > capacity) {
+                // keep the load factor <= 0.5
+                const auto newCapacity = capacity ? capacity * 2 : 64;
+                auto       newSlots    = static_cast<slot *>(calloc(newCapacity, sizeof(slot)));
+
+                for (uint32_t i{0}; i != capacity; ++i) {
+                        if (const auto &it = slots[i]; it.used) {
+                                auto idx = std::hash<str8_t>{}(it.term) & (newCapacity - 1);
+
+                                while (newSlots[idx].used)
+                                        idx = (idx + 1) & (newCapacity - 1);
+                                newSlots[idx] = it;
+                        }
                 }
+
+                std::free(slots);
+                slots    = newSlots;
+                capacity = newCapacity;
         }
 
-        return res.first->second;
+        for (auto idx = std::hash<str8_t>{}(term) & (capacity - 1);; idx = (idx + 1) & (capacity - 1)) {
+                auto &it = slots[idx];
+
+                if (!it.used) {
+                        it.term = term;
+                        it.id   = 0;
+                        it.used = true;
+                        ++cnt;
+                        return {&it.id, true};
+                } else if (it.term == term) {
+                        return {&it.id, false};
+                }
+        }
+}
+
+exec_term_id_t terms_dict::find(const str8_t term) const noexcept {
+        if (!cnt)
+                return 0;
+
+        for (auto idx = std::hash<str8_t>{}(term) & (capacity - 1);; idx = (idx + 1) & (capacity - 1)) {
+                const auto &it = slots[idx];
+
+                if (!it.used)
+                        return 0;
+                else if (it.term == term)
+                        return it.id;
+        }
+}
+
+namespace {
+        // idle arenas of this thread
+        struct arenas_pool final {
+                std::vector<queryexec_arena *> idle;
+
+                ~arenas_pool() {
+                        for (auto it : idle)
+                                delete it;
+                }
+        };
+
+        thread_local arenas_pool arenasPool;
+} // namespace
+
+queryexec_arena::~queryexec_arena() {
+        for (auto it : banks)
+                delete it;
+        for (auto it : reusableBanks)
+                delete it;
+
+        std::free(trackedDocrefs);
+        std::free(reusableCDS);
+        std::free(decoders);
+        std::free(collectedIts);
+}
+
+queryexec_arena *queryexec_arena::acquire() {
+        auto &idle = arenasPool.idle;
+
+        if (idle.empty())
+                return new queryexec_arena();
+
+        auto res = idle.back();
+
+        idle.pop_back();
+        return res;
+}
+
+void queryexec_arena::release(queryexec_arena *const a) {
+        auto &idle = arenasPool.idle;
+
+        if (idle.size() >= K_max_idle || a->allocator.banksCount() > K_max_allocator_banks || a->candidate_documents_allocator.banksCount() > K_max_cds_allocator_banks) {
+                delete a;
+                return;
+        }
+
+        a->allocator.reuse();
+        a->candidate_documents_allocator.reuse();
+        a->termsDict.clear();
+        a->tctxMap.clear();
+        idle.emplace_back(a);
 }
 
 void queryexec_ctx::decode_ctx_struct::check(const uint16_t idx) {
@@ -348,11 +505,31 @@ Trinity::term_hits *candidate_document::materialize_term_hits(queryexec_ctx *rct
         return th;
 }
 
+void *queryexec_ctx::cds_alloc(const std::size_t size) {
+#ifdef _HAVE_CANDIDATE_DOCUMENTS_ALLOCATOR
+        if (size <= candidate_documents_allocator.bankCapacity())
+                return candidate_documents_allocator.Alloc(size);
+#endif
+
+        auto res = malloc(size);
+
+        large_allocs.emplace_back(res);
+        return res;
+}
+
 Trinity::candidate_document::candidate_document(queryexec_ctx *const rctx) {
         const auto maxQueryTermIDPlus1 = rctx->termsDict.size() + 1;
+        // keep termHits[] aligned
+        const auto capturedSize = (sizeof(isrc_docid_t) * maxQueryTermIDPlus1 + 7) & ~7;
+        auto       p            = static_cast<uint8_t *>(rctx->cds_alloc(capturedSize + sizeof(term_hits) * maxQueryTermIDPlus1));
+
+        curDocQueryTokensCaptured = reinterpret_cast<isrc_docid_t *>(p);
+        memset(curDocQueryTokensCaptured, 0, sizeof(isrc_docid_t) * maxQueryTermIDPlus1);
 
-        curDocQueryTokensCaptured = (isrc_docid_t *)calloc(sizeof(isrc_docid_t), maxQueryTermIDPlus1);
-        termHits                  = new term_hits[maxQueryTermIDPlus1];
+        termHits    = reinterpret_cast<term_hits *>(p + capturedSize);
+        termHitsCnt = maxQueryTermIDPlus1;
+        for (uint32_t i{0}; i != maxQueryTermIDPlus1; ++i)
+                new (termHits + i) term_hits();
 
         if (const auto required = sizeof(matched_query_term) * maxQueryTermIDPlus1; rctx->allocator.can_allocate(required)) {
                 matchedDocument.matchedTerms = (matched_query_term *)rctx->allocator.Alloc(required);
@@ -362,6 +539,13 @@ Trinity::candidate_document::candidate_document(queryexec_ctx *const rctx) {
         }
 }
 
+void queryexec_ctx::_reusable_cds::reserve(const uint32_t n) {
+        if (n > capacity) {
+                data     = static_cast<candidate_document **>(realloc(data, sizeof(candidate_document *) * n));
+                capacity = n;
+        }
+}
+
 void queryexec_ctx::_reusable_cds::push_back(candidate_document *const d) {
         if (unlikely(size_ == capacity)) {
 #ifndef _HAVE_CANDIDATE_DOCUMENTS_ALLOCATOR
@@ -390,6 +574,15 @@ static void collect_doc_matching_terms(Trinity::DocsSetIterators::Iterator *cons
                         out->cnt += n;
                 } break;
 
+                case DocsSetIterators::Type::PhraseSet: {
+                        // only the (distinct) terms of the phrases matched
+                        const auto I = static_cast<const DocsSetIterators::PhraseSet *>(it);
+                        const auto n = I->matchedIts.size();
+
+                        memcpy(out->data + out->cnt, I->matchedIts.data(), sizeof(Codecs::PostingsListIterator *) * n);
+                        out->cnt += n;
+                } break;
+
                 case DocsSetIterators::Type::DisjunctionSome: {
                         auto const d = static_cast<DocsSetIterators::DisjunctionSome *>(it);
 
@@ -524,6 +717,15 @@ static void collect_doc_matching_terms(Trinity::DocsSetIterators::Iterator *cons
                         }
                 } break;
 
+                case DocsSetIterators::Type::CachedDocsSet:
+                        // FilterCache sets and drained term sets replace sub-trees we don't need to collect terms from
+                        break;
+
+                case DocsSetIterators::Type::AppIDs:
+                case DocsSetIterators::Type::AppIterator:
+                        // application sets of documents, not terms
+                        break;
+
                 default:
                         SLog("IMPLEMENT ME\n");
                         exit(1);
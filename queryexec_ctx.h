@@ -24,12 +24,14 @@ namespace Trinity {
                 isrc_docid_t *   curDocQueryTokensCaptured;
                 uint16_t         curDocSeq{UINT16_MAX};
                 term_hits *      termHits{nullptr};
+                uint32_t         termHitsCnt;
 
                 candidate_document(queryexec_ctx *const rctx);
 
                 ~candidate_document() {
-                        std::free(curDocQueryTokensCaptured);
-                        delete[] termHits;
+                        // curDocQueryTokensCaptured[] and termHits[] are owned by the queryexec_ctx (see queryexec_ctx::cds_alloc())
+                        for (uint32_t i{0}; i != termHitsCnt; ++i)
+                                termHits[i].~term_hits();
                 }
 
                 term_hits *materialize_term_hits(queryexec_ctx *, Codecs::PostingsListIterator *, const exec_term_id_t termID);
@@ -103,9 +105,13 @@ namespace Trinity {
         struct iterators_collector final {
                 Codecs::PostingsListIterator **data{nullptr};
                 uint16_t                       cnt{0};
+                uint16_t                       capacity{0};
 
                 void init(const uint16_t n) {
-                        data = (Codecs::PostingsListIterator **)malloc(sizeof(Codecs::PostingsListIterator *) * n);
+                        if (n > capacity) {
+                                data     = (Codecs::PostingsListIterator **)realloc(data, sizeof(Codecs::PostingsListIterator *) * n);
+                                capacity = n;
+                        }
                 }
 
                 ~iterators_collector() noexcept {
@@ -115,17 +121,102 @@ namespace Trinity {
                 }
         };
 
+        // A flat, open addressing (linear probing) str8_t => exec_term_id_t map, for resolving query terms to exec_term_id_t.
+        // We used to use an std::unordered_map<> for that, which allocates a node for every distinct term. The slots
+        // of a terms_dict are instead retained by the queryexec_arena that owns it, so that, once warmed up, resolving the terms of a query
+        // doesn't need to allocate memory.
+        struct terms_dict final {
+                struct slot final {
+                        str8_t         term;
+                        exec_term_id_t id;
+                        bool           used;
+                };
+
+                slot *   slots{nullptr};
+                uint32_t capacity{0}; // always a power of 2
+                uint32_t cnt{0};
+
+                ~terms_dict() noexcept {
+                        std::free(slots);
+                }
+
+                inline auto size() const noexcept {
+                        return cnt;
+                }
+
+                void clear() noexcept {
+                        if (cnt) {
+                                memset(slots, 0, sizeof(slot) * capacity);
+                                cnt = 0;
+                        }
+                }
+
+                // Returns a pointer to the id of term, and true if term was just inserted(its id is then set to 0)
+                std::pair<exec_term_id_t *, bool> insert(const str8_t term);
+
+                // Returns the id of term, or 0 if it's not in the dictionary
+                exec_term_id_t find(const str8_t term) const noexcept;
+        };
+
+        // Executing a query used to require allocating and then freeing the banks of two allocators, a hashmap node
+        // for each distinct term, the docstracker_banks, and a few arrays sized for the query; hundreds of malloc()/free() calls for
+        // e.g a query with just a few terms, and that's hardly negligible for cheap queries.
+        //
+        // A queryexec_arena owns all those resources instead. A queryexec_ctx acquires an arena from a thread-local pool of idle
+        // arenas, and ~queryexec_ctx() resets it(e.g the allocators are rewinded with simple_allocator::reuse(), which retains their banks) and returns it to the pool
+        // for the next query executed by that thread. A steady-state query thus doesn't allocate memory for that state.
+        //
+        // Arenas that grew too large(e.g because of a huge query) are not retained; see queryexec_arena::release()
+        struct queryexec_arena final {
+                static constexpr std::size_t K_max_idle{4};
+                static constexpr std::size_t K_max_allocator_banks{16};
+                static constexpr std::size_t K_max_cds_allocator_banks{32};
+                static constexpr std::size_t K_max_idle_docstracker_banks{8};
+
+                simple_allocator                               allocator{4096 * 6};
+                simple_allocator                               candidate_documents_allocator{32 * 1024};
+                terms_dict                                     termsDict;
+                std::vector<std::pair<term_index_ctx, str8_t>> tctxMap;
+                std::vector<void *>                            large_allocs;
+                std::vector<DocsSetIterators::Iterator *>      docsetsIterators;
+                std::vector<Codecs::PostingsListIterator *>    allIterators;
+                std::vector<docstracker_bank *>                banks, reusableBanks;
+
+                // realloc()ed arrays; they are handed over to the queryexec_ctx and given back to the arena in ~queryexec_ctx()
+                candidate_document **          trackedDocrefs{nullptr}, **reusableCDS{nullptr};
+                uint32_t                       trackedDocrefsCapacity{0}, reusableCDSCapacity{0};
+                Codecs::Decoder **             decoders{nullptr};
+                uint16_t                       decodersCapacity{0};
+                Codecs::PostingsListIterator **collectedIts{nullptr};
+                uint16_t                       collectedItsCapacity{0};
+
+                ~queryexec_arena();
+
+                // Returns an idle arena of the calling thread, or a new one if there are no idle arenas
+                static queryexec_arena *acquire();
+
+                // Resets the arena and returns it to the calling thread's pool, or deletes it if it can't be retained
+                static void release(queryexec_arena *);
+        };
+
         // This is initialized by the compiler
         // and used by the VM
         struct queryexec_ctx final {
                 const bool                          documentsOnly, accumScoreMode;
                 IndexSource *const                  idxsrc;
+                queryexec_arena *const              arena;
                 iterators_collector                 collectedIts;
                 Similarity::IndexSourceTermsScorer *scorer{nullptr};
+                // See IndexSource::use_filter_cache(); nullptr unless the source is immutable()
+                FilterCache *const filterCache;
+                bool               materializingFilter{false};
+                // Set while building the iterators of the RHS of a logical NOT; see termset_iterator()
+                bool buildingFilter{false};
+                // How many times, at most, the iterator being built will be advanced by its consumer; e.g for a conjunction follower
+                // that's the cost of the other operands. See build_follower_iterator() and termset_iterator()
+                uint64_t advancesBudget{std::numeric_limits<uint64_t>::max()};
 
-                queryexec_ctx(IndexSource *src, const bool documentsOnly_, const bool accumScoreMode_)
-                    : documentsOnly{documentsOnly_}, accumScoreMode{accumScoreMode_}, idxsrc{src} {
-                }
+                queryexec_ctx(IndexSource *src, const bool documentsOnly_, const bool accumScoreMode_);
 
                 ~queryexec_ctx();
 
@@ -150,6 +241,17 @@ namespace Trinity {
 
                 DocsSetIterators::Iterator *build_iterator(const exec_node n, const uint32_t execFlags);
 
+                // build_iterator() for an operand that will be advanced at most leadCost times(see advancesBudget)
+                DocsSetIterators::Iterator *build_follower_iterator(const exec_node n, const uint64_t leadCost, const uint32_t execFlags);
+
+                // Returns an iterator over the FilterCache set materialized for the sub-tree, materializing it first if
+                // the FilterCache admits it, or nullptr if it's not cached. See filter_cache.h
+                DocsSetIterators::Iterator *cached_filter_iterator(const exec_node n, const uint32_t execFlags);
+
+                // Drains the postings of all terms of a large ENT::matchanyterms run into a docids_set up front, and returns
+                // an iterator over it, or nullptr if merging the PLIs with a heap as we go is expected to be cheaper. See exec.cpp
+                DocsSetIterators::Iterator *termset_iterator(const compilation_ctx::termsrun *run);
+
                 // Instead of having a virtual DocsSetIterators::Iterator::~Iterator()
                 // which means we would need another entry in the vtable, which means an higher chance for cache misses, for no really good reason
                 // we just track all created DocsSetIterators::Iterators along with its type, and in ~queryexec_ctx() we consider the type, cast and delete it
@@ -187,6 +289,9 @@ namespace Trinity {
 
                         void push_back(candidate_document *d);
 
+                        // Makes sure there's room for at least n candidate_documents
+                        void reserve(const uint32_t n);
+
                         inline auto size() const noexcept {
                                 return size_;
                         }
@@ -197,12 +302,15 @@ namespace Trinity {
 
                 } reusableCDS;
 #ifdef _HAVE_CANDIDATE_DOCUMENTS_ALLOCATOR
-		simple_allocator candidate_documents_allocator{32 * 1024};
+                simple_allocator &candidate_documents_allocator;
 #endif
                 DocsSetIterators::Iterator *rootIterator{nullptr};
 
                 candidate_document *cds_track(const isrc_docid_t did);
 
+                // Allocates memory for a candidate_document's per-term state. It's released when the queryexec_ctx is destroyed
+                void *cds_alloc(const std::size_t size);
+
                 inline void cds_release(candidate_document *const d) {
                         if (1 == d->rc--) {
                                 if (auto th = d->termHits) {
@@ -246,7 +354,7 @@ namespace Trinity {
                 // to do away with (lastBank != nullptr) tests
                 // we can instead assign lastBank to (&docstracker_bank::dummy_bank)
                 // and because its base is set to an 'impossible' value, it will work great
-                std::unordered_map<str8_t, exec_term_id_t> termsDict;
+                terms_dict &termsDict;
 
 
                 // TODO: determine suitable allocator bank size based on some meaningful metric
@@ -255,11 +363,14 @@ namespace Trinity {
                 // For now, go with large enough bank sizes for the allocators and figure out something later.
                 // We should also track allocated (from allocators) memory that is no longer needed so that we can reuse it
                 // Maybe we just need a method for allocating arbitrary amount of memory and releasing it back to the runtime ctx
-                simple_allocator                                                      allocator{4096 * 6};
-                std::vector<void *>                                                   large_allocs;
-                std::unordered_map<exec_term_id_t, std::pair<term_index_ctx, str8_t>> tctxMap;
-                std::vector<DocsSetIterators::Iterator *>                             docsetsIterators;
-                std::vector<Codecs::PostingsListIterator *>                           allIterators;
+                //
+                // All those are owned by the arena
+                simple_allocator &   allocator;
+                std::vector<void *> &large_allocs;
+                // indexed by termID; the term_index_ctx::documents of unused and unknown termIDs is 0
+                std::vector<std::pair<term_index_ctx, str8_t>> &tctxMap;
+                std::vector<DocsSetIterators::Iterator *> &     docsetsIterators;
+                std::vector<Codecs::PostingsListIterator *> &   allIterators;
 #ifndef TRINITY_LASTBANK_OPTIMIZATION
                 docstracker_bank *                                                    lastBank{nullptr};
 #else
@@ -3,6 +3,7 @@
 #include "lucene_codec.h"
 
 Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
+    : segmentBasePath(basePath)
 {
         int fd;
         char path[PATH_MAX];
@@ -46,6 +47,12 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
 
                 terms.reset(new SegmentTerms(basePath));
 
+                snprintf(path, sizeof(path), "%s/docvalues", basePath);
+                docValues = DocValues::open(path);
+
+                snprintf(path, sizeof(path), "%s/common_words", basePath);
+                commonWords = common_words_set::open(path);
+
                 snprintf(path, sizeof(path), "%s/index", basePath);
                 fd = open(path, O_RDONLY | O_LARGEFILE);
                 if (fd == -1)
@@ -170,13 +177,15 @@ Trinity::SegmentIndexSource::SegmentIndexSource(const char *basePath)
                 }
 
                 if (codec.Eq(_S("LUCENE")))
-                        accessProxy.reset(new Trinity::Codecs::Lucene::AccessProxy(basePath, index.start()));
+                        accessProxy.reset(new Trinity::Codecs::Lucene::AccessProxy(segmentBasePath.c_str(), index.start()));
 #ifdef TRINITY_CODECS_GOOGLE_AVAILABLE
                 else if (codec.Eq(_S("GOOGLE")))
-                        accessProxy.reset(new Trinity::Codecs::Google::AccessProxy(basePath, index.start()));
+                        accessProxy.reset(new Trinity::Codecs::Google::AccessProxy(segmentBasePath.c_str(), index.start()));
 #endif
                 else
                         throw Switch::data_error("Unknown codec");
+
+                accessProxy->backedByFiles = true;
         }
         catch (...)
         {
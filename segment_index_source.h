@@ -2,6 +2,7 @@
 #include "index_source.h"
 #include "terms.h"
 #include "docidupdates.h"
+#include "docvalues.h"
 
 namespace Trinity {
         // You can use SegmentIndexSession to create a new segment
@@ -10,9 +11,13 @@ namespace Trinity {
             : public IndexSource {
               private:
                 field_statistics                              defaultFieldStats;
+                // AccessProxy holds on to the base path, so we need to own it
+                const std::string                             segmentBasePath;
                 std::unique_ptr<Trinity::Codecs::AccessProxy> accessProxy;
                 std::unique_ptr<SegmentTerms>                 terms; // all terms for this segment
                 range_base<const uint8_t *, uint32_t>         index;
+                std::unique_ptr<DocValues>                    docValues;
+                std::unique_ptr<common_words_set>             commonWords;
 
                 struct masked_documents_struct final {
                         updated_documents                     set;
@@ -35,6 +40,10 @@ namespace Trinity {
                         return accessProxy.get() == nullptr;
                 }
 
+                bool immutable() const noexcept override final {
+                        return true;
+                }
+
                 auto backing_index() const noexcept {
                         return index;
                 }
@@ -43,10 +52,27 @@ namespace Trinity {
                         return accessProxy.get();
                 }
 
+                // Decoders for this segment's terms will consult the cache before decoding postings blocks
+                // The cache can be shared among multiple segments; blocks are keyed by the segment generation
+                void use_blocks_cache(Codecs::DecodedBlocksCache *const c) noexcept {
+                        if (auto ap = accessProxy.get()) {
+                                ap->blocksCache    = c;
+                                ap->blocksCacheGen = gen;
+                        }
+                }
+
                 field_statistics default_field_stats() override final {
                         return defaultFieldStats;
                 }
 
+                const DocValues *doc_values() const override final {
+                        return docValues.get();
+                }
+
+                const common_words_set *common_words() const override final {
+                        return commonWords.get();
+                }
+
                 term_index_ctx resolve_term_ctx(const str8_t term) override final {
                         return terms->lookup(term);
                 }
@@ -0,0 +1,170 @@
+// Decoders that use a Codecs::DecodedBlocksCache must produce exactly the same documents and hits as decoders that don't, whether
+// they get blocks from the cache or decode them, and whether they got to a block by iterating or by seeking with the skiplist; and
+// that must still be the case when the cache is too small for the blocks the queries access and blocks are evicted
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+
+using namespace Trinity;
+
+namespace {
+        struct match final {
+                docid_t               id;
+                std::vector<uint32_t> hits; // for each matched term, its freq followed by its positions
+
+                bool operator==(const match &o) const noexcept {
+                        return id == o.id && hits == o.hits;
+                }
+        };
+
+        struct collector final
+            : public MatchedIndexDocumentsFilter {
+                std::vector<match> matches;
+
+                void consider(const docid_t id) override final {
+                        matches.push_back({id, {}});
+                }
+
+                void consider(const matched_document &md) override final {
+                        match m{md.id, {}};
+
+                        for (uint16_t i{0}; i != md.matchedTermsCnt; ++i) {
+                                const auto th = md.matchedTerms[i].hits;
+
+                                m.hits.push_back(th->freq);
+                                if (th->all && th->freq <= th->allCapacity) {
+                                        for (uint32_t k{0}; k != th->freq; ++k)
+                                                m.hits.push_back(th->all[k].pos);
+                                }
+                        }
+                        matches.push_back(std::move(m));
+                }
+        };
+
+        void index_document(SegmentIndexSession &s, const docid_t id, const bool replace) {
+                auto d = s.begin(id);
+
+                d.insert("a"_s8, 1);
+                if (id % 3 == 0) {
+                        d.insert("b"_s8, 2);
+                        // different frequencies, so that hits blocks are not all alike
+                        for (uint32_t i{0}; i != id % 4; ++i)
+                                d.insert("b"_s8, 10 + i);
+                }
+                if (id % 7 == 0)
+                        d.insert("c"_s8, 3);
+                // a conjunction led by it seeks(skiplist) into the middle of the other terms' lists
+                if (id % 5000 == 0)
+                        d.insert("rare"_s8, 4);
+
+                if (replace)
+                        s.replace(d);
+                else
+                        s.insert(d);
+        }
+
+        std::vector<std::vector<match>> run(IndexSourcesCollection *const collection, const std::vector<query> &queries) {
+                std::vector<std::vector<match>> res;
+
+                for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), uint32_t(0)}) {
+                        for (const auto &q : queries) {
+                                std::vector<match> all;
+
+                                for (auto &it : exec_query<collector>(q, collection, nullptr, flags))
+                                        all.insert(all.end(), it->matches.begin(), it->matches.end());
+                                res.push_back(std::move(all));
+                        }
+                }
+                return res;
+        }
+
+        void open(scratch_segments &segments, IndexSourcesCollection *const collection, Codecs::DecodedBlocksCache *const cache) {
+                for (const uint64_t gen : {1, 2}) {
+                        auto src = segments.open(gen);
+
+                        if (cache)
+                                src->use_blocks_cache(cache);
+                        collection->insert(src);
+                        src->Release();
+                }
+                collection->commit();
+        }
+} // namespace
+
+int main() {
+        scratch_segments segments;
+
+        {
+                SegmentIndexSession s;
+
+                for (docid_t id{1}; id != 300'000; ++id)
+                        index_document(s, id, false);
+                segments.commit(s, 1);
+        }
+
+        {
+                // masks some of the documents of the first segment; the cache is shared by both, keyed by generation
+                SegmentIndexSession s;
+
+                for (docid_t id{250'000}; id != 320'000; ++id)
+                        index_document(s, id, id < 300'000);
+                segments.commit(s, 2);
+        }
+
+        const char *const  queriesStrs[] = {"a", "b", "\"a b\"", "rare a", "rare b c", "c b", "\"b c\"", "a -c", "b OR rare", "rare \"a b\""};
+        std::vector<query> queries;
+
+        for (const auto s : queriesStrs)
+                queries.emplace_back(str32_t(s, strlen(s)));
+
+        std::vector<std::vector<match>> expected;
+
+        {
+                IndexSourcesCollection collection;
+
+                open(segments, &collection, nullptr);
+                expected = run(&collection, queries);
+        }
+
+        for (const auto &it : expected)
+                CHECK(!it.empty());
+
+        {
+                // large enough for all blocks
+                Codecs::DecodedBlocksCache cache(256 * 1024 * 1024, 64);
+                IndexSourcesCollection     collection;
+
+                open(segments, &collection, &cache);
+                // blocks are admitted the second time they are requested, and found after that
+                for (uint32_t i{0}; i != 3; ++i)
+                        CHECK(run(&collection, queries) == expected);
+
+                CHECK(cache.hits > 0);
+                CHECK(cache.misses > 0);
+                CHECK(cache.evictions == 0);
+        }
+
+        {
+                // only a few blocks per shard
+                Codecs::DecodedBlocksCache cache(64 * 1024, 64);
+                IndexSourcesCollection     collection;
+
+                open(segments, &collection, &cache);
+                for (uint32_t i{0}; i != 3; ++i)
+                        CHECK(run(&collection, queries) == expected);
+
+                CHECK(cache.evictions > 0);
+        }
+
+        {
+                // no term is eligible
+                Codecs::DecodedBlocksCache cache(256 * 1024 * 1024, 1'000'000);
+                IndexSourcesCollection     collection;
+
+                open(segments, &collection, &cache);
+                CHECK(run(&collection, queries) == expected);
+                CHECK(cache.hits == 0 && cache.misses == 0);
+        }
+
+        return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal assertions for the programs in tests/(see `make check`); each program exits with a non-zero status on the first failed check
+#define CHECK(cond)                                                                                 \
+        do {                                                                                        \
+                if (!(cond)) {                                                                      \
+                        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+                        std::exit(1);                                                               \
+                }                                                                                   \
+        } while (0)
@@ -0,0 +1,247 @@
+// Phrases rewritten to use common-grams(see SegmentIndexSession::set_common_words()) must match exactly the same documents as the original phrases
+// on the same documents indexed without common words. Bigrams are only used for pairs with a word of the index source's own common words, because
+// only those are indexed for all their occurrences(see common_words_set), so sources with bigrams they don't know are complete must not use them, and
+// merge() must refuse to merge candidates indexed with different common words.
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+#include <merge.h>
+#include <random>
+#include <set>
+
+using namespace Trinity;
+
+namespace {
+        struct collector final
+            : public MatchedIndexDocumentsFilter {
+                std::vector<docid_t> matches;
+
+                void consider(const docid_t id) override final {
+                        matches.push_back(id);
+                }
+
+                void consider(const matched_document &match) override final {
+                        matches.push_back(match.id);
+                }
+        };
+
+        // Forwards to a segment, and tracks the terms of the decoders it created
+        class tracking_source final
+            : public IndexSource {
+              public:
+                SegmentIndexSource *const src;
+                std::set<std::string>     decoded;
+
+                tracking_source(SegmentIndexSource *const s)
+                    : src{s} {
+                        gen = s->generation();
+                }
+
+                ~tracking_source() {
+                        src->Release();
+                }
+
+                term_index_ctx resolve_term_ctx(const str8_t term) override final {
+                        return src->term_ctx(term);
+                }
+
+                Codecs::Decoder *new_postings_decoder(const str8_t term, const term_index_ctx ctx) override final {
+                        decoded.emplace(term.data(), term.size());
+                        return src->new_postings_decoder(term, ctx);
+                }
+
+                updated_documents masked_documents() override final {
+                        return src->masked_documents();
+                }
+
+                bool index_empty() const override final {
+                        return src->index_empty();
+                }
+
+                const common_words_set *common_words() const override final {
+                        return src->common_words();
+                }
+
+                // bigrams decoded
+                std::vector<std::pair<std::string, std::string>> grams() const {
+                        std::vector<std::pair<std::string, std::string>> res;
+
+                        for (const auto &t : decoded) {
+                                if (const auto p = t.find(K_common_gram_separator); p != std::string::npos)
+                                        res.emplace_back(t.substr(0, p), t.substr(p + 1));
+                        }
+                        return res;
+                }
+        };
+
+        void index_segment(scratch_segments &segments, const uint64_t gen, const docid_t from, const docid_t to, const std::vector<str8_t> &commonWords) {
+                static const str8_t vocabulary[] = {"world"_s8, "of"_s8, "warcraft"_s8, "the"_s8, "a"_s8};
+                SegmentIndexSession s;
+
+                if (!commonWords.empty())
+                        s.set_common_words(commonWords);
+
+                for (auto id = from; id != to; ++id) {
+                        // the same terms for the same document, whatever the segment
+                        std::mt19937 g(id);
+                        auto         d   = s.begin(id);
+                        const auto   len = 2 + g() % 8;
+
+                        for (uint32_t i{0}; i != len; ++i)
+                                d.insert(vocabulary[g() % 5], i + 1);
+                        s.insert(d);
+                }
+                segments.commit(s, gen);
+        }
+
+        void merge(scratch_segments &segments, std::initializer_list<uint64_t> gens, const uint64_t out, const bool withCommonWords) {
+                MergeCandidatesCollection                          collection;
+                std::vector<SegmentIndexSource *>                  sources;
+                std::vector<std::unique_ptr<IndexSourceTermsView>> views;
+
+                for (const auto gen : gens) {
+                        auto s = segments.open(gen);
+
+                        views.emplace_back(s->segment_terms()->new_terms_view());
+
+                        merge_candidate c{s->generation(), views.back().get(), s->access_proxy(), s->masked_documents()};
+
+                        if (withCommonWords)
+                                c.commonWords = s->common_words();
+                        collection.insert(c);
+                        sources.push_back(s);
+                }
+                collection.commit();
+
+                DEFER({
+                        for (auto s : sources)
+                                s->Release();
+                });
+
+                const auto path = segments.path(out);
+
+                mkdir(path.c_str(), 0775);
+
+                std::unique_ptr<Codecs::IndexSession>          sess(new Codecs::Lucene::IndexSession(path.c_str()));
+                simple_allocator                               allocator;
+                std::vector<std::pair<str8_t, term_index_ctx>> terms;
+                IndexSource::field_statistics                  fs;
+                std::vector<uint32_t>                          none;
+
+                sess->begin();
+                collection.merge(sess.get(), &allocator, &terms, &fs);
+                sess->persist_terms(terms);
+                persist_segment(fs, sess.get(), none);
+        }
+
+        const char *const queries[] = {
+            "\"world of warcraft\"", "\"of the\"", "\"the world\"", "\"world of\"",
+            "\"a of the world\"", "\"of of\"", "\"the a\"", "\"warcraft the of\"",
+            // in the default mode, phrases are only rewritten on the RHS of NOT
+            "a NOT \"world of\"", "world NOT \"of the warcraft\"",
+        };
+
+        std::vector<std::vector<docid_t>> run(IndexSource *const src) {
+                IndexSourcesCollection            collection;
+                std::vector<std::vector<docid_t>> res;
+
+                collection.insert(src);
+                collection.commit();
+
+                for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), uint32_t(0)}) {
+                        for (const auto s : queries) {
+                                const query q(str32_t(s, strlen(s)));
+
+                                res.push_back(std::move(exec_query<collector>(q, &collection, nullptr, flags).front()->matches));
+                        }
+                }
+                return res;
+        }
+
+        std::vector<std::vector<docid_t>> run(scratch_segments &segments, const uint64_t gen) {
+                auto       src = segments.open(gen);
+                const auto res = run(src);
+
+                src->Release();
+                return res;
+        }
+
+        bool merge_throws(scratch_segments &segments, std::initializer_list<uint64_t> gens, const uint64_t out) {
+                try {
+                        merge(segments, gens, out, true);
+                        return false;
+                } catch (const Switch::invalid_argument &) {
+                        return true;
+                }
+        }
+} // namespace
+
+int main() {
+        scratch_segments segments, reference;
+
+        index_segment(reference, 1, 1, 20'000, {});
+        index_segment(reference, 2, 1, 25'000, {});
+
+        const auto expected = run(reference, 1), expectedAll = run(reference, 2);
+
+        for (const auto &it : expected)
+                CHECK(!it.empty());
+
+        index_segment(segments, 1, 1, 20'000, {"the"_s8, "of"_s8});
+
+        {
+                auto src = new tracking_source(segments.open(1));
+
+                CHECK(src->common_words() && src->common_words()->words == std::vector<std::string>({"of", "the"}));
+                CHECK(run(src) == expected);
+                // bigrams were used
+                CHECK(!src->grams().empty());
+                src->Release();
+        }
+
+        // same common words
+        index_segment(segments, 2, 20'000, 25'000, {"of"_s8, "the"_s8});
+        merge(segments, {1, 2}, 3, true);
+        CHECK(run(segments, 3) == expectedAll);
+
+        {
+                auto src = segments.open(3);
+
+                CHECK(src->common_words() && src->common_words()->words == std::vector<std::string>({"of", "the"}));
+                src->Release();
+        }
+
+        // different common words, or none
+        index_segment(segments, 4, 20'000, 25'000, {"of"_s8});
+        index_segment(segments, 5, 20'000, 25'000, {});
+        CHECK(merge_throws(segments, {1, 4}, 6));
+        CHECK(merge_throws(segments, {1, 5}, 7));
+
+        // Bigrams of [the] pairs exist only for the documents of segment 1 once merged with 4 ignoring their common words; the merged
+        // segment has no common words, so none are used
+        merge(segments, {1, 4}, 8, false);
+
+        {
+                auto src = new tracking_source(segments.open(8));
+
+                CHECK(!src->common_words());
+                CHECK(run(src) == expectedAll);
+                CHECK(src->grams().empty());
+                src->Release();
+        }
+
+        // ..and if it only knows that [of] was a common word of both, only bigrams with [of] are used
+        common_words_set{{"of"}}.persist((segments.path(8) + "/common_words").c_str());
+
+        {
+                auto src = new tracking_source(segments.open(8));
+
+                CHECK(run(src) == expectedAll);
+                CHECK(!src->grams().empty());
+                for (const auto &it : src->grams())
+                        CHECK(it.first == "of" || it.second == "of");
+                src->Release();
+        }
+
+        return 0;
+}
@@ -0,0 +1,94 @@
+// Conjunctions re-order their iterators(and may replace their lead) based on sampled rejection rates while they are being iterated;
+// see DocsSetIterators::conjunction_sample. Whatever the order they end up in, they must match exactly the documents all their operands match.
+//
+// Here, a has fewer documents than b, so it leads, but all its documents are at the start of the documents space where b is 4x sparser
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+#include <functional>
+
+using namespace Trinity;
+
+namespace {
+        struct collector final
+            : public MatchedIndexDocumentsFilter {
+                std::vector<docid_t> matches;
+
+                void consider(const docid_t id) override final {
+                        matches.push_back(id);
+                }
+
+                void consider(const matched_document &match) override final {
+                        matches.push_back(match.id);
+                }
+        };
+
+        bool has_a(const docid_t id) {
+                return id <= 60'000;
+        }
+
+        bool has_b(const docid_t id) {
+                return id % 4 == 0;
+        }
+
+        bool has_c(const docid_t id) {
+                return id % 3 == 0 || id > 200'000;
+        }
+} // namespace
+
+int main() {
+        static constexpr docid_t K_max_id{300'000};
+        scratch_segments         segments;
+        IndexSourcesCollection   collection;
+
+        {
+                SegmentIndexSession s;
+
+                for (docid_t id{1}; id <= K_max_id; ++id) {
+                        auto d = s.begin(id);
+
+                        // a and b are adjacent, for the phrase
+                        if (has_a(id))
+                                d.insert("a"_s8, 1);
+                        if (has_b(id))
+                                d.insert("b"_s8, 2);
+                        if (has_c(id))
+                                d.insert("c"_s8, 4);
+                        d.insert("all"_s8, 5);
+                        s.insert(d);
+                }
+                segments.commit(s, 1);
+        }
+
+        auto src = segments.open(1);
+
+        collection.insert(src);
+        src->Release();
+        collection.commit();
+
+        const std::pair<const char *, std::function<bool(docid_t)>> queries[] = {
+            {"a b", [](const docid_t id) { return has_a(id) && has_b(id); }},
+            {"a b c", [](const docid_t id) { return has_a(id) && has_b(id) && has_c(id); }},
+            {"c b all", [](const docid_t id) { return has_b(id) && has_c(id); }},
+            {"\"a b\" c", [](const docid_t id) { return has_a(id) && has_b(id) && has_c(id); }},
+            {"\"a b\" all", [](const docid_t id) { return has_a(id) && has_b(id); }},
+        };
+
+        for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), uint32_t(0)}) {
+                for (const auto &it : queries) {
+                        const query          q(str32_t(it.first, strlen(it.first)));
+                        const auto           res = exec_query<collector>(q, &collection, nullptr, flags);
+                        std::vector<docid_t> expected;
+
+                        for (docid_t id{1}; id <= K_max_id; ++id) {
+                                if (it.second(id))
+                                        expected.push_back(id);
+                        }
+
+                        CHECK(res.size() == 1);
+                        CHECK(res[0]->matches == expected);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,108 @@
+// Iterators over sets of document IDs(VectorIDs, CachedDocsSet and AppIDs) must behave the same whether the set is an IDs array or a bitmap;
+// in particular, advance() to a target at or before the current document must return the current document, not move past it(see Iterator::advance()).
+// docids_set::make() picks whichever representation is smaller, so sets are generated with densities on either side of the threshold.
+#include "check.h"
+#include <algorithm>
+#include <codecs.h>
+#include <docset_iterators.h>
+#include <random>
+
+using namespace Trinity;
+
+namespace {
+        static constexpr isrc_docid_t K_max_id{64 * 1024 - 1};
+
+        // Drives it with random next() and advance() calls, and compares with ids
+        void check(DocsSetIterators::Iterator *const it, const std::vector<isrc_docid_t> &ids, std::mt19937 &g) {
+                isrc_docid_t cur{0};
+
+                while (cur != DocIDsEND) {
+                        const auto   r = g() % 4;
+                        isrc_docid_t expected, res;
+
+                        if (r == 0) {
+                                const auto i = std::upper_bound(ids.begin(), ids.end(), cur);
+
+                                expected = i == ids.end() ? DocIDsEND : *i;
+                                res      = it->next();
+                        } else {
+                                // at or before the current document, or past it
+                                const isrc_docid_t target = r == 1 && cur ? cur - std::min<isrc_docid_t>(cur - 1, g() % 3) : cur + 1 + g() % 256;
+
+                                if (target <= cur)
+                                        expected = cur;
+                                else {
+                                        const auto i = std::lower_bound(ids.begin(), ids.end(), target);
+
+                                        expected = i == ids.end() ? DocIDsEND : *i;
+                                }
+                                res = it->advance(target);
+                        }
+
+                        CHECK(res == expected);
+                        CHECK(it->current() == expected);
+                        cur = expected;
+                }
+        }
+} // namespace
+
+int main() {
+        std::mt19937 g(46);
+        bool         seen[2]{false, false};
+
+        // an array is smaller up to (K_max_id + 1) / 32 = 2048 IDs
+        for (const uint32_t cnt : {1, 100, 1500, 2047, 2048, 2049, 2100, 8000, 40'000, 65'535}) {
+                for (uint32_t round{0}; round != 8; ++round) {
+                        std::vector<isrc_docid_t> ids;
+
+                        for (isrc_docid_t id{1}; id <= K_max_id; ++id)
+                                ids.push_back(id);
+                        std::shuffle(ids.begin(), ids.end(), g);
+                        ids.resize(cnt - 1);
+                        // so that the bitmap size doesn't depend on the sample
+                        ids.push_back(K_max_id);
+                        std::sort(ids.begin(), ids.end());
+                        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+                        const auto set = docids_set::make(ids.data(), ids.size());
+
+                        CHECK((set->repr == docids_set::Repr::Array) == (ids.size() <= 2048));
+                        seen[uint8_t(set->repr)] = true;
+
+                        std::vector<uint64_t> bm(K_max_id / 64 + 1, 0);
+
+                        for (const auto id : ids)
+                                bm[id / 64] |= uint64_t(1) << (id & 63);
+
+                        const auto array = app_ids_set::of_array(ids.data(), ids.size()), bitmap = app_ids_set::of_bitmap(bm.data(), bm.size(), ids.size());
+
+                        {
+                                DocsSetIterators::CachedDocsSet it(set);
+
+                                check(&it, ids, g);
+                        }
+
+                        {
+                                DocsSetIterators::AppIDs it(&array);
+
+                                check(&it, ids, g);
+                        }
+
+                        {
+                                DocsSetIterators::AppIDs it(&bitmap);
+
+                                check(&it, ids, g);
+                        }
+
+                        {
+                                auto                        copy = ids;
+                                DocsSetIterators::VectorIDs it(std::move(copy));
+
+                                check(&it, ids, g);
+                        }
+                }
+        }
+
+        CHECK(seen[0] && seen[1]);
+        return 0;
+}
@@ -0,0 +1,108 @@
+// pack_updates() / unpack_updates() round-trips, and updated_documents_scanner and masked_documents_registry tests
+// in ascending and arbitrary order, for all container types
+#include "check.h"
+#include <docidupdates.h>
+#include <algorithm>
+#include <random>
+#include <set>
+
+using namespace Trinity;
+
+static void check_set(std::vector<docid_t> ids) {
+        const std::set<docid_t> s(ids.begin(), ids.end());
+        std::vector<docid_t>    v(s.begin(), s.end()), all;
+        IOBuffer                b;
+        std::mt19937            g(v.size());
+
+        pack_updates(v, &b);
+
+        const auto ud = unpack_updates({reinterpret_cast<const uint8_t *>(b.data()), uint32_t(b.size())});
+
+        CHECK(ud);
+        CHECK(ud.lowestID == v.front() && ud.highestID == v.back());
+
+        materialize_updates(ud, &all);
+        CHECK(all == v);
+
+        // ascending, every document ID around each member
+        {
+                updated_documents_scanner sc(ud);
+                uint64_t                  next{1};
+
+                for (const auto m : v) {
+                        for (uint64_t id = std::max<uint64_t>(next, m > 100 ? m - 100 : 1); id <= uint64_t(m) + 100; ++id)
+                                CHECK(sc.test(id) == bool(s.count(id)));
+                        next = uint64_t(m) + 101;
+                }
+        }
+
+        // ascending, random strides
+        {
+                updated_documents_scanner sc(ud);
+
+                for (uint64_t id = 1; id <= uint64_t(v.back()) + 10; id += 1 + g() % 5000)
+                        CHECK(sc.test(id) == bool(s.count(id)));
+        }
+
+        // arbitrary order, members and non-members
+        {
+                updated_documents_scanner sc(ud);
+                std::vector<docid_t>      probes;
+
+                for (uint32_t i{0}; i != 20000; ++i)
+                        probes.push_back(i & 1 ? v[g() % v.size()] : v.front() + g() % (v.back() - v.front() + 1));
+
+                for (const auto id : probes)
+                        CHECK(sc.test(id) == bool(s.count(id)));
+
+                // lower IDs within the same container
+                for (auto it = v.rbegin(); it != v.rend() && it - v.rbegin() < 5000; ++it)
+                        CHECK(sc.test(*it));
+        }
+
+        // the registry, ascending
+        {
+                auto reg = masked_documents_registry::make(&ud, 1);
+
+                for (docid_t id = 1; id <= v.back() + 10; id += 1 + g() % 64)
+                        CHECK(reg->test(id) == bool(s.count(id)));
+        }
+}
+
+int main() {
+        std::mt19937         g(42);
+        std::vector<docid_t> ids;
+
+        // sparse; array containers
+        for (uint32_t i{0}; i != 2000; ++i)
+                ids.push_back(1 + g() % 50'000'000);
+        check_set(ids);
+
+        // dense; bitmap containers
+        ids.clear();
+        for (uint32_t i{0}; i != 300'000; ++i)
+                ids.push_back(1 + g() % 400'000);
+        check_set(ids);
+
+        // runs containers
+        ids.clear();
+        for (docid_t base{1000}; base < 3'000'000; base += 100'000) {
+                for (docid_t j{0}; j != 5000; ++j)
+                        ids.push_back(base + j);
+        }
+        check_set(ids);
+
+        // containers boundaries
+        ids.clear();
+        for (uint32_t i{0}; i != 4096; ++i)
+                ids.push_back(65536 * 3 + i * 16);
+        for (uint32_t i{0}; i != 4097; ++i)
+                ids.push_back(65536 * 5 + i * 15);
+        ids.push_back(65535);
+        ids.push_back(65536);
+        check_set(ids);
+
+        check_set({1});
+        check_set({5, 0xFFFFFF00u, 0xFFFFFF10u});
+        return 0;
+}
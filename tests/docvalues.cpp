@@ -0,0 +1,155 @@
+// DocValuesWriter::serialize() and DocValues must round-trip all (document, value) pairs of numeric and string columns, and
+// DocValues must reject truncated or corrupt files when they are opened, instead of reading past them later
+#include "check.h"
+#include <docvalues.h>
+#include <map>
+#include <random>
+
+using namespace Trinity;
+
+namespace {
+        // 8 bytes aligned copy of the serialized file, as if mmap()ed
+        struct file final {
+                std::vector<uint64_t> words;
+                std::size_t           size;
+
+                file(const IOBuffer &b)
+                    : words((b.size() + 7) / 8), size{b.size()} {
+                        memcpy(words.data(), b.data(), b.size());
+                }
+
+                uint8_t *data() noexcept {
+                        return reinterpret_cast<uint8_t *>(words.data());
+                }
+        };
+
+        bool rejected(const uint8_t *const content, const std::size_t size) {
+                try {
+                        DocValues dv(content, size);
+
+                        return false;
+                } catch (const Switch::data_error &) {
+                        return true;
+                }
+        }
+} // namespace
+
+int main() {
+        static const char *const            names[] = {"red", "green", "blue", "", "cyan", "magenta", "yellow"};
+        std::mt19937                        g(47);
+        std::map<isrc_docid_t, int64_t>     prices;
+        std::map<isrc_docid_t, std::string> colors;
+        DocValuesWriter                     w;
+        IOBuffer                            b;
+
+        // consecutive runs(no packed documents), gaps, negative and 64 bit values
+        for (isrc_docid_t id{1}; id != 5000; ++id) {
+                if (id < 1000 || g() % 3 == 0) {
+                        const int64_t v = id % 7 == 0 ? std::numeric_limits<int64_t>::min() + id : id % 11 == 0 ? std::numeric_limits<int64_t>::max() - id : int64_t(g() % 100'000) - 50'000;
+
+                        prices.emplace(id, v);
+                        w.set(id, "price"_s8, v);
+                }
+                if (g() % 4 == 0) {
+                        const auto s = names[g() % 7];
+
+                        colors.emplace(id, s);
+                        w.set(id, "color"_s8, str32_t(s, strlen(s)));
+                }
+        }
+        // only the first value for a document is retained
+        w.set(1, "price"_s8, int64_t(-1));
+
+        w.serialize(&b);
+
+        file f(b);
+
+        {
+                DocValues dv(f.data(), f.size);
+
+                CHECK(dv.fields().size() == 2);
+                CHECK(!dv.documents_sort());
+                CHECK(!dv.field("weight"_s8));
+
+                const auto price = dv.field("price"_s8);
+                const auto color = dv.field("color"_s8);
+
+                CHECK(price && price->kind == docvalues_kind::Numeric && price->valuesCnt == prices.size());
+                CHECK(color && color->kind == docvalues_kind::String && color->valuesCnt == colors.size());
+
+                using pairs = std::vector<std::pair<isrc_docid_t, int64_t>>;
+                pairs all;
+
+                price->for_each([&all](const auto id, const auto v) { all.emplace_back(id, v); });
+                CHECK(all == pairs(prices.begin(), prices.end()));
+
+                for (isrc_docid_t id{1}; id != 5100; ++id) {
+                        int64_t v;
+
+                        if (const auto it = prices.find(id); it != prices.end())
+                                CHECK(price->get(id, &v) && v == it->second);
+                        else
+                                CHECK(!price->get(id, &v));
+
+                        if (const auto it = colors.find(id); it != colors.end()) {
+                                CHECK(color->get(id, &v) && v >= 0 && uint32_t(v) < color->dictCnt);
+
+                                const auto s = color->string(v);
+
+                                CHECK(std::string(s.data(), s.size()) == it->second);
+                        } else
+                                CHECK(!color->get(id, &v));
+                }
+
+                // the dictionary is sorted
+                for (uint32_t i{1}; i < color->dictCnt; ++i) {
+                        const auto a = color->string(i - 1), b = color->string(i);
+
+                        CHECK(std::string(a.data(), a.size()) < std::string(b.data(), b.size()));
+                }
+                CHECK(color->lower_bound("green"_s32) + 1 == color->upper_bound("green"_s32));
+        }
+
+        // Truncated anywhere; the last field's packed data are only followed by the word DocValuesWriter appends so that data are never empty
+        for (std::size_t n{0}; n < f.size - sizeof(uint64_t); n += n < 256 ? 1 : 61)
+                CHECK(rejected(f.data(), n));
+
+        // Corrupt headers
+        {
+                const auto hdr          = f.data() + 4 * sizeof(uint32_t);
+                const auto blocksOffset = *reinterpret_cast<const uint64_t *>(hdr + 24);
+                const auto block        = reinterpret_cast<docvalues_block *>(f.data() + blocksOffset);
+                const auto saved        = *block;
+
+                CHECK(!rejected(f.data(), f.size));
+
+                block->dataOffset = 1u << 30;
+                CHECK(rejected(f.data(), f.size));
+                *block = saved;
+
+                block->cnt = 0;
+                CHECK(rejected(f.data(), f.size));
+                *block = saved;
+
+                block->valueBits = 65;
+                CHECK(rejected(f.data(), f.size));
+                *block = saved;
+
+                block->lastDocID = block[1].lastDocID;
+                CHECK(rejected(f.data(), f.size));
+                *block = saved;
+
+                f.data()[0] ^= 1;
+                CHECK(rejected(f.data(), f.size));
+                f.data()[0] ^= 1;
+
+                // TDV1; different header layout
+                f.data()[3] = '1';
+                CHECK(rejected(f.data(), f.size));
+                f.data()[3] = '2';
+
+                CHECK(!rejected(f.data(), f.size));
+        }
+
+        return 0;
+}
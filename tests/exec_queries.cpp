@@ -0,0 +1,98 @@
+// exec_queries() executes a batch of queries in a single pass, sharing the postings of terms used by more than one query;
+// each query must match exactly the same documents(and terms) as it would if it were executed on its own with exec_query()
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+
+using namespace Trinity;
+
+namespace {
+        struct collector final
+            : public MatchedIndexDocumentsFilter {
+                std::vector<std::pair<docid_t, uint16_t>> matches;
+
+                void consider(const docid_t id) override final {
+                        matches.push_back({id, 0});
+                }
+
+                void consider(const matched_document &match) override final {
+                        matches.push_back({match.id, match.matchedTermsCnt});
+                }
+        };
+
+        std::vector<std::pair<docid_t, uint16_t>> all_matches(const std::vector<std::unique_ptr<collector>> &v) {
+                std::vector<std::pair<docid_t, uint16_t>> res;
+
+                for (const auto &it : v)
+                        res.insert(res.end(), it->matches.begin(), it->matches.end());
+                return res;
+        }
+
+        void index_document(SegmentIndexSession &s, const uint32_t id, const bool replace) {
+                auto d = s.begin(id);
+                char buf[16];
+
+                d.insert(str8_t(buf, sprintf(buf, "w%u", id % 7)), 1);
+                d.insert(str8_t(buf, sprintf(buf, "x%u", id % 11)), 2);
+                if (id & 1)
+                        d.insert("common"_s8, 3);
+                // only found past the first few windows
+                if (id > 130'000 && id % 1000 == 0)
+                        d.insert("rare"_s8, 4);
+
+                if (replace)
+                        s.replace(d);
+                else
+                        s.insert(d);
+        }
+} // namespace
+
+int main() {
+        scratch_segments       segments;
+        IndexSourcesCollection collection;
+
+        {
+                SegmentIndexSession s;
+
+                for (uint32_t id{1}; id != 150'000; ++id)
+                        index_document(s, id, false);
+                segments.commit(s, 1);
+        }
+
+        {
+                // masks some of the documents of the first segment
+                SegmentIndexSession s;
+
+                for (uint32_t id{140'000}; id != 160'000; ++id)
+                        index_document(s, id, id < 150'000);
+                segments.commit(s, 2);
+        }
+
+        for (const uint64_t gen : {1, 2}) {
+                auto src = segments.open(gen);
+
+                collection.insert(src);
+                src->Release();
+        }
+        collection.commit();
+
+        const char *const  queriesStrs[] = {"common", "common w1", "w1 x2", "\"w1 x2\"", "common OR rare", "rare", "common -w3", "w1 OR x5 OR rare", "missing common", "\"x2 common\" w2"};
+        std::vector<query> queries;
+
+        for (const auto s : queriesStrs)
+                queries.emplace_back(str32_t(s, strlen(s)));
+
+        for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), uint32_t(0)}) {
+                const auto batch = exec_queries<collector>(queries.data(), queries.size(), &collection, nullptr, flags);
+
+                CHECK(batch.size() == queries.size());
+                for (size_t i{0}; i != queries.size(); ++i) {
+                        const auto expected = all_matches(exec_query<collector>(queries[i], &collection, nullptr, flags));
+
+                        CHECK(all_matches(batch[i]) == expected);
+                        CHECK(!expected.empty() || i == 8);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,166 @@
+// FacetsCollector must count, for every field, the values of exactly the matched documents across all index sources of a collection; documents
+// updated in a more recent segment are counted with their latest values, and fields may only exist in some of the segments. The counts must
+// remain valid after the index sources are released(see FacetsCollector::finalize_index_source())
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+#include <facets.h>
+#include <map>
+
+using namespace Trinity;
+
+namespace {
+        struct document final {
+                bool        b;
+                std::string brand;
+                int64_t     price; // narrow range; counted in a dense array
+                int64_t     ts;    // wide range; counted in a hashtable
+                int64_t     size;  // only set in the second segment
+        };
+
+        std::map<docid_t, document> documents;
+
+        void index_document(SegmentIndexSession &s, const docid_t id, const bool second) {
+                static const char *const brands[] = {"apple", "samsung", "nokia", "lg", "sony"};
+                document                 doc;
+                auto                     d = s.begin(id);
+
+                doc.b     = id & 1;
+                doc.brand = brands[(id * (second ? 3 : 1)) % 5];
+                doc.price = (id * 7) % 100 + (second ? 1000 : 0);
+                doc.ts    = int64_t(id % 13) * 1'000'000'007;
+                doc.size  = second ? int64_t(id % 4) : -1;
+
+                d.insert("a"_s8, 1);
+                if (doc.b)
+                        d.insert("b"_s8, 2);
+                // some documents have no brand
+                if (id % 17)
+                        d.set_value("brand"_s8, str32_t(doc.brand.data(), doc.brand.size()));
+                else
+                        doc.brand.clear();
+                d.set_value("price"_s8, doc.price);
+                d.set_value("ts"_s8, doc.ts);
+                if (second)
+                        d.set_value("size"_s8, doc.size);
+
+                if (documents.count(id))
+                        s.replace(d);
+                else
+                        s.insert(d);
+                documents[id] = doc;
+        }
+
+        void check(const std::vector<FacetsCollector::facet> &facets, const bool onlyB) {
+                std::map<std::string, uint64_t> brands;
+                std::map<int64_t, uint64_t>     prices, ts, sizes;
+
+                for (const auto &it : documents) {
+                        if (onlyB && !it.second.b)
+                                continue;
+
+                        if (!it.second.brand.empty())
+                                ++brands[it.second.brand];
+                        ++prices[it.second.price];
+                        ++ts[it.second.ts];
+                        if (it.second.size != -1)
+                                ++sizes[it.second.size];
+                }
+
+                // "missing" doesn't exist in any segment
+                CHECK(facets.size() == 4);
+                for (const auto &f : facets) {
+                        std::map<std::string, uint64_t> strings;
+                        std::map<int64_t, uint64_t>     values;
+
+                        for (size_t i{0}; i != f.values.size(); ++i) {
+                                const auto &v = f.values[i];
+
+                                if (f.kind == docvalues_kind::String)
+                                        strings[v.str] = v.count;
+                                else
+                                        values[v.value] = v.count;
+
+                                // by count DESC, value ASC
+                                if (i) {
+                                        const auto &p = f.values[i - 1];
+
+                                        CHECK(p.count > v.count || (p.count == v.count && (f.kind == docvalues_kind::String ? p.str < v.str : p.value < v.value)));
+                                }
+                        }
+
+                        if (f.field == "brand")
+                                CHECK(f.kind == docvalues_kind::String && strings == brands);
+                        else if (f.field == "price")
+                                CHECK(values == prices);
+                        else if (f.field == "ts")
+                                CHECK(values == ts);
+                        else {
+                                CHECK(f.field == "size");
+                                CHECK(values == sizes);
+                        }
+                }
+        }
+} // namespace
+
+int main() {
+        scratch_segments segments;
+
+        {
+                SegmentIndexSession s;
+
+                for (docid_t id{1}; id != 20'000; ++id)
+                        index_document(s, id, false);
+                segments.commit(s, 1);
+        }
+
+        {
+                // updates some of the documents of the first segment
+                SegmentIndexSession s;
+
+                for (docid_t id{15'000}; id != 30'000; ++id)
+                        index_document(s, id, true);
+                segments.commit(s, 2);
+        }
+
+        const str8_t fields[] = {"brand"_s8, "price"_s8, "ts"_s8, "size"_s8, "missing"_s8};
+
+        for (const bool onlyB : {false, true}) {
+                const query                                   q(onlyB ? "b"_s32 : "a"_s32);
+                std::vector<std::unique_ptr<FacetsCollector>> seq, par;
+
+                {
+                        IndexSourcesCollection collection;
+
+                        for (const uint64_t gen : {1, 2}) {
+                                auto src = segments.open(gen);
+
+                                collection.insert(src);
+                                src->Release();
+                        }
+                        collection.commit();
+
+                        seq = exec_query<FacetsCollector>(q, &collection, nullptr, uint32_t(ExecFlags::DocumentsOnly), fields, 5);
+                        par = exec_query_par<FacetsCollector>(q, &collection, nullptr, uint32_t(ExecFlags::DocumentsOnly), nullptr, fields, 5);
+                }
+
+                // the index sources are gone by now; the counts(and the strings of their dictionaries) must not depend on them
+
+                check(FacetsCollector::merge(seq), onlyB);
+                check(FacetsCollector::merge(par), onlyB);
+
+                // only the top values
+                const auto all = FacetsCollector::merge(seq);
+                const auto top = FacetsCollector::merge(seq, 3);
+
+                CHECK(top.size() == all.size());
+                for (size_t i{0}; i != top.size(); ++i) {
+                        CHECK(top[i].field == all[i].field);
+                        CHECK(top[i].values.size() == std::min<size_t>(3, all[i].values.size()));
+                        for (size_t k{0}; k != top[i].values.size(); ++k)
+                                CHECK(top[i].values[k].count == all[i].values[k].count);
+                }
+        }
+
+        return 0;
+}
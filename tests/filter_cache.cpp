@@ -0,0 +1,203 @@
+// With a FilterCache, queries must match exactly the same documents as without one. Sub-trees are keyed by their canonical
+// representation, so the operands order of commutative operators(AND, OR) must not matter, but the operands order of NOT must; and
+// they are keyed by the index source generation, so sets of one source must never be used for another. Sources that are not
+// IndexSource::immutable() must not use the cache at all.
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+#include <filter_cache.h>
+
+using namespace Trinity;
+
+namespace {
+        struct collector final
+            : public MatchedIndexDocumentsFilter {
+                std::vector<docid_t> matches;
+
+                void consider(const docid_t id) override final {
+                        matches.push_back(id);
+                }
+
+                void consider(const matched_document &match) override final {
+                        matches.push_back(match.id);
+                }
+        };
+
+        // Forwards to a segment, but it is not immutable()
+        class mutable_source final
+            : public IndexSource {
+              public:
+                IndexSource *const src;
+
+                mutable_source(IndexSource *const s)
+                    : src{s} {
+                        gen = s->generation();
+                        src->Retain();
+                }
+
+                ~mutable_source() {
+                        src->Release();
+                }
+
+                term_index_ctx resolve_term_ctx(const str8_t term) override final {
+                        return src->term_ctx(term);
+                }
+
+                Codecs::Decoder *new_postings_decoder(const str8_t term, const term_index_ctx ctx) override final {
+                        return src->new_postings_decoder(term, ctx);
+                }
+
+                updated_documents masked_documents() override final {
+                        return src->masked_documents();
+                }
+
+                field_statistics default_field_stats() override final {
+                        return src->default_field_stats();
+                }
+
+                bool index_empty() const override final {
+                        return src->index_empty();
+                }
+        };
+
+        void index_document(SegmentIndexSession &s, const docid_t id, const uint32_t m, const bool replace) {
+                auto d = s.begin(id);
+
+                d.insert("x"_s8, 1);
+                if (id % (2 * m) == 0)
+                        d.insert("a"_s8, 2);
+                if (id % (3 * m) == 0)
+                        d.insert("b"_s8, 3);
+                if (id % 5 == 0)
+                        d.insert("c"_s8, 4);
+
+                if (replace)
+                        s.replace(d);
+                else
+                        s.insert(d);
+        }
+
+        std::vector<docid_t> run(IndexSourcesCollection *const collection, const char *const s, const uint32_t flags) {
+                const query          q(str32_t(s, strlen(s)));
+                std::vector<docid_t> res;
+
+                for (auto &it : exec_query<collector>(q, collection, nullptr, flags))
+                        res.insert(res.end(), it->matches.begin(), it->matches.end());
+                return res;
+        }
+
+        void open(scratch_segments &segments, IndexSourcesCollection *const collection, FilterCache *const cache) {
+                for (const uint64_t gen : {1, 2}) {
+                        auto src = segments.open(gen);
+
+                        src->use_filter_cache(cache);
+                        collection->insert(src);
+                        src->Release();
+                }
+                collection->commit();
+        }
+} // namespace
+
+int main() {
+        scratch_segments segments;
+
+        {
+                SegmentIndexSession s;
+
+                for (docid_t id{1}; id != 200'000; ++id)
+                        index_document(s, id, 1, false);
+                segments.commit(s, 1);
+        }
+
+        {
+                // updates some of the documents of the first segment; same sub-trees match different documents here
+                SegmentIndexSession s;
+
+                for (docid_t id{150'000}; id != 250'000; ++id)
+                        index_document(s, id, 2, id < 200'000);
+                segments.commit(s, 2);
+        }
+
+        const char *const queries[] = {
+            "a NOT b", "b NOT a",
+            "x NOT (a NOT b)", "x NOT (b NOT a)",
+            "x NOT (a b)", "x NOT (b a)",
+            "(a OR b) c", "c (b OR a)",
+            "(a b) OR c", "c OR (b a)",
+            "x NOT (a OR c)", "x NOT (c OR a)",
+            "a b c", "c b a",
+        };
+        IndexSourcesCollection uncached;
+
+        open(segments, &uncached, nullptr);
+
+        {
+                // every sub-tree is materialized the first time it's seen, so that a wrong key would return another sub-tree's set
+                FilterCache            cache(64 * 1024 * 1024, 0, 1);
+                IndexSourcesCollection cached;
+
+                open(segments, &cached, &cache);
+
+                for (uint32_t i{0}; i != 2; ++i) {
+                        for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), uint32_t(0)}) {
+                                for (const auto s : queries) {
+                                        const auto expected = run(&uncached, s, flags);
+
+                                        CHECK(!expected.empty());
+                                        CHECK(run(&cached, s, flags) == expected);
+                                }
+                        }
+                }
+
+                CHECK(cache.hits > 0);
+        }
+
+        {
+                // When not in DocumentsOnly mode, only NOT filters are considered, so we can tell which are found
+                FilterCache            cache(64 * 1024 * 1024, 0, 1);
+                IndexSourcesCollection cached;
+
+                open(segments, &cached, &cache);
+
+                const auto found = [&](const char *const s) {
+                        const auto hits = cache.hits.load();
+
+                        CHECK(run(&cached, s, 0) == run(&uncached, s, 0));
+                        return cache.hits > hits;
+                };
+
+                // operands of AND and OR in either order
+                CHECK(!found("x NOT (a b)"));
+                CHECK(found("x NOT (b a)"));
+                CHECK(!found("x NOT (a OR c)"));
+                CHECK(found("b NOT (c OR a)"));
+
+                // but not of NOT
+                CHECK(!found("x NOT (a NOT b)"));
+                CHECK(!found("x NOT (b NOT a)"));
+                CHECK(found("c NOT (a NOT b)"));
+        }
+
+        {
+                FilterCache            cache(64 * 1024 * 1024, 0, 1);
+                IndexSourcesCollection collection;
+
+                for (const uint64_t gen : {1, 2}) {
+                        auto segment = segments.open(gen);
+                        auto src     = new mutable_source(segment);
+
+                        segment->Release();
+                        src->use_filter_cache(&cache);
+                        collection.insert(src);
+                        src->Release();
+                }
+                collection.commit();
+
+                for (const auto s : queries)
+                        CHECK(run(&collection, s, uint32_t(ExecFlags::DocumentsOnly)) == run(&uncached, s, uint32_t(ExecFlags::DocumentsOnly)));
+
+                CHECK(cache.hits == 0 && cache.misses == 0);
+        }
+
+        return 0;
+}
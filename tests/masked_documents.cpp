@@ -0,0 +1,82 @@
+// IndexSourcesCollection::commit() collapses the masked documents of all more recent index sources, for each index source;
+// scanner_registry_for() must mask exactly the documents updated in index sources of a higher generation
+#include "check.h"
+#include <index_source.h>
+#include <random>
+#include <set>
+
+using namespace Trinity;
+
+namespace {
+        struct masking_source final
+            : public TrivialMaskedDocumentsIndexSource {
+                masking_source(const updated_documents ud, const uint64_t g)
+                    : TrivialMaskedDocumentsIndexSource(ud) {
+                        gen = g;
+                }
+        };
+} // namespace
+
+int main() {
+        static constexpr docid_t             K_max_id{300'000};
+        std::mt19937                         g(7);
+        std::vector<std::unique_ptr<IOBuffer>> storage;
+        std::vector<std::set<docid_t>>       updated;
+        IndexSourcesCollection               collection;
+
+        // index sources in no particular order of generation; some don't mask any documents
+        for (const uint64_t gen : {5, 2, 9, 1, 7, 3, 8}) {
+                std::vector<docid_t> ids;
+
+                if (gen != 2 && gen != 8) {
+                        const auto n = gen * 3000;
+
+                        for (uint32_t i{0}; i != n; ++i)
+                                ids.push_back(1 + g() % K_max_id);
+                        if (gen == 7) {
+                                for (docid_t id{50'000}; id != 120'000; ++id)
+                                        ids.push_back(id);
+                        }
+                }
+
+                std::set<docid_t> s(ids.begin(), ids.end());
+
+                storage.emplace_back(std::make_unique<IOBuffer>());
+                ids.assign(s.begin(), s.end());
+                pack_updates(ids, storage.back().get());
+
+                const auto ud = unpack_updates({reinterpret_cast<const uint8_t *>(storage.back()->data()), uint32_t(storage.back()->size())});
+                auto       src = new masking_source(ud, gen);
+
+                if (updated.size() <= gen)
+                        updated.resize(gen + 1);
+                updated[gen] = std::move(s);
+                collection.insert(src);
+                src->Release();
+        }
+
+        collection.commit();
+
+        for (uint16_t i{0}; i != collection.sources.size(); ++i) {
+                const auto        gen = collection.sources[i]->generation();
+                std::set<docid_t> expected;
+
+                for (uint64_t other{gen + 1}; other < updated.size(); ++other)
+                        expected.insert(updated[other].begin(), updated[other].end());
+
+                auto       r    = collection.scanner_registry_for(i);
+                auto       copy = r;
+                const auto reg  = r.get();
+
+                CHECK(reg->size() == (expected.empty() ? 0 : 1));
+                for (docid_t id{1}; id <= K_max_id + 10; ++id) {
+                        const bool masked = expected.count(id);
+
+                        CHECK(reg->test(id) == masked);
+                        if (id & 1)
+                                CHECK(copy.get()->test(id) == masked);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,219 @@
+// Compiled percolator programs must match exactly the documents their percolator_query matches, both when owned by the percolator_index
+// and when loaded from a buffer of serialized programs(as if read from a file); and invalid programs must be rejected when loaded, not when matched
+#include "check.h"
+#include <percolator.h>
+#include <random>
+#include <set>
+
+using namespace Trinity;
+
+namespace {
+        const char *const words[] = {"apple", "iphone", "ipad", "world", "of", "warcraft", "the", "game", "pc", "mac", "red", "blue"};
+
+        struct document final
+            : public percolator_document {
+                std::vector<std::string> tokens;
+
+                bool match_term(const str8_t t) const {
+                        return std::find(tokens.begin(), tokens.end(), std::string(t.data(), t.size())) != tokens.end();
+                }
+
+                bool match_phrase(const str8_t *const terms, const uint16_t cnt) override final {
+                        for (std::size_t i{0}; i + cnt <= tokens.size(); ++i) {
+                                uint16_t k{0};
+
+                                while (k != cnt && tokens[i + k] == std::string(terms[k].data(), terms[k].size()))
+                                        ++k;
+                                if (k == cnt)
+                                        return true;
+                        }
+                        return false;
+                }
+        };
+
+        struct query_document final
+            : public percolator_document_proxy {
+                document *const               d;
+                const percolator_query *const q;
+
+                query_document(document *const d_, const percolator_query *const q_)
+                    : d{d_}, q{q_} {
+                }
+
+                bool match_term(const uint16_t t) override final {
+                        return d->match_term(q->term_by_index(t));
+                }
+
+                bool match_phrase(const uint16_t *const ids, const uint16_t cnt) override final {
+                        str8_t terms[cnt];
+
+                        for (uint16_t i{0}; i != cnt; ++i)
+                                terms[i] = q->term_by_index(ids[i]);
+                        return d->match_phrase(terms, cnt);
+                }
+        };
+
+        bool rejected(const uint8_t *const p, const std::size_t available) {
+                try {
+                        const percolator_program program(p, available);
+
+                        return false;
+                } catch (const Switch::data_error &) {
+                        return true;
+                }
+        }
+} // namespace
+
+int main() {
+        std::mt19937                                   g(3);
+        std::vector<std::unique_ptr<query>>            parsed;
+        std::vector<std::unique_ptr<percolator_query>> compiled;
+        IOBuffer                                       blob;
+        std::vector<std::size_t>                       offsets;
+
+        for (uint32_t i{0}; i != 2000; ++i) {
+                static const char *const ops[] = {" ", " OR ", " NOT ", " "};
+                std::string              s;
+
+                if (g() % 20 == 0)
+                        s = "-";
+                for (uint32_t j{0}, n = 1 + g() % 4; j != n; ++j) {
+                        if (j)
+                                s += ops[g() % 4];
+                        if (g() % 6 == 0)
+                                s.append("\"").append(words[g() % 12]).append(" ").append(words[g() % 12]).append("\"");
+                        else if (g() % 6 == 0)
+                                s.append("(").append(words[g() % 12]).append(" OR ").append(words[g() % 12]).append(")");
+                        else
+                                s += words[g() % 12];
+                }
+
+                try {
+                        parsed.emplace_back(new query(str32_t(s.data(), s.size())));
+                } catch (...) {
+                        // e.g [apple NOT -game]
+                        parsed.emplace_back(new query());
+                }
+                compiled.emplace_back(new percolator_query(*parsed.back()));
+                if (*compiled.back()) {
+                        offsets.push_back(blob.size());
+                        compiled.back()->compile(&blob);
+                } else
+                        offsets.push_back(std::numeric_limits<std::size_t>::max());
+        }
+
+        // 4 bytes aligned copy, as if mmap()ed
+        std::unique_ptr<uint32_t[]> storage(new uint32_t[blob.size() / sizeof(uint32_t)]);
+        const auto                  base = reinterpret_cast<const uint8_t *>(storage.get());
+
+        memcpy(storage.get(), blob.data(), blob.size());
+
+        percolator_index owned, loaded;
+
+        for (std::size_t i{0}; i != compiled.size(); ++i) {
+                CHECK(owned.insert(i, *parsed[i]) == bool(*compiled[i]));
+
+                if (const auto o = offsets[i]; o != std::numeric_limits<std::size_t>::max()) {
+                        const percolator_program p(base + o, blob.size() - o);
+
+                        CHECK(o + p.size <= blob.size());
+                        loaded.insert(i, base + o, blob.size() - o);
+                }
+        }
+
+        for (uint32_t i{0}; i != 1000; ++i) {
+                document                                  doc;
+                std::set<std::string>                     distinct;
+                std::vector<str8_t>                       docTerms;
+                std::vector<percolator_index::query_id_t> expected, a, b;
+
+                for (uint32_t j{0}, n = 1 + g() % 6; j != n; ++j)
+                        doc.tokens.push_back(words[g() % 12]);
+                distinct.insert(doc.tokens.begin(), doc.tokens.end());
+                for (const auto &it : distinct)
+                        docTerms.emplace_back(it.data(), it.size());
+
+                for (std::size_t k{0}; k != compiled.size(); ++k) {
+                        query_document proxy(&doc, compiled[k].get());
+
+                        if (*compiled[k] && compiled[k]->match(proxy))
+                                expected.push_back(k);
+                }
+
+                owned.match(doc, docTerms.data(), docTerms.size(), &a);
+                loaded.match(doc, docTerms.data(), docTerms.size(), &b);
+                std::sort(a.begin(), a.end());
+                std::sort(b.begin(), b.end());
+                CHECK(a == expected);
+                CHECK(b == expected);
+        }
+
+        // Invalid programs
+        {
+                const auto            o     = *std::find_if(offsets.begin(), offsets.end(), [](const auto o) { return o != std::numeric_limits<std::size_t>::max(); });
+                const auto            size  = percolator_program(base + o, blob.size() - o).size;
+                std::vector<uint32_t> copy(size / sizeof(uint32_t));
+                const auto            p     = reinterpret_cast<uint8_t *>(copy.data());
+                const auto            reset = [&]() {
+                        memcpy(copy.data(), base + o, size);
+                };
+
+                reset();
+                CHECK(!rejected(p, size));
+
+                // truncated
+                for (std::size_t n{0}; n != size; ++n)
+                        CHECK(rejected(p, n));
+
+                // magic, version
+                copy[0] ^= 1;
+                CHECK(rejected(p, size));
+                reset();
+                ++copy[1];
+                CHECK(rejected(p, size));
+                reset();
+
+                // unknown instruction, bit out of range
+                copy[6] = copy[6] | 0xff;
+                CHECK(rejected(p, size));
+                reset();
+                copy[6] = percolator_program::instruction(percolator_program::Op::Bit, 1u << 20);
+                CHECK(rejected(p, size));
+                reset();
+
+                // stack underflow
+                copy[6] = percolator_program::instruction(percolator_program::Op::AndNot, 0);
+                CHECK(rejected(p, size));
+                reset();
+
+                // percolator_index::insert() validates programs
+                bool threw{false};
+
+                try {
+                        percolator_index index;
+
+                        index.insert(1, p, size - 4);
+                } catch (const Switch::data_error &) {
+                        threw = true;
+                }
+                CHECK(threw);
+
+                // random corruption must either be rejected, or be a program we can safely match against
+                for (uint32_t i{0}; i != 20000; ++i) {
+                        reset();
+                        for (uint32_t n = 1 + g() % 4; n; --n)
+                                p[g() % size] ^= uint8_t(1 + g() % 255);
+
+                        if (!rejected(p, size)) {
+                                const percolator_program program(p, size);
+                                uint64_t                 bits[(program.bits_cnt() + 63) / 64 + 1];
+
+                                for (auto &it : bits)
+                                        it = (uint64_t(g()) << 32) | g();
+                                program.match(bits);
+                        }
+                }
+        }
+
+        return 0;
+}
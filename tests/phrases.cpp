@@ -0,0 +1,185 @@
+// Phrases are matched by confirming positions(Phrase::consider_phrase_match()) for every document that has all their terms, unless they are
+// operands of a conjunction, where they are only approximated by those documents until all operands agree on one, and confirmed last(two-phase
+// iteration; see DocsSetIterators::Conjuction). Either way, they must match exactly the documents where their terms are adjacent, with the same hits.
+//
+// Documents are random sequences of few distinct terms, so that phrases with repeated terms([a a], [a b a]) often almost match, and some
+// are long enough for their hits to span more than one hits block(Codecs::Lucene::BLOCK_SIZE), so that phrases are found across blocks edges.
+#include "check.h"
+#include "segments.h"
+#include <algorithm>
+#include <exec.h>
+#include <map>
+#include <random>
+
+using namespace Trinity;
+
+namespace {
+        struct match final {
+                docid_t                                      id;
+                std::map<std::string, std::vector<uint32_t>> hits; // positions of each matched term
+
+                bool operator==(const match &o) const noexcept {
+                        return id == o.id && hits == o.hits;
+                }
+        };
+
+        struct collector final
+            : public MatchedIndexDocumentsFilter {
+                std::vector<match> matches;
+
+                void consider(const docid_t id) override final {
+                        matches.push_back({id, {}});
+                }
+
+                void consider(const matched_document &md) override final {
+                        match m{md.id, {}};
+
+                        for (uint16_t i{0}; i != md.matchedTermsCnt; ++i) {
+                                const auto th = md.matchedTerms[i].hits;
+                                const auto t  = md.matchedTerms[i].queryCtx->term.token;
+                                auto &     v  = m.hits[std::string(t.data(), t.size())];
+
+                                for (uint32_t k{0}; k != th->freq; ++k)
+                                        v.push_back(th->all[k].pos);
+                        }
+                        matches.push_back(std::move(m));
+                }
+        };
+
+        // A phrase of a single term is just the term
+        using clause = std::vector<std::string>;
+
+        std::map<docid_t, std::vector<std::string>> documents; // position i + 1 is [i]
+
+        bool has(const std::vector<std::string> &doc, const clause &c) {
+                for (std::size_t i{0}; i + c.size() <= doc.size(); ++i) {
+                        if (std::equal(c.begin(), c.end(), doc.begin() + i))
+                                return true;
+                }
+                return false;
+        }
+
+        std::vector<match> expected(const std::vector<clause> &q, const bool docsOnly) {
+                std::vector<match> res;
+
+                for (const auto &it : documents) {
+                        const auto &doc = it.second;
+
+                        if (!std::all_of(q.begin(), q.end(), [&doc](const auto &c) { return has(doc, c); }))
+                                continue;
+
+                        match m{it.first, {}};
+
+                        if (!docsOnly) {
+                                for (const auto &c : q) {
+                                        for (const auto &t : c) {
+                                                auto &v = m.hits[t];
+
+                                                v.clear();
+                                                for (uint32_t i{0}; i != doc.size(); ++i) {
+                                                        if (doc[i] == t)
+                                                                v.push_back(i + 1);
+                                                }
+                                        }
+                                }
+                        }
+                        res.push_back(std::move(m));
+                }
+                return res;
+        }
+
+        std::string query_str(const std::vector<clause> &q) {
+                std::string res;
+
+                for (const auto &c : q) {
+                        if (!res.empty())
+                                res.push_back(' ');
+                        if (c.size() > 1)
+                                res.push_back('"');
+                        for (std::size_t i{0}; i != c.size(); ++i) {
+                                if (i)
+                                        res.push_back(' ');
+                                res.append(c[i]);
+                        }
+                        if (c.size() > 1)
+                                res.push_back('"');
+                }
+                return res;
+        }
+} // namespace
+
+int main() {
+        scratch_segments       segments;
+        IndexSourcesCollection collection;
+        std::mt19937           g(43);
+
+        {
+                SegmentIndexSession s;
+
+                for (docid_t id{1}; id != 40'000; ++id) {
+                        auto &     doc = documents[id];
+                        const auto len = id % 101 == 0 ? 200 + g() % 200 : 1 + g() % 12;
+
+                        for (uint32_t i{0}; i != len; ++i) {
+                                // mostly a, for repeated terms
+                                const auto r = g() % 8;
+
+                                doc.push_back(r < 4 ? "a" : r < 7 ? "b" : "c");
+                        }
+                        if (id % 3)
+                                doc.push_back("x");
+                        if (id % 211 == 0)
+                                doc.push_back("r");
+
+                        auto d = s.begin(id);
+
+                        for (uint32_t i{0}; i != doc.size(); ++i)
+                                d.insert(str8_t(doc[i].data(), doc[i].size()), i + 1);
+                        s.insert(d);
+                }
+                segments.commit(s, 1);
+        }
+
+        auto src = segments.open(1);
+
+        collection.insert(src);
+        src->Release();
+        collection.commit();
+
+        const std::vector<clause> queries[] = {
+            // a phrase on its own is confirmed for every candidate
+            {{"a", "b"}},
+            {{"a", "a"}},
+            {{"a", "b", "a"}},
+            {{"a", "a", "a"}},
+            {{"b", "c", "a", "b"}},
+            // two-phase, as the lead or not
+            {{"a", "b"}, {"x"}},
+            {{"x"}, {"a", "b", "a"}},
+            {{"a", "a"}, {"x"}},
+            {{"a", "b"}, {"b", "a"}},
+            {{"a", "a"}, {"b", "c"}, {"x"}},
+            {{"a", "a", "a"}, {"c"}},
+            // led by a rare term, so the phrases are advanced past many documents(and blocks) at once
+            {{"r"}, {"a", "b", "a"}},
+            {{"a", "b", "a"}, {"r"}},
+            {{"r"}, {"a", "a"}, {"c", "b"}},
+        };
+
+        for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), uint32_t(0)}) {
+                for (const auto &it : queries) {
+                        const auto         s = query_str(it);
+                        const query        q(str32_t(s.data(), s.size()));
+                        const auto         exp = expected(it, flags != 0);
+                        std::vector<match> res;
+
+                        for (auto &c : exec_query<collector>(q, &collection, nullptr, flags))
+                                res.insert(res.end(), c->matches.begin(), c->matches.end());
+
+                        CHECK(!exp.empty());
+                        CHECK(res == exp);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,168 @@
+// Paging through results with a cursor(search-after; the last document of the previous page) must yield, page by page, exactly the
+// documents of a single query for all of them, in the same order, and without duplicates; both for results sorted by a doc-values field
+// (SortedDocumentsCollector, where sorted index sources are also executed starting from the cursor), and for results ranked by score(TopKDocumentsCollector)
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+#include <map>
+#include <random>
+#include <set>
+#include <similarity.h>
+#include <topk.h>
+
+using namespace Trinity;
+
+namespace {
+        // documents without a value are not in the map
+        std::map<docid_t, int64_t> prices;
+        std::set<docid_t>          documents;
+        std::mt19937               g(50);
+
+        void index_segment(scratch_segments &segments, const uint64_t gen, const docid_t from, const docid_t to, const bool sorted, const std::vector<docid_t> &replaced = {}) {
+                SegmentIndexSession s;
+                const auto          index_document = [&](const docid_t id, const bool replace) {
+                        auto d = s.begin(id);
+
+                        d.insert("a"_s8, 1);
+                        if (id % 3 == 0)
+                                d.insert("b"_s8, 2);
+                        // more hits, for different scores
+                        if (id % 5 == 0)
+                                d.insert("b"_s8, 3);
+
+                        documents.insert(id);
+                        prices.erase(id);
+                        if (sorted || g() % 10) {
+                                // many ties, which are broken by document ID
+                                const int64_t v = sorted ? int64_t(id / 4) : int64_t(g() % 1000);
+
+                                d.set_value("price"_s8, v);
+                                prices[id] = v;
+                        }
+
+                        if (replace)
+                                s.replace(d);
+                        else
+                                s.insert(d);
+                };
+
+                if (sorted)
+                        s.set_index_sort("price"_s8, index_sort::Order::Ascending);
+                for (const auto id : replaced)
+                        index_document(id, true);
+                for (auto id = from; id != to; ++id)
+                        index_document(id, false);
+                segments.commit(s, gen);
+        }
+
+        bool matches(const char *const q, const docid_t id) {
+                const bool b = id % 3 == 0 || id % 5 == 0;
+
+                return q[0] == 'a' ? q[1] == 0 || !b : b;
+        }
+
+        void page_sorted(IndexSourcesCollection *const collection, const index_sort::Order order) {
+                const index_sort sort{"price"_s8, order};
+
+                for (const char *const s : {"a", "b", "a NOT b"}) {
+                        const query                  q(str32_t(s, strlen(s)));
+                        std::vector<sorted_document> expected;
+
+                        for (const auto id : documents) {
+                                if (matches(s, id)) {
+                                        const auto it = prices.find(id);
+
+                                        expected.push_back({id, it != prices.end(), it != prices.end() ? it->second : 0});
+                                }
+                        }
+                        std::sort(expected.begin(), expected.end(), [&sort](const auto &a, const auto &b) { return sort.before(a, b); });
+
+                        for (const uint32_t k : {7, 1000}) {
+                                std::vector<sorted_document> all;
+
+                                for (std::size_t pages{0};; ++pages) {
+                                        const auto after = all.empty() ? nullptr : &all.back();
+                                        const auto page  = SortedDocumentsCollector::merge(exec_query_sorted<SortedDocumentsCollector>(q, collection, nullptr, uint32_t(ExecFlags::DocumentsOnly), sort, after, k, sort, k, after), k);
+
+                                        all.insert(all.end(), page.begin(), page.end());
+                                        if (page.size() < k || pages > expected.size() / k + 1)
+                                                break;
+                                }
+
+                                CHECK(all.size() == expected.size());
+                                for (std::size_t i{0}; i != std::min(all.size(), expected.size()); ++i)
+                                        CHECK(all[i].id == expected[i].id && all[i].hasValue == expected[i].hasValue && all[i].value == expected[i].value);
+                        }
+                }
+        }
+
+        void page_scored(IndexSourcesCollection *const collection) {
+                static constexpr uint32_t K_page{500};
+                const uint32_t            flags = uint32_t(ExecFlags::AccumulatedScoreScheme);
+
+                for (const char *const s : {"a", "b", "a NOT b"}) {
+                        const query                                           q(str32_t(s, strlen(s)));
+                        Similarity::IndexSourcesCollectionTFIDFScorer         scorer;
+                        const auto                                            expected = TopKDocumentsCollector::merge(exec_query_par<TopKDocumentsCollector>(q, collection, nullptr, flags, &scorer, uint32_t(documents.size())), documents.size());
+                        std::vector<TopKDocumentsCollector::scored_document> all;
+
+                        for (std::size_t pages{0};; ++pages) {
+                                const auto                                    after = all.empty() ? nullptr : &all.back();
+                                TopKThreshold                                 threshold;
+                                Similarity::IndexSourcesCollectionTFIDFScorer pageScorer;
+                                const auto                                    page = TopKDocumentsCollector::merge(exec_query_par<TopKDocumentsCollector>(q, collection, nullptr, flags, &pageScorer, K_page, &threshold, after), K_page);
+
+                                all.insert(all.end(), page.begin(), page.end());
+                                if (page.size() < K_page || pages > expected.size() / K_page + 1)
+                                        break;
+                        }
+
+                        CHECK(!expected.empty());
+                        CHECK(all.size() == expected.size());
+                        for (std::size_t i{0}; i != std::min(all.size(), expected.size()); ++i)
+                                CHECK(all[i].id == expected[i].id && all[i].score == expected[i].score);
+                }
+        }
+} // namespace
+
+int main() {
+        scratch_segments segments;
+
+        index_segment(segments, 1, 1, 30'000, true);
+        {
+                IndexSourcesCollection collection;
+                auto                   src = segments.open(1);
+
+                collection.insert(src);
+                src->Release();
+                collection.commit();
+
+                page_sorted(&collection, index_sort::Order::Ascending);
+                // not the segment's sort order, so it is executed in full for every page
+                page_sorted(&collection, index_sort::Order::Descending);
+        }
+
+        {
+                // an unsorted segment that updates some of the documents of the sorted one; some of its documents have no price
+                std::vector<docid_t>   replaced;
+                IndexSourcesCollection collection;
+
+                for (docid_t id{1}; id < 30'000; id += 7)
+                        replaced.push_back(id);
+                index_segment(segments, 2, 30'000, 32'000, false, replaced);
+
+                for (const uint64_t gen : {1, 2}) {
+                        auto src = segments.open(gen);
+
+                        collection.insert(src);
+                        src->Release();
+                }
+                collection.commit();
+
+                page_sorted(&collection, index_sort::Order::Ascending);
+                page_sorted(&collection, index_sort::Order::Descending);
+                page_scored(&collection);
+        }
+
+        return 0;
+}
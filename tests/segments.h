@@ -0,0 +1,48 @@
+#pragma once
+// Scratch segments for the programs in tests/ that need to execute queries against real index sources
+#include <ftw.h>
+#include <indexer.h>
+#include <lucene_codec.h>
+#include <segment_index_source.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A temporary directory for a test program's segments, removed when it goes out of scope.
+// Segments are committed to sub-directories named after their generation, which is what SegmentIndexSource expects
+struct scratch_segments final {
+        std::string base;
+
+        scratch_segments() {
+                char path[] = "/tmp/trinity_tests_XXXXXX";
+
+                if (!mkdtemp(path)) {
+                        std::perror("mkdtemp");
+                        std::exit(1);
+                }
+                base = path;
+        }
+
+        ~scratch_segments() {
+                nftw(base.c_str(), [](const char *p, const struct stat *, int, struct FTW *) { return remove(p); }, 16, FTW_DEPTH | FTW_PHYS);
+        }
+
+        std::string path(const uint64_t gen) const {
+                return base + "/" + std::to_string(gen);
+        }
+
+        void commit(Trinity::SegmentIndexSession &s, const uint64_t gen) const {
+                const auto p = path(gen);
+
+                mkdir(p.c_str(), 0775);
+
+                std::unique_ptr<Trinity::Codecs::IndexSession> sess(new Trinity::Codecs::Lucene::IndexSession(p.c_str()));
+
+                s.commit(sess.get());
+        }
+
+        // Caller is responsible for Release()ing it
+        Trinity::SegmentIndexSource *open(const uint64_t gen) const {
+                return new Trinity::SegmentIndexSource(path(gen).c_str());
+        }
+};
@@ -0,0 +1,274 @@
+// Segments sorted by a doc-values field(see SegmentIndexSession::set_index_sort()) allow exec_query_sorted() to stop
+// considering a segment's documents once it has collected enough of them; the top-K documents must be the same as if
+// all matches were considered(i.e with exec_query<SortedDocumentsCollector>), including for unsorted segments, masked documents
+// and segments that are sorted the other way. Merged segments are sorted only if the merged documents still are in order,
+// and no document that's not masked is in more than one of the merged segments.
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+#include <functional>
+#include <map>
+#include <merge.h>
+#include <random>
+#include <topk.h>
+
+using namespace Trinity;
+
+namespace {
+        std::map<docid_t, int64_t> prices;
+        std::mt19937               g(49);
+
+        enum class Mode : uint8_t {
+                Ascending = 0,  // price = id / 2, sorted
+                Unsorted,       // random prices
+                Descending      // price = -id, sorted
+        };
+
+        void index_segment(scratch_segments &segments, const uint64_t gen, const docid_t from, const docid_t to, const Mode mode, const std::vector<docid_t> &replaced = {}) {
+                SegmentIndexSession s;
+                const auto          index_document = [&](const docid_t id, const bool replace) {
+                        const int64_t v = mode == Mode::Ascending ? int64_t(id / 2) : mode == Mode::Descending ? -int64_t(id) : int64_t(g() % 100'000);
+                        auto          d = s.begin(id);
+
+                        d.insert("a"_s8, 1);
+                        if (id % 3 == 0)
+                                d.insert("b"_s8, 2);
+                        d.set_value("price"_s8, v);
+                        prices[id] = v;
+
+                        if (replace)
+                                s.replace(d);
+                        else
+                                s.insert(d);
+                };
+
+                if (mode != Mode::Unsorted)
+                        s.set_index_sort("price"_s8, mode == Mode::Ascending ? index_sort::Order::Ascending : index_sort::Order::Descending);
+                for (const auto id : replaced)
+                        index_document(id, true);
+                for (auto id = from; id != to; ++id)
+                        index_document(id, false);
+                segments.commit(s, gen);
+        }
+
+        void merge(scratch_segments &segments, std::initializer_list<uint64_t> gens, const uint64_t out, const uint32_t threadsCnt) {
+                MergeCandidatesCollection                          collection;
+                std::vector<SegmentIndexSource *>                  sources;
+                std::vector<std::unique_ptr<IndexSourceTermsView>> views;
+
+                for (const auto gen : gens) {
+                        auto s = segments.open(gen);
+
+                        views.emplace_back(s->segment_terms()->new_terms_view());
+
+                        merge_candidate c{s->generation(), views.back().get(), s->access_proxy(), s->masked_documents()};
+
+                        c.docValues = s->doc_values();
+                        collection.insert(c);
+                        sources.push_back(s);
+                }
+                collection.commit();
+
+                const auto path = segments.path(out);
+
+                mkdir(path.c_str(), 0775);
+
+                std::unique_ptr<Codecs::IndexSession>          sess(new Codecs::Lucene::IndexSession(path.c_str()));
+                simple_allocator                               allocator;
+                std::vector<std::pair<str8_t, term_index_ctx>> terms;
+                IndexSource::field_statistics                  fs;
+                std::vector<uint32_t>                          none;
+
+                sess->begin();
+                collection.merge(sess.get(), &allocator, &terms, &fs, 0, false, threadsCnt);
+                sess->persist_terms(terms);
+                persist_segment(fs, sess.get(), none);
+
+                for (auto s : sources)
+                        s->Release();
+        }
+
+        bool sorted(scratch_segments &segments, const uint64_t gen) {
+                auto       s   = segments.open(gen);
+                const auto res = s->doc_values() && s->doc_values()->documents_sort();
+
+                s->Release();
+                return res;
+        }
+
+        void check(scratch_segments &segments, std::initializer_list<uint64_t> gens, const index_sort::Order order) {
+                const index_sort       sort{"price"_s8, order};
+                IndexSourcesCollection collection;
+
+                for (const auto gen : gens) {
+                        auto s = segments.open(gen);
+
+                        collection.insert(s);
+                        s->Release();
+                }
+                collection.commit();
+
+                for (const char *const s : {"a", "b", "a NOT b"}) {
+                        const query q(str32_t(s, strlen(s)));
+
+                        for (const uint32_t k : {1, 10, 100, 5000}) {
+                                std::vector<std::pair<docid_t, int64_t>> expected;
+
+                                for (const auto &it : prices) {
+                                        const bool b = it.first % 3 == 0;
+
+                                        if (s[0] == 'b' ? b : s[1] == 0 || !b)
+                                                expected.push_back(it);
+                                }
+                                std::sort(expected.begin(), expected.end(), [order](const auto &a, const auto &b) {
+                                        if (a.second != b.second)
+                                                return order == index_sort::Order::Ascending ? a.second < b.second : a.second > b.second;
+                                        return a.first < b.first;
+                                });
+                                if (expected.size() > k)
+                                        expected.resize(k);
+
+                                const auto early = SortedDocumentsCollector::merge(exec_query_sorted<SortedDocumentsCollector>(q, &collection, nullptr, uint32_t(ExecFlags::DocumentsOnly), sort, nullptr, k, sort, k), k);
+                                const auto all   = SortedDocumentsCollector::merge(exec_query<SortedDocumentsCollector>(q, &collection, nullptr, uint32_t(ExecFlags::DocumentsOnly), sort, k), k);
+
+                                CHECK(early.size() == expected.size());
+                                CHECK(all.size() == expected.size());
+                                for (size_t i{0}; i != expected.size(); ++i) {
+                                        CHECK(early[i].id == expected[i].first && early[i].value == expected[i].second);
+                                        CHECK(all[i].id == expected[i].first);
+                                }
+                        }
+                }
+        }
+
+        bool commit_throws(const std::function<void(SegmentIndexSession &)> &index) {
+                scratch_segments    segments;
+                SegmentIndexSession s;
+
+                s.set_index_sort("price"_s8, index_sort::Order::Ascending);
+                index(s);
+                try {
+                        segments.commit(s, 1);
+                        return false;
+                } catch (const Switch::data_error &) {
+                        return true;
+                }
+        }
+} // namespace
+
+int main() {
+        // documents out of order, or without a value for the sort field
+        for (const bool missing : {false, true}) {
+                CHECK(commit_throws([missing](auto &s) {
+                        for (const docid_t id : {1, 2, 3}) {
+                                auto d = s.begin(id);
+
+                                d.insert("a"_s8, 1);
+                                if (!missing)
+                                        d.set_value("price"_s8, int64_t(id == 2 ? 100 : id));
+                                else if (id != 2)
+                                        d.set_value("price"_s8, int64_t(id));
+                                s.insert(d);
+                        }
+                }));
+        }
+
+        {
+                scratch_segments      segments;
+                std::vector<docid_t> replaced;
+
+                index_segment(segments, 1, 1, 200'000, Mode::Ascending);
+                CHECK(sorted(segments, 1));
+                check(segments, {1}, index_sort::Order::Ascending);
+                check(segments, {1}, index_sort::Order::Descending);
+
+                // masks some of the documents of the sorted segment
+                for (docid_t id{1}; id < 200'000; id += 7)
+                        replaced.push_back(id);
+                index_segment(segments, 2, 200'000, 210'000, Mode::Unsorted, replaced);
+                CHECK(!sorted(segments, 2));
+                check(segments, {1, 2}, index_sort::Order::Ascending);
+
+                // merged with an unsorted segment
+                merge(segments, {1, 2}, 3, 1);
+                CHECK(!sorted(segments, 3));
+                check(segments, {3}, index_sort::Order::Ascending);
+        }
+
+        for (const uint32_t threadsCnt : {1, 4}) {
+                // two sorted segments with documents still in order once merged
+                scratch_segments segments;
+
+                prices.clear();
+                index_segment(segments, 1, 1, 100'000, Mode::Ascending);
+                index_segment(segments, 2, 100'000, 150'000, Mode::Ascending);
+                merge(segments, {1, 2}, 3, threadsCnt);
+                CHECK(sorted(segments, 3));
+                check(segments, {3}, index_sort::Order::Ascending);
+
+                // a document with a value but no terms is never matched, so it doesn't matter
+                {
+                        SegmentIndexSession s;
+
+                        s.set_index_sort("price"_s8, index_sort::Order::Ascending);
+                        for (docid_t id{150'000}; id != 150'100; ++id) {
+                                auto d = s.begin(id);
+
+                                if (id != 150'050) {
+                                        d.insert("a"_s8, 1);
+                                        prices[id] = id / 2;
+                                }
+                                d.set_value("price"_s8, int64_t(id / 2));
+                                s.insert(d);
+                        }
+                        segments.commit(s, 4);
+                }
+                merge(segments, {3, 4}, 5, threadsCnt);
+                CHECK(sorted(segments, 5));
+                check(segments, {5}, index_sort::Order::Ascending);
+
+                // updates some of the documents of a sorted segment, with values still in order
+                {
+                        std::vector<docid_t> replaced;
+
+                        for (docid_t id{3}; id < 150'000; id += 11)
+                                replaced.push_back(id);
+                        index_segment(segments, 6, 150'100, 150'200, Mode::Ascending, replaced);
+                }
+                merge(segments, {5, 6}, 7, threadsCnt);
+                CHECK(sorted(segments, 7));
+                check(segments, {7}, index_sort::Order::Ascending);
+
+                // the same documents in two segments, not masked by the most recent one; the values are still in order, but
+                // only one of them is retained for each document
+                {
+                        SegmentIndexSession s;
+
+                        s.set_index_sort("price"_s8, index_sort::Order::Ascending);
+                        for (docid_t id{150'150}; id != 150'250; ++id) {
+                                auto d = s.begin(id);
+
+                                d.insert("a"_s8, 1);
+                                d.set_value("price"_s8, int64_t(id / 2));
+                                prices[id] = id / 2;
+                                s.insert(d);
+                        }
+                        segments.commit(s, 8);
+                }
+                merge(segments, {7, 8}, 9, threadsCnt);
+                CHECK(!sorted(segments, 9));
+                check(segments, {9}, index_sort::Order::Ascending);
+        }
+
+        {
+                scratch_segments segments;
+
+                prices.clear();
+                index_segment(segments, 1, 1, 100'000, Mode::Descending);
+                CHECK(sorted(segments, 1));
+                check(segments, {1}, index_sort::Order::Descending);
+                check(segments, {1}, index_sort::Order::Ascending);
+        }
+
+        return 0;
+}
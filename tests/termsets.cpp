@@ -0,0 +1,158 @@
+// Large OR-lists of terms(ENT::matchanyterms runs) are drained into a docids_set up front in DocumentsOnly mode, if that is cheaper than merging
+// their postings with a heap for the consumer(see queryexec_ctx::termset_iterator()); i.e at the root, or as a follower of a conjunction with a lead
+// that is not selective, but not as a follower of a selective lead. Whichever is used, and whether the set is a bitmap or an IDs array, they must
+// match exactly the same documents, including when the consumer advance()s them(conjunctions, NOT).
+#include "check.h"
+#include "segments.h"
+#include <exec.h>
+#include <functional>
+
+using namespace Trinity;
+
+namespace {
+        struct collector final
+            : public MatchedIndexDocumentsFilter {
+                std::vector<docid_t> matches;
+
+                void consider(const docid_t id) override final {
+                        matches.push_back(id);
+                }
+
+                void consider(const matched_document &match) override final {
+                        matches.push_back(match.id);
+                }
+        };
+
+        static constexpr docid_t  K_max_id{200'000};
+        static constexpr uint32_t K_dense_terms{40}, K_sparse_terms{20};
+
+        uint64_t mix(uint64_t v) noexcept {
+                v ^= v >> 33;
+                v *= 0xff51afd7ed558ccdULL;
+                v ^= v >> 33;
+                return v;
+        }
+
+        // each in about 1/97 documents; their union is large enough for a bitmap
+        bool has_dense(const docid_t id, const uint32_t k) noexcept {
+                return mix(uint64_t(id) << 8 | k) % 97 == 0;
+        }
+
+        // each in about 40 documents; their union is small enough for an IDs array
+        bool has_sparse(const docid_t id, const uint32_t k) noexcept {
+                return id % (5000 + k * 37) == k;
+        }
+
+        bool any_dense(const docid_t id) noexcept {
+                for (uint32_t k{0}; k != K_dense_terms; ++k) {
+                        if (has_dense(id, k))
+                                return true;
+                }
+                return false;
+        }
+
+        bool any_sparse(const docid_t id) noexcept {
+                for (uint32_t k{0}; k != K_sparse_terms; ++k) {
+                        if (has_sparse(id, k))
+                                return true;
+                }
+                return false;
+        }
+
+        bool rare(const docid_t id) noexcept {
+                return id % 1000 == 0;
+        }
+
+        bool half(const docid_t id) noexcept {
+                return id % 2 == 0;
+        }
+
+        std::string any_of(const char *const prefix, const uint32_t cnt) {
+                std::string res("(");
+
+                for (uint32_t k{0}; k != cnt; ++k) {
+                        if (k)
+                                res.append(" OR ");
+                        res.append(prefix).append(std::to_string(k));
+                }
+                res.push_back(')');
+                return res;
+        }
+} // namespace
+
+int main() {
+        scratch_segments       segments;
+        IndexSourcesCollection collection;
+
+        {
+                SegmentIndexSession s;
+                char                term[16];
+
+                for (docid_t id{1}; id <= K_max_id; ++id) {
+                        auto d = s.begin(id);
+
+                        d.insert("all"_s8, 1);
+                        if (rare(id))
+                                d.insert("rare"_s8, 2);
+                        if (half(id))
+                                d.insert("half"_s8, 3);
+                        for (uint32_t k{0}; k != K_dense_terms; ++k) {
+                                if (has_dense(id, k))
+                                        d.insert(str8_t(term, sprintf(term, "d%u", k)), 4);
+                        }
+                        for (uint32_t k{0}; k != K_sparse_terms; ++k) {
+                                if (has_sparse(id, k))
+                                        d.insert(str8_t(term, sprintf(term, "s%u", k)), 5);
+                        }
+                        s.insert(d);
+                }
+                segments.commit(s, 1);
+        }
+
+        auto src = segments.open(1);
+
+        collection.insert(src);
+        src->Release();
+        collection.commit();
+
+        const auto dense = any_of("d", K_dense_terms), sparse = any_of("s", K_sparse_terms);
+        const std::pair<std::string, std::function<bool(docid_t)>> queries[] = {
+            // at the root
+            {dense, any_dense},
+            {sparse, any_sparse},
+            // advanced by a lead that is not selective
+            {"all " + dense, any_dense},
+            {"half " + dense, [](const docid_t id) { return half(id) && any_dense(id); }},
+            {"half " + sparse, [](const docid_t id) { return half(id) && any_sparse(id); }},
+            // and by a selective lead
+            {"rare " + dense, [](const docid_t id) { return rare(id) && any_dense(id); }},
+            {"rare " + sparse, [](const docid_t id) { return rare(id) && any_sparse(id); }},
+            {"rare half " + dense, [](const docid_t id) { return rare(id) && half(id) && any_dense(id); }},
+            // both, advancing each other
+            {dense + " " + sparse, [](const docid_t id) { return any_dense(id) && any_sparse(id); }},
+            // on the RHS of NOT
+            {"all NOT " + dense, [](const docid_t id) { return !any_dense(id); }},
+            {"half NOT " + sparse, [](const docid_t id) { return half(id) && !any_sparse(id); }},
+            {"rare NOT " + dense, [](const docid_t id) { return rare(id) && !any_dense(id); }},
+        };
+
+        // term sets are only drained in DocumentsOnly mode
+        for (const uint32_t flags : {uint32_t(ExecFlags::DocumentsOnly), uint32_t(0)}) {
+                for (const auto &it : queries) {
+                        const query          q(str32_t(it.first.data(), it.first.size()));
+                        const auto           res = exec_query<collector>(q, &collection, nullptr, flags);
+                        std::vector<docid_t> expected;
+
+                        for (docid_t id{1}; id <= K_max_id; ++id) {
+                                if (it.second(id))
+                                        expected.push_back(id);
+                        }
+
+                        CHECK(!expected.empty());
+                        CHECK(res.size() == 1);
+                        CHECK(res[0]->matches == expected);
+                }
+        }
+
+        return 0;
+}
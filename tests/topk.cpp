@@ -0,0 +1,75 @@
+// TopKDocumentsCollector must collect exactly the top-k documents of a full sort by score DESC, id ASC; including when many documents
+// have the same score, for k that fill the 4-ary heap's levels exactly or partially, and when the documents are spread across collectors
+// that share a TopKThreshold, where each collector rejects documents based on the other collectors' k-th best scores
+#include "check.h"
+#include <algorithm>
+#include <random>
+#include <topk.h>
+
+using namespace Trinity;
+
+namespace {
+        using scored_document = TopKDocumentsCollector::scored_document;
+
+        bool before(const scored_document &a, const scored_document &b) noexcept {
+                return a.score > b.score || (a.score == b.score && a.id < b.id);
+        }
+
+        bool same(const std::vector<scored_document> &a, const std::vector<scored_document> &b) {
+                if (a.size() != b.size())
+                        return false;
+                for (std::size_t i{0}; i != a.size(); ++i) {
+                        if (a[i].id != b[i].id || a[i].score != b[i].score)
+                                return false;
+                }
+                return true;
+        }
+} // namespace
+
+int main() {
+        std::mt19937 g(36);
+
+        for (const uint32_t distinct : {1, 7, 1000, 1'000'000}) {
+                // documents are considered in random IDs order; few distinct scores mean many ties
+                std::vector<scored_document> all;
+
+                for (docid_t id{1}; id != 20'000; ++id)
+                        all.push_back({double(int32_t(g() % distinct) - int32_t(distinct / 2)), id});
+                std::shuffle(all.begin(), all.end(), g);
+
+                auto sorted = all;
+
+                std::sort(sorted.begin(), sorted.end(), before);
+
+                // 1, 5, 21, 85 and 341 fill the heap's levels exactly
+                for (const uint32_t k : {1, 2, 4, 5, 6, 21, 85, 100, 341, 1000, 19'999, 50'000}) {
+                        const std::vector<scored_document> expected(sorted.begin(), sorted.begin() + std::min<std::size_t>(k, sorted.size()));
+
+                        {
+                                TopKDocumentsCollector c(k);
+
+                                for (const auto &d : all)
+                                        c.consider(d.id, d.score);
+
+                                CHECK(c.size() == expected.size());
+                                CHECK(same(c.documents(), expected));
+                        }
+
+                        for (const uint32_t collectorsCnt : {1, 3, 8}) {
+                                TopKThreshold                                       threshold;
+                                std::vector<std::unique_ptr<TopKDocumentsCollector>> collectors;
+
+                                for (uint32_t i{0}; i != collectorsCnt; ++i)
+                                        collectors.emplace_back(new TopKDocumentsCollector(k, &threshold));
+                                for (const auto &d : all)
+                                        collectors[g() % collectorsCnt]->consider(d.id, d.score);
+
+                                CHECK(same(TopKDocumentsCollector::merge(collectors, k), expected));
+                                // a safe lower bound of the k-th best score, once any collector has collected k documents
+                                CHECK(threshold.get() <= expected.back().score);
+                        }
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,309 @@
+#pragma once
+#include "docvalues.h"
+#include "index_source.h"
+#include "matches.h"
+#include <atomic>
+#include <memory>
+#include <new>
+
+namespace Trinity {
+        // The score of the k-th best document collected so far among all index sources a query is executed against, shared
+        // by all TopKDocumentsCollector instances of that query. Because no document with a lower score can make it into the top-k
+        // results of the query, each collector will reject those immediately, instead of having to track its own k-th best score
+        // which is usually far lower early on, and is only merged with others at the end.
+        //
+        // Accesses are relaxed; it doesn't matter if a collector doesn't see the latest threshold right away, because it is monotonically
+        // increasing and any threshold published is a safe lower bound.
+        struct TopKThreshold final {
+                std::atomic<double> v{-std::numeric_limits<double>::max()};
+
+                inline double get() const noexcept {
+                        return v.load(std::memory_order_relaxed);
+                }
+
+                void raise(const double s) noexcept {
+                        auto cur = v.load(std::memory_order_relaxed);
+
+                        while (s > cur && !v.compare_exchange_weak(cur, s, std::memory_order_relaxed, std::memory_order_relaxed))
+                                continue;
+                }
+        };
+
+        // A MatchedIndexDocumentsFilter that tracks the top-k documents by score.
+        //
+        // Documents are tracked in a flat 4-ary min-heap (top() is the worst document collected) allocated once. The root is stored in heap[3]
+        // so that the 4 children of a node are always in the same 64 bytes cache line.
+        // Ties are broken by document ID; lower IDs win.
+        //
+        // The AccumulatedScoreScheme mode is supported directly. For the default execution mode, subclass and override score().
+        // If you use exec_query_par() or exec_query() for an IndexSourcesCollection, pass the same TopKThreshold to all collectors, e.g
+        // 	TopKThreshold threshold;
+        // 	auto res = exec_query_par<TopKDocumentsCollector>(q, &collection, nullptr, unsigned(ExecFlags::AccumulatedScoreScheme), &scorer, 10, &threshold);
+        // 	auto top = TopKDocumentsCollector::merge(res, 10);
+        //
+        // For the next page of results, pass the last document of the current page as the cursor(search-after), instead of collecting the top (page * k) documents and
+        // skipping all but the last k. Documents ranked at or before the cursor are rejected before they reach the heap.
+        struct TopKDocumentsCollector
+            : public MatchedIndexDocumentsFilter {
+                struct scored_document final {
+                        double  score;
+                        docid_t id;
+                };
+
+              private:
+                static constexpr uint32_t K_root{3};
+
+                scored_document *const heap;
+                const uint32_t         k;
+                uint32_t               size_{0};
+                TopKThreshold *const   shared;
+                double                 published{-std::numeric_limits<double>::max()};
+                const bool             hasCursor;
+                const scored_document  cursor;
+
+              private:
+                static inline bool worse(const scored_document &a, const scored_document &b) noexcept {
+                        return a.score < b.score || (a.score == b.score && a.id > b.id);
+                }
+
+                void sift_up(uint32_t i) noexcept {
+                        const auto d = heap[i + K_root];
+
+                        while (i) {
+                                const auto parent = (i - 1) >> 2;
+
+                                if (!worse(d, heap[parent + K_root]))
+                                        break;
+
+                                heap[i + K_root] = heap[parent + K_root];
+                                i                = parent;
+                        }
+
+                        heap[i + K_root] = d;
+                }
+
+                void sift_down() noexcept {
+                        const auto d = heap[K_root];
+                        uint32_t   i{0};
+
+                        for (;;) {
+                                const auto first = (i << 2) + 1;
+
+                                if (first >= size_)
+                                        break;
+
+                                const auto end = std::min(first + 4, size_);
+                                auto       m   = first;
+
+                                for (auto c = first + 1; c < end; ++c) {
+                                        if (worse(heap[c + K_root], heap[m + K_root]))
+                                                m = c;
+                                }
+
+                                if (!worse(heap[m + K_root], d))
+                                        break;
+
+                                heap[i + K_root] = heap[m + K_root];
+                                i                = m;
+                        }
+
+                        heap[i + K_root] = d;
+                }
+
+                void publish() noexcept {
+                        if (const auto s = heap[K_root].score; s > published) {
+                                published = s;
+                                shared->raise(s);
+                        }
+                }
+
+              public:
+                TopKDocumentsCollector(const uint32_t k_, TopKThreshold *const threshold = nullptr, const scored_document *const after = nullptr)
+                    : heap{static_cast<scored_document *>(aligned_alloc(64, ((k_ + K_root) * sizeof(scored_document) + 63) & ~63))}, k{k_}, shared{threshold}, hasCursor{after != nullptr}, cursor{after ? *after : scored_document{0, 0}} {
+                        EXPECT(k);
+
+                        if (unlikely(!heap))
+                                throw std::bad_alloc();
+                }
+
+                // We own heap
+                TopKDocumentsCollector(const TopKDocumentsCollector &) = delete;
+
+                TopKDocumentsCollector &operator=(const TopKDocumentsCollector &) = delete;
+
+                ~TopKDocumentsCollector() {
+                        std::free(heap);
+                }
+
+                // Override for the default execution mode
+                virtual double score(const matched_document &) {
+                        return 0;
+                }
+
+                void consider(const matched_document &match) override {
+                        consider(match.id, score(match));
+                }
+
+                void consider(const docid_t id, const double score) override final {
+                        const scored_document d{score, id};
+
+                        if (shared && score < shared->get()) {
+                                // can't make it to the top-k of the query
+                                return;
+                        } else if (hasCursor && !worse(d, cursor)) {
+                                // in a previous page
+                                return;
+                        }
+
+                        if (size_ == k) {
+                                if (!worse(heap[K_root], d))
+                                        return;
+
+                                heap[K_root] = d;
+                                sift_down();
+                        } else {
+                                heap[size_ + K_root] = d;
+                                sift_up(size_++);
+                        }
+
+                        if (shared && size_ == k)
+                                publish();
+                }
+
+                inline auto size() const noexcept {
+                        return size_;
+                }
+
+                // The collected documents by score DESC, id ASC
+                std::vector<scored_document> documents() const {
+                        std::vector<scored_document> res(heap + K_root, heap + K_root + size_);
+
+                        std::sort(res.begin(), res.end(), [](const auto &a, const auto &b) noexcept { return worse(b, a); });
+                        return res;
+                }
+
+                // Merges the documents collected by each collector into the top-k of them all
+                template <typename T>
+                static std::vector<scored_document> merge(const std::vector<std::unique_ptr<T>> &collectors, const uint32_t k) {
+                        static_assert(std::is_base_of<TopKDocumentsCollector, T>::value);
+                        std::vector<scored_document> res;
+
+                        for (const auto &c : collectors)
+                                res.insert(res.end(), c->heap + K_root, c->heap + K_root + c->size_);
+
+                        const auto n = std::min<std::size_t>(k, res.size());
+
+                        std::partial_sort(res.begin(), res.begin() + n, res.end(), [](const auto &a, const auto &b) noexcept { return worse(b, a); });
+                        res.resize(n);
+                        return res;
+                }
+        };
+
+        // A MatchedIndexDocumentsFilter that tracks the top-k documents by the value of a numeric doc-values field(see docvalues.h), in sort.order.
+        // Documents without a value for the field are ordered last, and ties are broken by document ID; lower IDs win.
+        //
+        // You should use it with exec_query_sorted(), which stops the execution on index sources sorted the same way(see index_sort) once
+        // k documents have been collected, e.g
+        // 	const index_sort sort{"published"_s8, index_sort::Order::Descending};
+        // 	auto res = exec_query_sorted<SortedDocumentsCollector>(q, &collection, nullptr, unsigned(ExecFlags::DocumentsOnly), sort, nullptr, 20, sort, 20);
+        // 	auto top = SortedDocumentsCollector::merge(res, 20);
+        //
+        // For the next page, pass the last document of the current page as the cursor to both, e.g
+        // 	res = exec_query_sorted<SortedDocumentsCollector>(q, &collection, nullptr, unsigned(ExecFlags::DocumentsOnly), sort, &top.back(), 20, sort, 20, &top.back());
+        // Documents ordered at or before the cursor are rejected, and exec_query_sorted() starts the execution of sorted index sources past them.
+        //
+        // Index sources that require document IDs translation are not supported, because doc-values are keyed by index source document IDs.
+        struct SortedDocumentsCollector
+            : public MatchedIndexDocumentsFilter {
+                using sorted_document = Trinity::sorted_document;
+
+              private:
+                const index_sort             sort;
+                const uint32_t               k;
+                const docvalues_field *      f{nullptr};
+                std::vector<sorted_document> heap; // top is the worst document collected
+                const bool                   hasCursor;
+                const sorted_document        cursor;
+
+              public:
+                // sort.field must outlive the collector
+                SortedDocumentsCollector(const index_sort s, const uint32_t k_, const sorted_document *const after = nullptr)
+                    : sort{s}, k{k_}, hasCursor{after != nullptr}, cursor{after ? *after : sorted_document{0, false, 0}} {
+                        EXPECT(k);
+                        heap.reserve(k);
+                }
+
+                void prepare_index_source(IndexSource *const src) override {
+                        const auto dv = src->doc_values();
+
+                        if (dv && src->require_docid_translation())
+                                throw Switch::invalid_argument("SortedDocumentsCollector doesn't support index sources that require document IDs translation");
+
+                        f = dv ? dv->field(sort.field) : nullptr;
+                        if (f && f->kind != docvalues_kind::Numeric)
+                                throw Switch::invalid_argument("Expected a numeric field");
+                }
+
+                void consider(const docid_t id) override {
+                        const auto      cmp = [this](const auto &a, const auto &b) noexcept { return sort.before(a, b); };
+                        sorted_document d{id, false, 0};
+
+                        if (f)
+                                d.hasValue = f->get(id, &d.value);
+
+                        if (hasCursor && !sort.before(cursor, d)) {
+                                // in a previous page
+                                return;
+                        }
+
+                        if (heap.size() != k) {
+                                heap.push_back(d);
+                                std::push_heap(heap.begin(), heap.end(), cmp);
+                        } else if (sort.before(d, heap.front())) {
+                                std::pop_heap(heap.begin(), heap.end(), cmp);
+                                heap.back() = d;
+                                std::push_heap(heap.begin(), heap.end(), cmp);
+                        }
+                }
+
+                void consider(const docid_t id, const double) override {
+                        SortedDocumentsCollector::consider(id);
+                }
+
+                void consider(const matched_document &match) override {
+                        SortedDocumentsCollector::consider(match.id);
+                }
+
+                inline auto size() const noexcept {
+                        return heap.size();
+                }
+
+                // The collected documents, in sort order
+                std::vector<sorted_document> documents() const {
+                        auto res = heap;
+
+                        std::sort(res.begin(), res.end(), [this](const auto &a, const auto &b) noexcept { return sort.before(a, b); });
+                        return res;
+                }
+
+                // Merges the documents collected by each collector into the top-k of them all
+                template <typename T>
+                static std::vector<sorted_document> merge(const std::vector<std::unique_ptr<T>> &collectors, const uint32_t k) {
+                        static_assert(std::is_base_of<SortedDocumentsCollector, T>::value);
+                        std::vector<sorted_document> res;
+
+                        if (collectors.empty())
+                                return res;
+
+                        for (const auto &c : collectors)
+                                res.insert(res.end(), c->heap.begin(), c->heap.end());
+
+                        const auto  n    = std::min<std::size_t>(k, res.size());
+                        const auto &sort = collectors.front()->sort;
+
+                        std::partial_sort(res.begin(), res.begin() + n, res.end(), [&sort](const auto &a, const auto &b) noexcept { return sort.before(a, b); });
+                        res.resize(n);
+                        return res;
+                }
+        };
+} // namespace Trinity
@@ -1,6 +1,7 @@
 #include "utils.h"
 #include "common.h"
 #include <fcntl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -44,3 +45,55 @@ int8_t Trinity::Utilities::to_file(const char *p, uint64_t len, const char *path
         else
                 return 0;
 }
+
+int8_t Trinity::Utilities::copy_file_range(int srcFd, uint64_t offset, uint64_t len, int outFd) {
+        loff_t off = offset;
+
+        while (len) {
+                const auto r = ::copy_file_range(srcFd, &off, outFd, nullptr, len, 0);
+
+                if (r > 0)
+                        len -= r;
+                else if (r == 0)
+                        return -1; // EOF
+                else if (errno == EINTR)
+                        continue;
+                else if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)
+                        break;
+                else
+                        return -1;
+        }
+
+        while (len) {
+                auto       o = off_t(off);
+                const auto r = sendfile(outFd, srcFd, &o, len);
+
+                if (r > 0) {
+                        off = o;
+                        len -= r;
+                } else if (r == 0)
+                        return -1;
+                else if (errno == EINTR)
+                        continue;
+                else if (errno == ENOSYS || errno == EINVAL)
+                        break;
+                else
+                        return -1;
+        }
+
+        if (len) {
+                char b[64 * 1024];
+
+                do {
+                        const auto r = pread64(srcFd, b, std::min<uint64_t>(len, sizeof(b)), off);
+
+                        if (r <= 0 || write(outFd, b, r) != r)
+                                return -1;
+
+                        off += r;
+                        len -= r;
+                } while (len);
+        }
+
+        return 0;
+}
@@ -7,5 +7,9 @@ namespace Trinity {
                 int8_t to_file(const char *p, uint64_t len, const char *path);
 
                 int8_t to_file(const char *p, uint64_t len, int fd);
+
+                // Copies [offset, offset + len) of srcFd to outFd, at outFd's current file offset, kernel-side
+                // via copy_file_range() or sendfile() if that's not supported, and falls back to pread()/write() otherwise.
+                int8_t copy_file_range(int srcFd, uint64_t offset, uint64_t len, int outFd);
         } // namespace Utilities
 } // namespace Trinity